@@ -0,0 +1,1571 @@
+#include "../include/bitcask.h"
+#include "../include/crc32.h"
+#include "../include/server.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cmath>
+#include <ctime>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace bitcask;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Keeps benchmarked reads from being optimized away
+volatile size_t g_sink = 0;
+
+struct BenchOptions {
+    std::string directory = "bench_db";
+    int num_keys = 100000;
+    int ops_per_thread = 200000;
+    int value_size = 100;
+    int value_max = 0;              // Values uniform in [value_size, value_max] if set
+    int key_size = 0;               // Pad generated keys to this length
+    int read_percent = 90;
+    int threads = 4;
+    std::string workload = "all";   // YCSB workload letter(s)
+    std::string distribution = "zipfian";
+    std::string json_path;          // Append results here as JSON lines ("-" = stdout)
+};
+
+double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::unique_ptr<Bitcask> open_fresh(const BenchOptions& opts, Config config) {
+    std::system(("rm -rf " + opts.directory).c_str());
+    config.directory = opts.directory;
+    auto result = Bitcask::open(config);
+    if (!result.ok()) {
+        std::cerr << "Error opening database: " << result.err() << "\n";
+        std::exit(1);
+    }
+    return std::move(result.value);
+}
+
+std::string make_key(int i) {
+    return "key" + std::to_string(i);
+}
+
+// Zipfian ranks in [0, n) as in YCSB (Gray et al., "Quickly Generating
+// Billion-Record Synthetic Databases"); rank 0 is the most popular
+class ZipfianGenerator {
+public:
+    explicit ZipfianGenerator(uint64_t n, double theta = 0.99) : n_(n), theta_(theta) {
+        double zeta2 = zeta(2);
+        zetan_ = zeta(n);
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan_);
+    }
+    
+    template <typename Rng>
+    uint64_t next(Rng& rng) {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zetan_;
+        if (uz < 1.0) {
+            return 0;
+        }
+        if (uz < 1.0 + std::pow(0.5, theta_)) {
+            return 1;
+        }
+        return std::min<uint64_t>(n_ - 1, static_cast<uint64_t>(n_ * std::pow(eta_ * u - eta_ + 1.0, alpha_)));
+    }
+
+private:
+    uint64_t n_;
+    double theta_;
+    double zetan_;
+    double alpha_;
+    double eta_;
+    
+    double zeta(uint64_t n) const {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; ++i) {
+            sum += 1.0 / std::pow(static_cast<double>(i), theta_);
+        }
+        return sum;
+    }
+};
+
+// Latency histogram in the style of HdrHistogram: 128 linear sub-buckets
+// per power of two, so any recorded value is reported within 1%
+class LatencyHistogram {
+public:
+    LatencyHistogram() : counts_(kBuckets, 0) {}
+    
+    void record(uint64_t ns) {
+        ++counts_[index(ns)];
+        ++count_;
+        sum_ += ns;
+        max_ = std::max(max_, ns);
+    }
+    
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < kBuckets; ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        count_ += other.count_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+    }
+    
+    // Smallest recorded value (bucket upper bound) at or above percentile p
+    uint64_t percentile(double p) const {
+        uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p / 100 * count_)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += counts_[i];
+            if (seen >= target) {
+                return std::min(max_, upper_bound(i));
+            }
+        }
+        return max_;
+    }
+    
+    uint64_t count() const { return count_; }
+    uint64_t max() const { return max_; }
+    double mean() const { return count_ ? static_cast<double>(sum_) / count_ : 0; }
+
+private:
+    static constexpr int kSubBits = 7;
+    static constexpr uint64_t kSubBuckets = 1u << kSubBits;
+    static constexpr size_t kBuckets = (64 - kSubBits + 1) * kSubBuckets;
+    
+    std::vector<uint64_t> counts_;
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t max_ = 0;
+    
+    static size_t index(uint64_t value) {
+        if (value < kSubBuckets) {
+            return value;
+        }
+        int shift = 63 - __builtin_clzll(value) - kSubBits;
+        return (shift + 1) * kSubBuckets + ((value >> shift) - kSubBuckets);
+    }
+    
+    static uint64_t upper_bound(size_t index) {
+        if (index < kSubBuckets) {
+            return index;
+        }
+        int shift = static_cast<int>(index / kSubBuckets) - 1;
+        uint64_t sub = index % kSubBuckets + kSubBuckets;
+        return ((sub + 1) << shift) - 1;
+    }
+};
+
+// Flat JSON object builder for machine-readable results
+class Json {
+public:
+    Json& add(const std::string& key, const std::string& value) {
+        std::string escaped;
+        for (char c : value) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return raw(key, "\"" + escaped + "\"");
+    }
+    Json& add(const std::string& key, const char* value) { return add(key, std::string(value)); }
+    Json& add(const std::string& key, uint64_t value) { return raw(key, std::to_string(value)); }
+    Json& add(const std::string& key, int value) { return raw(key, std::to_string(value)); }
+    Json& add(const std::string& key, bool value) { return raw(key, value ? "true" : "false"); }
+    Json& add(const std::string& key, double value) {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.3f", value);
+        return raw(key, buffer);
+    }
+    Json& add(const std::string& key, const Json& value) { return raw(key, value.str()); }
+    Json& add(const std::string& key, const std::vector<Json>& values) {
+        std::string array = "[";
+        for (const auto& value : values) {
+            array += (array.size() > 1 ? "," : "") + value.str();
+        }
+        return raw(key, array + "]");
+    }
+    
+    std::string str() const { return "{" + body_ + "}"; }
+
+private:
+    std::string body_;
+    
+    Json& raw(const std::string& key, const std::string& value) {
+        body_ += (body_.empty() ? "\"" : ",\"") + key + "\":" + value;
+        return *this;
+    }
+};
+
+Json latency_json(const LatencyHistogram& histogram) {
+    Json json;
+    json.add("count", histogram.count())
+        .add("mean_ns", histogram.mean())
+        .add("p50_ns", histogram.percentile(50))
+        .add("p99_ns", histogram.percentile(99))
+        .add("p999_ns", histogram.percentile(99.9))
+        .add("max_ns", histogram.max());
+    return json;
+}
+
+// Append one result line for a scenario to -json, tagged with the run's
+// options so lines from different runs can be compared
+void emit_json(const BenchOptions& opts, const std::string& scenario, const Json& results) {
+    if (opts.json_path.empty()) {
+        return;
+    }
+    
+    Json options;
+    options.add("keys", opts.num_keys)
+        .add("ops_per_thread", opts.ops_per_thread)
+        .add("value_size", opts.value_size)
+        .add("value_max", opts.value_max)
+        .add("key_size", opts.key_size)
+        .add("threads", opts.threads)
+        .add("distribution", opts.distribution);
+    Json line;
+    line.add("scenario", scenario)
+        .add("timestamp", static_cast<uint64_t>(std::time(nullptr)))
+        .add("cpus", static_cast<uint64_t>(std::thread::hardware_concurrency()))
+        .add("options", options)
+        .add("results", results);
+    
+    if (opts.json_path == "-") {
+        std::cout << line.str() << "\n";
+    } else {
+        std::ofstream(opts.json_path, std::ios::app) << line.str() << "\n";
+    }
+}
+
+void preload(Bitcask& db, const BenchOptions& opts) {
+    std::string value(opts.value_size, 'x');
+    for (int i = 0; i < opts.num_keys; ++i) {
+        db.put(make_key(i), value);
+    }
+}
+
+// Mixed get/put throughput at 1..16 threads against one shared instance
+void bench_scaling(const BenchOptions& opts) {
+    std::cout << "scaling: " << opts.num_keys << " keys, " << opts.value_size
+              << " B values, " << opts.read_percent << "% reads\n";
+    std::cout << std::setw(8) << "threads" << std::setw(16) << "ops/s"
+              << std::setw(10) << "speedup" << "\n";
+    
+    Config config(opts.directory);
+    auto db = open_fresh(opts, config);
+    preload(*db, opts);
+    
+    double baseline = 0;
+    for (int threads : {1, 2, 4, 8, 16}) {
+        std::vector<std::thread> workers;
+        auto start = Clock::now();
+        
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                std::mt19937 rng(t + 1);
+                std::uniform_int_distribution<int> key_dist(0, opts.num_keys - 1);
+                std::uniform_int_distribution<int> pct(0, 99);
+                std::string value(opts.value_size, 'y');
+                
+                for (int i = 0; i < opts.ops_per_thread; ++i) {
+                    std::string key = make_key(key_dist(rng));
+                    if (pct(rng) < opts.read_percent) {
+                        db->get(key);
+                    } else {
+                        db->put(key, value);
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        
+        double ops_per_sec = threads * static_cast<double>(opts.ops_per_thread) /
+                             seconds_since(start);
+        if (threads == 1) {
+            baseline = ops_per_sec;
+        }
+        std::cout << std::setw(8) << threads << std::setw(16) << std::fixed
+                  << std::setprecision(0) << ops_per_sec << std::setw(9)
+                  << std::setprecision(2) << ops_per_sec / baseline << "x\n";
+    }
+}
+
+// get() through pread vs zero-copy get_view() on mapped immutable files
+void bench_mmap(const BenchOptions& opts) {
+    std::cout << "mmap: read_value (pread + copy) vs get_view (mapped, zero-copy)\n";
+    std::cout << std::setw(10) << "value" << std::setw(18) << "read_value ops/s"
+              << std::setw(18) << "get_view ops/s" << "\n";
+    
+    for (int value_size : {100, 4096, 1024 * 1024}) {
+        // Keep the data set around 64 MB so the page cache holds it
+        int num_keys = std::max(16, std::min(opts.num_keys, (64 << 20) / value_size));
+        int lookups = std::max(1000, std::min(opts.ops_per_thread, (1 << 30) / value_size));
+        
+        double results[2];
+        for (int mapped = 0; mapped < 2; ++mapped) {
+            Config config(opts.directory);
+            config.max_file_size = 8 * 1024 * 1024;
+            config.mmap_immutable_files = mapped;
+            auto db = open_fresh(opts, config);
+            
+            std::string value(value_size, 'v');
+            for (int i = 0; i < num_keys; ++i) {
+                db->put(make_key(i), value);
+            }
+            
+            // Reopen so every file but the last is immutable (and mapped)
+            db.reset();
+            db = std::move(Bitcask::open(config).value);
+            
+            std::mt19937 rng(42);
+            std::uniform_int_distribution<int> key_dist(0, num_keys - 1);
+            std::string buffer;
+            size_t checksum = 0;
+            
+            auto start = Clock::now();
+            for (int i = 0; i < lookups; ++i) {
+                std::string key = make_key(key_dist(rng));
+                if (mapped) {
+                    auto view = db->get_view(key);
+                    checksum += view.value.size() + view.value.data()[value_size - 1];
+                } else {
+                    db->get(key, buffer);
+                    checksum += buffer.size() + buffer[value_size - 1];
+                }
+            }
+            results[mapped] = lookups / seconds_since(start);
+            g_sink = checksum;
+        }
+        
+        std::cout << std::setw(9) << value_size << "B" << std::setw(18) << std::fixed
+                  << std::setprecision(0) << results[0] << std::setw(18) << results[1] << "\n";
+    }
+}
+
+// Ingest ops/s for WriteBatch sizes 1..1024, plus group commit of put()
+void bench_batch(const BenchOptions& opts) {
+    std::cout << "batch: " << opts.num_keys << " puts of " << opts.value_size
+              << " B values per run\n";
+    std::cout << std::setw(12) << "batch size" << std::setw(16) << "ops/s" << std::setw(10)
+              << "B/rec" << std::setw(22) << "ops/s (no blocks)" << std::setw(18)
+              << "B/rec (no blocks)" << "\n";
+    
+    std::string value(opts.value_size, 'b');
+    for (int batch_size = 1; batch_size <= 1024; batch_size *= 2) {
+        std::cout << std::setw(12) << batch_size;
+        
+        // Bytes on disk per record, with and without block CRCs
+        for (bool blocks : {true, false}) {
+            Config config(opts.directory);
+            config.block_crc = blocks;
+            auto db = open_fresh(opts, config);
+            
+            auto start = Clock::now();
+            WriteBatch batch;
+            for (int i = 0; i < opts.num_keys; ++i) {
+                batch.put(make_key(i), value);
+                if (static_cast<int>(batch.count()) == batch_size) {
+                    db->write(batch);
+                    batch.clear();
+                }
+            }
+            db->write(batch);
+            double ops = opts.num_keys / seconds_since(start);
+            
+            uint64_t bytes = 0;
+            for (const auto& file : db->file_stats()) {
+                bytes += file.total_bytes;
+            }
+            std::cout << std::setw(blocks ? 16 : 22) << std::fixed << std::setprecision(0) << ops
+                      << std::setw(blocks ? 10 : 18) << std::setprecision(1)
+                      << static_cast<double>(bytes) / opts.num_keys;
+        }
+        std::cout << "\n";
+    }
+    
+    // Independent put() callers coalesced by group commit
+    for (int threads : {4, 16}) {
+        Config config(opts.directory);
+        auto db = open_fresh(opts, config);
+        int per_thread = opts.num_keys / threads;
+        
+        auto start = Clock::now();
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                for (int i = 0; i < per_thread; ++i) {
+                    db->put(make_key(t * per_thread + i), value);
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        
+        std::cout << std::setw(4) << threads << " x put" << std::setw(18) << std::fixed
+                  << std::setprecision(0) << per_thread * threads / seconds_since(start)
+                  << "\n";
+    }
+}
+
+// put() throughput and latency under each Config::sync_policy
+void bench_durability(const BenchOptions& opts) {
+    struct PolicyCase {
+        const char* name;
+        SyncPolicy policy;
+        uint32_t interval_ms;
+    };
+    const PolicyCase cases[] = {
+        {"none", SyncPolicy::None, 0},
+        {"interval-10ms", SyncPolicy::Interval, 10},
+        {"interval-100ms", SyncPolicy::Interval, 100},
+        {"always", SyncPolicy::Always, 0},
+    };
+    
+    std::cout << "durability: " << opts.value_size << " B puts\n";
+    std::cout << std::setw(16) << "policy" << std::setw(9) << "threads" << std::setw(14)
+              << "ops/s" << std::setw(12) << "p50 us" << std::setw(12) << "p99 us" << "\n";
+    
+    std::string value(opts.value_size, 'd');
+    for (const auto& c : cases) {
+        for (int threads : {1, 8}) {
+            Config config(opts.directory);
+            config.sync_policy = c.policy;
+            config.sync_interval_ms = c.interval_ms;
+            auto db = open_fresh(opts, config);
+            
+            // fsync-bound policies are orders of magnitude slower; keep runs short
+            int per_thread = c.policy == SyncPolicy::Always
+                ? std::max(1, 2000 / threads)
+                : std::max(1, opts.num_keys / threads);
+            std::vector<std::vector<double>> latencies(threads);
+            
+            auto start = Clock::now();
+            std::vector<std::thread> workers;
+            for (int t = 0; t < threads; ++t) {
+                workers.emplace_back([&, t] {
+                    latencies[t].reserve(per_thread);
+                    for (int i = 0; i < per_thread; ++i) {
+                        auto op_start = Clock::now();
+                        db->put(make_key(t * per_thread + i), value);
+                        latencies[t].push_back(seconds_since(op_start) * 1e6);
+                    }
+                });
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            double elapsed = seconds_since(start);
+            
+            std::vector<double> all;
+            for (const auto& l : latencies) {
+                all.insert(all.end(), l.begin(), l.end());
+            }
+            std::sort(all.begin(), all.end());
+            
+            std::cout << std::setw(16) << c.name << std::setw(9) << threads << std::fixed
+                      << std::setprecision(0) << std::setw(14) << all.size() / elapsed
+                      << std::setprecision(1) << std::setw(12) << all[all.size() / 2]
+                      << std::setw(12) << all[all.size() * 99 / 100] << "\n";
+        }
+    }
+}
+
+// CRC-32 throughput per implementation
+void bench_crc(const BenchOptions&) {
+    std::cout << "crc: GB/s per implementation (active: "
+              << crc32_impl_name(crc32_active_impl()) << ")\n";
+    std::cout << std::setw(16) << "impl" << std::setw(12) << "64 B" << std::setw(12)
+              << "4 KB" << std::setw(12) << "1 MB" << "\n";
+    
+    std::vector<uint8_t> data(1 << 20);
+    std::mt19937 rng(1);
+    for (auto& byte : data) {
+        byte = static_cast<uint8_t>(rng());
+    }
+    
+    for (Crc32Impl impl : {Crc32Impl::Reference, Crc32Impl::Slicing8, Crc32Impl::Hardware}) {
+        if (impl == Crc32Impl::Hardware && !crc32_hardware_available()) {
+            continue;
+        }
+        
+        std::cout << std::setw(16) << crc32_impl_name(impl);
+        for (size_t block : {size_t(64), size_t(4096), size_t(1 << 20)}) {
+            // ~256 MB per measurement; the bitwise loop gets 1/16 of that
+            size_t total = impl == Crc32Impl::Reference ? (16u << 20) : (256u << 20);
+            size_t iterations = total / block;
+            uint32_t crc = 0;
+            
+            auto start = Clock::now();
+            for (size_t i = 0; i < iterations; ++i) {
+                crc = crc32_with(impl, data.data(), block, crc);
+            }
+            double elapsed = seconds_since(start);
+            g_sink = crc;
+            
+            std::cout << std::setw(12) << std::fixed << std::setprecision(2)
+                      << (iterations * block) / elapsed / 1e9;
+        }
+        std::cout << "\n";
+    }
+}
+
+// put() cost of maintaining the ordered index, and prefix scan throughput
+// against the list_keys() + filter + sort it replaces
+void bench_scan(const BenchOptions& opts) {
+    const int per_prefix = 100;
+    std::cout << "scan: " << opts.num_keys << " keys in groups of " << per_prefix << "\n";
+    
+    auto group_key = [&](int i) {
+        char key[32];
+        std::snprintf(key, sizeof(key), "user:%07d:%03d", i / per_prefix, i % per_prefix);
+        return std::string(key);
+    };
+    
+    // Insert in shuffled order so the ordered index sees random keys
+    std::vector<int> order(opts.num_keys);
+    for (int i = 0; i < opts.num_keys; ++i) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), std::mt19937(3));
+    std::string value(opts.value_size, 'x');
+    
+    std::cout << std::setw(10) << "ordered" << std::setw(14) << "put ns" << "\n";
+    std::unique_ptr<Bitcask> db;
+    for (bool ordered : {false, true}) {
+        Config config(opts.directory);
+        config.ordered_index = ordered;
+        db = open_fresh(opts, config);
+        
+        auto start = Clock::now();
+        for (int i : order) {
+            db->put(group_key(i), value);
+        }
+        std::cout << std::setw(10) << (ordered ? "yes" : "no") << std::setw(14) << std::fixed
+                  << std::setprecision(0) << seconds_since(start) * 1e9 / opts.num_keys << "\n";
+    }
+    
+    std::mt19937 rng(5);
+    std::uniform_int_distribution<int> group(0, (opts.num_keys - 1) / per_prefix);
+    auto prefix_for = [&](int g) {
+        char prefix[32];
+        std::snprintf(prefix, sizeof(prefix), "user:%07d:", g);
+        return std::string(prefix);
+    };
+    
+    size_t found = 0;
+    const int scans = 10000;
+    auto start = Clock::now();
+    for (int n = 0; n < scans; ++n) {
+        for (auto it = db->scan(prefix_for(group(rng))).value; it.valid(); it.next()) {
+            ++found;
+        }
+    }
+    double elapsed = seconds_since(start);
+    std::cout << "scan(prefix):         " << std::setprecision(0) << scans / elapsed
+              << " scans/s, " << found / elapsed << " keys/s\n";
+    
+    // The old way: copy every key out, filter, sort
+    const int baseline_scans = 10;
+    start = Clock::now();
+    for (int n = 0; n < baseline_scans; ++n) {
+        std::string prefix = prefix_for(group(rng));
+        std::vector<std::string> matches;
+        for (auto& key : db->list_keys()) {
+            if (key.compare(0, prefix.size(), prefix) == 0) {
+                matches.push_back(std::move(key));
+            }
+        }
+        std::sort(matches.begin(), matches.end());
+        found += matches.size();
+    }
+    elapsed = seconds_since(start);
+    g_sink = found;
+    std::cout << "list_keys + filter:   " << std::setprecision(1) << baseline_scans / elapsed
+              << " scans/s\n";
+}
+
+// merge() throughput over files where a third of the records are live
+void bench_merge(const BenchOptions& opts) {
+    Config config(opts.directory);
+    config.max_file_size = 8 * 1024 * 1024;     // Small enough that the default run rotates
+    auto db = open_fresh(opts, config);
+    
+    std::string value(opts.value_size, 'm');
+    for (int version = 0; version < 3; ++version) {
+        preload(*db, opts);
+    }
+    db->put("tail", value);
+    
+    auto result = db->merge();
+    if (!result.ok()) {
+        std::cerr << "merge failed: " << result.err() << "\n";
+        return;
+    }
+    const MergeStats& stats = result.value;
+    std::cout << "merge: " << opts.num_keys << " keys x 3 versions, " << opts.value_size
+              << " B values\n" << std::fixed << std::setprecision(1)
+              << "  in:  " << stats.input_files << " file(s), " << stats.input_bytes / 1e6
+              << " MB, " << stats.records_scanned << " records\n"
+              << "  out: " << stats.output_files << " file(s), " << stats.output_bytes / 1e6
+              << " MB, " << stats.records_copied << " records\n"
+              << "  " << stats.seconds << " s, " << stats.mb_per_sec() << " MB/s, "
+              << std::setprecision(0) << stats.records_per_sec() << " records/s\n";
+    
+    Json json;
+    json.add("input_files", static_cast<uint64_t>(stats.input_files))
+        .add("input_bytes", stats.input_bytes)
+        .add("records_scanned", stats.records_scanned)
+        .add("output_files", static_cast<uint64_t>(stats.output_files))
+        .add("output_bytes", stats.output_bytes)
+        .add("records_copied", stats.records_copied)
+        .add("seconds", stats.seconds)
+        .add("mb_per_sec", stats.mb_per_sec())
+        .add("records_per_sec", stats.records_per_sec());
+    emit_json(opts, "merge", json);
+}
+
+// Zipfian reads with no value cache, one sized to a tenth of the data, and
+// one holding all of it
+void bench_cache(const BenchOptions& opts) {
+    size_t data_bytes = static_cast<size_t>(opts.num_keys) * opts.value_size;
+    std::cout << "cache: Zipfian (0.99) gets over " << opts.num_keys << " keys, "
+              << opts.value_size << " B values\n";
+    std::cout << std::setw(10) << "cache KB" << std::setw(14) << "ops/s" << std::setw(14) << "ns/op"
+              << std::setw(14) << "hit rate" << std::setw(14) << "evictions" << "\n";
+    
+    // Scatter popular ranks over the key space, as YCSB does
+    ZipfianGenerator zipf(opts.num_keys);
+    std::mt19937_64 rng(99);
+    std::vector<std::string> order(opts.ops_per_thread);
+    for (auto& key : order) {
+        key = make_key(static_cast<int>(zipf.next(rng) * 2654435761u % opts.num_keys));
+    }
+    
+    for (size_t budget : {size_t{0}, data_bytes / 10, data_bytes}) {
+        Config config(opts.directory);
+        config.max_file_size = 64 * 1024 * 1024;
+        config.cache_bytes = budget;
+        auto db = open_fresh(opts, config);
+        preload(*db, opts);
+        
+        std::string buffer;
+        size_t checksum = 0;
+        auto start = Clock::now();
+        for (const auto& key : order) {
+            db->get(key, buffer);
+            checksum += buffer.size();
+        }
+        double elapsed = seconds_since(start);
+        g_sink = checksum;
+        
+        CacheStats stats = db->cache_stats();
+        std::cout << std::setw(10) << budget / 1024 << std::fixed
+                  << std::setprecision(0) << std::setw(14) << order.size() / elapsed
+                  << std::setw(14) << elapsed * 1e9 / order.size() << std::setprecision(3)
+                  << std::setw(14) << stats.hit_rate() << std::setw(14) << stats.evictions << "\n";
+    }
+}
+
+// JSON-ish value of about size bytes; compresses around 5x like typical API payloads
+std::string json_value(int key, int size) {
+    std::string value = "[";
+    for (int i = 0; static_cast<int>(value.size()) < size; ++i) {
+        value += "{\"id\":" + std::to_string(key * 100 + i) + ",\"user\":\"user" +
+                 std::to_string(key % 1000) + "\",\"status\":\"active\",\"score\":" +
+                 std::to_string((key * 7 + i * 13) % 1000) + ",\"tags\":[\"a\",\"b\"]},";
+    }
+    value.back() = ']';
+    return value;
+}
+
+// put/get/merge cost and disk footprint with and without value compression
+void bench_compression(const BenchOptions& opts) {
+    int value_size = std::max(opts.value_size, 256);
+    std::cout << "compression: " << opts.num_keys << " keys, ~" << value_size
+              << " B JSON values\n";
+    std::cout << std::setw(8) << "codec" << std::setw(12) << "disk MB" << std::setw(10) << "ratio"
+              << std::setw(12) << "put ops/s" << std::setw(12) << "get ops/s" << std::setw(12)
+              << "merge s" << std::setw(14) << "compress ns" << std::setw(16) << "decompress ns"
+              << "\n";
+    
+    std::vector<std::string> values;
+    values.reserve(opts.num_keys);
+    for (int i = 0; i < opts.num_keys; ++i) {
+        values.push_back(json_value(i, value_size));
+    }
+    
+    for (Compression codec : {Compression::None, Compression::LZ4}) {
+        Config config(opts.directory);
+        config.max_file_size = 8 * 1024 * 1024;
+        config.compression = codec;
+        auto db = open_fresh(opts, config);
+        
+        auto start = Clock::now();
+        for (int version = 0; version < 2; ++version) {
+            for (int i = 0; i < opts.num_keys; ++i) {
+                db->put(make_key(i), values[i]);
+            }
+        }
+        double put_rate = 2.0 * opts.num_keys / seconds_since(start);
+        
+        std::mt19937 rng(5);
+        std::uniform_int_distribution<int> pick(0, opts.num_keys - 1);
+        std::string buffer;
+        size_t checksum = 0;
+        start = Clock::now();
+        for (int i = 0; i < opts.ops_per_thread; ++i) {
+            db->get(make_key(pick(rng)), buffer);
+            checksum += buffer.size();
+        }
+        double get_rate = opts.ops_per_thread / seconds_since(start);
+        g_sink = checksum;
+        
+        uint64_t disk_bytes = 0;
+        for (const auto& file : db->file_stats()) {
+            disk_bytes += file.total_bytes;
+        }
+        db->put("tail", "x");
+        auto merge = db->merge();
+        
+        CompressionStats stats = db->compression_stats();
+        std::cout << std::setw(8) << (codec == Compression::None ? "none" : "lz4") << std::fixed
+                  << std::setprecision(1) << std::setw(12) << disk_bytes / 1e6 << std::setw(10)
+                  << (stats.ratio() > 0 ? stats.ratio() : 1.0) << std::setprecision(0)
+                  << std::setw(12) << put_rate << std::setw(12) << get_rate << std::setprecision(3)
+                  << std::setw(12) << (merge.ok() ? merge.value.seconds : 0.0)
+                  << std::setprecision(0) << std::setw(14) << stats.compress_ns_per_op()
+                  << std::setw(16) << stats.decompress_ns_per_op() << "\n";
+    }
+}
+
+// Resident set size in bytes
+size_t resident_bytes() {
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0;
+    size_t resident = 0;
+    statm >> pages >> resident;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+void bench_keydir(const BenchOptions& opts) {
+    std::cout << "Keydir memory and lookup cost for " << opts.num_keys << " keys\n";
+    std::cout << std::setw(10) << "index" << std::setw(14) << "rss B/key"
+              << std::setw(14) << "est B/key" << std::setw(14) << "insert ns"
+              << std::setw(14) << "lookup ns" << "\n";
+    
+    std::vector<std::string> keys;
+    keys.reserve(opts.num_keys);
+    for (int i = 0; i < opts.num_keys; ++i) {
+        keys.push_back("user:" + std::to_string(i * 2654435761u));
+    }
+    
+    std::vector<std::pair<const char*, IndexType>> types = {
+        {"map", IndexType::Map},
+        {"compact", IndexType::Compact},
+        {"hashed", IndexType::Hashed},
+    };
+    for (const auto& [name, type] : types) {
+        size_t rss_before = resident_bytes();
+        auto index = std::make_unique<HashIndex>(16, type);
+        
+        auto start = Clock::now();
+        for (int i = 0; i < opts.num_keys; ++i) {
+            index->put(keys[i], {static_cast<uint32_t>(i % 64), 0, 0, i * 128ull, 100,
+                                 static_cast<uint32_t>(i)});
+        }
+        double insert_elapsed = seconds_since(start);
+        size_t rss_delta = resident_bytes() - rss_before;
+        
+        std::mt19937 rng(7);
+        std::uniform_int_distribution<int> pick(0, opts.num_keys - 1);
+        std::vector<int> order(opts.ops_per_thread);
+        for (auto& i : order) {
+            i = pick(rng);
+        }
+        
+        size_t found = 0;
+        start = Clock::now();
+        for (int i : order) {
+            found += index->get(keys[i]).has_value();
+        }
+        double lookup_elapsed = seconds_since(start);
+        g_sink = found;
+        
+        std::cout << std::setw(10) << name << std::fixed << std::setprecision(1)
+                  << std::setw(14) << static_cast<double>(rss_delta) / opts.num_keys
+                  << std::setw(14) << static_cast<double>(index->memory_usage()) / opts.num_keys
+                  << std::setw(14) << insert_elapsed * 1e9 / opts.num_keys
+                  << std::setw(14) << lookup_elapsed * 1e9 / order.size() << "\n";
+        
+        index.reset();
+        malloc_trim(0);
+    }
+    std::cout << "(hashed lookups exclude the key check, a read of the record header and key)\n";
+}
+
+// Drop a database's files from the page cache so reads go to the device
+void evict_page_cache(const std::string& directory) {
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) {
+        return;
+    }
+    while (struct dirent* entry = readdir(dir)) {
+        std::string path = directory + "/" + entry->d_name;
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            ::fdatasync(fd);
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            ::close(fd);
+        }
+    }
+    closedir(dir);
+}
+
+// Issue get_async over keys with at most depth in flight; returns seconds
+double run_async_gets(Bitcask& db, const std::vector<std::string>& keys, int depth) {
+    std::mutex mutex;
+    std::condition_variable cv;
+    int in_flight = 0;
+    size_t bytes = 0;
+    
+    auto start = Clock::now();
+    for (const auto& key : keys) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return in_flight < depth; });
+            ++in_flight;
+        }
+        db.get_async(key, [&](Result<std::string> result) {
+            std::lock_guard<std::mutex> lock(mutex);
+            bytes += result.value.size();
+            --in_flight;
+            cv.notify_one();
+        });
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&] { return in_flight == 0; });
+    g_sink = bytes;
+    return seconds_since(start);
+}
+
+// Random 4 KB+ reads from one thread: blocking get() vs get_async() at
+// queue depth 1 and 32, with a cold and a warm page cache
+void bench_async(const BenchOptions& opts) {
+    BenchOptions load = opts;
+    load.value_size = std::max(opts.value_size, 4096);
+    
+    Config config(opts.directory);
+    config.max_file_size = 64 * 1024 * 1024;
+    auto db = open_fresh(opts, config);
+    preload(*db, load);
+    
+    std::cout << "async: random gets of " << load.value_size << " B values over "
+              << opts.num_keys << " keys, backend "
+              << (db->async_uses_io_uring() ? "io_uring" : "thread pool") << "\n";
+    std::cout << std::setw(8) << "cache" << std::setw(12) << "mode" << std::setw(14) << "ops/s"
+              << std::setw(14) << "us/op" << "\n";
+    
+    std::mt19937 rng(5);
+    std::uniform_int_distribution<int> pick(0, opts.num_keys - 1);
+    std::vector<std::string> keys(std::min(opts.ops_per_thread, opts.num_keys));
+    for (auto& key : keys) {
+        key = make_key(pick(rng));
+    }
+    
+    for (bool cold : {true, false}) {
+        for (int depth : {0, 1, 32}) {
+            if (cold) {
+                evict_page_cache(opts.directory);
+            }
+            
+            double elapsed;
+            if (depth == 0) {
+                std::string buffer;
+                size_t checksum = 0;
+                auto start = Clock::now();
+                for (const auto& key : keys) {
+                    db->get(key, buffer);
+                    checksum += buffer.size();
+                }
+                elapsed = seconds_since(start);
+                g_sink = checksum;
+            } else {
+                elapsed = run_async_gets(*db, keys, depth);
+            }
+            
+            std::string mode = depth == 0 ? "sync" : "QD" + std::to_string(depth);
+            std::cout << std::setw(8) << (cold ? "cold" : "warm") << std::setw(12) << mode
+                      << std::fixed << std::setprecision(0) << std::setw(14)
+                      << keys.size() / elapsed << std::setprecision(2) << std::setw(14)
+                      << elapsed * 1e6 / keys.size() << "\n";
+        }
+    }
+}
+
+// Batches of random keys: a get() loop vs one multi_get(), with a cold and
+// a warm page cache
+void bench_multi_get(const BenchOptions& opts) {
+    Config config(opts.directory);
+    config.max_file_size = 16 * 1024 * 1024;
+    auto db = open_fresh(opts, config);
+    preload(*db, opts);
+    
+    std::cout << "multi_get: random batches over " << opts.num_keys << " keys, "
+              << opts.value_size << " B values\n";
+    std::cout << std::setw(8) << "cache" << std::setw(8) << "batch" << std::setw(12) << "mode"
+              << std::setw(14) << "keys/s" << std::setw(14) << "us/batch" << "\n";
+    
+    std::mt19937 rng(11);
+    std::uniform_int_distribution<int> pick(0, opts.num_keys - 1);
+    for (bool cold : {true, false}) {
+        for (size_t batch_size : {size_t{50}, size_t{500}}) {
+            size_t batches = std::max<size_t>(1, opts.ops_per_thread / batch_size / 10);
+            std::vector<std::vector<std::string>> batches_keys(batches);
+            for (auto& keys : batches_keys) {
+                for (size_t i = 0; i < batch_size; ++i) {
+                    keys.push_back(make_key(pick(rng)));
+                }
+            }
+            
+            for (bool multi : {false, true}) {
+                if (cold) {
+                    evict_page_cache(opts.directory);
+                }
+                
+                size_t checksum = 0;
+                auto start = Clock::now();
+                for (const auto& keys : batches_keys) {
+                    // Both hand back every value of the batch at once
+                    std::vector<Result<std::string>> results;
+                    if (multi) {
+                        results = db->multi_get(keys);
+                    } else {
+                        results.reserve(keys.size());
+                        for (const auto& key : keys) {
+                            results.push_back(db->get(key));
+                        }
+                    }
+                    for (const auto& result : results) {
+                        checksum += result.value.size();
+                    }
+                }
+                double elapsed = seconds_since(start);
+                g_sink = checksum;
+                
+                std::cout << std::setw(8) << (cold ? "cold" : "warm") << std::setw(8) << batch_size
+                          << std::setw(12) << (multi ? "multi_get" : "get loop") << std::fixed
+                          << std::setprecision(0) << std::setw(14)
+                          << batches * batch_size / elapsed << std::setprecision(1)
+                          << std::setw(14) << elapsed * 1e6 / batches << "\n";
+            }
+        }
+    }
+}
+
+// FNV-1a over the bytes of i; YCSB's hash for keys and scrambled ranks
+uint64_t fnv_hash(uint64_t i) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (int b = 0; b < 8; ++b) {
+        h ^= (i >> (b * 8)) & 0xff;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+// Key of YCSB record i: hashed, so insertion order is not key order
+std::string ycsb_key(uint64_t i, int key_size) {
+    std::string key = "user" + std::to_string(fnv_hash(i));
+    if (static_cast<int>(key.size()) < key_size) {
+        key.append(key_size - key.size(), '0');
+    }
+    return key;
+}
+
+// Operation mix of a YCSB core workload, in percent
+struct YcsbWorkload {
+    char name;
+    int read;
+    int update;
+    int insert;
+    int scan;
+    int read_modify_write;
+    bool latest;        // Reads favour the newest records (workload D)
+    const char* description;
+};
+
+// YCSB core workloads A-F: each loads a fresh store, then runs -threads
+// clients for -ops operations each, recording per-operation latency
+void bench_ycsb(const BenchOptions& opts) {
+    static const YcsbWorkload kWorkloads[] = {
+        {'A', 50, 50, 0, 0, 0, false, "update heavy"},
+        {'B', 95, 5, 0, 0, 0, false, "read mostly"},
+        {'C', 100, 0, 0, 0, 0, false, "read only"},
+        {'D', 95, 0, 5, 0, 0, true, "read latest"},
+        {'E', 0, 0, 5, 95, 0, false, "short ranges"},
+        {'F', 50, 0, 0, 0, 50, false, "read-modify-write"},
+    };
+    enum { kRead, kUpdate, kInsert, kScan, kReadModifyWrite, kOpKinds };
+    static const char* kOpNames[] = {"read", "update", "insert", "scan", "rmw"};
+    
+    const uint64_t records = opts.num_keys;
+    const int threads = std::max(1, opts.threads);
+    const bool zipfian = opts.distribution != "uniform";
+    const int value_min = opts.value_size;
+    const int value_max = std::max(opts.value_size, opts.value_max);
+    ZipfianGenerator zipf(records);
+    
+    std::string payload(value_max, '\0');
+    std::mt19937 payload_rng(1);
+    for (auto& c : payload) {
+        c = static_cast<char>('a' + payload_rng() % 26);
+    }
+    
+    std::cout << "ycsb: " << records << " records, " << threads << " threads x "
+              << opts.ops_per_thread << " ops, " << (zipfian ? "zipfian" : "uniform")
+              << " keys, " << value_min;
+    if (value_max > value_min) {
+        std::cout << "-" << value_max;
+    }
+    std::cout << " B values\n";
+    std::cout << std::setw(4) << "" << std::setw(20) << "workload" << std::setw(12) << "ops/s"
+              << std::setw(8) << "op" << std::setw(10) << "count" << std::setw(10) << "p50 us"
+              << std::setw(10) << "p99 us" << std::setw(10) << "p999 us" << std::setw(10)
+              << "max us" << "\n";
+    
+    std::vector<Json> results;
+    for (const auto& workload : kWorkloads) {
+        if (opts.workload != "all" && opts.workload.find(workload.name) == std::string::npos) {
+            continue;
+        }
+        
+        Config config(opts.directory);
+        config.max_file_size = 64 * 1024 * 1024;
+        config.ordered_index = workload.scan > 0;
+        auto db = open_fresh(opts, config);
+        
+        auto run_clients = [&](const std::function<void(int, std::mt19937_64&)>& client) {
+            std::vector<std::thread> workers;
+            for (int t = 0; t < threads; ++t) {
+                workers.emplace_back([&, t] {
+                    std::mt19937_64 rng(t + 1);
+                    client(t, rng);
+                });
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        };
+        auto make_value = [&](std::mt19937_64& rng) {
+            int size = value_max > value_min
+                           ? std::uniform_int_distribution<int>(value_min, value_max)(rng)
+                           : value_min;
+            return payload.substr(0, size);
+        };
+        
+        auto start = Clock::now();
+        run_clients([&](int t, std::mt19937_64& rng) {
+            for (uint64_t i = t; i < records; i += threads) {
+                db->put(ycsb_key(i, opts.key_size), make_value(rng));
+            }
+        });
+        double load_rate = records / seconds_since(start);
+        
+        std::atomic<uint64_t> inserted{records};
+        auto choose = [&](std::mt19937_64& rng) -> uint64_t {
+            uint64_t count = inserted.load(std::memory_order_relaxed);
+            if (workload.latest) {
+                uint64_t rank = zipf.next(rng);
+                return rank < count ? count - 1 - rank : 0;
+            }
+            if (zipfian) {
+                return fnv_hash(zipf.next(rng)) % records;
+            }
+            return std::uniform_int_distribution<uint64_t>(0, count - 1)(rng);
+        };
+        
+        std::vector<std::array<LatencyHistogram, kOpKinds>> histograms(threads);
+        start = Clock::now();
+        run_clients([&](int t, std::mt19937_64& rng) {
+            std::uniform_int_distribution<int> percent(0, 99);
+            std::uniform_int_distribution<int> scan_length(1, 100);
+            std::string value;
+            
+            for (int i = 0; i < opts.ops_per_thread; ++i) {
+                int roll = percent(rng);
+                int kind = roll < workload.read ? kRead
+                         : (roll -= workload.read) < workload.update ? kUpdate
+                         : (roll -= workload.update) < workload.insert ? kInsert
+                         : (roll -= workload.insert) < workload.scan ? kScan
+                         : kReadModifyWrite;
+                
+                auto op_start = Clock::now();
+                switch (kind) {
+                case kRead:
+                    db->get(ycsb_key(choose(rng), opts.key_size), value);
+                    break;
+                case kUpdate:
+                    db->put(ycsb_key(choose(rng), opts.key_size), make_value(rng));
+                    break;
+                case kInsert:
+                    db->put(ycsb_key(inserted.fetch_add(1), opts.key_size), make_value(rng));
+                    break;
+                case kScan: {
+                    auto range = db->range(ycsb_key(choose(rng), opts.key_size), "",
+                                           scan_length(rng));
+                    for (auto& it = range.value; it.valid(); it.next()) {
+                        db->get(it.key(), value);
+                    }
+                    break;
+                }
+                case kReadModifyWrite: {
+                    std::string key = ycsb_key(choose(rng), opts.key_size);
+                    db->get(key, value);
+                    db->put(key, make_value(rng));
+                    break;
+                }
+                }
+                histograms[t][kind].record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Clock::now() - op_start).count());
+            }
+        });
+        double elapsed = seconds_since(start);
+        double ops_rate = static_cast<double>(threads) * opts.ops_per_thread / elapsed;
+        
+        Json ops;
+        std::string label = std::string(1, workload.name) + " " + workload.description;
+        for (int kind = 0; kind < kOpKinds; ++kind) {
+            LatencyHistogram total;
+            for (const auto& per_thread : histograms) {
+                total.merge(per_thread[kind]);
+            }
+            if (total.count() == 0) {
+                continue;
+            }
+            ops.add(kOpNames[kind], latency_json(total));
+            
+            // Workload and throughput only on its first row
+            std::cout << std::setw(4) << "" << std::setw(20) << label << std::setw(12)
+                      << (label.empty() ? "" : std::to_string(static_cast<uint64_t>(ops_rate)))
+                      << std::fixed << std::setw(8) << kOpNames[kind] << std::setw(10) << total.count()
+                      << std::setprecision(1) << std::setw(10) << total.percentile(50) / 1e3
+                      << std::setw(10) << total.percentile(99) / 1e3 << std::setw(10)
+                      << total.percentile(99.9) / 1e3 << std::setw(10) << total.max() / 1e3
+                      << "\n";
+            label.clear();
+        }
+        
+        Json result;
+        result.add("workload", std::string(1, workload.name))
+            .add("load_ops_per_sec", load_rate)
+            .add("ops_per_sec", ops_rate)
+            .add("seconds", elapsed)
+            .add("ops", ops);
+        results.push_back(result);
+    }
+    
+    emit_json(opts, "ycsb", Json().add("workloads", results));
+}
+
+// Time for open() to rebuild the keydir, first by scanning every log file
+// and then from the hint files merge leaves, each with a cold and a warm
+// page cache
+void bench_recovery(const BenchOptions& opts) {
+    Config config(opts.directory);
+    config.max_file_size = 4 * 1024 * 1024;
+    {
+        auto db = open_fresh(opts, config);
+        for (int version = 0; version < 2; ++version) {
+            preload(*db, opts);
+        }
+    }
+    
+    std::cout << "recovery: " << opts.num_keys << " keys x 2 versions, " << opts.value_size
+              << " B values\n";
+    std::cout << std::setw(12) << "keydir from" << std::setw(8) << "cache" << std::setw(8)
+              << "files" << std::setw(10) << "MB" << std::setw(10) << "open s" << std::setw(14)
+              << "entries/s" << std::setw(10) << "MB/s" << std::setw(9) << "threads" << "\n";
+    
+    std::vector<Json> results;
+    auto measure = [&](const char* source, bool cold) {
+        if (cold) {
+            evict_page_cache(opts.directory);
+        }
+        auto start = Clock::now();
+        auto db = Bitcask::open(config);
+        double seconds = seconds_since(start);
+        if (!db.ok()) {
+            std::cerr << "open failed: " << db.err() << "\n";
+            std::exit(1);
+        }
+        
+        const RecoveryStats& stats = db.value->recovery_stats();
+        std::cout << std::setw(12) << source << std::setw(8) << (cold ? "cold" : "warm")
+                  << std::setw(8) << stats.files.size() << std::fixed << std::setprecision(1)
+                  << std::setw(10) << stats.total_bytes / 1e6 << std::setprecision(3)
+                  << std::setw(10) << seconds << std::setprecision(0) << std::setw(14)
+                  << stats.total_entries / seconds << std::setw(10)
+                  << stats.total_bytes / 1e6 / seconds << std::setw(9) << stats.threads << "\n";
+        
+        Json result;
+        result.add("keydir_from", source)
+            .add("cold", cold)
+            .add("files", static_cast<uint64_t>(stats.files.size()))
+            .add("bytes", stats.total_bytes)
+            .add("entries", stats.total_entries)
+            .add("threads", static_cast<uint64_t>(stats.threads))
+            .add("open_seconds", seconds);
+        results.push_back(result);
+    };
+    
+    measure("scan", true);
+    measure("scan", false);
+    {
+        auto db = Bitcask::open(config);
+        if (db.ok()) {
+            db.value->merge();
+        }
+    }
+    measure("hints", true);
+    measure("hints", false);
+    
+    emit_json(opts, "recovery", Json().add("opens", results));
+}
+
+// get()/put() throughput with Config::metrics on vs off
+void bench_metrics(const BenchOptions& opts) {
+    std::cout << "metrics: " << opts.num_keys << " keys, " << opts.value_size
+              << " B values, best of 5 runs\n";
+    std::cout << std::setw(6) << "op" << std::setw(9) << "threads" << std::setw(14) << "off ops/s"
+              << std::setw(14) << "on ops/s" << std::setw(11) << "overhead" << "\n";
+    
+    std::vector<std::string> keys;
+    for (int i = 0; i < opts.num_keys; ++i) {
+        keys.push_back(make_key(i));
+    }
+    
+    auto run = [&](Bitcask& db, bool reads, int threads) {
+        std::vector<std::thread> workers;
+        auto start = Clock::now();
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                std::mt19937 rng(t + 1);
+                std::uniform_int_distribution<int> key_dist(0, opts.num_keys - 1);
+                std::string value(opts.value_size, 'y');
+                for (int i = 0; i < opts.ops_per_thread; ++i) {
+                    const std::string& key = keys[key_dist(rng)];
+                    if (reads) {
+                        g_sink += db.get(key).value.size();
+                    } else {
+                        db.put(key, value);
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        return threads * static_cast<double>(opts.ops_per_thread) / seconds_since(start);
+    };
+    
+    // Both sides reopen the same preloaded files
+    Config config(opts.directory);
+    preload(*open_fresh(opts, config), opts);
+    
+    std::vector<Json> results;
+    for (bool reads : {true, false}) {
+        for (int threads : {1, opts.threads}) {
+            double best[2] = {0, 0};
+            for (int round = 0; round < 5; ++round) {
+                // Alternate so drift in the machine hits both sides alike
+                for (int on = 0; on < 2; ++on) {
+                    config.metrics = on;
+                    auto db = Bitcask::open(config);
+                    if (!db.ok()) {
+                        std::cerr << "open failed: " << db.err() << "\n";
+                        std::exit(1);
+                    }
+                    best[on] = std::max(best[on], run(*db.value, reads, threads));
+                }
+            }
+            
+            double overhead = (best[0] - best[1]) / best[0] * 100;
+            std::cout << std::setw(6) << (reads ? "get" : "put") << std::setw(9) << threads
+                      << std::fixed << std::setprecision(0) << std::setw(14) << best[0]
+                      << std::setw(14) << best[1] << std::setprecision(1) << std::setw(10)
+                      << overhead << "%\n";
+            
+            Json result;
+            result.add("op", reads ? "get" : "put")
+                .add("threads", static_cast<uint64_t>(threads))
+                .add("off_ops_per_sec", best[0])
+                .add("on_ops_per_sec", best[1])
+                .add("overhead_percent", overhead);
+            results.push_back(result);
+        }
+    }
+    
+    // The recording itself, free of the noise in the runs above
+    Json recording;
+    for (uint32_t sample_every : {1u, 8u}) {
+        Metrics metrics(sample_every);
+        const int n = 10000000;
+        auto start = Clock::now();
+        for (int i = 0; i < n; ++i) {
+            metrics.finish(Metrics::Op::Get, metrics.start(Metrics::Op::Get), true);
+        }
+        double ns = seconds_since(start) * 1e9 / n;
+        std::cout << "recording: " << std::setprecision(1) << ns << " ns/op timing 1 in "
+                  << sample_every << "\n";
+        recording.add("ns_per_op_sample_" + std::to_string(sample_every), ns);
+    }
+    
+    emit_json(opts, "metrics", Json().add("runs", results).add("recording", recording));
+}
+
+// SET then GET through serve mode's reactor over a Unix socket, with
+// -threads clients each keeping a pipeline of requests outstanding
+void bench_server(const BenchOptions& opts) {
+    Config config(opts.directory);
+    config.ordered_index = true;
+    auto db = open_fresh(opts, config);
+    preload(*db, opts);     // So every GET finds its key
+    Server server(*db);
+    std::string path = opts.directory + "/bench.sock";
+    auto listening = server.listen(path);
+    if (!listening.ok()) {
+        std::cerr << "listen failed: " << listening.err() << "\n";
+        std::exit(1);
+    }
+    std::thread reactor([&] { server.run(); });
+    
+    std::cout << "server: " << opts.threads << " clients, " << opts.num_keys << " keys, "
+              << opts.value_size << " B values\n";
+    std::cout << std::setw(6) << "op" << std::setw(10) << "pipeline" << std::setw(14) << "ops/s"
+              << std::setw(12) << "p50 us" << std::setw(12) << "p99 us" << "\n";
+    
+    std::string value(opts.value_size, 'x');
+    std::string get_reply = "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
+    
+    std::vector<Json> results;
+    for (int pipeline : {1, 16}) {
+        for (bool reads : {false, true}) {
+            std::vector<LatencyHistogram> histograms(opts.threads);
+            std::vector<std::thread> clients;
+            auto start = Clock::now();
+            
+            for (int t = 0; t < opts.threads; ++t) {
+                clients.emplace_back([&, t] {
+                    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+                    sockaddr_un addr{};
+                    addr.sun_family = AF_UNIX;
+                    std::snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path.c_str());
+                    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+                        std::cerr << "connect failed\n";
+                        std::exit(1);
+                    }
+                    
+                    std::mt19937 rng(t + 1);
+                    std::uniform_int_distribution<int> key_dist(0, opts.num_keys - 1);
+                    std::string request;
+                    std::string reply;
+                    size_t reply_size = (reads ? get_reply.size() : 5) * pipeline;
+                    
+                    for (int i = 0; i < opts.ops_per_thread; i += pipeline) {
+                        request.clear();
+                        for (int p = 0; p < pipeline; ++p) {
+                            std::string key = make_key(key_dist(rng));
+                            request += reads ? "*2\r\n$3\r\nGET\r\n" : "*3\r\n$3\r\nSET\r\n";
+                            request += "$" + std::to_string(key.size()) + "\r\n" + key + "\r\n";
+                            if (!reads) {
+                                request += get_reply;
+                            }
+                        }
+                        
+                        auto sent = Clock::now();
+                        ::write(fd, request.data(), request.size());
+                        reply.resize(reply_size);
+                        size_t got = 0;
+                        while (got < reply_size) {
+                            ssize_t n = ::read(fd, &reply[got], reply_size - got);
+                            if (n <= 0) {
+                                std::cerr << "server closed the connection\n";
+                                std::exit(1);
+                            }
+                            got += static_cast<size_t>(n);
+                        }
+                        histograms[t].record(static_cast<uint64_t>(
+                            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                Clock::now() - sent).count()));
+                    }
+                    ::close(fd);
+                });
+            }
+            for (auto& client : clients) {
+                client.join();
+            }
+            
+            double ops_per_sec = opts.threads * static_cast<double>(opts.ops_per_thread) /
+                                 seconds_since(start);
+            LatencyHistogram latency;
+            for (const auto& histogram : histograms) {
+                latency.merge(histogram);
+            }
+            std::cout << std::setw(6) << (reads ? "GET" : "SET") << std::setw(10) << pipeline
+                      << std::fixed << std::setprecision(0) << std::setw(14) << ops_per_sec
+                      << std::setprecision(1) << std::setw(12) << latency.percentile(50) / 1e3
+                      << std::setw(12) << latency.percentile(99) / 1e3 << "\n";
+            
+            Json result;
+            result.add("op", reads ? "GET" : "SET")
+                .add("pipeline", pipeline)
+                .add("ops_per_sec", ops_per_sec)
+                .add("round_trip", latency_json(latency));
+            results.push_back(result);
+        }
+    }
+    
+    server.stop();
+    reactor.join();
+    emit_json(opts, "server", Json().add("runs", results));
+}
+
+void print_usage(const char* program_name) {
+    std::cerr << "Usage: " << program_name << " <scenario> [options]\n\n";
+    std::cerr << "Scenarios:\n";
+    std::cerr << "  scaling             Mixed get/put throughput at 1-16 threads\n";
+    std::cerr << "  mmap                pread read_value vs mapped get_view at 100B/4KB/1MB\n";
+    std::cerr << "  batch               Ingest ops/s and disk bytes/record for WriteBatch sizes 1-1024\n";
+    std::cerr << "  durability          put() throughput/latency per sync policy\n";
+    std::cerr << "  crc                 CRC-32 GB/s per implementation\n";
+    std::cerr << "  keydir              Bytes/key and lookup ns for map, compact and hashed keydirs\n";
+    std::cerr << "  scan                Ordered index put overhead and prefix scan throughput\n";
+    std::cerr << "  merge               merge() MB/s and records/s\n";
+    std::cerr << "  cache               Zipfian get() hit rate and ns/op with the value cache\n";
+    std::cerr << "  compression         Disk bytes, put/get/merge cost with LZ4 value compression\n";
+    std::cerr << "  async               Random 4KB gets: sync vs get_async at QD1/QD32, cold and warm\n";
+    std::cerr << "  multiget            get() loop vs multi_get() for batches of 50/500 keys\n";
+    std::cerr << "  ycsb                YCSB workloads A-F: ops/s and p50/p99/p999 latency\n";
+    std::cerr << "  recovery            open() time rebuilding the keydir by scan and from hints\n";
+    std::cerr << "  metrics             get()/put() throughput with metrics on vs off\n";
+    std::cerr << "  server              SET/GET ops/s and round trip over serve mode's socket\n\n";
+    std::cerr << "Options:\n";
+    std::cerr << "  -dir <path>         Scratch database directory (default bench_db)\n";
+    std::cerr << "  -keys <n>           Number of keys (default 100000)\n";
+    std::cerr << "  -ops <n>            Operations per thread (default 200000)\n";
+    std::cerr << "  -value <bytes>      Value size (default 100)\n";
+    std::cerr << "  -value-max <bytes>  Draw value sizes uniformly from [-value, -value-max]\n";
+    std::cerr << "  -key-size <bytes>   Pad YCSB keys to this length\n";
+    std::cerr << "  -reads <percent>    Read percentage for mixed workloads (default 90)\n";
+    std::cerr << "  -threads <n>        YCSB client threads (default 4)\n";
+    std::cerr << "  -workload <ABCDEF>  YCSB workloads to run (default all)\n";
+    std::cerr << "  -dist <name>        YCSB key choice: zipfian (default) or uniform\n";
+    std::cerr << "  -json <path>        Append ycsb/recovery/merge/metrics/server results as JSON lines (- = stdout)\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    std::string scenario = argv[1];
+    BenchOptions opts;
+    
+    for (int i = 2; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        std::string value = argv[i + 1];
+        if (flag == "-dir") {
+            opts.directory = value;
+        } else if (flag == "-keys") {
+            opts.num_keys = std::stoi(value);
+        } else if (flag == "-ops") {
+            opts.ops_per_thread = std::stoi(value);
+        } else if (flag == "-value") {
+            opts.value_size = std::stoi(value);
+        } else if (flag == "-reads") {
+            opts.read_percent = std::stoi(value);
+        } else if (flag == "-value-max") {
+            opts.value_max = std::stoi(value);
+        } else if (flag == "-key-size") {
+            opts.key_size = std::stoi(value);
+        } else if (flag == "-threads") {
+            opts.threads = std::stoi(value);
+        } else if (flag == "-workload") {
+            opts.workload = value;
+            std::transform(value.begin(), value.end(), opts.workload.begin(), ::toupper);
+            if (opts.workload == "ALL") {
+                opts.workload = "all";
+            }
+        } else if (flag == "-dist") {
+            if (value != "zipfian" && value != "uniform") {
+                std::cerr << "Error: -dist must be zipfian or uniform\n\n";
+                print_usage(argv[0]);
+                return 1;
+            }
+            opts.distribution = value;
+        } else if (flag == "-json") {
+            opts.json_path = value;
+        } else {
+            std::cerr << "Error: Unknown option '" << flag << "'\n\n";
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    std::map<std::string, void (*)(const BenchOptions&)> scenarios = {
+        {"scaling", bench_scaling},
+        {"mmap", bench_mmap},
+        {"batch", bench_batch},
+        {"durability", bench_durability},
+        {"crc", bench_crc},
+        {"keydir", bench_keydir},
+        {"scan", bench_scan},
+        {"merge", bench_merge},
+        {"cache", bench_cache},
+        {"compression", bench_compression},
+        {"async", bench_async},
+        {"multiget", bench_multi_get},
+        {"ycsb", bench_ycsb},
+        {"recovery", bench_recovery},
+        {"metrics", bench_metrics},
+        {"server", bench_server},
+    };
+    
+    auto it = scenarios.find(scenario);
+    if (it == scenarios.end()) {
+        std::cerr << "Error: Unknown scenario '" << scenario << "'\n\n";
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    it->second(opts);
+    std::system(("rm -rf " + opts.directory).c_str());
+    return 0;
+}
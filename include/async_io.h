@@ -0,0 +1,156 @@
+#ifndef BITCASK_ASYNC_IO_H
+#define BITCASK_ASYNC_IO_H
+
+#include "types.h"
+#include "log_file.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace bitcask {
+
+// Completion engine behind Bitcask's *_async calls and multi_get.
+//
+// Reads are positional reads on a pinned descriptor. Each is first tried
+// on the calling thread with RWF_NOWAIT, which succeeds only if the page
+// cache holds the data, so warm reads complete inline without a thread
+// hand-off. The rest go through an io_uring on Linux, so any number can be
+// in flight across files without a thread each; a reaper thread runs their
+// callbacks. Where io_uring is unavailable (old kernel, seccomp, disabled
+// by sysctl), or once the reaper can no longer wait on the ring, they run
+// on the thread pool instead. Blocking work such as appends always runs on
+// the pool. Callbacks must not block for long: they hold up other
+// completions. Thread-safe; the destructor waits for everything submitted.
+class AsyncIO {
+public:
+    using Callback = std::function<void(Result<void>)>;
+    
+    // Read length bytes at offset into buffer, which must stay valid until
+    // done runs. Short reads are continued; end of file is an error.
+    struct ReadRequest {
+        std::shared_ptr<const FileHandle> handle;
+        uint64_t offset;
+        size_t length;
+        char* buffer;
+        Callback done;
+    };
+    
+    // queue_depth of 0 disables io_uring
+    AsyncIO(size_t threads, unsigned queue_depth);
+    ~AsyncIO();
+    
+    AsyncIO(const AsyncIO&) = delete;
+    AsyncIO& operator=(const AsyncIO&) = delete;
+    
+    void read(ReadRequest request);
+    
+    // Issue several reads with a single submission
+    void read_batch(std::vector<ReadRequest> requests);
+    
+    // Run a task on the pool
+    void run(std::function<void()> task);
+    
+    // True if reads go through io_uring
+    bool uses_io_uring() const {
+        return ring_fd_.load(std::memory_order_relaxed) >= 0 &&
+               !ring_failed_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct ReadOp {
+        std::shared_ptr<const FileHandle> handle;
+        uint64_t offset;
+        char* buffer;
+        size_t length;
+        size_t done = 0;
+        Callback callback;
+    };
+    
+    // Thread pool
+    std::vector<std::thread> workers_;
+    std::mutex pool_mutex_;
+    std::condition_variable pool_cv_;
+    std::deque<std::function<void()>> tasks_;
+    bool stop_ = false;
+    
+    // io_uring, mapped from the kernel (ring_fd_ < 0 if not in use; torn
+    // down under submit_mutex_)
+    std::atomic<int> ring_fd_{-1};
+    unsigned sq_entries_ = 0;
+    void* sq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    void* cq_ring_ = nullptr;           // Same mapping as sq_ring_ with a single mmap
+    size_t cq_ring_size_ = 0;
+    void* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_mask_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned* cq_mask_ = nullptr;
+    void* cqes_ = nullptr;
+    
+    // Submissions are capped at the ring size so completions never overflow;
+    // the rest wait in backlog_ and go out as completions free slots
+    std::mutex submit_mutex_;
+    std::condition_variable idle_cv_;
+    size_t in_flight_ = 0;
+    std::unordered_set<ReadOp*> ring_ops_;  // Taken by the kernel and not yet reaped
+    std::deque<ReadOp*> backlog_;
+    std::atomic<bool> stopping_{false};
+    std::atomic<bool> ring_failed_{false};  // The reaper gave up; reads go to the pool
+    std::thread reaper_;
+    std::atomic<bool> nowait_{true};    // Cleared if RWF_NOWAIT is unsupported
+    
+    void worker_loop();
+    
+    // Map a ring; false (and nothing held) if io_uring is unavailable
+    bool setup_ring(unsigned entries);
+    void teardown_ring();
+    
+    // Try an op's read without blocking; false if it has to wait for the
+    // device (what was read, if anything, is kept in op->done)
+    bool read_if_cached(ReadOp* op);
+    
+    // Put ops on the ring with one enter; those past the ring's capacity
+    // wait in backlog_ and any the kernel refuses go to the pool (caller
+    // holds submit_mutex_)
+    void submit_locked(const std::vector<ReadOp*>& ops);
+    
+    // Fill the next SQE (caller holds submit_mutex_)
+    void prepare_sqe(uint8_t opcode, ReadOp* op);
+    
+    // Submit count prepared SQEs, returning how many the kernel took; the
+    // rest are taken back off the ring (caller holds submit_mutex_)
+    size_t enter_locked(unsigned count);
+    
+    // Handle a ring completion: finish the op, or resubmit what is left
+    void complete(ReadOp* op, int64_t result);
+    
+    // Blocking pread of what is left of an op, on the calling thread
+    void read_on_pool(ReadOp* op);
+    
+    void reap_loop();
+    
+    // Handle every completion on the ring, without waiting for any. Returns
+    // true if the destructor's wake-up was among them.
+    bool reap_completions();
+    
+    // Stop using a ring the reaper can no longer wait on: later reads go to
+    // the pool, and so do those still on the ring once they complete or are
+    // cancelled. Any the kernel keeps past that are leaked, never freed.
+    void abandon_ring();
+};
+
+} // namespace bitcask
+
+#endif // BITCASK_ASYNC_IO_H
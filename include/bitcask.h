@@ -4,15 +4,39 @@
 #include "types.h"
 #include "log_file.h"
 #include "hash_index.h"
+#include "write_batch.h"
+#include "hint_file.h"
+#include "file_registry.h"
+#include "ordered_index.h"
+#include "value_cache.h"
+#include "async_io.h"
+#include "metrics.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
 #include <vector>
 #include <string>
+#include <string_view>
 
 namespace bitcask {
 
-// Main Bitcask database class
+// Main Bitcask database class.
+//
+// All public methods are thread-safe. Writers (put/del/write/merge) are
+// serialized on a single append lock; get() only takes shard-level index
+// locks and a shared lock on the file set, so readers never wait behind an
+// append. Concurrent writers are group-committed: the writer at the head of
+// the queue appends every queued batch with one write on behalf of the rest.
 class Bitcask {
 public:
+    using GetCallback = std::function<void(Result<std::string>)>;
+    using WriteCallback = std::function<void(Result<void>)>;
+    
     // Open or create a Bitcask database
     static Result<std::unique_ptr<Bitcask>> open(const Config& config);
     
@@ -25,45 +49,291 @@ public:
     // Get a value by key
     Result<std::string> get(const std::string& key);
     
+    // Get a value by key into a caller-owned string, reusing its capacity
+    Result<void> get(const std::string& key, std::string& value);
+    
+    // True if key has a live value (no read)
+    bool contains(const std::string& key) const;
+    
+    // Get a pinned view of a value. With Config::mmap_immutable_files the
+    // view points straight into the mapping of an immutable file and stays
+    // valid even if merge() retires that file; otherwise it owns a copy,
+    // served from the value cache when one is configured.
+    Result<ValueView> get_view(const std::string& key);
+    
     // Delete a key
     Result<void> del(const std::string& key);
     
-    // List all keys
+    // Apply a batch of puts and deletes atomically with one contiguous
+    // append. Readers see all of it or none of it, and so does recovery
+    // after a crash mid-append: every record but the batch's last is
+    // flagged kRecordContinued, and a batch whose last record didn't make
+    // it to disk is dropped whole.
+    Result<void> write(const WriteBatch& batch);
+    
+    // Why write() would refuse a put of key with value (or a delete of key,
+    // with an empty value): an empty key, or a key or value too large for
+    // the log format. Lets a caller gathering ops from several sources
+    // turn one away before it is queued with the rest.
+    static Result<void> check_op(std::string_view key, std::string_view value = {});
+    
+    // Get many values at once, returned in the order of keys (a missing key
+    // gets an error result). Lookups are sorted by file and offset, values
+    // close together in a file (Config::multi_get_gap) are fetched with one
+    // read, and the reads run in parallel through the async engine. Must
+    // not be called from an async callback.
+    std::vector<Result<std::string>> multi_get(const std::vector<std::string>& keys);
+    
+    // Asynchronous get: the key is resolved on the calling thread and the
+    // value read without blocking it, through io_uring where available.
+    // done runs exactly once: inline for a missing key or a value already
+    // cached (ours or the page cache), otherwise on an I/O thread, so it
+    // must not block for long.
+    void get_async(const std::string& key, GetCallback done);
+    
+    // Asynchronous put/del/write: run on the async thread pool, where
+    // concurrent calls are group-committed like blocking writers. Writes
+    // issued from one thread may complete in any order.
+    void put_async(const std::string& key, const std::string& value, WriteCallback done);
+    void del_async(const std::string& key, WriteCallback done);
+    void write_async(WriteBatch batch, WriteCallback done);
+    
+    // True if async reads go through io_uring rather than the thread pool
+    bool async_uses_io_uring();
+    
+    // List all keys. With IndexType::Hashed this reads every log file.
     std::vector<std::string> list_keys();
     
-    // Merge (compact) log files
-    Result<void> merge();
+    // Iterate live keys starting with prefix in byte order, at most limit
+    // of them (0 = all). Requires Config::ordered_index.
+    Result<OrderedIndex::Iterator> scan(const std::string& prefix, size_t limit = 0);
     
-    // Sync active file to disk
-    Result<void> sync();
+    // Iterate live keys in [begin, end) in byte order; an empty end is
+    // unbounded. Requires Config::ordered_index.
+    Result<OrderedIndex::Iterator> range(const std::string& begin, const std::string& end,
+                                         size_t limit = 0);
+    
+    // Merge (compact) every immutable log file: each is read sequentially
+    // and its live records are copied verbatim into new files, with their
+    // hint files written in the same pass. Writers wait until it finishes.
+    Result<MergeStats> merge();
+    
+    // Run one round of incremental compaction now: rewrite the most
+    // fragmented immutable files (per the Config::compaction_* thresholds)
+    // into one new file while reads and writes carry on. Returns true if
+    // any files were compacted. With Config::background_compaction a
+    // scheduler thread calls this periodically.
+    Result<bool> compact();
     
+    // Size and liveness of every log file, oldest first
+    std::vector<FileStats> file_stats() const;
+    
+    // Value cache counters; all zero unless Config::cache_bytes is set
+    CacheStats cache_stats() const;
+    
+    // Value compression counters; all zero unless Config::compression is set
+    CompressionStats compression_stats() const;
+    
+    // Snapshot of operation counters and latencies, bytes moved, keydir
+    // size, per-file figures and merge progress; see format_stats() to
+    // render it. Counts keys and sizes files on each call, so poll it every
+    // few seconds rather than per operation.
+    Stats stats() const;
+    
+    // Timing of the recovery done by open()
+    const RecoveryStats& recovery_stats() const;
+    
+    // Durability barrier: every write that returned before this call is on
+    // stable storage when it returns, whatever Config::sync_policy says
+    Result<void> sync();
+
 private:
     Bitcask(const Config& config);
     
     Config config_;
     HashIndex index_;
-    std::vector<std::unique_ptr<LogFile>> old_files_;  // Immutable files
-    std::unique_ptr<LogFile> active_file_;             // Current writable file
+    std::unique_ptr<OrderedIndex> ordered_;            // Null unless Config::ordered_index
+    std::unique_ptr<ValueCache> cache_;                // Null unless Config::cache_bytes
+    std::unique_ptr<Metrics> metrics_;                 // Null unless Config::metrics
+    mutable FdCache fd_cache_;                         // Caps open read fds of immutable files
+    std::vector<std::shared_ptr<LogFile>> old_files_;  // Immutable files, sorted by id
+    std::shared_ptr<LogFile> active_file_;             // Current writable file
+    FileRegistry files_;                               // Every open file by id
     uint32_t next_file_id_;
     
+    std::mutex write_mutex_;                    // Serializes appends, rotation and merge
+    mutable std::shared_mutex files_mutex_;     // Guards old_files_ and active_file_
+    
+    // A write() call waiting to be group-committed
+    struct PendingWrite {
+        const WriteBatch* batch;
+        std::vector<std::string> frames;        // Compressed value per op; empty = stored raw
+        bool must_exist = false;                // Deletes fail if their key is absent
+        bool missing = false;                   // ... and one was, so nothing was written
+        Result<void> result;                    // Set early if a key check failed, ditto
+        bool done = false;
+        std::condition_variable cv;
+        
+        bool written() const { return !missing && result.ok(); }
+    };
+    std::mutex queue_mutex_;                    // Guards pending_writes_
+    std::deque<PendingWrite*> pending_writes_;
+    
+    // Group-commit a batch (write() without the metrics). With must_exist,
+    // a batch deleting a key that is absent when its turn comes fails with
+    // "Key not found" and writes nothing.
+    Result<void> commit(const WriteBatch& batch, bool must_exist = false);
+    
+    // Append a group of batches with one write and index them (leader only)
+    Result<void> apply_batches(const std::vector<PendingWrite*>& group);
+    
+    // Compress the values of a batch worth storing compressed
+    void compress_values(const WriteBatch& batch, std::vector<std::string>& frames);
+    
+    // Start time of an operation, if metrics are on
+    Metrics::Clock::time_point op_start(Metrics::Op op) {
+        return metrics_ ? metrics_->start(op) : Metrics::Clock::time_point();
+    }
+    
+    void op_done(Metrics::Op op, Metrics::Clock::time_point start, bool ok) {
+        if (metrics_) {
+            metrics_->finish(op, start, ok);
+        }
+    }
+    
+    // Account value bytes read from a file
+    void add_bytes_read(const LogFile& file, uint64_t bytes) {
+        file.add_bytes_read(bytes);
+        if (metrics_) {
+            metrics_->add_bytes_read(bytes);
+        }
+    }
+    
+    // Progress of the running merge, for stats()
+    std::atomic<bool> merge_running_{false};
+    std::atomic<uint64_t> merge_bytes_done_{0};
+    std::atomic<uint64_t> merge_bytes_total_{0};
+    
+    // merge() and compact() without the metrics
+    Result<MergeStats> merge_files();
+    Result<bool> compact_files();
+    
+    // Periodic stats dump (Config::stats_dump_interval_ms)
+    std::thread stats_dumper_;
+    std::mutex stats_dumper_mutex_;
+    std::condition_variable stats_dumper_cv_;
+    bool stop_stats_dumper_ = false;
+    
+    void stats_dumper_loop();
+    
+    // Compression counters
+    std::atomic<uint64_t> values_compressed_{0};
+    std::atomic<uint64_t> values_raw_{0};
+    std::atomic<uint64_t> compressed_raw_bytes_{0};
+    std::atomic<uint64_t> compressed_stored_bytes_{0};
+    std::atomic<uint64_t> compress_ns_{0};
+    std::atomic<uint64_t> values_decompressed_{0};
+    std::atomic<uint64_t> decompress_ns_{0};
+    
+    // Engine behind the *_async calls, started on first use and drained
+    // first on destruction, while everything its callbacks touch is alive
+    std::unique_ptr<AsyncIO> async_;
+    std::once_flag async_once_;
+    
+    AsyncIO& async_io();
+    
+    // Take a replaced index entry's record off its file's live bytes
+    // (caller holds files_mutex_)
+    void retire_entry(const std::string& key, const std::optional<IndexEntry>& previous);
+    
+    // Durability state. sync_mutex_ is held while syncing the active file so
+    // rotation cannot close it underneath the background flusher.
+    // Lock order: compaction_mutex_ -> write_mutex_ -> sync_mutex_ -> files_mutex_.
+    std::mutex sync_mutex_;
+    std::atomic<uint64_t> unsynced_bytes_{0};
+    std::vector<uint32_t> unsynced_file_ids_;   // Rotated out before being synced
+    std::thread flusher_;
+    std::mutex flusher_mutex_;
+    std::condition_variable flusher_cv_;
+    bool stop_flusher_ = false;
+    
+    // Background flusher loop for SyncPolicy::Interval
+    void flusher_loop();
+    
+    // Incremental compaction. compaction_mutex_ serializes compaction rounds
+    // with merge() and is taken before write_mutex_.
+    std::mutex compaction_mutex_;
+    std::thread compactor_;
+    std::mutex compactor_mutex_;
+    std::condition_variable compactor_cv_;
+    bool stop_compactor_ = false;
+    
+    // Scheduler loop for Config::background_compaction
+    void compactor_loop();
+    
+    // Most fragmented immutable files worth a round, oldest first (caller
+    // holds compaction_mutex_)
+    std::vector<std::shared_ptr<LogFile>> pick_compaction_inputs() const;
+    
+    // Sync the active file (caller holds sync_mutex_)
+    Result<void> sync_active_file();
+    
+    // Make newly created files in the directory durable
+    void sync_directory() const;
+    
     // Initialize database (create directory, load existing data)
     Result<void> initialize();
     
     // Load existing log files and rebuild index
     Result<void> load_existing_files();
     
-    // Create a new active file
+    // Create a new active file (caller holds write_mutex_ once open)
     Result<void> rotate_active_file();
     
+    // Resolve a key to its index entry and a handle on the file holding it
+    Result<void> lookup(const std::string& key, IndexEntry& entry,
+                        std::shared_ptr<LogFile>& file) const;
+    
+    // Read a value through the value cache, filling it on a miss
+    Result<void> read_cached(const IndexEntry& entry, const LogFile& file, std::string& value);
+    
+    // Longest read multi_get coalesces values into
+    static constexpr uint64_t kMaxCoalescedRead = 1024 * 1024;
+    
+    // Expand a compressed value
+    Result<void> decompress_value(std::string_view frame, std::string& value);
+    
+    // Add an immutable file to old_files_ (kept sorted by id) and the
+    // registry (caller holds files_mutex_ exclusively)
+    void install_immutable_file(std::shared_ptr<LogFile> file);
+    
+    // Whether entry's record has this key: the Hashed keydir's KeyCheck
+    // (caller holds files_mutex_). An error if the record can't be read.
+    Result<bool> record_has_key(std::string_view key, const IndexEntry& entry) const;
+    
+    // Find the file for a file id (caller holds files_mutex_)
+    std::shared_ptr<LogFile> find_file(uint32_t file_id) const;
+    
+    // Open an immutable file, mapping it if configured
+    std::unique_ptr<LogFile> open_immutable_file(uint32_t file_id) const;
+    
     // Get current timestamp
     uint32_t get_timestamp() const;
     
-    // Write hint file for a log file
-    Result<void> write_hint_file(uint32_t file_id, 
-                                  const std::vector<HashIndex::HintEntry>& hints);
+    // Keydir fragment recovered from one file, bucketed by index shard.
+    // Keys are deduplicated within the file, so its size tracks unique keys.
+    struct PartialKeydir {
+        std::unique_ptr<LogFile> file;
+        std::vector<HashIndex::ShardMap> by_shard;
+        uint64_t valid_bytes = 0;       // Length of the intact record prefix
+        RecoveryStats::FileRecovery stats;
+        std::string error;
+    };
+    
+    // Recover one file from its hint or by scanning it (thread-safe)
+    PartialKeydir recover_file(uint32_t file_id, bool is_last) const;
     
-    // Read hint file if exists
-    Result<bool> read_hint_file(uint32_t file_id);
+    RecoveryStats recovery_stats_;
     
     // Get list of all log file IDs in directory
     std::vector<uint32_t> get_log_file_ids() const;
@@ -0,0 +1,217 @@
+#ifndef BITCASK_COMPACT_TABLE_H
+#define BITCASK_COMPACT_TABLE_H
+
+#include "types.h"
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace bitcask {
+
+// Location packed into 16 bytes: 24-bit file id, 5-bit record overhead and
+// 35-bit value position share one word, and the compressed flag is the top
+// bit of the size. Limits: 16M files, 32 GB per file, 31 bytes of overhead,
+// 2 GB per stored value. Entries past
+// them don't fit(); the tables keep those unpacked in an overflow map and
+// store an overflow marker in the slot.
+struct PackedEntry {
+    uint64_t file_and_pos;
+    uint32_t value_size;
+    uint32_t timestamp;
+    
+    static constexpr uint32_t kMaxFileId = (1u << 24) - 1;     // Reserved for tombstones
+    static constexpr uint64_t kMaxValuePos = (1ull << 35) - 1;
+    static constexpr uint8_t kMaxOverhead = (1u << 5) - 1;
+    static constexpr uint32_t kCompressedBit = 1u << 31;
+    
+    // True if pack() represents entry exactly
+    static bool fits(const IndexEntry& entry) {
+        return entry.is_tombstone() || (entry.file_id < kMaxFileId &&
+                                        entry.overhead <= kMaxOverhead &&
+                                        entry.value_pos <= kMaxValuePos &&
+                                        entry.value_size < kCompressedBit);
+    }
+    
+    // Pack an entry that fits()
+    static PackedEntry pack(const IndexEntry& entry);
+    
+    // Stand-in for an entry kept outside the slot: the tombstone file id
+    // with a nonzero size
+    static PackedEntry overflow(uint32_t timestamp);
+    bool is_overflow() const {
+        return (file_and_pos >> 40) == kMaxFileId && value_size != 0;
+    }
+    
+    IndexEntry unpack() const;
+};
+
+// Open-addressing hash table from keys to index entries, used by HashIndex
+// when Config::index_type is IndexType::Compact.
+//
+// Swiss-table layout: one control byte per slot holding 7 bits of the hash,
+// probed 16 at a time with SSE2 (or a portable loop elsewhere). Slots hold a
+// PackedEntry plus an 8-byte reference to the key, which lives in a bump
+// arena, for 24 bytes per slot plus one control byte. Keys are never
+// removed individually (deletes are stored as tombstone entries), so the
+// arena only grows until clear(). Not thread-safe; HashIndex locks around it.
+class CompactKeyTable {
+public:
+    CompactKeyTable();
+    ~CompactKeyTable();
+    
+    CompactKeyTable(const CompactKeyTable&) = delete;
+    CompactKeyTable& operator=(const CompactKeyTable&) = delete;
+    
+    // Look up a key; returns false if absent
+    bool find(std::string_view key, IndexEntry& entry) const;
+    
+    // Insert or overwrite a key
+    void assign(std::string_view key, const IndexEntry& entry);
+    
+    // Visit every stored key (tombstones included) in table order
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (size_t i = 0; i < capacity_; ++i) {
+            if (is_full(ctrl_[i])) {
+                fn(key_at(slots_[i].key_ref), entry_at(slots_[i]));
+            }
+        }
+    }
+    
+    // Number of stored keys, tombstones included
+    size_t size() const { return size_; }
+    
+    // Bytes held by slots, control bytes and the key arena
+    size_t memory_usage() const;
+    
+    void clear();
+
+private:
+    struct Slot {
+        PackedEntry entry;
+        uint64_t key_ref;   // Arena chunk << kChunkShift | offset
+    };
+    
+    static constexpr size_t kGroupSize = 16;
+    static constexpr uint8_t kEmpty = 0x80;
+    static constexpr int kChunkShift = 24;
+    static constexpr size_t kChunkSize = size_t(1) << 20;
+    
+    static bool is_full(uint8_t ctrl) { return (ctrl & 0x80) == 0; }
+    
+    std::unique_ptr<uint8_t[]> ctrl_;   // capacity_ + kGroupSize (mirrored tail)
+    std::unique_ptr<Slot[]> slots_;
+    size_t capacity_;                   // Power of two, >= kGroupSize
+    size_t size_;
+    
+    std::vector<std::unique_ptr<char[]>> arena_;
+    std::vector<size_t> arena_sizes_;   // Capacity of each chunk
+    size_t arena_used_;                 // Bytes used in the last chunk
+    size_t arena_bytes_;                // Total bytes allocated for chunks
+    
+    // Entries that don't fit a PackedEntry, by key_ref
+    std::unordered_map<uint64_t, IndexEntry> overflow_;
+    
+    uint64_t store_key(std::string_view key);
+    std::string_view key_at(uint64_t key_ref) const;
+    IndexEntry entry_at(const Slot& slot) const;
+    
+    // Find the slot holding key, or the first empty slot of its probe
+    // sequence (found = false)
+    size_t probe(std::string_view key, uint64_t hash, bool& found) const;
+    
+    void set_ctrl(size_t index, uint8_t value);
+    void grow();
+};
+
+// Open-addressing table from 64-bit key fingerprints to index entries, used
+// by HashIndex when Config::index_type is IndexType::Hashed.
+//
+// Control bytes and SSE2 group matching as in CompactKeyTable, but a slot
+// holds the fingerprint where that holds a key reference, and no key bytes
+// are kept at all: 20 bytes per slot (no timestamp) plus one control byte.
+// Fingerprints are unique in the table; telling apart keys that share one
+// is up to the caller. Since slots are all there is, the table grows by
+// half rather than doubling, over aligned groups probed in turn, so a
+// fresh rehash leaves it 58% full rather than 44%. Entries are erased
+// individually, leaving a deleted marker that probes step over until the
+// next rehash drops it. Not thread-safe.
+class FingerprintTable {
+public:
+    FingerprintTable();
+    ~FingerprintTable();
+    
+    FingerprintTable(const FingerprintTable&) = delete;
+    FingerprintTable& operator=(const FingerprintTable&) = delete;
+    
+    // Look up a fingerprint; returns false if absent. Entries come back
+    // with timestamp 0.
+    bool find(uint64_t fingerprint, IndexEntry& entry) const;
+    
+    // Insert or overwrite a fingerprint's entry
+    void assign(uint64_t fingerprint, const IndexEntry& entry);
+    
+    // Remove a fingerprint; returns false if absent
+    bool erase(uint64_t fingerprint);
+    
+    // Visit every fingerprint in table order
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (size_t i = 0; i < capacity_; ++i) {
+            if (is_full(ctrl_[i])) {
+                fn(slots_[i].fingerprint, entry_at(slots_[i]));
+            }
+        }
+    }
+    
+    size_t size() const { return size_; }
+    
+    // Bytes held by slots and control bytes
+    size_t memory_usage() const;
+    
+    void clear();
+
+private:
+    // PackedEntry without the timestamp
+    struct Slot {
+        uint64_t fingerprint;
+        uint64_t file_and_pos;
+        uint32_t value_size;
+    } __attribute__((packed));
+    
+    static constexpr size_t kGroupSize = 16;
+    static constexpr uint8_t kEmpty = 0x80;
+    static constexpr uint8_t kDeleted = 0xFE;
+    
+    static bool is_full(uint8_t ctrl) { return (ctrl & 0x80) == 0; }
+    
+    std::unique_ptr<uint8_t[]> ctrl_;
+    std::unique_ptr<Slot[]> slots_;
+    size_t capacity_;                   // Whole groups
+    size_t size_;
+    size_t deleted_;                    // Slots marked kDeleted
+    
+    // Entries that don't fit a PackedEntry, by fingerprint
+    std::unordered_map<uint64_t, IndexEntry> overflow_;
+    
+    IndexEntry entry_at(const Slot& slot) const;
+    
+    // Point a slot at entry, packed or through overflow_
+    void store(Slot& slot, const IndexEntry& entry);
+    
+    // Find the slot holding fingerprint, or the first free (empty or
+    // deleted) slot of its probe sequence (found = false)
+    size_t probe(uint64_t fingerprint, uint64_t hash, bool& found) const;
+    
+    // Group a probe for hash starts at
+    size_t home_group(uint64_t hash) const;
+    
+    // Move every entry into a fresh table of the given capacity
+    void rehash(size_t capacity);
+};
+
+} // namespace bitcask
+
+#endif // BITCASK_COMPACT_TABLE_H
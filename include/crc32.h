@@ -0,0 +1,37 @@
+#ifndef BITCASK_CRC32_H
+#define BITCASK_CRC32_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bitcask {
+
+// CRC-32 (IEEE, reflected polynomial 0xEDB88320) implementations.
+//
+// Every implementation produces bit-identical results. crc32() dispatches to
+// the fastest one the CPU supports, chosen once at startup. All functions
+// take and return a finished CRC, so a checksum can be built up
+// incrementally: crc32(b, nb, crc32(a, na)) == crc32(a||b).
+enum class Crc32Impl {
+    Reference,  // Bit-at-a-time loop (original implementation)
+    Slicing8,   // Table-driven, 8 bytes per step
+    Hardware    // PCLMULQDQ folding (x86-64) or ARMv8 CRC32 instructions
+};
+
+// Compute with the fastest available implementation
+uint32_t crc32(const uint8_t* data, size_t length, uint32_t crc = 0);
+
+// Compute with a specific implementation (Hardware requires hardware support)
+uint32_t crc32_with(Crc32Impl impl, const uint8_t* data, size_t length, uint32_t crc = 0);
+
+// Check whether the Hardware implementation can run on this CPU
+bool crc32_hardware_available();
+
+// Implementation used by crc32()
+Crc32Impl crc32_active_impl();
+
+const char* crc32_impl_name(Crc32Impl impl);
+
+} // namespace bitcask
+
+#endif // BITCASK_CRC32_H
@@ -0,0 +1,73 @@
+#ifndef BITCASK_FILE_REGISTRY_H
+#define BITCASK_FILE_REGISTRY_H
+
+#include "log_file.h"
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace bitcask {
+
+// Caps how many log files registered with it hold an open read
+// descriptor. Past the cap, the least recently read file (a CLOCK
+// approximation of LRU, so reads only set a flag) gives its descriptor
+// back and reopens it on its next read. Thread-safe.
+class FdCache {
+public:
+    // max_open of 0 means no cap
+    explicit FdCache(size_t max_open) : max_open_(max_open), hand_(ring_.end()) {}
+    
+    // A file just opened its read descriptor; may evict others
+    void opened(const LogFile* file);
+    
+    // A file closed its descriptor or is being destroyed
+    void forget(const LogFile* file);
+    
+    // Files currently holding a descriptor
+    size_t open_count() const;
+    
+private:
+    using Ring = std::list<const LogFile*>;
+    
+    mutable std::mutex mutex_;
+    size_t max_open_;
+    Ring ring_;
+    std::unordered_map<const LogFile*, Ring::iterator> positions_;
+    Ring::iterator hand_;               // Next eviction candidate
+    
+    void erase(Ring::iterator it);
+};
+
+// Log files by id, for O(1) lookup on the read path. Handles are shared,
+// so rotation and merge can swap files out while readers that already hold
+// one finish with it. Not synchronized itself; Bitcask guards it with
+// files_mutex_.
+class FileRegistry {
+public:
+    // Handle for a file id, or null if it is not registered
+    std::shared_ptr<LogFile> find(uint32_t file_id) const {
+        if (file_id < base_ || file_id - base_ >= files_.size()) {
+            return nullptr;
+        }
+        return files_[file_id - base_];
+    }
+    
+    // Register a file, replacing any file with the same id
+    void insert(std::shared_ptr<LogFile> file);
+    
+    // Drop a file; readers holding its handle keep it open
+    void erase(uint32_t file_id);
+    
+    void clear();
+    
+private:
+    uint32_t base_ = 0;                             // Id of files_[0]
+    std::vector<std::shared_ptr<LogFile>> files_;   // Slot per id from base_
+};
+
+} // namespace bitcask
+
+#endif // BITCASK_FILE_REGISTRY_H
@@ -2,36 +2,96 @@
 #define BITCASK_HASH_INDEX_H
 
 #include "types.h"
+#include "compact_table.h"
+#include <functional>
 #include <unordered_map>
+#include <shared_mutex>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <optional>
 #include <vector>
 
 namespace bitcask {
 
-// In-memory hash index mapping keys to log file positions
+// In-memory hash index mapping keys to log file positions.
+//
+// The index is split into independently locked shards selected by key hash,
+// so readers only contend with writers that touch the same shard. All
+// methods are safe to call concurrently. Each shard is either a
+// std::unordered_map or, with IndexType::Compact, a CompactKeyTable.
+//
+// With IndexType::Hashed a shard keeps no keys, only a 64-bit fingerprint
+// per key in a FingerprintTable; the few keys whose fingerprint another
+// live key shares are kept whole in the shard's map instead. Which key a
+// fingerprint entry belongs to is settled by a KeyCheck against the record
+// it points at, called under the shard lock by get(), contains(), put()
+// and remove(). Deleted keys are erased rather than kept as tombstones. A
+// check that fails makes put() and remove() fail, since guessing either
+// way would leave two entries for the key or clobber another key's; reads
+// treat it as a mismatch.
 class HashIndex {
 public:
-    HashIndex() = default;
+    // Whether the record at entry's location has this key (IndexType::Hashed),
+    // or an error if the record can't be read
+    using KeyCheck = std::function<Result<bool>(std::string_view key, const IndexEntry& entry)>;
     
-    // Insert or update a key in the index
-    void put(const std::string& key, const IndexEntry& entry);
+    // Without a key_check, a Hashed index takes keys that share a
+    // fingerprint to be the same key
+    explicit HashIndex(size_t num_shards = 16, IndexType type = IndexType::Map,
+                       KeyCheck key_check = nullptr);
+    
+    // Insert or update a key in the index, returning the entry it replaced
+    // (tombstones included). Fails, changing nothing, only if a key check
+    // does; key_check, if given, is used instead of the index's own.
+    Result<std::optional<IndexEntry>> put(const std::string& key, const IndexEntry& entry,
+                                          const KeyCheck& key_check = nullptr);
     
     // Get index entry for a key
     std::optional<IndexEntry> get(const std::string& key) const;
     
-    // Remove a key (mark as tombstone)
-    void remove(const std::string& key, uint32_t timestamp);
+    // Get index entry for a key, tombstones included. With IndexType::Hashed
+    // the key is not checked, so this may be the entry of another key with
+    // the same fingerprint: only compare its location with a known record's.
+    std::optional<IndexEntry> lookup(const std::string& key) const;
+    
+    // Remove a key (mark as tombstone), returning the entry it replaced.
+    // Fails, changing nothing, only if a key check does, as for put().
+    Result<std::optional<IndexEntry>> remove(const std::string& key, uint32_t timestamp,
+                                             const KeyCheck& key_check = nullptr);
+    
+    // Run the key check put() or remove() would need for key now, changing
+    // nothing: whether key owns the fingerprint entry it would replace, or
+    // true when there is nothing to check. Fails only if the check does.
+    Result<bool> check(const std::string& key) const;
+    
+    // Repoint a key only if it still refers to expected's record (same file
+    // and position); used to relocate values without losing racing writes
+    bool compare_and_set(const std::string& key, const IndexEntry& expected,
+                         const IndexEntry& desired);
     
     // Check if key exists and is not deleted
     bool contains(const std::string& key) const;
     
-    // Get all keys (for merge operations)
+    // Get all keys (for merge operations). With IndexType::Hashed, keys(),
+    // for_each() and export_hints() see only the keys held whole.
     std::vector<std::string> keys() const;
     
     // Get number of keys (excluding tombstones)
     size_t size() const;
     
+    // Visit every entry, tombstones included, one shard at a time
+    void for_each(const std::function<void(std::string_view key, const IndexEntry& entry)>& fn) const;
+    
+    // Number of shards the index is split into
+    size_t shard_count() const { return shards_.size(); }
+    
+    // Shard a key belongs to
+    size_t shard_of(const std::string& key) const;
+    
+    // Approximate bytes used by the index (exact for IndexType::Compact)
+    size_t memory_usage() const;
+    
     // Clear the index
     void clear();
     
@@ -42,10 +102,61 @@ public:
     };
     std::vector<HintEntry> export_hints() const;
     
+    using ShardMap = std::unordered_map<std::string, IndexEntry>;
+    
+    // Bulk-apply entries that all belong to one shard, overwriting existing
+    // keys (recovery). Nodes are moved out of entries, not copied.
+    // Tombstone entries are stored as tombstones.
+    void load_shard(size_t shard, ShardMap&& entries);
+    
+    // Finish a recovery (IndexType::Hashed; a no-op otherwise). load_shard()
+    // keeps whole keys so keys sharing a fingerprint are told apart without
+    // reading the log; this folds the rest into fingerprints and drops
+    // deleted keys.
+    void seal();
+
 private:
-    std::unordered_map<std::string, IndexEntry> index_;
+    struct Shard {
+        mutable std::shared_mutex mutex;
+        ShardMap map;                               // IndexType::Map; Hashed: shared fingerprints
+        std::unique_ptr<CompactKeyTable> compact;   // IndexType::Compact
+        std::unique_ptr<FingerprintTable> hashed;   // IndexType::Hashed
+        
+        // Unlocked accessors over whichever container the shard uses
+        bool find(const std::string& key, IndexEntry& entry) const;
+        void assign(const std::string& key, const IndexEntry& entry);
+        std::optional<IndexEntry> replace(const std::string& key, const IndexEntry& entry);
+        size_t memory_usage() const;
+        
+        template <typename Fn>
+        void for_each(Fn&& fn) const {
+            if (compact) {
+                compact->for_each(fn);
+            } else {
+                for (const auto& [key, entry] : map) {
+                    fn(std::string_view(key), entry);
+                }
+            }
+        }
+    };
+    
+    std::vector<std::unique_ptr<Shard>> shards_;
+    KeyCheck key_check_;
+    
+    // Find a key in a Hashed shard, checking a fingerprint match against
+    // the record only if check_key (caller holds the shard lock)
+    bool find_hashed(const Shard& shard, const std::string& key, IndexEntry& entry,
+                     bool check_key) const;
+    
+    Result<bool> owns(const std::string& key, const IndexEntry& entry,
+                      const KeyCheck& key_check = nullptr) const {
+        const KeyCheck& check = key_check ? key_check : key_check_;
+        return check ? check(key, entry) : Result<bool>::Ok(true);
+    }
+    
+    Shard& shard_for(const std::string& key) const { return *shards_[shard_of(key)]; }
 };
 
 } // namespace bitcask
 
-#endif // BITCASK_HASH_INDEX_H
\ No newline at end of file
+#endif // BITCASK_HASH_INDEX_H
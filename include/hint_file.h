@@ -0,0 +1,53 @@
+#ifndef BITCASK_HINT_FILE_H
+#define BITCASK_HINT_FILE_H
+
+#include "types.h"
+#include "hash_index.h"
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bitcask {
+
+// Reader and writer for hint files (cask.N.hint), which let recovery rebuild
+// the index for a log file without scanning it.
+//
+// Version 2 files carry a header with the entry count, the log size they
+// describe and CRCs over the header and body, followed by contiguous
+// entries. Version 3 adds the record flags to each entry, version 4 the
+// record's overhead (IndexEntry::overhead). Older versions, including
+// headerless version 1 files, are still read for logs of formats before 3,
+// whose records all have the same overhead.
+class HintFile {
+public:
+    static constexpr char kMagic[8] = {'B', 'C', 'S', 'K', 'H', 'I', 'N', 'T'};
+    static constexpr uint32_t kVersion = 4;
+    
+    using Visitor = std::function<void(std::string_view key, const IndexEntry& entry)>;
+    
+    // Path of the hint file for a log file id
+    static std::string path_for(const std::string& directory, uint32_t file_id);
+    
+    // Write a version 4 hint file describing the first log_size bytes of
+    // its log file. Encoded into one buffer, written with a single write to
+    // a temporary file and renamed into place.
+    static Result<void> write(const std::string& path, uint64_t log_size,
+                              const std::vector<HashIndex::HintEntry>& hints);
+    
+    // Map and parse a hint file, passing every entry to the visitor.
+    // Returns Ok(false), without visiting anything, if the file is missing,
+    // fails its checksums, is truncated or holds a different number of
+    // entries than its header says, or is empty while the log has records;
+    // the caller must then scan the log.
+    // It does the same for a hint too old for a log of the given format.
+    // covered_size receives how much of the log the hint describes (version
+    // 1 files describe the whole log).
+    static Result<bool> load(const std::string& path, uint32_t file_id, uint64_t log_size,
+                             uint32_t format, const Visitor& visitor,
+                             uint64_t& covered_size);
+};
+
+} // namespace bitcask
+
+#endif // BITCASK_HINT_FILE_H
@@ -2,26 +2,146 @@
 #define BITCASK_LOG_FILE_H
 
 #include "types.h"
-#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace bitcask {
 
-// Represents a single log file in the Bitcask database
+// Read-only memory mapping of an immutable log file. Views share ownership
+// of the mapping, so it is only unmapped once the owning LogFile and every
+// outstanding view are gone (e.g. after merge() retires the file).
+class MappedRegion {
+public:
+    static std::shared_ptr<MappedRegion> map(int fd, uint64_t length);
+    ~MappedRegion();
+    
+    MappedRegion(const MappedRegion&) = delete;
+    MappedRegion& operator=(const MappedRegion&) = delete;
+    
+    const char* data() const { return data_; }
+    uint64_t size() const { return size_; }
+    
+    // Pass an access-pattern hint (MADV_RANDOM, MADV_SEQUENTIAL, ...) to the kernel
+    void advise(int advice) const;
+
+private:
+    MappedRegion(const char* data, uint64_t size) : data_(data), size_(size) {}
+    
+    const char* data_;
+    uint64_t size_;
+};
+
+// A value pinned in memory: either a zero-copy slice of a mapped file or,
+// for files that are not mapped, an owned copy
+class ValueView {
+public:
+    ValueView() = default;
+    ValueView(std::shared_ptr<const MappedRegion> region, const char* data, size_t size)
+        : region_(std::move(region)), data_(data), size_(size) {}
+    explicit ValueView(std::string owned) : owned_(std::move(owned)) {}
+    
+    const char* data() const { return region_ ? data_ : owned_.data(); }
+    size_t size() const { return region_ ? size_ : owned_.size(); }
+    std::string_view view() const { return std::string_view(data(), size()); }
+    std::string str() const { return std::string(data(), size()); }
+    
+    // True if the view points into a mapping rather than owning a copy
+    bool is_mapped() const { return region_ != nullptr; }
+
+private:
+    std::shared_ptr<const MappedRegion> region_;
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    std::string owned_;
+};
+
+class FdCache;
+
+// An open descriptor, closed when the last holder releases it. Readers
+// hold one across a pread() so the descriptor can be dropped from its
+// LogFile (fd cap eviction, close()) without pulling it out from under them.
+class FileHandle {
+public:
+    explicit FileHandle(int fd) : fd_(fd) {}
+    ~FileHandle();
+    
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+    
+    int fd() const { return fd_; }
+
+private:
+    int fd_;
+};
+
+// Represents a single log file in the Bitcask database.
+//
+// append() writes through an O_APPEND descriptor while reads use positional
+// pread() on a separate read-only descriptor, so any number of threads can
+// read the file concurrently with each other and with the single appender.
+// With an FdCache, the read descriptor of an immutable file may be closed
+// while idle and is reopened on the next read.
+//
+// New files start with a LogFileHeader naming their record format
+// (kFormatVersion); files without one are version 1 and stay readable.
+// Appends always use the current format, so Bitcask never appends to an
+// older file.
 class LogFile {
 public:
-    LogFile(uint32_t file_id, const std::string& directory, bool read_only = false);
+    static constexpr char kMagic[8] = {'B', 'C', 'S', 'K', 'L', 'O', 'G', '\0'};
+    static constexpr uint32_t kFormatVersion = 3;
+    
+    LogFile(uint32_t file_id, const std::string& directory, bool read_only = false,
+            FdCache* fd_cache = nullptr);
     ~LogFile();
     
-    // Write a key-value entry to the log
-    Result<uint64_t> append(const std::string& key, const std::string& value, uint32_t timestamp);
+    LogFile(const LogFile&) = delete;
+    LogFile& operator=(const LogFile&) = delete;
+    
+    // Write a key-value entry to the log, returning the value position
+    Result<uint64_t> append(std::string_view key, std::string_view value, uint32_t timestamp);
+    
+    // Write pre-encoded records with a single write, returning their start
+    // offset. A write that fails partway is cut back off; if even that
+    // fails, every later append fails rather than land after it.
+    Result<uint64_t> append_raw(const char* data, size_t length);
+    
+    // Encode one standalone record in the current format onto the end of
+    // buffer, returning the value's offset in it (see RecordEncoder for blocks)
+    static size_t encode_entry(std::string& buffer, uint32_t timestamp,
+                               std::string_view key, std::string_view value,
+                               uint8_t flags = 0);
     
     // Read a value at a specific position
-    Result<std::string> read_value(uint64_t pos, uint32_t value_size);
+    Result<std::string> read_value(uint64_t pos, uint32_t value_size) const;
+    
+    // Read a value straight into a caller-provided buffer of value_size bytes
+    Result<void> read_value_into(uint64_t pos, uint32_t value_size, char* buffer) const;
+    
+    // Get a pinned view of a value; zero-copy if the file is mapped
+    Result<ValueView> read_view(uint64_t pos, uint32_t value_size) const;
+    
+    // Check that the record whose value is at pos has this key and stored
+    // value size, by reading back its header and key
+    Result<bool> has_key(uint64_t pos, std::string_view key, uint32_t value_size) const;
+    
+    // Memory-map the file for reads. Only valid for read-only files.
+    Result<void> map();
+    
+    // Check if the file is memory-mapped
+    bool is_mapped() const { return mapping_ != nullptr; }
+    
+    // Flush written data to stable storage (fdatasync, or fsync with metadata)
+    Result<void> sync(bool metadata = false) const;
     
     // Get current file size
-    uint64_t size() const { return current_size_; }
+    uint64_t size() const { return current_size_.load(std::memory_order_acquire); }
     
     // Get file ID
     uint32_t id() const { return file_id_; }
@@ -32,30 +152,188 @@ public:
     // Check if file is active (writable)
     bool is_active() const { return !read_only_; }
     
+    // Record format version of the file
+    uint32_t format() const { return format_; }
+    
+    // Offset of the first record (just past the file header, if any)
+    uint64_t data_start() const { return data_start_; }
+    
+    // True if the file holds no records
+    bool empty() const { return size() <= data_start_; }
+    
     // Calculate CRC-32 checksum
     static uint32_t calculate_crc32(const uint8_t* data, size_t length);
     
-    // Validate and read all entries (for recovery/merge)
-    struct EntryMetadata {
-        std::string key;
-        uint64_t value_pos;
-        uint32_t value_size;
+    // Size of the fixed part of a record header in the given format
+    // (version 3 headers go on with the varint sizes)
+    static constexpr size_t header_size(uint32_t format = kFormatVersion) {
+        return format >= 3 ? sizeof(LogEntryHeaderV3)
+             : format == 2 ? sizeof(LogEntryHeaderV2) : sizeof(LogEntryHeader);
+    }
+    
+    // Bytes of a LEB128 varint
+    static constexpr size_t varint_size(uint64_t value) {
+        size_t size = 1;
+        while (value >= 0x80) {
+            value >>= 7;
+            ++size;
+        }
+        return size;
+    }
+    
+    // On-disk size of a standalone record with the given key and (stored)
+    // value lengths. A version 3 block member takes a few bytes less; what
+    // each record actually took is in RecordView::size and
+    // IndexEntry::overhead.
+    static constexpr uint64_t record_size(size_t key_size, size_t value_size,
+                                          uint32_t format = kFormatVersion) {
+        uint64_t sizes = format >= 3 ? varint_size(key_size) + varint_size(value_size) : 0;
+        return header_size(format) + sizes + key_size + value_size;
+    }
+    
+    // Liveness accounting, maintained by Bitcask: records in the file, and
+    // the bytes and keys of those the index still points at. Updated as
+    // keys are overwritten and deleted; the rest of the file is reclaimable.
+    // The file header is never reclaimable, so counts as live. Records are
+    // counted at the size they were written with (IndexEntry::record_size()),
+    // so a block's header goes with its first member.
+    uint64_t record_count() const { return record_count_.load(std::memory_order_relaxed); }
+    uint64_t live_bytes() const {
+        return data_start_ + clamp(live_bytes_.load(std::memory_order_relaxed));
+    }
+    uint64_t live_keys() const { return clamp(live_keys_.load(std::memory_order_relaxed)); }
+    void add_records(uint64_t count) { record_count_.fetch_add(count, std::memory_order_relaxed); }
+    void add_live(int64_t bytes, int64_t keys) {
+        live_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+        live_keys_.fetch_add(keys, std::memory_order_relaxed);
+    }
+    
+    // Value bytes read since open (Bitcask::stats())
+    uint64_t bytes_read() const { return bytes_read_.load(std::memory_order_relaxed); }
+    void add_bytes_read(uint64_t bytes) const {
+        bytes_read_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    
+    // One record as seen by scan(). The views point into the scan buffer
+    // and are only valid for the duration of the callback.
+    struct RecordView {
+        uint64_t offset;            // Start of the record in the file
         uint32_t timestamp;
+        uint8_t flags;              // kRecord* bits (tombstone only, in version 1 files)
+        uint32_t format;            // Record format of the file
+        std::string_view key;
+        std::string_view value;     // As stored, so possibly compressed
+        uint64_t value_pos;         // File offset of the value (as indexed)
+        std::string_view raw;       // The whole encoded record, CRC included
+        bool in_block;              // A block member: raw has no CRC of its own
+        uint64_t size;              // Bytes it takes: raw, plus the block header
+                                    // if it is its block's first member
     };
-    Result<std::vector<EntryMetadata>> read_all_entries();
     
+    // Return false to stop the scan early
+    using RecordVisitor = std::function<bool(const RecordView&)>;
+    
+    static constexpr size_t kScanChunkSize = 1024 * 1024;
+    
+    // Stream every valid record from start_offset (or the first record, if
+    // later) on to the visitor in file order, reading the file in chunk_size
+    // reads and checking each CRC in place. Stops at the first torn or
+    // corrupt record or block and returns the offset just past the last
+    // valid one.
+    // Memory use is one chunk (or one record, if larger) regardless of file
+    // size.
+    Result<uint64_t> scan(const RecordVisitor& visitor, uint64_t start_offset = 0,
+                          size_t chunk_size = kScanChunkSize) const;
+    
+    // True if a scan that stopped at offset hit a torn append rather than
+    // corruption: the unit there runs to the end of the file, or only zeros
+    // follow
+    Result<bool> torn_at(uint64_t offset) const;
+    
+    // Cut the file back to length bytes (drops a torn tail after a crash)
+    Result<void> truncate(uint64_t length);
+    
+    // The read descriptor, reopened if it was evicted; null if the file
+    // cannot be opened
+    std::shared_ptr<const FileHandle> read_handle() const;
+    
+    // Close the read descriptor if open (FdCache eviction); the next read
+    // reopens it
+    void release_read_handle() const;
+    
+    // Clear and return the recently-read bit (FdCache second chance)
+    bool take_referenced() const { return referenced_.exchange(false, std::memory_order_relaxed); }
+
 private:
     uint32_t file_id_;
     std::string filepath_;
-    std::fstream file_;
+    int write_fd_;                      // O_APPEND descriptor (writable files only)
+    mutable std::mutex handle_mutex_;   // Guards read_handle_
+    mutable std::shared_ptr<const FileHandle> read_handle_;  // For pread(); null while evicted
+    mutable std::atomic<bool> referenced_{false};
+    FdCache* fd_cache_;                 // Caps open read descriptors, if set
+    std::shared_ptr<const MappedRegion> mapping_;  // Set once map() succeeds
     bool read_only_;
-    uint64_t current_size_;
+    bool torn_ = false;                 // A failed append couldn't be cut back off
+    uint32_t format_;                   // Record format (1 if there is no header)
+    uint64_t data_start_;               // Header size
+    std::atomic<uint64_t> current_size_;
+    std::atomic<uint64_t> record_count_{0};
+    std::atomic<int64_t> live_bytes_{0};    // Signed: racing updates may briefly overshoot
+    std::atomic<int64_t> live_keys_{0};
+    mutable std::atomic<uint64_t> bytes_read_{0};
+    
+    static uint64_t clamp(int64_t value) { return value > 0 ? static_cast<uint64_t>(value) : 0; }
+    
+    // Write the header of a new file, or detect the format of an existing one
+    void init_format();
     
     std::string get_filepath(uint32_t file_id, const std::string& directory);
+};
+
+// Encodes records in the current format onto the end of a buffer. With
+// blocks on, consecutive small records are packed into blocks that share
+// one header and CRC; larger ones still stand alone. A value's offset is
+// known as soon as it is added, but the buffer is only valid to write once
+// finish() has sealed the open block.
+class RecordEncoder {
+public:
+    static constexpr size_t kMaxMemberSize = 1024;      // Key plus value bytes
+    static constexpr size_t kMaxBlockSize = 64 * 1024;  // Member bytes
+    static constexpr size_t kMaxMemberOverhead = 16;    // Flags and varints
+    
+    RecordEncoder(std::string& buffer, bool blocks) : buffer_(buffer), blocks_(blocks) {}
+    
+    // Where add() put a record
+    struct Encoded {
+        size_t value_offset;    // In the buffer
+        size_t size;            // Bytes it took, including the header of a block it opened
+    };
+    
+    // Encode a record onto the buffer
+    Encoded add(uint32_t timestamp, std::string_view key, std::string_view value,
+                uint8_t flags = 0);
+    
+    // True if a record of these sizes would go into a block
+    bool blocks(size_t key_size, size_t value_size) const {
+        return blocks_ && key_size + value_size <= kMaxMemberSize;
+    }
+    
+    // Close the open block unless it has room for count more members with
+    // bytes of keys and values between them, so that records which fit in
+    // one block land in one
+    void reserve(size_t count, size_t bytes);
+    
+    // Close the open block, if any, filling in its size and CRC
+    void finish();
+
+private:
+    static constexpr size_t kNoBlock = static_cast<size_t>(-1);
     
-    // Pack header and data for CRC calculation
-    std::vector<uint8_t> pack_entry(uint32_t timestamp, const std::string& key, 
-                                    const std::string& value);
+    std::string& buffer_;
+    bool blocks_;
+    size_t block_start_ = kNoBlock;     // Offset of the open block's header
+    uint32_t block_timestamp_ = 0;
 };
 
 } // namespace bitcask
@@ -0,0 +1,127 @@
+#ifndef BITCASK_METRICS_H
+#define BITCASK_METRICS_H
+
+#include "types.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace bitcask {
+
+// Operation counters and latency histograms for the engine's hot paths.
+//
+// Each thread records into one of kSlots cache-line-aligned slots, picked
+// once per thread, so recording is a few relaxed adds to a line other
+// threads rarely touch and nothing is locked. Every operation is counted,
+// but reading the clock costs as much as the adds, so put/get/del/write/
+// multi_get calls are timed only one in sample_every per thread; merge,
+// compaction and recovery are always timed. snapshot() sums the slots; it
+// may miss operations in flight, and max_ns can lose a race between two
+// threads sharing a slot. Thread-safe.
+class Metrics {
+public:
+    // Ops before Merge are sampled
+    enum class Op { Put, Get, Del, Write, MultiGet, Merge, Compaction, Recovery, kCount };
+    
+    using Clock = std::chrono::steady_clock;
+    
+    explicit Metrics(uint32_t sample_every = 1)
+        : sample_every_(sample_every == 0 ? 1 : sample_every), opened_(Clock::now()) {}
+    
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+    
+    // Start of an operation: the current time if it is to be timed, else a
+    // zero time point so finish() only counts it
+    Clock::time_point start(Op op) {
+        if (op < Op::Merge && sample_every_ > 1 && ++tick() % sample_every_ != 0) {
+            return Clock::time_point();
+        }
+        return Clock::now();
+    }
+    
+    // Count an operation begun by start()
+    void finish(Op op, Clock::time_point start, bool ok) {
+        if (start == Clock::time_point()) {
+            count(slot().ops[static_cast<size_t>(op)], ok);
+        } else {
+            record(op, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                 Clock::now() - start).count()), ok);
+        }
+    }
+    
+    // Count and time an operation measured by the caller
+    void record(Op op, uint64_t ns, bool ok) {
+        Counters& counters = slot().ops[static_cast<size_t>(op)];
+        count(counters, ok);
+        counters.buckets[OpStats::bucket_for(ns)].fetch_add(1, std::memory_order_relaxed);
+        counters.total_ns.fetch_add(ns, std::memory_order_relaxed);
+        if (ns > counters.max_ns.load(std::memory_order_relaxed)) {
+            counters.max_ns.store(ns, std::memory_order_relaxed);
+        }
+    }
+    
+    void add_bytes_written(uint64_t bytes) {
+        slot().bytes_written.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    
+    void add_bytes_read(uint64_t bytes) {
+        slot().bytes_read.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    
+    // Fill the operation counters, byte totals and uptime of stats
+    void snapshot(Stats& stats) const;
+
+private:
+    static constexpr size_t kSlots = 32;
+    static constexpr size_t kOps = static_cast<size_t>(Op::kCount);
+    
+    struct Counters {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> failed{0};
+        std::atomic<uint64_t> total_ns{0};
+        std::atomic<uint64_t> max_ns{0};
+        std::array<std::atomic<uint64_t>, OpStats::kBuckets> buckets{};
+    };
+    
+    struct alignas(64) Slot {
+        std::array<Counters, kOps> ops;
+        std::atomic<uint64_t> bytes_written{0};
+        std::atomic<uint64_t> bytes_read{0};
+    };
+    
+    uint32_t sample_every_;
+    Clock::time_point opened_;
+    std::array<Slot, kSlots> slots_;
+    
+    static inline std::atomic<size_t> next_slot_{0};
+    
+    static void count(Counters& counters, bool ok) {
+        counters.count.fetch_add(1, std::memory_order_relaxed);
+        if (!ok) {
+            counters.failed.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    
+    // Calls to start() on this thread, for sampling
+    static uint32_t& tick() {
+        thread_local uint32_t calls = 0;
+        return calls;
+    }
+    
+    // Slot of the calling thread, assigned round-robin on first use
+    Slot& slot() {
+        thread_local size_t index = next_slot_.fetch_add(1, std::memory_order_relaxed) % kSlots;
+        return slots_[index];
+    }
+};
+
+// Render a stats() snapshot as a human-readable report, or as one line of
+// JSON
+std::string format_stats(const Stats& stats, bool json);
+
+} // namespace bitcask
+
+#endif // BITCASK_METRICS_H
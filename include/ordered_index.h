@@ -0,0 +1,92 @@
+#ifndef BITCASK_ORDERED_INDEX_H
+#define BITCASK_ORDERED_INDEX_H
+
+#include <cstddef>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+namespace bitcask {
+
+// Sorted set of live keys kept next to the HashIndex when
+// Config::ordered_index is set, for prefix and range scans.
+//
+// A two-level B+-tree: leaves are sorted vectors of at most kLeafCapacity
+// keys, ordered by their first key and found by binary search. Values are
+// not stored; callers look keys up in the HashIndex. All methods are safe
+// to call concurrently.
+class OrderedIndex {
+public:
+    static constexpr size_t kLeafCapacity = 256;
+    
+    // Forward iterator over a key range. Keys are copied out a page at a
+    // time, so writes between pages are seen (or not) without invalidating
+    // the iterator. Must not outlive the index it came from.
+    class Iterator {
+    public:
+        Iterator() = default;
+        
+        bool valid() const { return pos_ < page_.size(); }
+        const std::string& key() const { return page_[pos_]; }
+        void next();
+    
+    private:
+        friend class OrderedIndex;
+        static constexpr size_t kPageSize = 256;
+        
+        Iterator(const OrderedIndex* index, std::string begin, std::string end, size_t limit);
+        
+        // Load the page after last_ (or starting at last_ if first)
+        void fill(bool inclusive);
+        
+        const OrderedIndex* index_ = nullptr;
+        std::string last_;          // Resume point
+        std::string end_;           // Exclusive; empty means unbounded
+        size_t remaining_ = 0;      // Keys left under the limit
+        std::vector<std::string> page_;
+        size_t pos_ = 0;
+    };
+    
+    // Add a key; no-op if present
+    void insert(const std::string& key);
+    
+    // Drop a key; no-op if absent
+    void remove(const std::string& key);
+    
+    // Replace the contents with a bulk-loaded set of keys (any order)
+    void build(std::vector<std::string> keys);
+    
+    void clear();
+    
+    size_t size() const;
+    
+    // Keys in [begin, end) in byte order; an empty end means unbounded and
+    // a limit of 0 means no limit
+    Iterator range(const std::string& begin, const std::string& end, size_t limit = 0) const;
+    
+    // Keys starting with prefix in byte order
+    Iterator scan(const std::string& prefix, size_t limit = 0) const;
+    
+    // Smallest string greater than every string starting with prefix, or
+    // empty if there is none (prefix empty or all 0xFF bytes)
+    static std::string prefix_end(const std::string& prefix);
+    
+private:
+    using Leaf = std::vector<std::string>;
+    
+    mutable std::shared_mutex mutex_;
+    std::vector<Leaf> leaves_;      // Non-empty, ordered, disjoint
+    size_t size_ = 0;
+    
+    // Leaf that key belongs in (caller holds mutex_, leaves_ non-empty)
+    size_t leaf_for(const std::string& key) const;
+    
+    // Copy up to limit keys from [begin, end) (or (begin, end) if not
+    // inclusive) into out
+    void collect(const std::string& begin, bool inclusive, const std::string& end,
+                 size_t limit, std::vector<std::string>& out) const;
+};
+
+} // namespace bitcask
+
+#endif // BITCASK_ORDERED_INDEX_H
@@ -0,0 +1,55 @@
+#ifndef BITCASK_PROTOCOL_H
+#define BITCASK_PROTOCOL_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bitcask {
+
+// Command framing for the CLI batch mode and server, after Redis
+// (https://redis.io/docs/reference/protocol-spec/). A command is either a
+// RESP array of bulk strings, which is length-delimited and binary-safe,
+// or an inline line of space-separated words. Replies use the framing of
+// the command they answer.
+namespace resp {
+
+// Largest bulk string and array accepted
+constexpr size_t kMaxBulkLength = 512 * 1024 * 1024;
+constexpr size_t kMaxArgs = 1024 * 1024;
+
+enum class ParseStatus { Ok, Incomplete, Error };
+
+struct Command {
+    std::vector<std::string> args;  // Empty for blank and comment lines
+    bool framed = false;            // Came as a RESP array
+};
+
+// Parse the command at the front of input into command and set consumed to
+// its length. Incomplete means input holds only part of a command; at_eof
+// accepts a last inline line with no newline. Error sets error and leaves
+// the stream unusable, since framing can't be recovered.
+//
+// Inline lines split on spaces, except that the value of `set <key>
+// <value>` is the rest of the line verbatim. A trailing \r is dropped, and
+// lines starting with # are comments.
+ParseStatus parse(std::string_view input, bool at_eof, Command& command, size_t& consumed,
+                  std::string& error);
+
+// Append a reply to out. Inline replies are one line each (values are
+// written raw, so only framed replies are binary-safe); an inline array is
+// just its elements.
+void append_ok(std::string& out, bool framed);
+void append_status(std::string& out, std::string_view status, bool framed);
+void append_integer(std::string& out, long long value, bool framed);
+void append_value(std::string& out, std::string_view value, bool framed);
+void append_nil(std::string& out, bool framed);
+void append_error(std::string& out, std::string_view message, bool framed);
+void append_array(std::string& out, size_t count, bool framed);
+
+} // namespace resp
+
+} // namespace bitcask
+
+#endif // BITCASK_PROTOCOL_H
@@ -0,0 +1,112 @@
+#ifndef BITCASK_SERVER_H
+#define BITCASK_SERVER_H
+
+#include "bitcask.h"
+#include "protocol.h"
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace bitcask {
+
+// Serves a Bitcask over a Redis-compatible subset of RESP: GET, SET, DEL,
+// MGET, SCAN (MATCH and COUNT; needs Config::ordered_index), INFO, PING and
+// QUIT, on a Unix domain socket or a loopback TCP port.
+//
+// One thread runs an epoll reactor over nonblocking sockets. Each pass
+// parses every pipelined command a ready connection has sent. SETs and
+// DELs from all connections go into one WriteBatch, committed with a
+// single append at the end of the pass (or sooner if it grows large, or a
+// connection reads after its own writes); their replies are held until
+// then, so no client sees a write acknowledged before it is in the log.
+// Reads run inline on the reactor thread. Inline commands are accepted
+// too, and like Redis answered in RESP.
+class Server {
+public:
+    explicit Server(Bitcask& db);
+    ~Server();
+    
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+    
+    // Bind and listen on "unix:<path>" (or any address containing '/') or
+    // "[host:]port", where host is 127.0.0.1 (the default), localhost or ::1.
+    // Port 0 picks a free port; see port().
+    Result<void> listen(const std::string& address);
+    
+    // Serve until stop() is called
+    Result<void> run();
+    
+    // Make run() return after its current pass. Async-signal-safe.
+    void stop();
+    
+    // TCP port listened on, or 0 for a Unix socket
+    uint16_t port() const { return port_; }
+
+private:
+    struct Connection {
+        int fd = -1;
+        std::string in;                 // Received, not yet parsed
+        std::string out;                // Replies not yet sent
+        size_t out_sent = 0;            // Prefix of out already sent
+        size_t pending_writes = 0;      // Commands waiting on the batch
+        bool eof = false;               // Peer stopped sending
+        bool closing = false;           // QUIT or bad framing: close once out is sent
+        bool blocked = false;           // Parsing paused until out drains
+        bool queued = false;            // In this pass's ready list
+        uint32_t events = 0;            // Registered epoll interest
+    };
+    
+    // A SET or DEL whose reply waits for the batch commit
+    struct PendingReply {
+        Connection* conn;
+        long long deleted;              // DEL's reply; -1 for SET
+    };
+    
+    // Stop reading from a connection whose unsent replies pass this
+    static constexpr size_t kMaxOutput = 16 * 1024 * 1024;
+    static constexpr size_t kMaxBatchOps = 4096;
+    static constexpr size_t kMaxBatchBytes = 4 * 1024 * 1024;
+    
+    Bitcask& db_;
+    int listen_fd_ = -1;
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;                  // eventfd written by stop()
+    uint16_t port_ = 0;
+    std::string unix_path_;             // Unlinked on destruction
+    std::unordered_map<int, std::unique_ptr<Connection>> connections_;
+    
+    WriteBatch batch_;
+    std::vector<PendingReply> pending_;
+    std::unordered_map<std::string, bool> pending_live_;   // Keys the batch sets (or deletes)
+    std::string value_;                 // GET buffer, reused
+    
+    std::chrono::steady_clock::time_point started_;
+    uint64_t connections_received_ = 0;
+    uint64_t commands_processed_ = 0;
+    
+    void accept_connections();
+    
+    // Read what the socket holds; false if the peer is gone
+    bool read_input(Connection& conn);
+    
+    // Run the complete commands in conn.in while its output has room
+    void process(Connection& conn);
+    void execute(Connection& conn, const resp::Command& command);
+    void scan(Connection& conn, const resp::Command& command);
+    std::string info();
+    
+    // Append the batched writes and hand out their replies
+    void commit_writes();
+    
+    // Send what we can, re-arm epoll, and close if finished; false if closed
+    bool flush(Connection& conn);
+    void close_connection(Connection& conn);
+};
+
+} // namespace bitcask
+
+#endif // BITCASK_SERVER_H
@@ -1,14 +1,25 @@
 #ifndef BITCASK_TYPES_H
 #define BITCASK_TYPES_H
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
 #include <string>
 #include <limits>
 #include <utility>
+#include <vector>
 
 namespace bitcask {
 
-// Log entry header structure (on-disk format)
+// Log file header (on-disk format, version 2). Version 1 log files have no
+// header and start directly with the first record.
+struct LogFileHeader {
+    char magic[8];          // "BCSKLOG\0"
+    uint32_t version;       // Record format of every record in the file
+    uint32_t header_crc;    // CRC-32 of the fields above
+} __attribute__((packed));
+
+// Log entry header structure (on-disk format, version 1)
 struct LogEntryHeader {
     uint32_t crc;           // CRC-32 checksum for data integrity
     uint32_t timestamp;     // Unix timestamp
@@ -16,13 +27,80 @@ struct LogEntryHeader {
     uint32_t value_size;    // Size of value in bytes
 } __attribute__((packed));  // Prevent padding for binary consistency
 
+// Log entry header, version 2: version 1 plus a flags byte. The CRC covers
+// everything after itself, flags included.
+struct LogEntryHeaderV2 {
+    uint32_t crc;
+    uint32_t timestamp;
+    uint32_t key_size;
+    uint32_t value_size;    // Stored (possibly compressed) size
+    uint8_t flags;          // kRecord* bits
+} __attribute__((packed));
+
+// Log entry format version 3 puts the flags byte first and varint-encodes
+// the sizes. A record either stands alone:
+//   LogEntryHeaderV3 | varint key_size | varint value_size | key | value
+// or is a member of a block, a run of small records written together
+// under one CRC:
+//   BlockHeader | member...
+//   member: flags | varint zigzag(timestamp - block timestamp) |
+//           varint key_size | varint value_size | key | value
+// Each CRC covers everything after itself. Deletes are records flagged
+// kRecordTombstone; earlier versions mark them with an empty value.
+struct LogEntryHeaderV3 {
+    uint32_t crc;
+    uint8_t flags;          // kRecord* bits
+    uint32_t timestamp;
+} __attribute__((packed));
+
+struct BlockHeader {
+    uint32_t crc;
+    uint8_t flags;          // kRecordBlock
+    uint32_t body_size;     // Bytes of members that follow
+    uint32_t timestamp;     // Members store theirs relative to this
+} __attribute__((packed));
+
+// Record flags
+constexpr uint8_t kRecordCompressed = 0x01;     // Value is a ValueCodec frame
+constexpr uint8_t kRecordTombstone = 0x02;      // Delete (set by scan() for older formats too)
+constexpr uint8_t kRecordContinued = 0x04;      // More of its WriteBatch follows (log only)
+constexpr uint8_t kRecordBlock = 0x80;          // A block, not a record (version 3)
+
+// Hint file header (on-disk format, version 2). Version 1 hint files have
+// no header and start directly with the first entry.
+struct HintFileHeader {
+    char magic[8];          // "BCSKHINT"
+    uint32_t version;       // 2
+    uint32_t entry_count;   // Number of entries that follow
+    uint64_t log_size;      // Bytes of the log file the entries describe
+    uint32_t body_crc;      // CRC-32 of every entry after the header
+    uint32_t header_crc;    // CRC-32 of the header fields above
+} __attribute__((packed));
+
+// Hint file entry (on-disk format, followed by key bytes). Version 1 and 2
+// entries end before flags, version 3 entries before overhead.
+struct HintEntryHeader {
+    uint32_t timestamp;
+    uint32_t key_size;
+    uint32_t value_size;
+    uint64_t value_pos;
+    uint8_t flags;
+    uint8_t overhead;       // IndexEntry::overhead
+} __attribute__((packed));
+
 // Hash index metadata (in-memory)
 struct IndexEntry {
     uint32_t file_id;       // Which log file contains this entry
+    uint8_t flags = 0;      // Record flags (kRecord*); fits in padding
+    uint8_t overhead = 0;   // Record bytes besides key and value; also padding
     uint64_t value_pos;     // Byte offset to value in file
     uint32_t value_size;    // Size of value for reading
     uint32_t timestamp;     // Timestamp of entry
     
+    // Bytes the record takes in its log file. A block's header is counted
+    // in the overhead of its first member.
+    uint64_t record_size(size_t key_size) const { return overhead + key_size + value_size; }
+    
     // Tombstone check: deleted entries have max values
     bool is_tombstone() const {
         return file_id == std::numeric_limits<uint32_t>::max() &&
@@ -34,6 +112,8 @@ struct IndexEntry {
     static IndexEntry create_tombstone(uint32_t ts) {
         return {
             std::numeric_limits<uint32_t>::max(),
+            0,
+            0,
             std::numeric_limits<uint64_t>::max(),
             std::numeric_limits<uint32_t>::max(),
             ts
@@ -41,14 +121,227 @@ struct IndexEntry {
     }
 };
 
+// How appends are made durable
+enum class SyncPolicy {
+    None,       // Leave writeback to the OS; sync() is the only barrier
+    Always,     // Sync after every write (one sync per group commit)
+    Interval    // Background flusher syncs every sync_interval_ms / sync_bytes
+};
+
+// In-memory keydir implementation
+enum class IndexType {
+    Map,        // std::unordered_map per shard
+    Compact,    // Open-addressing table with arena-stored keys (CompactKeyTable)
+    Hashed      // Key fingerprints only (FingerprintTable); keys are checked on disk
+};
+
+// Per-value compression of new records
+enum class Compression {
+    None,
+    LZ4         // LZ4 block format (in-tree codec)
+};
+
 // Configuration for Bitcask instance
 struct Config {
     std::string directory;              // Database directory path
     uint64_t max_file_size = 2ULL * 1024 * 1024 * 1024;  // 2GB default
+    size_t index_shards = 16;           // Independently locked keydir shards
+    IndexType index_type = IndexType::Map;
+    bool ordered_index = false;         // Keep a sorted key index for scan()/range()
+    bool mmap_immutable_files = false;  // Serve reads of old files from mmap
+    size_t max_open_files = 256;        // Immutable files holding a read fd (0 = no cap)
+    size_t cache_bytes = 0;             // Value cache budget (0 = no cache)
+    size_t cache_shards = 16;           // Independently locked cache shards
+    Compression compression = Compression::None;
+    size_t compression_min_size = 128;  // Store smaller values uncompressed
+    bool block_crc = true;              // One CRC per write's run of small records, not each
+    uint64_t max_group_commit_bytes = 4 * 1024 * 1024;  // Cap on one coalesced write
+    uint64_t multi_get_gap = 4096;      // multi_get reads through gaps up to this between values
+    bool metrics = true;                // Count and time operations for stats()
+    uint32_t metrics_sample_every = 8;  // Time one put/get/del per thread in this many (1 = all)
+    uint32_t stats_dump_interval_ms = 0;    // Write stats() periodically (0 = never)
+    std::string stats_dump_path;        // Where dumps are appended (empty = stderr)
+    bool stats_dump_json = false;       // Dump JSON lines instead of text
+    size_t async_threads = 4;           // Pool threads behind the *_async calls
+    uint32_t async_queue_depth = 128;   // io_uring entries for async reads (0 = pool only)
+    SyncPolicy sync_policy = SyncPolicy::None;
+    uint32_t sync_interval_ms = 1000;   // Interval policy: max time data stays unsynced
+    uint64_t sync_bytes = 0;            // Interval policy: also sync after this many bytes (0 = off)
+    bool sync_metadata = false;         // fsync() instead of fdatasync()
+    size_t recovery_threads = 0;        // Threads scanning files at open (0 = all cores)
+    bool background_compaction = false; // Compact fragmented files on a background thread
+    double compaction_min_dead_ratio = 0.5;      // File qualifies when this fraction is dead
+    uint64_t compaction_min_reclaim_bytes = 16 * 1024 * 1024;  // Skip rounds reclaiming less
+    size_t compaction_max_files = 8;    // Input files per round (inputs also capped at max_file_size live)
+    uint32_t compaction_interval_ms = 5000;      // Time between scheduler checks
     
     Config(const std::string& dir) : directory(dir) {}
 };
 
+// Space accounting for one log file
+struct FileStats {
+    uint32_t file_id = 0;
+    bool active = false;            // The file currently appended to
+    uint64_t total_bytes = 0;
+    uint64_t live_bytes = 0;        // Records the index still points at
+    uint64_t total_records = 0;     // Tombstones included
+    uint64_t live_keys = 0;
+    uint64_t bytes_read = 0;        // Value bytes read from it since open (cache hits excluded)
+    
+    uint64_t reclaimable_bytes() const {
+        return total_bytes > live_bytes ? total_bytes - live_bytes : 0;
+    }
+    double dead_ratio() const {
+        return total_bytes == 0 ? 0.0 : static_cast<double>(reclaimable_bytes()) / total_bytes;
+    }
+};
+
+// Value cache counters since open
+struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t inserts = 0;
+    uint64_t evictions = 0;
+    uint64_t bytes = 0;             // Charged against Config::cache_bytes
+    uint64_t entries = 0;
+    
+    double hit_rate() const {
+        return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / (hits + misses);
+    }
+};
+
+// Value compression counters since open
+struct CompressionStats {
+    uint64_t values_compressed = 0;     // Stored compressed
+    uint64_t values_raw = 0;            // Too small or compressed too poorly
+    uint64_t raw_bytes = 0;             // Of compressed values, before
+    uint64_t stored_bytes = 0;          // Of compressed values, after
+    uint64_t compress_ns = 0;           // Including attempts that were dropped
+    uint64_t values_decompressed = 0;
+    uint64_t decompress_ns = 0;
+    
+    double ratio() const {
+        return stored_bytes == 0 ? 0.0 : static_cast<double>(raw_bytes) / stored_bytes;
+    }
+    double compress_ns_per_op() const {
+        uint64_t ops = values_compressed + values_raw;
+        return ops == 0 ? 0.0 : static_cast<double>(compress_ns) / ops;
+    }
+    double decompress_ns_per_op() const {
+        return values_decompressed == 0 ? 0.0 : static_cast<double>(decompress_ns) / values_decompressed;
+    }
+};
+
+// Work done and throughput of a merge()
+struct MergeStats {
+    size_t input_files = 0;
+    uint64_t input_bytes = 0;
+    uint64_t records_scanned = 0;
+    size_t output_files = 0;
+    uint64_t output_bytes = 0;
+    uint64_t records_copied = 0;    // Live records carried over
+    double seconds = 0;
+    
+    double mb_per_sec() const { return seconds > 0 ? input_bytes / 1e6 / seconds : 0; }
+    double records_per_sec() const { return seconds > 0 ? records_scanned / seconds : 0; }
+};
+
+// Timing of the recovery performed when a database is opened
+struct RecoveryStats {
+    struct FileRecovery {
+        uint32_t file_id = 0;
+        uint64_t bytes = 0;         // Log file size
+        uint64_t entries = 0;       // Records (or hint entries) loaded
+        double seconds = 0;
+        bool from_hint = false;     // Loaded from a hint file instead of a scan
+    };
+    
+    std::vector<FileRecovery> files;   // In file-id order
+    uint64_t total_bytes = 0;
+    uint64_t total_entries = 0;
+    size_t threads = 0;
+    double seconds = 0;                // Wall time including the keydir merge
+};
+
+// Calls and latency of one kind of operation since open. Latency comes
+// from the calls that were timed (see Config::metrics_sample_every) and
+// goes in fixed log-scale buckets, four per power of two, so percentiles
+// are bucket upper bounds within 19% of the true value.
+struct OpStats {
+    static constexpr size_t kBuckets = 160;    // Up to 2^40 ns (about 18 minutes)
+    
+    uint64_t count = 0;
+    uint64_t failed = 0;            // Returned an error (including key not found)
+    uint64_t timed = 0;             // Calls in the histogram
+    uint64_t total_ns = 0;          // Over timed calls
+    uint64_t max_ns = 0;
+    std::array<uint64_t, kBuckets> buckets{};
+    
+    double mean_ns() const { return timed == 0 ? 0.0 : static_cast<double>(total_ns) / timed; }
+    
+    // Upper bound of the bucket holding the p-th percentile (0 if empty)
+    uint64_t percentile_ns(double p) const {
+        uint64_t target = static_cast<uint64_t>(p / 100 * timed);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += buckets[i];
+            if (seen > target) {
+                return bucket_upper_bound(i) < max_ns ? bucket_upper_bound(i) : max_ns;
+            }
+        }
+        return max_ns;
+    }
+    
+    static size_t bucket_for(uint64_t ns) {
+        if (ns < 4) {
+            return static_cast<size_t>(ns);
+        }
+        int msb = 63 - __builtin_clzll(ns);
+        size_t bucket = static_cast<size_t>(msb - 1) * 4 + ((ns >> (msb - 2)) & 3);
+        return bucket < kBuckets ? bucket : kBuckets - 1;
+    }
+    
+    static uint64_t bucket_upper_bound(size_t bucket) {
+        if (bucket < 4) {
+            return bucket;
+        }
+        int shift = static_cast<int>(bucket / 4) - 1;
+        return ((4 + bucket % 4 + 1) << shift) - 1;
+    }
+};
+
+// Snapshot of the engine's metrics (Bitcask::stats())
+struct Stats {
+    double uptime_seconds = 0;
+    
+    // Operation counters and latency; all zero unless Config::metrics is set
+    OpStats put;
+    OpStats get;                    // get(), get_view() and get_async()
+    OpStats del;
+    OpStats write;                  // write() batches
+    OpStats multi_get;              // One per call
+    OpStats merge;
+    OpStats compaction;             // Rounds that compacted files
+    OpStats recovery;               // One per file recovered at open
+    uint64_t bytes_written = 0;     // Record bytes appended by writers
+    uint64_t bytes_read = 0;        // Value bytes read from disk (cache hits excluded)
+    
+    // Keydir and files
+    uint64_t keys = 0;
+    uint64_t keydir_bytes = 0;      // Estimated index memory
+    uint64_t open_files = 0;        // Immutable files holding a read descriptor
+    std::vector<FileStats> files;   // Oldest first
+    
+    // Merge in progress, if any
+    bool merge_running = false;
+    uint64_t merge_bytes_done = 0;
+    uint64_t merge_bytes_total = 0;
+    
+    double recovery_seconds = 0;    // Wall time of the recovery done by open()
+    CacheStats cache;
+    CompressionStats compression;
+};
+
 // Tag type for error constructor disambiguation
 struct ErrorTag {};
 inline constexpr ErrorTag error_tag{};
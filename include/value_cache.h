@@ -0,0 +1,103 @@
+#ifndef BITCASK_VALUE_CACHE_H
+#define BITCASK_VALUE_CACHE_H
+
+#include "types.h"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace bitcask {
+
+// Read cache of values keyed by their location (file id, value offset).
+//
+// A record never changes once written, so entries need no invalidation: a
+// put or del moves the key to a new location and the old entry simply stops
+// being read and ages out. Each shard runs S3-FIFO: new values enter a
+// small FIFO, and only those read again before leaving it are promoted to
+// the main FIFO, so one-off reads can't flush the hot set. Hits take a
+// shared lock and bump a counter; only misses and evictions lock
+// exclusively. Thread-safe.
+class ValueCache {
+public:
+    ValueCache(size_t capacity_bytes, size_t num_shards = 16);
+    
+    // Copy a cached value into value; false on a miss
+    bool get(uint32_t file_id, uint64_t value_pos, std::string& value);
+    
+    // Cache a value read from disk
+    void insert(uint32_t file_id, uint64_t value_pos, const std::string& value);
+    
+    CacheStats stats() const;
+    
+private:
+    struct Key {
+        uint32_t file_id;
+        uint64_t value_pos;
+        
+        bool operator==(const Key& other) const {
+            return file_id == other.file_id && value_pos == other.value_pos;
+        }
+    };
+    
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            uint64_t h = key.value_pos * 0x9E3779B97F4A7C15ull ^ key.file_id;
+            return static_cast<size_t>(h ^ (h >> 29));
+        }
+    };
+    
+    struct Entry {
+        std::string value;
+        mutable std::atomic<uint8_t> freq{0};   // Reads since insert/last pass, capped at 3
+        uint64_t seq = 0;                       // Matches the live queue slot
+    };
+    
+    // Queue slots go stale when their entry moves or is evicted; seq tells
+    struct Slot {
+        Key key;
+        uint64_t seq;
+    };
+    
+    struct Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<Key, Entry, KeyHash> entries;
+        std::deque<Slot> small;
+        std::deque<Slot> main;
+        std::deque<uint64_t> ghost;             // Recently evicted from small
+        std::unordered_set<uint64_t> ghost_set;
+        size_t small_bytes = 0;
+        size_t main_bytes = 0;
+        uint64_t next_seq = 0;
+        
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+        std::atomic<uint64_t> inserts{0};
+        std::atomic<uint64_t> evictions{0};
+    };
+    
+    // Bytes charged per entry beyond the value (map node, queue slot)
+    static constexpr size_t kEntryOverhead = 96;
+    
+    size_t shard_capacity_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    
+    Shard& shard_for(const Key& key) const {
+        // High bits, so shard choice is independent of bucket choice
+        return *shards_[(KeyHash{}(key) >> 32) % shards_.size()];
+    }
+    
+    // Evict until the shard fits its budget (caller holds the shard exclusively)
+    void evict(Shard& shard);
+    void evict_small(Shard& shard);
+    void evict_main(Shard& shard);
+};
+
+} // namespace bitcask
+
+#endif // BITCASK_VALUE_CACHE_H
@@ -0,0 +1,46 @@
+#ifndef BITCASK_VALUE_CODEC_H
+#define BITCASK_VALUE_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace bitcask {
+
+// LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md),
+// implemented in-tree so the store has no external dependencies. Output is
+// readable by any LZ4 block decoder and vice versa.
+namespace lz4 {
+
+// Worst-case compressed size of n bytes (incompressible input)
+constexpr size_t max_compressed_size(size_t n) { return n + n / 255 + 16; }
+
+// Compress n bytes into dst (at least max_compressed_size(n) bytes),
+// returning the compressed length
+size_t compress(const char* src, size_t n, char* dst);
+
+// Decompress a block into exactly raw_size bytes at dst. Returns false if
+// the block is malformed or doesn't expand to raw_size; never reads or
+// writes out of bounds.
+bool decompress(const char* src, size_t n, char* dst, size_t raw_size);
+
+} // namespace lz4
+
+// Stored form of a compressed value (records flagged kRecordCompressed):
+// the raw size as a 4-byte little-endian integer, then one LZ4 block.
+class ValueCodec {
+public:
+    static constexpr size_t kFrameHeaderSize = 4;
+    
+    // Compress value into frame. Returns false, leaving frame unspecified,
+    // if that wouldn't save at least an eighth of the value.
+    static bool compress(std::string_view value, std::string& frame);
+    
+    // Expand a frame into value; false if the frame is corrupt
+    static bool decompress(std::string_view frame, std::string& value);
+};
+
+} // namespace bitcask
+
+#endif // BITCASK_VALUE_CODEC_H
@@ -0,0 +1,56 @@
+#ifndef BITCASK_WRITE_BATCH_H
+#define BITCASK_WRITE_BATCH_H
+
+#include <string>
+#include <vector>
+
+namespace bitcask {
+
+// A group of puts and deletes applied together by Bitcask::write().
+//
+// The whole batch is encoded into one buffer, appended to the active file
+// with a single write and indexed in one pass; readers never observe a
+// partially applied batch, nor does recovery after a crash (see
+// Bitcask::write()).
+class WriteBatch {
+public:
+    enum class OpType { Put, Delete };
+    
+    struct Op {
+        OpType type;
+        std::string key;
+        std::string value;
+    };
+    
+    // Queue a put of key -> value
+    void put(const std::string& key, const std::string& value) {
+        ops_.push_back({OpType::Put, key, value});
+        byte_size_ += key.size() + value.size();
+    }
+    
+    // Queue a delete (tombstone) of key
+    void del(const std::string& key) {
+        ops_.push_back({OpType::Delete, key, std::string()});
+        byte_size_ += key.size();
+    }
+    
+    void clear() {
+        ops_.clear();
+        byte_size_ = 0;
+    }
+    
+    const std::vector<Op>& ops() const { return ops_; }
+    size_t count() const { return ops_.size(); }
+    bool empty() const { return ops_.empty(); }
+    
+    // Total key and value bytes queued (excluding record headers)
+    size_t byte_size() const { return byte_size_; }
+    
+private:
+    std::vector<Op> ops_;
+    size_t byte_size_ = 0;
+};
+
+} // namespace bitcask
+
+#endif // BITCASK_WRITE_BATCH_H
@@ -0,0 +1,460 @@
+#include "../include/async_io.h"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+namespace bitcask {
+
+namespace {
+
+int io_uring_setup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                                      nullptr, 0));
+}
+
+// Largest single read; longer values take more than one
+constexpr size_t kMaxReadChunk = 1u << 30;
+
+// user_data of cancel requests, whose completions carry no op
+constexpr uint64_t kCancelTag = 1;
+
+} // namespace
+
+AsyncIO::AsyncIO(size_t threads, unsigned queue_depth) {
+    if (queue_depth > 0 && setup_ring(queue_depth)) {
+        reaper_ = std::thread(&AsyncIO::reap_loop, this);
+    }
+    
+    threads = std::max<size_t>(1, threads);
+    for (size_t i = 0; i < threads; ++i) {
+        workers_.emplace_back(&AsyncIO::worker_loop, this);
+    }
+}
+
+AsyncIO::~AsyncIO() {
+    // Ring reads may fall back to the pool, never the other way round, so
+    // drain the ring first
+    if (ring_fd_.load() >= 0) {
+        {
+            std::unique_lock<std::mutex> lock(submit_mutex_);
+            idle_cv_.wait(lock, [&] { return in_flight_ == 0 && backlog_.empty(); });
+            stopping_.store(true, std::memory_order_relaxed);
+            if (!ring_failed_.load(std::memory_order_relaxed)) {
+                prepare_sqe(IORING_OP_NOP, nullptr);  // Wakes the reaper to exit
+                enter_locked(1);
+            }
+        }
+        reaper_.join();
+        
+        // Reads racing with the destructor see the ring gone and use the pool
+        std::lock_guard<std::mutex> lock(submit_mutex_);
+        teardown_ring();
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        stop_ = true;
+    }
+    pool_cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void AsyncIO::run(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    pool_cv_.notify_one();
+}
+
+void AsyncIO::worker_loop() {
+    std::unique_lock<std::mutex> lock(pool_mutex_);
+    while (true) {
+        pool_cv_.wait(lock, [&] { return stop_ || !tasks_.empty(); });
+        if (tasks_.empty()) {
+            return;  // Stopped and drained
+        }
+        
+        auto task = std::move(tasks_.front());
+        tasks_.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
+
+void AsyncIO::read(ReadRequest request) {
+    std::vector<ReadRequest> requests;
+    requests.push_back(std::move(request));
+    read_batch(std::move(requests));
+}
+
+void AsyncIO::read_batch(std::vector<ReadRequest> requests) {
+    std::vector<ReadOp*> ops;
+    for (auto& request : requests) {
+        auto* op = new ReadOp{std::move(request.handle), request.offset, request.buffer,
+                              request.length, 0, std::move(request.done)};
+        if (read_if_cached(op)) {
+            Callback callback = std::move(op->callback);
+            delete op;
+            callback(Result<void>::Ok());
+        } else {
+            ops.push_back(op);
+        }
+    }
+    
+    if (!ops.empty()) {
+        std::lock_guard<std::mutex> lock(submit_mutex_);
+        submit_locked(ops);
+    }
+}
+
+bool AsyncIO::read_if_cached(ReadOp* op) {
+    while (op->done < op->length && nowait_.load(std::memory_order_relaxed)) {
+        iovec iov{op->buffer + op->done, std::min(op->length - op->done, kMaxReadChunk)};
+        ssize_t n = ::preadv2(op->handle->fd(), &iov, 1,
+                              static_cast<off_t>(op->offset + op->done), RWF_NOWAIT);
+        if (n > 0) {
+            op->done += static_cast<size_t>(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EOPNOTSUPP || errno == EINVAL || errno == ENOSYS)) {
+            nowait_.store(false, std::memory_order_relaxed);
+        }
+        break;  // Not cached (or end of file, which the blocking read reports)
+    }
+    return op->done == op->length;
+}
+
+void AsyncIO::read_on_pool(ReadOp* op) {
+    Result<void> result = Result<void>::Ok();
+    while (op->done < op->length) {
+        ssize_t n = ::pread(op->handle->fd(), op->buffer + op->done,
+                            std::min(op->length - op->done, kMaxReadChunk),
+                            static_cast<off_t>(op->offset + op->done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            result = Result<void>::Err(n == 0 ? "Unexpected end of file reading value"
+                                              : "Failed to read value from file");
+            break;
+        }
+        op->done += static_cast<size_t>(n);
+    }
+    
+    Callback callback = std::move(op->callback);
+    delete op;
+    callback(result);
+}
+
+bool AsyncIO::setup_ring(unsigned entries) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int fd = io_uring_setup(entries, &params);
+    if (fd < 0) {
+        return false;
+    }
+    ring_fd_ = fd;
+    
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    
+    sq_ring_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+        sq_ring_ = nullptr;
+        teardown_ring();
+        return false;
+    }
+    
+    cq_ring_ = single_mmap ? sq_ring_
+                           : ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+        cq_ring_ = nullptr;
+        teardown_ring();
+        return false;
+    }
+    
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+        sqes_ = nullptr;
+        teardown_ring();
+        return false;
+    }
+    
+    char* sq = static_cast<char*>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    
+    char* cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = cq + params.cq_off.cqes;
+    
+    // The completion ring holds at least twice this many, so capping
+    // in-flight reads here means it can never overflow
+    sq_entries_ = params.sq_entries;
+    return true;
+}
+
+void AsyncIO::teardown_ring() {
+    if (sqes_) {
+        ::munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ && cq_ring_ != sq_ring_) {
+        ::munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_) {
+        ::munmap(sq_ring_, sq_ring_size_);
+    }
+    sqes_ = cq_ring_ = sq_ring_ = nullptr;
+    
+    ::close(ring_fd_);
+    ring_fd_ = -1;
+}
+
+void AsyncIO::submit_locked(const std::vector<ReadOp*>& ops) {
+    if (ring_fd_.load(std::memory_order_relaxed) < 0 ||
+        ring_failed_.load(std::memory_order_relaxed)) {
+        for (ReadOp* op : ops) {
+            run([this, op] { read_on_pool(op); });
+        }
+        return;
+    }
+    
+    std::vector<ReadOp*> queued;
+    for (ReadOp* op : ops) {
+        if (in_flight_ + queued.size() >= sq_entries_) {
+            backlog_.push_back(op);
+        } else {
+            prepare_sqe(IORING_OP_READ, op);
+            queued.push_back(op);
+        }
+    }
+    
+    size_t submitted = enter_locked(static_cast<unsigned>(queued.size()));
+    in_flight_ += submitted;
+    ring_ops_.insert(queued.begin(), queued.begin() + submitted);
+    for (size_t i = submitted; i < queued.size(); ++i) {
+        ReadOp* op = queued[i];
+        run([this, op] { read_on_pool(op); });
+    }
+}
+
+void AsyncIO::prepare_sqe(uint8_t opcode, ReadOp* op) {
+    // Only submitters write the tail, and every earlier entry was consumed
+    // or taken back, so the slot at the tail is free
+    unsigned tail = *sq_tail_;
+    unsigned index = tail & *sq_mask_;
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(sqes_) + index;
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    if (opcode == IORING_OP_ASYNC_CANCEL) {
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<uint64_t>(op);  // user_data of the read
+        sqe->user_data = kCancelTag;
+    } else {
+        if (op) {
+            sqe->fd = op->handle->fd();
+            sqe->off = op->offset + op->done;
+            sqe->addr = reinterpret_cast<uint64_t>(op->buffer + op->done);
+            sqe->len = static_cast<uint32_t>(std::min(op->length - op->done, kMaxReadChunk));
+        }
+        sqe->user_data = reinterpret_cast<uint64_t>(op);
+    }
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+}
+
+size_t AsyncIO::enter_locked(unsigned count) {
+    if (count == 0) {
+        return 0;
+    }
+    
+    int rc;
+    do {
+        rc = io_uring_enter(ring_fd_, count, 0, 0);
+    } while (rc < 0 && errno == EINTR);
+    
+    // Without SQPOLL the kernel only consumes entries inside enter, so any
+    // it left behind (the last ones) can be taken back
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    unsigned left = *sq_tail_ - head;
+    if (left > 0) {
+        __atomic_store_n(sq_tail_, head, __ATOMIC_RELEASE);
+    }
+    return count - left;
+}
+
+void AsyncIO::complete(ReadOp* op, int64_t result) {
+    if (result > 0) {
+        op->done += static_cast<size_t>(result);
+        if (op->done < op->length) {
+            std::lock_guard<std::mutex> lock(submit_mutex_);
+            submit_locked({op});  // Short read: continue where it stopped
+            return;
+        }
+    } else if (result == -EINTR || result == -EAGAIN || result == -ECANCELED) {
+        std::lock_guard<std::mutex> lock(submit_mutex_);
+        submit_locked({op});  // On the pool once the ring is abandoned
+        return;
+    } else if (result == -EINVAL || result == -EOPNOTSUPP) {
+        // Kernel predates IORING_OP_READ
+        run([this, op] { read_on_pool(op); });
+        return;
+    }
+    
+    Result<void> status = Result<void>::Ok();
+    if (result == 0) {
+        status = Result<void>::Err("Unexpected end of file reading value");
+    } else if (result < 0) {
+        status = Result<void>::Err("Failed to read value from file");
+    }
+    
+    Callback callback = std::move(op->callback);
+    delete op;
+    callback(status);
+}
+
+void AsyncIO::reap_loop() {
+    while (true) {
+        int rc = io_uring_enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS);
+        if (rc < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            abandon_ring();
+            return;
+        }
+        if (reap_completions()) {
+            return;
+        }
+    }
+}
+
+bool AsyncIO::reap_completions() {
+    std::vector<std::pair<ReadOp*, int32_t>> completed;
+    bool stop = false;
+    
+    // Only this thread advances the head
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        const io_uring_cqe* cqe = static_cast<const io_uring_cqe*>(cqes_) + (head & *cq_mask_);
+        auto* op = reinterpret_cast<ReadOp*>(cqe->user_data);
+        if (cqe->user_data == kCancelTag) {
+            continue;  // The cancelled read posts its own completion
+        }
+        if (op) {
+            completed.emplace_back(op, cqe->res);
+        } else {
+            stop = stopping_.load(std::memory_order_relaxed);
+        }
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    
+    if (!completed.empty()) {
+        std::lock_guard<std::mutex> lock(submit_mutex_);
+        for (const auto& completion : completed) {
+            ring_ops_.erase(completion.first);
+        }
+    }
+    
+    // Run callbacks before releasing their slots, so a resubmitted short
+    // read is counted before the destructor can see the ring idle
+    for (const auto& [op, res] : completed) {
+        complete(op, res);
+    }
+    
+    std::lock_guard<std::mutex> lock(submit_mutex_);
+    in_flight_ -= completed.size();
+    if (!backlog_.empty() && in_flight_ < sq_entries_) {
+        size_t count = std::min<size_t>(backlog_.size(), sq_entries_ - in_flight_);
+        std::vector<ReadOp*> refill(backlog_.begin(), backlog_.begin() + count);
+        backlog_.erase(backlog_.begin(), backlog_.begin() + count);
+        submit_locked(refill);
+    }
+    if (in_flight_ == 0 && backlog_.empty()) {
+        idle_cv_.notify_all();
+    }
+    return stop;
+}
+
+void AsyncIO::abandon_ring() {
+    {
+        std::lock_guard<std::mutex> lock(submit_mutex_);
+        ring_failed_.store(true, std::memory_order_relaxed);
+        std::vector<ReadOp*> waiting(backlog_.begin(), backlog_.end());
+        backlog_.clear();
+        submit_locked(waiting);  // To the pool
+    }
+    
+    // Reads already on the ring still post their completions to it, so
+    // keep collecting those for a while; complete() sends what is left of
+    // them to the pool. True once none is left on the ring.
+    auto collect = [&] {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        while (true) {
+            reap_completions();
+            {
+                std::lock_guard<std::mutex> lock(submit_mutex_);
+                if (in_flight_ == 0) {
+                    return true;
+                }
+            }
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    };
+    if (collect()) {
+        return;
+    }
+    
+    // The kernel may still write into a straggler's buffer until it posts
+    // its completion, so ask it to cancel them and collect again
+    {
+        std::lock_guard<std::mutex> lock(submit_mutex_);
+        for (ReadOp* op : ring_ops_) {
+            prepare_sqe(IORING_OP_ASYNC_CANCEL, op);
+        }
+        enter_locked(static_cast<unsigned>(ring_ops_.size()));
+    }
+    if (collect()) {
+        return;
+    }
+    
+    // Whatever the kernel still holds is leaked on purpose: freeing it, or
+    // handing its buffer back through the callback, could let a late read
+    // land in reused memory. Those callers never hear back.
+    std::lock_guard<std::mutex> lock(submit_mutex_);
+    in_flight_ -= ring_ops_.size();
+    ring_ops_.clear();
+    idle_cv_.notify_all();
+}
+
+} // namespace bitcask
@@ -1,22 +1,172 @@
 #include "../include/bitcask.h"
+#include "../include/value_codec.h"
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <ctime>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <fstream>
 #include <sstream>
 #include <map>
+#include <unordered_map>
 
 namespace bitcask {
 
+namespace {
+
+// Appends records copied verbatim (CRC included) from other log files;
+// records from files in an older format, block members and records that
+// belong in a block are re-encoded in the output's format. Records are
+// buffered so runs of live records go out in large writes.
+class RecordCopier {
+public:
+    RecordCopier(LogFile& output, bool blocks)
+        : output_(output), written_(output.size()), encoder_(pending_, blocks) {}
+    
+    // Queue a record, returning the index entry of its copy
+    Result<IndexEntry> add(const LogFile::RecordView& record) {
+        // A copy stands on its own, whatever batch the record was part of
+        IndexEntry entry;
+        entry.file_id = output_.id();
+        entry.flags = record.flags & ~kRecordContinued;
+        entry.value_size = record.value.size();
+        entry.timestamp = record.timestamp;
+        
+        size_t bytes;
+        if (record.format == output_.format() && !record.in_block &&
+            !(record.flags & kRecordContinued) && !encoder_.blocks(record.key.size(), record.value.size())) {
+            encoder_.finish();
+            entry.value_pos = size() + (record.value_pos - record.offset);
+            bytes = record.raw.size();
+            pending_.append(record.raw);
+        } else {
+            auto encoded = encoder_.add(record.timestamp, record.key, record.value, entry.flags);
+            entry.value_pos = written_ + encoded.value_offset;
+            bytes = encoded.size;
+        }
+        entry.overhead = static_cast<uint8_t>(bytes - record.key.size() - record.value.size());
+        
+        if (pending_.size() >= LogFile::kScanChunkSize) {
+            auto flush_result = flush();
+            if (!flush_result.ok()) {
+                return Result<IndexEntry>::Err(flush_result.err());
+            }
+        }
+        return Result<IndexEntry>::Ok(entry);
+    }
+    
+    Result<void> flush() {
+        encoder_.finish();
+        if (pending_.empty()) {
+            return Result<void>::Ok();
+        }
+        auto append_result = output_.append_raw(pending_.data(), pending_.size());
+        if (!append_result.ok()) {
+            return Result<void>::Err(append_result.err());
+        }
+        written_ += pending_.size();
+        pending_.clear();
+        return Result<void>::Ok();
+    }
+    
+    // Output size including queued records
+    uint64_t size() const { return written_ + pending_.size(); }
+    
+    // True until a record is queued
+    bool empty() const { return size() <= output_.data_start(); }
+
+private:
+    LogFile& output_;
+    uint64_t written_;
+    std::string pending_;
+    RecordEncoder encoder_;             // Writes into pending_
+};
+
+// A value multi_get has to read from disk
+struct PendingRead {
+    size_t slot;                        // Position in the request
+    IndexEntry entry;
+    std::shared_ptr<LogFile> file;
+};
+
+// Values of one file close enough together to fetch with a single read:
+// reads [first, last) of the sorted pending reads
+struct ReadRun {
+    std::shared_ptr<LogFile> file;
+    uint64_t start;
+    uint64_t end;
+    size_t first;
+    size_t last;
+    std::string buffer;
+    Result<void> result;
+};
+
+} // namespace
+
 Bitcask::Bitcask(const Config& config) 
-    : config_(config), next_file_id_(0) {
+    : config_(config),
+      index_(config.index_shards, config.index_type,
+             [this](std::string_view key, const IndexEntry& entry) {
+                 return record_has_key(key, entry);
+             }),
+      fd_cache_(config.max_open_files), next_file_id_(0) {
+    if (config.ordered_index) {
+        ordered_ = std::make_unique<OrderedIndex>();
+    }
+    if (config.cache_bytes > 0) {
+        cache_ = std::make_unique<ValueCache>(config.cache_bytes, config.cache_shards);
+    }
+    if (config.metrics) {
+        metrics_ = std::make_unique<Metrics>(config.metrics_sample_every);
+    }
 }
 
 Bitcask::~Bitcask() {
+    // Outstanding async calls still use the database
+    async_.reset();
+    
+    if (stats_dumper_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(stats_dumper_mutex_);
+            stop_stats_dumper_ = true;
+        }
+        stats_dumper_cv_.notify_one();
+        stats_dumper_.join();
+    }
+    
+    if (compactor_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(compactor_mutex_);
+            stop_compactor_ = true;
+        }
+        compactor_cv_.notify_one();
+        compactor_.join();
+    }
+    
+    if (flusher_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(flusher_mutex_);
+            stop_flusher_ = true;
+        }
+        flusher_cv_.notify_one();
+        flusher_.join();
+    }
+    
+    // Don't drop data the policy promised to sync
+    if (config_.sync_policy != SyncPolicy::None && active_file_) {
+        std::lock_guard<std::mutex> sync_lock(sync_mutex_);
+        sync_active_file();
+    }
+    
     // Ensure all files are closed
+    files_.clear();
     active_file_.reset();
     old_files_.clear();
 }
@@ -33,6 +183,10 @@ Result<std::unique_ptr<Bitcask>> Bitcask::open(const Config& config) {
 }
 
 Result<void> Bitcask::initialize() {
+    if (config_.ordered_index && config_.index_type == IndexType::Hashed) {
+        return Result<void>::Err("The ordered index needs keys, which IndexType::Hashed does not keep");
+    }
+    
     // Create directory if it doesn't exist
     struct stat st;
     if (stat(config_.directory.c_str(), &st) != 0) {
@@ -59,10 +213,120 @@ Result<void> Bitcask::initialize() {
         }
     }
     
+    if (config_.sync_policy == SyncPolicy::Interval) {
+        flusher_ = std::thread(&Bitcask::flusher_loop, this);
+    }
+    
+    if (config_.background_compaction) {
+        compactor_ = std::thread(&Bitcask::compactor_loop, this);
+    }
+    
+    if (metrics_) {
+        for (const auto& file : recovery_stats_.files) {
+            metrics_->record(Metrics::Op::Recovery, static_cast<uint64_t>(file.seconds * 1e9), true);
+        }
+    }
+    if (config_.stats_dump_interval_ms > 0) {
+        stats_dumper_ = std::thread(&Bitcask::stats_dumper_loop, this);
+    }
+    
     return Result<void>::Ok();
 }
 
+Bitcask::PartialKeydir Bitcask::recover_file(uint32_t file_id, bool is_last) const {
+    PartialKeydir partial;
+    partial.by_shard.resize(index_.shard_count());
+    partial.stats.file_id = file_id;
+    
+    auto start = std::chrono::steady_clock::now();
+    
+    // The last file is reopened as writable once recovery is done
+    partial.file = is_last
+        ? std::make_unique<LogFile>(file_id, config_.directory, true)
+        : open_immutable_file(file_id);
+    partial.stats.bytes = partial.file->size();
+    
+    auto add = [&](std::string key, const IndexEntry& entry) {
+        size_t shard = index_.shard_of(key);
+        partial.by_shard[shard].insert_or_assign(std::move(key), entry);
+        partial.stats.entries++;
+    };
+    
+    // Try to load from hint file first
+    uint64_t scan_from = 0;
+    auto hint_result = HintFile::load(
+        HintFile::path_for(config_.directory, file_id), file_id, partial.stats.bytes,
+        partial.file->format(),
+        [&](std::string_view key, const IndexEntry& entry) { add(std::string(key), entry); },
+        scan_from);
+    partial.stats.from_hint = hint_result.ok() && hint_result.value;
+    if (!partial.stats.from_hint) {
+        scan_from = 0;
+    }
+    
+    // Stream the part of the log file the hint doesn't cover (all of it
+    // without a usable hint). Records of a batch are held back until its
+    // last one, so a batch a crash cut short is dropped whole; it starts
+    // on a unit boundary (see apply_batches()).
+    std::vector<std::pair<std::string, IndexEntry>> batch;
+    uint64_t batch_start = 0;
+    auto scan_result = partial.file->scan([&](const LogFile::RecordView& record) {
+        IndexEntry idx_entry;
+        if (record.flags & kRecordTombstone) {
+            idx_entry = IndexEntry::create_tombstone(record.timestamp);  // Written by del()
+        } else {
+            idx_entry.file_id = file_id;
+            idx_entry.flags = record.flags & ~kRecordContinued;
+            idx_entry.overhead = static_cast<uint8_t>(record.size - record.key.size() -
+                                                      record.value.size());
+            idx_entry.value_pos = record.value_pos;
+            idx_entry.value_size = record.value.size();
+            idx_entry.timestamp = record.timestamp;
+        }
+        
+        if (record.flags & kRecordContinued) {
+            if (batch.empty()) {
+                batch_start = record.offset + record.raw.size() - record.size;
+            }
+            batch.emplace_back(std::string(record.key), idx_entry);
+            return true;
+        }
+        for (auto& [key, entry] : batch) {
+            add(std::move(key), entry);
+        }
+        batch.clear();
+        add(std::string(record.key), idx_entry);
+        return true;
+    }, scan_from);
+    
+    if (!scan_result.ok()) {
+        partial.error = "Failed to read log file: " + scan_result.err();
+        return partial;
+    }
+    partial.valid_bytes = batch.empty() ? scan_result.value : batch_start;
+    
+    // Scans stop at the first unit that fails its checks. Only a torn
+    // append may be cut off: past corruption there are acknowledged writes.
+    if (scan_result.value < partial.stats.bytes) {
+        auto torn = partial.file->torn_at(scan_result.value);
+        if (!torn.ok()) {
+            partial.error = "Failed to read log file: " + torn.err();
+            return partial;
+        }
+        if (!torn.value) {
+            partial.error = "Corrupt record in cask." + std::to_string(file_id) +
+                            " at offset " + std::to_string(scan_result.value);
+            return partial;
+        }
+    }
+    
+    partial.stats.seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    return partial;
+}
+
 Result<void> Bitcask::load_existing_files() {
+    auto start = std::chrono::steady_clock::now();
     auto file_ids = get_log_file_ids();
     
     if (file_ids.empty()) {
@@ -72,56 +336,113 @@ Result<void> Bitcask::load_existing_files() {
     // Sort file IDs to process in order
     std::sort(file_ids.begin(), file_ids.end());
     
-    for (size_t i = 0; i < file_ids.size(); ++i) {
-        uint32_t file_id = file_ids[i];
-        bool is_last = (i == file_ids.size() - 1);
-        
-        // Try to load from hint file first
-        auto hint_result = read_hint_file(file_id);
-        if (hint_result.ok() && hint_result.value) {
-            // Successfully loaded from hint file
-            if (!is_last) {
-                old_files_.push_back(
-                    std::make_unique<LogFile>(file_id, config_.directory, true)
-                );
-            } else {
-                active_file_ = std::make_unique<LogFile>(file_id, config_.directory, false);
-            }
-            continue;
+    size_t num_threads = config_.recovery_threads;
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    num_threads = std::min(num_threads, file_ids.size());
+    
+    // Scan files (or load their hints) in parallel into per-file partials
+    std::vector<PartialKeydir> partials(file_ids.size());
+    std::atomic<size_t> next_file{0};
+    auto scan_worker = [&] {
+        for (size_t i = next_file++; i < file_ids.size(); i = next_file++) {
+            partials[i] = recover_file(file_ids[i], i == file_ids.size() - 1);
         }
-        
-        // Load from log file directly
-        auto log_file = std::make_unique<LogFile>(file_id, config_.directory, true);
-        auto entries_result = log_file->read_all_entries();
-        
-        if (!entries_result.ok()) {
-            return Result<void>::Err("Failed to read log file: " + entries_result.err());
+    };
+    
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < num_threads; ++t) {
+        workers.emplace_back(scan_worker);
+    }
+    scan_worker();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+    
+    for (const auto& partial : partials) {
+        if (!partial.error.empty()) {
+            return Result<void>::Err(partial.error);
         }
-        
-        // Rebuild index from entries
-        for (const auto& entry : entries_result.value) {
-            IndexEntry idx_entry;
-            idx_entry.file_id = file_id;
-            idx_entry.value_pos = entry.value_pos;
-            idx_entry.value_size = entry.value_size;
-            idx_entry.timestamp = entry.timestamp;
-            
-            index_.put(entry.key, idx_entry);
+    }
+    
+    // Merge partials in file-id order so the last writer wins. Shards are
+    // disjoint, so each thread owns a subset of shards outright.
+    size_t shard_count = index_.shard_count();
+    auto merge_worker = [&](size_t first) {
+        for (size_t shard = first; shard < shard_count; shard += num_threads) {
+            for (auto& partial : partials) {
+                index_.load_shard(shard, std::move(partial.by_shard[shard]));
+            }
         }
+    };
+    for (size_t t = 1; t < num_threads; ++t) {
+        workers.emplace_back(merge_worker, t);
+    }
+    merge_worker(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    
+    if (ordered_) {
+        ordered_->build(index_.keys());
+    }
+    
+    // Install files; the last one becomes active
+    for (size_t i = 0; i < partials.size(); ++i) {
+        recovery_stats_.files.push_back(partials[i].stats);
+        recovery_stats_.total_bytes += partials[i].stats.bytes;
+        recovery_stats_.total_entries += partials[i].stats.entries;
         
-        // Last file becomes active
-        if (is_last) {
-            // Reopen as writable
-            log_file.reset();
-            active_file_ = std::make_unique<LogFile>(file_id, config_.directory, false);
+        if (i + 1 < partials.size()) {
+            old_files_.push_back(std::move(partials[i].file));
+            old_files_.back()->add_records(partials[i].stats.entries);
+            files_.insert(old_files_.back());
         } else {
-            old_files_.push_back(std::move(log_file));
+            // Drop a torn tail so new appends aren't stranded behind it
+            if (partials[i].valid_bytes < partials[i].stats.bytes) {
+                auto truncate_result = partials[i].file->truncate(partials[i].valid_bytes);
+                if (!truncate_result.ok()) {
+                    return truncate_result;
+                }
+            }
+            
+            // Appends are always in the current format, so a last file in
+            // an older one is kept read-only and initialize() starts a new
+            // active file
+            if (partials[i].file->format() < LogFile::kFormatVersion &&
+                partials[i].valid_bytes > 0) {
+                partials[i].file.reset();
+                old_files_.push_back(open_immutable_file(file_ids[i]));
+                old_files_.back()->add_records(partials[i].stats.entries);
+                files_.insert(old_files_.back());
+                continue;
+            }
+            
+            // Reopen as writable
+            partials[i].file.reset();
+            active_file_ = std::make_shared<LogFile>(file_ids[i], config_.directory, false);
+            active_file_->add_records(partials[i].stats.entries);
+            files_.insert(active_file_);
         }
     }
     
-    if (!file_ids.empty()) {
-        next_file_id_ = file_ids.back() + 1;
-    }
+    // Live bytes per file, from what the index ended up pointing at
+    index_.for_each([&](std::string_view key, const IndexEntry& entry) {
+        if (!entry.is_tombstone()) {
+            if (auto file = files_.find(entry.file_id)) {
+                file->add_live(entry.record_size(key.size()), 1);
+            }
+        }
+    });
+    index_.seal();
+    
+    next_file_id_ = file_ids.back() + 1;
+    
+    recovery_stats_.threads = num_threads;
+    recovery_stats_.seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
     
     return Result<void>::Ok();
 }
@@ -154,120 +475,1035 @@ std::vector<uint32_t> Bitcask::get_log_file_ids() const {
 }
 
 Result<void> Bitcask::rotate_active_file() {
-    if (active_file_) {
-        // Move current active to old files
-        uint32_t old_id = active_file_->id();
-        active_file_->close();
-        old_files_.push_back(
-            std::make_unique<LogFile>(old_id, config_.directory, true)
-        );
+    std::lock_guard<std::mutex> sync_lock(sync_mutex_);
+    
+    // Settle the outgoing file's durability before it becomes immutable
+    bool outgoing_empty = active_file_ && active_file_->empty();
+    if (active_file_ && !outgoing_empty) {
+        if (config_.sync_policy != SyncPolicy::None) {
+            auto sync_result = sync_active_file();
+            if (!sync_result.ok()) {
+                return sync_result;
+            }
+        } else {
+            unsynced_file_ids_.push_back(active_file_->id());
+        }
     }
     
-    // Create new active file
-    active_file_ = std::make_unique<LogFile>(next_file_id_++, config_.directory, false);
+    {
+        std::unique_lock<std::shared_mutex> files_lock(files_mutex_);
+        
+        if (outgoing_empty) {
+            // Nothing was written (e.g. rotated for a compaction round);
+            // drop the file rather than keep an empty immutable one
+            files_.erase(active_file_->id());
+            std::string path = config_.directory + "/cask." + std::to_string(active_file_->id());
+            remove(path.c_str());
+        } else if (active_file_) {
+            // Reopen the current active file as immutable. Readers still
+            // holding the writable handle finish on it; it closes with them.
+            std::shared_ptr<LogFile> immutable = open_immutable_file(active_file_->id());
+            immutable->add_records(active_file_->record_count());
+            immutable->add_live(active_file_->live_bytes() - active_file_->data_start(),
+                                active_file_->live_keys());
+            install_immutable_file(std::move(immutable));
+        }
+        
+        // Create new active file
+        active_file_ = std::make_shared<LogFile>(next_file_id_++, config_.directory, false);
+        files_.insert(active_file_);
+    }
+    
+    if (config_.sync_policy != SyncPolicy::None) {
+        sync_directory();
+    }
     
     return Result<void>::Ok();
 }
 
+Result<void> Bitcask::sync_active_file() {
+    unsynced_bytes_.store(0, std::memory_order_relaxed);
+    return active_file_->sync(config_.sync_metadata);
+}
+
+void Bitcask::sync_directory() const {
+    int dir_fd = ::open(config_.directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        ::fsync(dir_fd);
+        ::close(dir_fd);
+    }
+}
+
+void Bitcask::flusher_loop() {
+    auto interval = std::chrono::milliseconds(config_.sync_interval_ms);
+    std::unique_lock<std::mutex> lock(flusher_mutex_);
+    
+    while (!stop_flusher_) {
+        flusher_cv_.wait_for(lock, interval, [&] {
+            return stop_flusher_ ||
+                   (config_.sync_bytes > 0 &&
+                    unsynced_bytes_.load(std::memory_order_relaxed) >= config_.sync_bytes);
+        });
+        
+        if (unsynced_bytes_.load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+        
+        // Sync without holding flusher_mutex_ so writers can still signal us
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> sync_lock(sync_mutex_);
+            sync_active_file();
+        }
+        lock.lock();
+    }
+}
+
+void Bitcask::stats_dumper_loop() {
+    auto interval = std::chrono::milliseconds(config_.stats_dump_interval_ms);
+    std::unique_lock<std::mutex> lock(stats_dumper_mutex_);
+    
+    while (!stats_dumper_cv_.wait_for(lock, interval, [&] { return stop_stats_dumper_; })) {
+        lock.unlock();
+        std::string report = format_stats(stats(), config_.stats_dump_json) + "\n";
+        if (config_.stats_dump_path.empty()) {
+            std::cerr << report;
+        } else {
+            std::ofstream(config_.stats_dump_path, std::ios::app) << report;
+        }
+        lock.lock();
+    }
+}
+
 uint32_t Bitcask::get_timestamp() const {
     return static_cast<uint32_t>(std::time(nullptr));
 }
 
 Result<void> Bitcask::put(const std::string& key, const std::string& value) {
+    auto start = op_start(Metrics::Op::Put);
+    WriteBatch batch;
+    batch.put(key, value);
+    auto result = commit(batch);
+    op_done(Metrics::Op::Put, start, result.ok());
+    return result;
+}
+
+Result<void> Bitcask::write(const WriteBatch& batch) {
+    auto start = op_start(Metrics::Op::Write);
+    auto result = commit(batch);
+    op_done(Metrics::Op::Write, start, result.ok());
+    return result;
+}
+
+Result<void> Bitcask::check_op(std::string_view key, std::string_view value) {
+    // Record sizes are stored as 32-bit quantities
+    constexpr size_t kMaxSize = std::numeric_limits<uint32_t>::max();
     if (key.empty()) {
         return Result<void>::Err("Key cannot be empty");
     }
+    if (key.size() > kMaxSize) {
+        return Result<void>::Err("Key too large");
+    }
+    if (value.size() > kMaxSize) {
+        return Result<void>::Err("Value too large");
+    }
+    return Result<void>::Ok();
+}
+
+Result<void> Bitcask::commit(const WriteBatch& batch, bool must_exist) {
+    for (const auto& op : batch.ops()) {
+        auto checked = check_op(op.key, op.value);
+        if (!checked.ok()) {
+            return checked;
+        }
+    }
+    
+    if (batch.empty()) {
+        return Result<void>::Ok();
+    }
+    
+    PendingWrite self;
+    self.batch = &batch;
+    self.must_exist = must_exist;
+    
+    // Compress on the caller's thread, before queueing behind other writers
+    if (config_.compression != Compression::None) {
+        compress_values(batch, self.frames);
+    }
     
+    std::unique_lock<std::mutex> queue_lock(queue_mutex_);
+    pending_writes_.push_back(&self);
+    self.cv.wait(queue_lock, [&] {
+        return self.done || pending_writes_.front() == &self;
+    });
+    
+    if (self.done) {
+        return self.result;  // A leader committed our batch
+    }
+    
+    // We lead: take every queued batch up to the group size cap
+    std::vector<PendingWrite*> group;
+    uint64_t group_bytes = 0;
+    for (PendingWrite* pending : pending_writes_) {
+        if (!group.empty() &&
+            group_bytes + pending->batch->byte_size() > config_.max_group_commit_bytes) {
+            break;
+        }
+        group.push_back(pending);
+        group_bytes += pending->batch->byte_size();
+    }
+    
+    // Let followers keep queueing while the group is written
+    queue_lock.unlock();
+    Result<void> result = apply_batches(group);
+    queue_lock.lock();
+    
+    for (PendingWrite* pending : group) {
+        pending_writes_.pop_front();
+        if (pending->missing) {
+            pending->result = Result<void>::Err("Key not found");
+        } else if (pending->result.ok()) {
+            pending->result = result;   // Unless indexing it already failed
+        }
+        pending->done = true;
+        if (pending != &self) {
+            pending->cv.notify_one();
+        }
+    }
+    
+    // Hand leadership to the next queued writer
+    if (!pending_writes_.empty()) {
+        pending_writes_.front()->cv.notify_one();
+    }
+    
+    return self.result;
+}
+
+void Bitcask::compress_values(const WriteBatch& batch, std::vector<std::string>& frames) {
+    const auto& ops = batch.ops();
+    frames.resize(ops.size());
+    
+    for (size_t i = 0; i < ops.size(); ++i) {
+        const std::string& value = ops[i].value;
+        if (ops[i].type == WriteBatch::OpType::Delete || value.size() < config_.compression_min_size) {
+            continue;
+        }
+        
+        auto start = std::chrono::steady_clock::now();
+        bool compressed = ValueCodec::compress(value, frames[i]);
+        compress_ns_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+        
+        if (compressed) {
+            values_compressed_.fetch_add(1, std::memory_order_relaxed);
+            compressed_raw_bytes_.fetch_add(value.size(), std::memory_order_relaxed);
+            compressed_stored_bytes_.fetch_add(frames[i].size(), std::memory_order_relaxed);
+        } else {
+            values_raw_.fetch_add(1, std::memory_order_relaxed);
+            frames[i].clear();
+        }
+    }
+}
+
+Result<void> Bitcask::apply_batches(const std::vector<PendingWrite*>& group) {
+    std::lock_guard<std::mutex> write_lock(write_mutex_);
     uint32_t timestamp = get_timestamp();
     
-    // Append to active file
-    auto append_result = active_file_->append(key, value, timestamp);
+    // A Hashed keydir settles whose fingerprint entry a key replaces by
+    // reading the entry's record back, which can fail. Do that for every
+    // key before anything is written, and fail a batch whose check fails
+    // here: once its records are in the log, recovery would apply them.
+    // Only the leader changes the index (merge relocates a record but keeps
+    // its key), so the answers still hold when the group is indexed.
+    std::unordered_map<std::string_view, bool> owners;
+    if (config_.index_type == IndexType::Hashed) {
+        for (PendingWrite* pending : group) {
+            for (const auto& op : pending->batch->ops()) {
+                if (owners.count(op.key)) {
+                    continue;
+                }
+                auto owned = index_.check(op.key);
+                if (!owned.ok()) {
+                    pending->result = Result<void>::Err(owned.err());
+                    break;
+                }
+                owners.emplace(op.key, owned.value);
+            }
+        }
+    }
+    
+    // Only the leader changes which keys exist, so deletes that need their
+    // key can be checked before anything is written. Earlier batches of the
+    // group count as applied.
+    bool checked = std::any_of(group.begin(), group.end(),
+                               [](const PendingWrite* pending) { return pending->must_exist; });
+    std::unordered_map<std::string_view, bool> group_live;
+    for (PendingWrite* pending : group) {
+        if (!pending->result.ok()) {
+            continue;
+        }
+        const auto& ops = pending->batch->ops();
+        if (pending->must_exist) {
+            for (const auto& op : ops) {
+                if (op.type != WriteBatch::OpType::Delete) {
+                    continue;
+                }
+                auto it = group_live.find(op.key);
+                if (!(it != group_live.end() ? it->second : contains(op.key))) {
+                    pending->missing = true;
+                    break;
+                }
+            }
+        }
+        if (checked && !pending->missing) {
+            for (const auto& op : ops) {
+                group_live[op.key] = op.type != WriteBatch::OpType::Delete;
+            }
+        }
+    }
+    
+    // What op i of a batch stores: its compressed frame, if it has one
+    auto stored_value = [](const PendingWrite* pending, size_t i) {
+        const auto& op = pending->batch->ops()[i];
+        if (i < pending->frames.size() && !pending->frames[i].empty()) {
+            return std::make_pair(std::string_view(pending->frames[i]), kRecordCompressed);
+        }
+        return std::make_pair(std::string_view(op.value), uint8_t{0});
+    };
+    
+    // Encode every record of every batch into one contiguous buffer, small
+    // ones sharing block CRCs when there are several
+    std::string buffer;
+    std::vector<RecordEncoder::Encoded> records;
+    size_t op_count = 0;
+    for (const PendingWrite* pending : group) {
+        if (pending->written()) {
+            op_count += pending->batch->count();
+        }
+    }
+    if (op_count == 0) {
+        return Result<void>::Ok();
+    }
+    records.reserve(op_count);
+    RecordEncoder encoder(buffer, config_.block_crc && op_count > 1);
+    
+    for (const PendingWrite* pending : group) {
+        if (!pending->written()) {
+            continue;
+        }
+        // A batch goes into the open block only if all of it fits there;
+        // otherwise it starts a new unit, so a batch that spans several
+        // starts on a unit boundary and recovery can cut it off whole
+        const auto& ops = pending->batch->ops();
+        size_t bytes = 0;
+        bool members = true;
+        for (size_t j = 0; j < ops.size(); ++j) {
+            size_t size = ops[j].key.size() + stored_value(pending, j).first.size();
+            bytes += size;
+            members = members && encoder.blocks(size, 0);
+        }
+        if (members) {
+            encoder.reserve(ops.size(), bytes);
+        } else {
+            encoder.finish();
+        }
+        
+        // Every record but the last says more of the batch follows; until
+        // recovery sees the last, it keeps none of them
+        for (size_t j = 0; j < ops.size(); ++j) {
+            auto [value, flags] = stored_value(pending, j);
+            if (ops[j].type == WriteBatch::OpType::Delete) {
+                flags |= kRecordTombstone;
+            }
+            if (j + 1 < ops.size()) {
+                flags |= kRecordContinued;
+            }
+            records.push_back(encoder.add(timestamp, ops[j].key, value, flags));
+        }
+    }
+    encoder.finish();
+    
+    auto append_result = active_file_->append_raw(buffer.data(), buffer.size());
     if (!append_result.ok()) {
         return Result<void>::Err(append_result.err());
     }
+    uint64_t base = append_result.value;
+    uint32_t file_id = active_file_->id();
+    active_file_->add_records(op_count);
+    if (metrics_) {
+        metrics_->add_bytes_written(buffer.size());
+    }
     
-    // Update index
-    IndexEntry entry;
-    entry.file_id = active_file_->id();
-    entry.value_pos = append_result.value;
-    entry.value_size = value.size();
-    entry.timestamp = timestamp;
+    // One sync covers the whole group
+    if (config_.sync_policy == SyncPolicy::Always) {
+        auto sync_result = active_file_->sync(config_.sync_metadata);
+        if (!sync_result.ok()) {
+            return sync_result;
+        }
+    } else if (config_.sync_policy == SyncPolicy::Interval) {
+        uint64_t pending = unsynced_bytes_.fetch_add(buffer.size()) + buffer.size();
+        if (config_.sync_bytes > 0 && pending >= config_.sync_bytes) {
+            flusher_cv_.notify_one();
+        }
+    }
     
-    index_.put(key, entry);
+    // Index the whole group in one pass. Readers hold files_mutex_ shared for
+    // each lookup, so taking it exclusively makes a multi-op group appear
+    // atomically; a single op is atomic on its own and only needs it shared
+    // to account the record it replaces.
+    std::unique_lock<std::shared_mutex> group_lock(files_mutex_, std::defer_lock);
+    std::shared_lock<std::shared_mutex> op_lock(files_mutex_, std::defer_lock);
+    if (op_count > 1) {
+        group_lock.lock();
+    } else {
+        op_lock.lock();
+    }
+    
+    // Key checks take the answers found before the append, or for a record
+    // of this group (an earlier op whose key shares the fingerprint), its
+    // key, so none of them reads the log again or can fail now
+    std::unordered_map<uint64_t, std::string_view> group_keys;
+    HashIndex::KeyCheck key_check;
+    if (config_.index_type == IndexType::Hashed) {
+        key_check = [&](std::string_view key, const IndexEntry& entry) {
+            if (entry.file_id == file_id && entry.value_pos >= base) {
+                auto it = group_keys.find(entry.value_pos);
+                return Result<bool>::Ok(it != group_keys.end() && it->second == key);
+            }
+            auto it = owners.find(key);
+            return it != owners.end() ? Result<bool>::Ok(it->second) : record_has_key(key, entry);
+        };
+    }
+    
+    size_t i = 0;
+    for (PendingWrite* pending : group) {
+        if (!pending->written()) {
+            continue;
+        }
+        const auto& ops = pending->batch->ops();
+        for (size_t j = 0; j < ops.size(); ++j) {
+            const auto& op = ops[j];
+            if (op.type == WriteBatch::OpType::Delete) {
+                auto removed = index_.remove(op.key, timestamp, key_check);
+                if (!removed.ok()) {
+                    pending->result = Result<void>::Err(removed.err());
+                } else {
+                    retire_entry(op.key, removed.value);
+                    if (ordered_) {
+                        ordered_->remove(op.key);
+                    }
+                }
+            } else {
+                auto [value, flags] = stored_value(pending, j);
+                IndexEntry entry;
+                entry.file_id = file_id;
+                entry.flags = flags;
+                entry.overhead = static_cast<uint8_t>(records[i].size - op.key.size() -
+                                                      value.size());
+                entry.value_pos = base + records[i].value_offset;
+                entry.value_size = value.size();
+                entry.timestamp = timestamp;
+                auto replaced = index_.put(op.key, entry, key_check);
+                if (!replaced.ok()) {
+                    pending->result = Result<void>::Err(replaced.err());
+                } else {
+                    group_keys.emplace(entry.value_pos, op.key);
+                    retire_entry(op.key, replaced.value);
+                    active_file_->add_live(entry.record_size(op.key.size()), 1);
+                    if (ordered_) {
+                        ordered_->insert(op.key);
+                    }
+                }
+            }
+            ++i;
+        }
+    }
+    
+    if (group_lock.owns_lock()) {
+        group_lock.unlock();
+    } else {
+        op_lock.unlock();
+    }
     
     // Check if we need to rotate
     if (active_file_->size() >= config_.max_file_size) {
-        auto rotate_result = rotate_active_file();
-        if (!rotate_result.ok()) {
-            return rotate_result;
-        }
+        return rotate_active_file();
     }
     
     return Result<void>::Ok();
 }
 
+void Bitcask::retire_entry(const std::string& key, const std::optional<IndexEntry>& previous) {
+    if (!previous || previous->is_tombstone()) {
+        return;
+    }
+    if (auto file = find_file(previous->file_id)) {
+        file->add_live(-static_cast<int64_t>(previous->record_size(key.size())), -1);
+    }
+}
+
+void Bitcask::install_immutable_file(std::shared_ptr<LogFile> file) {
+    // Merged and compacted files can sort before files rotated out earlier
+    auto pos = std::upper_bound(old_files_.begin(), old_files_.end(), file->id(),
+                                [](uint32_t id, const auto& other) { return id < other->id(); });
+    files_.insert(file);
+    old_files_.insert(pos, std::move(file));
+}
+
+std::shared_ptr<LogFile> Bitcask::find_file(uint32_t file_id) const {
+    return files_.find(file_id);
+}
+
+std::unique_ptr<LogFile> Bitcask::open_immutable_file(uint32_t file_id) const {
+    auto file = std::make_unique<LogFile>(file_id, config_.directory, true, &fd_cache_);
+    
+    if (config_.mmap_immutable_files) {
+        // A file that cannot be mapped is still readable through pread
+        file->map();
+    }
+    
+    return file;
+}
+
 Result<std::string> Bitcask::get(const std::string& key) {
+    std::string value;
+    auto result = get(key, value);
+    if (!result.ok()) {
+        return Result<std::string>::Err(result.err());
+    }
+    return Result<std::string>::Ok(std::move(value));
+}
+
+std::vector<FileStats> Bitcask::file_stats() const {
+    std::shared_lock<std::shared_mutex> files_lock(files_mutex_);
+    
+    std::vector<FileStats> stats;
+    stats.reserve(old_files_.size() + 1);
+    auto add = [&](const LogFile& file, bool active) {
+        FileStats file_stats;
+        file_stats.file_id = file.id();
+        file_stats.active = active;
+        file_stats.total_bytes = file.size();
+        file_stats.live_bytes = file.live_bytes();
+        file_stats.total_records = file.record_count();
+        file_stats.live_keys = file.live_keys();
+        file_stats.bytes_read = file.bytes_read();
+        stats.push_back(file_stats);
+    };
+    
+    for (const auto& file : old_files_) {
+        add(*file, false);
+    }
+    if (active_file_) {
+        add(*active_file_, true);
+    }
+    return stats;
+}
+
+CacheStats Bitcask::cache_stats() const {
+    return cache_ ? cache_->stats() : CacheStats{};
+}
+
+CompressionStats Bitcask::compression_stats() const {
+    CompressionStats stats;
+    stats.values_compressed = values_compressed_.load(std::memory_order_relaxed);
+    stats.values_raw = values_raw_.load(std::memory_order_relaxed);
+    stats.raw_bytes = compressed_raw_bytes_.load(std::memory_order_relaxed);
+    stats.stored_bytes = compressed_stored_bytes_.load(std::memory_order_relaxed);
+    stats.compress_ns = compress_ns_.load(std::memory_order_relaxed);
+    stats.values_decompressed = values_decompressed_.load(std::memory_order_relaxed);
+    stats.decompress_ns = decompress_ns_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+Stats Bitcask::stats() const {
+    Stats stats;
+    if (metrics_) {
+        metrics_->snapshot(stats);
+    }
+    stats.keys = index_.size();
+    stats.keydir_bytes = index_.memory_usage();
+    stats.open_files = fd_cache_.open_count();
+    stats.files = file_stats();
+    stats.merge_running = merge_running_.load(std::memory_order_relaxed);
+    if (stats.merge_running) {
+        stats.merge_bytes_done = merge_bytes_done_.load(std::memory_order_relaxed);
+        stats.merge_bytes_total = merge_bytes_total_.load(std::memory_order_relaxed);
+    }
+    stats.recovery_seconds = recovery_stats_.seconds;
+    stats.cache = cache_stats();
+    stats.compression = compression_stats();
+    return stats;
+}
+
+const RecoveryStats& Bitcask::recovery_stats() const {
+    return recovery_stats_;
+}
+
+Result<void> Bitcask::lookup(const std::string& key, IndexEntry& entry,
+                             std::shared_ptr<LogFile>& file) const {
+    // Hold the file set stable so the index entry and its file stay in sync
+    // across a concurrent rotation or merge; the read itself runs unlocked
+    // on the pinned handle
+    std::shared_lock<std::shared_mutex> files_lock(files_mutex_);
+    
     auto index_entry = index_.get(key);
     if (!index_entry.has_value()) {
-        return Result<std::string>::Err("Key not found");
+        return Result<void>::Err("Key not found");
     }
+    entry = index_entry.value();
     
-    const auto& entry = index_entry.value();
+    file = find_file(entry.file_id);
+    if (!file) {
+        return Result<void>::Err("File not found for key");
+    }
+    return Result<void>::Ok();
+}
+
+Result<void> Bitcask::get(const std::string& key, std::string& value) {
+    auto start = op_start(Metrics::Op::Get);
+    for (int attempt = 0; ; ++attempt) {
+        IndexEntry entry;
+        std::shared_ptr<LogFile> file;
+        auto lookup_result = lookup(key, entry, file);
+        if (!lookup_result.ok()) {
+            op_done(Metrics::Op::Get, start, false);
+            return lookup_result;
+        }
+        
+        auto result = read_cached(entry, *file, value);
+        
+        // A merge may have deleted the file after the lookup and its
+        // descriptor been evicted before the read; retry once against the
+        // index, which has moved on to the merged copy
+        if (result.ok() || attempt > 0) {
+            op_done(Metrics::Op::Get, start, result.ok());
+            return result;
+        }
+    }
+}
+
+bool Bitcask::contains(const std::string& key) const {
+    // A Hashed keydir reads the key back from the file
+    std::shared_lock<std::shared_mutex> files_lock(files_mutex_);
+    return index_.contains(key);
+}
+
+Result<bool> Bitcask::record_has_key(std::string_view key, const IndexEntry& entry) const {
+    auto file = find_file(entry.file_id);
+    if (!file) {
+        return Result<bool>::Err("Log file not found");
+    }
+    return file->has_key(entry.value_pos, key, entry.value_size);
+}
+
+Result<ValueView> Bitcask::get_view(const std::string& key) {
+    auto start = op_start(Metrics::Op::Get);
+    for (int attempt = 0; ; ++attempt) {
+        IndexEntry entry;
+        std::shared_ptr<LogFile> file;
+        auto lookup_result = lookup(key, entry, file);
+        if (!lookup_result.ok()) {
+            op_done(Metrics::Op::Get, start, false);
+            return Result<ValueView>::Err(lookup_result.err());
+        }
+        
+        // Mapped files are already zero-copy; only pread copies go through
+        // the cache. Compressed values are always expanded into a copy.
+        bool compressed = entry.flags & kRecordCompressed;
+        if (!compressed && (!cache_ || file->is_mapped())) {
+            auto result = file->read_view(entry.value_pos, entry.value_size);
+            if (result.ok()) {
+                add_bytes_read(*file, entry.value_size);
+            }
+            if (result.ok() || attempt > 0) {
+                op_done(Metrics::Op::Get, start, result.ok());
+                return result;
+            }
+            continue;
+        }
+        
+        std::string value;
+        auto result = read_cached(entry, *file, value);
+        if (result.ok()) {
+            op_done(Metrics::Op::Get, start, true);
+            return Result<ValueView>::Ok(ValueView(std::move(value)));
+        }
+        if (attempt > 0) {
+            op_done(Metrics::Op::Get, start, false);
+            return Result<ValueView>::Err(result.err());
+        }
+    }
+}
+
+AsyncIO& Bitcask::async_io() {
+    std::call_once(async_once_, [this] {
+        async_ = std::make_unique<AsyncIO>(config_.async_threads, config_.async_queue_depth);
+    });
+    return *async_;
+}
+
+bool Bitcask::async_uses_io_uring() {
+    return async_io().uses_io_uring();
+}
+
+void Bitcask::get_async(const std::string& key, GetCallback done) {
+    AsyncIO& io = async_io();
     
-    // Find the right file
-    LogFile* target_file = nullptr;
+    // Timed from the call to the completion
+    auto start = op_start(Metrics::Op::Get);
+    auto complete = [this, start](const GetCallback& done, Result<std::string> result) {
+        op_done(Metrics::Op::Get, start, result.ok());
+        done(std::move(result));
+    };
     
-    if (active_file_ && active_file_->id() == entry.file_id) {
-        target_file = active_file_.get();
-    } else {
-        for (const auto& file : old_files_) {
-            if (file->id() == entry.file_id) {
-                target_file = file.get();
-                break;
+    IndexEntry entry;
+    std::shared_ptr<LogFile> file;
+    auto lookup_result = lookup(key, entry, file);
+    if (!lookup_result.ok()) {
+        complete(done, Result<std::string>::Err(lookup_result.err()));
+        return;
+    }
+    
+    std::string cached;
+    if (cache_ && cache_->get(entry.file_id, entry.value_pos, cached)) {
+        complete(done, Result<std::string>::Ok(std::move(cached)));
+        return;
+    }
+    
+    // Mapped files have no descriptor to read through, and a file merge
+    // has retired may not reopen; both take the blocking path, which
+    // retries against the index
+    auto handle = file->is_mapped() ? nullptr : file->read_handle();
+    if (!handle) {
+        io.run([this, key, done = std::move(done)] { done(get(key)); });
+        return;
+    }
+    
+    // The pinned handle keeps the file readable even if merge deletes it
+    auto buffer = std::make_shared<std::string>(entry.value_size, '\0');
+    char* data = buffer->data();
+    io.read({std::move(handle), entry.value_pos, entry.value_size, data,
+             [this, entry, file, buffer, complete,
+              done = std::move(done)](Result<void> result) {
+                 if (!result.ok()) {
+                     complete(done, Result<std::string>::Err(result.err()));
+                     return;
+                 }
+                 add_bytes_read(*file, entry.value_size);
+                 
+                 std::string value;
+                 if (entry.flags & kRecordCompressed) {
+                     auto expanded = decompress_value(*buffer, value);
+                     if (!expanded.ok()) {
+                         complete(done, Result<std::string>::Err(expanded.err()));
+                         return;
+                     }
+                 } else {
+                     value = std::move(*buffer);
+                 }
+                 
+                 if (cache_) {
+                     cache_->insert(entry.file_id, entry.value_pos, value);
+                 }
+                 complete(done, Result<std::string>::Ok(std::move(value)));
+             }});
+}
+
+std::vector<Result<std::string>> Bitcask::multi_get(const std::vector<std::string>& keys) {
+    auto start = op_start(Metrics::Op::MultiGet);
+    std::vector<Result<std::string>> results(keys.size(), Result<std::string>::Err("Key not found"));
+    
+    // Resolve every key under one hold of the file set
+    std::vector<PendingRead> reads;
+    reads.reserve(keys.size());
+    {
+        std::shared_lock<std::shared_mutex> files_lock(files_mutex_);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            auto entry = index_.get(keys[i]);
+            if (!entry.has_value()) {
+                continue;
+            }
+            auto file = find_file(entry->file_id);
+            if (!file) {
+                results[i] = Result<std::string>::Err("File not found for key");
+                continue;
+            }
+            reads.push_back({i, *entry, std::move(file)});
+        }
+    }
+    
+    // Cache hits and mapped files need no I/O
+    size_t kept = 0;
+    for (auto& read : reads) {
+        std::string value;
+        if (cache_ && cache_->get(read.entry.file_id, read.entry.value_pos, value)) {
+            results[read.slot] = Result<std::string>::Ok(std::move(value));
+        } else if (read.file->is_mapped()) {
+            auto result = read_cached(read.entry, *read.file, value);
+            results[read.slot] = result.ok() ? Result<std::string>::Ok(std::move(value))
+                                             : Result<std::string>::Err(result.err());
+        } else {
+            reads[kept++] = std::move(read);
+        }
+    }
+    reads.resize(kept);
+    
+    // Sort by location and merge values that are adjacent or nearly so
+    std::sort(reads.begin(), reads.end(), [](const PendingRead& a, const PendingRead& b) {
+        return a.entry.file_id != b.entry.file_id ? a.entry.file_id < b.entry.file_id
+                                                  : a.entry.value_pos < b.entry.value_pos;
+    });
+    std::vector<ReadRun> runs;
+    for (size_t i = 0; i < reads.size(); ++i) {
+        const IndexEntry& entry = reads[i].entry;
+        uint64_t end = entry.value_pos + entry.value_size;
+        if (!runs.empty()) {
+            ReadRun& run = runs.back();
+            if (run.file == reads[i].file && entry.value_pos <= run.end + config_.multi_get_gap &&
+                end - run.start <= kMaxCoalescedRead) {
+                run.end = std::max(run.end, end);
+                run.last = i + 1;
+                continue;
             }
         }
+        runs.push_back({reads[i].file, entry.value_pos, end, i, i + 1, {}, Result<void>::Ok()});
     }
     
-    if (!target_file) {
-        return Result<std::string>::Err("File not found for key");
+    for (auto& run : runs) {
+        run.buffer.resize(run.end - run.start);
+    }
+    if (runs.size() == 1) {
+        // Not worth a hand-off
+        ReadRun& run = runs.front();
+        run.result = run.file->read_value_into(run.start, run.buffer.size(), run.buffer.data());
+    } else if (!runs.empty()) {
+        AsyncIO& io = async_io();
+        std::mutex mutex;
+        std::condition_variable cv;
+        size_t pending = runs.size();
+        auto finish = [&](ReadRun& run, Result<void> result) {
+            run.result = std::move(result);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0) {
+                cv.notify_one();
+            }
+        };
+        
+        std::vector<AsyncIO::ReadRequest> requests;
+        for (auto& run : runs) {
+            auto handle = run.file->read_handle();
+            if (!handle) {
+                finish(run, Result<void>::Err("Failed to open log file"));
+                continue;
+            }
+            requests.push_back({std::move(handle), run.start, run.buffer.size(), run.buffer.data(),
+                                [&finish, &run](Result<void> result) {
+                                    finish(run, std::move(result));
+                                }});
+        }
+        io.read_batch(std::move(requests));
+        
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return pending == 0; });
+    }
+    
+    // Scatter values back to their request slots
+    for (auto& run : runs) {
+        if (run.result.ok()) {
+            add_bytes_read(*run.file, run.buffer.size());
+        }
+        for (size_t i = run.first; i < run.last; ++i) {
+            const PendingRead& read = reads[i];
+            if (!run.result.ok()) {
+                // A merge may have retired the file since the lookup; get()
+                // retries against the index
+                results[read.slot] = get(keys[read.slot]);
+                continue;
+            }
+            
+            std::string_view stored(run.buffer.data() + (read.entry.value_pos - run.start),
+                                    read.entry.value_size);
+            std::string value;
+            bool whole_run = run.last - run.first == 1 && stored.size() == run.buffer.size();
+            if (read.entry.flags & kRecordCompressed) {
+                auto expanded = decompress_value(stored, value);
+                if (!expanded.ok()) {
+                    results[read.slot] = Result<std::string>::Err(expanded.err());
+                    continue;
+                }
+            } else if (whole_run) {
+                value = std::move(run.buffer);
+            } else {
+                value.assign(stored);
+            }
+            
+            if (cache_) {
+                cache_->insert(read.entry.file_id, read.entry.value_pos, value);
+            }
+            results[read.slot] = Result<std::string>::Ok(std::move(value));
+        }
     }
     
-    return target_file->read_value(entry.value_pos, entry.value_size);
+    op_done(Metrics::Op::MultiGet, start, true);
+    return results;
 }
 
-Result<void> Bitcask::del(const std::string& key) {
-    if (!index_.contains(key)) {
-        return Result<void>::Err("Key not found");
+void Bitcask::put_async(const std::string& key, const std::string& value, WriteCallback done) {
+    async_io().run([this, key, value, done = std::move(done)] { done(put(key, value)); });
+}
+
+void Bitcask::del_async(const std::string& key, WriteCallback done) {
+    async_io().run([this, key, done = std::move(done)] { done(del(key)); });
+}
+
+void Bitcask::write_async(WriteBatch batch, WriteCallback done) {
+    async_io().run([this, batch = std::move(batch), done = std::move(done)] {
+        done(write(batch));
+    });
+}
+
+Result<void> Bitcask::read_cached(const IndexEntry& entry, const LogFile& file,
+                                  std::string& value) {
+    // A location is never rewritten, so a cached copy can't be stale: a
+    // put or del moves the key and the index stops pointing here
+    if (cache_ && cache_->get(entry.file_id, entry.value_pos, value)) {
+        return Result<void>::Ok();
     }
     
-    uint32_t timestamp = get_timestamp();
-    
-    // Write tombstone to log (empty value)
-    auto append_result = active_file_->append(key, "", timestamp);
-    if (!append_result.ok()) {
-        return Result<void>::Err(append_result.err());
+    Result<void> result = Result<void>::Ok();
+    if (entry.flags & kRecordCompressed) {
+        // Zero-copy if the file is mapped
+        auto frame = file.read_view(entry.value_pos, entry.value_size);
+        if (!frame.ok()) {
+            return Result<void>::Err(frame.err());
+        }
+        result = decompress_value(frame.value.view(), value);
+    } else {
+        value.resize(entry.value_size);
+        result = file.read_value_into(entry.value_pos, entry.value_size, value.data());
     }
     
-    // Mark as deleted in index
-    index_.remove(key, timestamp);
+    if (result.ok()) {
+        add_bytes_read(file, entry.value_size);
+        if (cache_) {
+            cache_->insert(entry.file_id, entry.value_pos, value);
+        }
+    }
+    return result;
+}
+
+Result<void> Bitcask::decompress_value(std::string_view frame, std::string& value) {
+    auto start = std::chrono::steady_clock::now();
+    bool ok = ValueCodec::decompress(frame, value);
+    decompress_ns_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+    values_decompressed_.fetch_add(1, std::memory_order_relaxed);
     
+    if (!ok) {
+        return Result<void>::Err("Corrupt compressed value");
+    }
     return Result<void>::Ok();
 }
 
+Result<void> Bitcask::del(const std::string& key) {
+    auto start = op_start(Metrics::Op::Del);
+    
+    // Write a tombstone record to the log and mark as deleted in index. The
+    // leader checks the key exists, so racing deletes can't both succeed.
+    WriteBatch batch;
+    batch.del(key);
+    auto result = commit(batch, true);
+    op_done(Metrics::Op::Del, start, result.ok());
+    return result;
+}
+
 std::vector<std::string> Bitcask::list_keys() {
-    return index_.keys();
+    if (config_.index_type != IndexType::Hashed) {
+        return index_.keys();
+    }
+    
+    // No keys in memory: read them back from the log. A record's key is
+    // live if the index still points at that record, which needs no key
+    // check. Holding compaction_mutex_ keeps merges from moving records
+    // mid-scan; a key rewritten by a put meanwhile may be missed.
+    std::lock_guard<std::mutex> compaction_lock(compaction_mutex_);
+    std::vector<std::shared_ptr<LogFile>> files;
+    {
+        std::shared_lock<std::shared_mutex> files_lock(files_mutex_);
+        files = old_files_;
+        files.push_back(active_file_);
+    }
+    
+    std::vector<std::string> keys;
+    for (const auto& file : files) {
+        file->scan([&](const LogFile::RecordView& record) {
+            if (!(record.flags & kRecordTombstone)) {
+                std::string key(record.key);
+                auto entry = index_.lookup(key);
+                if (entry && entry->file_id == file->id() && entry->value_pos == record.value_pos) {
+                    keys.push_back(std::move(key));
+                }
+            }
+            return true;
+        });
+    }
+    return keys;
+}
+
+Result<OrderedIndex::Iterator> Bitcask::scan(const std::string& prefix, size_t limit) {
+    if (!ordered_) {
+        return Result<OrderedIndex::Iterator>::Err("Ordered index not enabled");
+    }
+    return ordered_->scan(prefix, limit);
+}
+
+Result<OrderedIndex::Iterator> Bitcask::range(const std::string& begin, const std::string& end,
+                                              size_t limit) {
+    if (!ordered_) {
+        return Result<OrderedIndex::Iterator>::Err("Ordered index not enabled");
+    }
+    return ordered_->range(begin, end, limit);
 }
 
 Result<void> Bitcask::sync() {
-    // In C++, flush is already called in append
-    // This is here for API completeness
-    return Result<void>::Ok();
+    // Writes hold write_mutex_ until their append returns, so taking it here
+    // orders this barrier after every write that has already completed
+    std::lock_guard<std::mutex> write_lock(write_mutex_);
+    std::lock_guard<std::mutex> sync_lock(sync_mutex_);
+    
+    // Files rotated out under SyncPolicy::None may still be unsynced
+    for (uint32_t file_id : unsynced_file_ids_) {
+        std::shared_lock<std::shared_mutex> files_lock(files_mutex_);
+        if (auto file = find_file(file_id)) {
+            auto sync_result = file->sync(config_.sync_metadata);
+            if (!sync_result.ok()) {
+                return sync_result;
+            }
+        }
+    }
+    unsynced_file_ids_.clear();
+    
+    return sync_active_file();
 }
 
-Result<void> Bitcask::merge() {
+Result<MergeStats> Bitcask::merge() {
+    auto start = op_start(Metrics::Op::Merge);
+    auto result = merge_files();
+    merge_running_.store(false, std::memory_order_relaxed);
+    op_done(Metrics::Op::Merge, start, result.ok());
+    return result;
+}
+
+Result<MergeStats> Bitcask::merge_files() {
+    std::lock_guard<std::mutex> compaction_lock(compaction_mutex_);
+    std::lock_guard<std::mutex> write_lock(write_mutex_);
+    
+    MergeStats stats;
     if (old_files_.empty()) {
-        return Result<void>::Ok();  // Nothing to merge
+        return Result<MergeStats>::Ok(stats);  // Nothing to merge
     }
+    auto start = std::chrono::steady_clock::now();
     
     // Create a temporary directory for merged files
     std::string merge_dir = config_.directory + "/.merge";
@@ -280,150 +1516,452 @@ Result<void> Bitcask::merge() {
         #endif
     }
     
-    // Get all current live keys
-    auto live_keys = index_.keys();
+    // Output files fill up to max_file_size; each one's hint is written as
+    // soon as it is complete
+    std::vector<uint32_t> merged_file_ids;
+    std::vector<HashIndex::HintEntry> merged_hints;
+    std::vector<IndexEntry> merged_from;    // Where each of merged_hints was copied from
+    std::unique_ptr<LogFile> merged_file;
+    std::unique_ptr<RecordCopier> copier;
+    std::vector<HashIndex::HintEntry> hints;
     
-    // Group keys by file
-    std::map<uint32_t, std::vector<std::string>> keys_by_file;
-    for (const auto& key : live_keys) {
-        auto entry = index_.get(key);
-        if (entry.has_value() && entry->file_id != active_file_->id()) {
-            keys_by_file[entry->file_id].push_back(key);
+    // The originals are untouched until every output is in place, so a
+    // failed merge only has to drop its outputs and their hints. A hint
+    // left behind could describe an unrelated file that reuses the id.
+    auto abandon = [&](const std::string& error) {
+        if (merged_file) {
+            merged_file_ids.push_back(merged_file->id());
+            merged_file.reset();
         }
-    }
+        for (uint32_t file_id : merged_file_ids) {
+            std::string name = "/cask." + std::to_string(file_id);
+            remove((merge_dir + name).c_str());
+            remove((config_.directory + name).c_str());
+            remove(HintFile::path_for(config_.directory, file_id).c_str());
+        }
+        sync_directory();
+        return Result<MergeStats>::Err(error);
+    };
     
-    // Process each old file
-    std::vector<uint32_t> merged_file_ids;
-    for (const auto& [file_id, keys] : keys_by_file) {
-        if (keys.empty()) continue;
+    auto finish_output = [&]() -> Result<void> {
+        auto flush_result = copier->flush();
+        if (!flush_result.ok()) {
+            return flush_result;
+        }
         
-        // Create new merged file
-        uint32_t new_file_id = next_file_id_++;
-        auto merged_file = std::make_unique<LogFile>(new_file_id, merge_dir, false);
+        // Merged data must be durable before the originals are deleted
+        auto sync_result = merged_file->sync(config_.sync_metadata);
+        if (!sync_result.ok()) {
+            return sync_result;
+        }
+        merged_file->close();
         
-        std::vector<HashIndex::HintEntry> hints;
+        auto hint_result = HintFile::write(HintFile::path_for(config_.directory, merged_file->id()),
+                                           merged_file->size(), hints);
+        if (!hint_result.ok()) {
+            return hint_result;
+        }
+        stats.output_files++;
+        stats.output_bytes += merged_file->size();
+        merged_file_ids.push_back(merged_file->id());
+        std::move(hints.begin(), hints.end(), std::back_inserter(merged_hints));
+        hints.clear();
+        copier.reset();
+        merged_file.reset();
+        return Result<void>::Ok();
+    };
+    
+    uint64_t total_bytes = 0;
+    for (const auto& old_file : old_files_) {
+        total_bytes += old_file->size();
+    }
+    merge_bytes_total_.store(total_bytes, std::memory_order_relaxed);
+    merge_bytes_done_.store(0, std::memory_order_relaxed);
+    merge_running_.store(true, std::memory_order_relaxed);
+    
+    // Stream each old file in order. Writers are blocked, so old_files_ is
+    // stable and a record is live exactly when the index points at it.
+    for (const auto& old_file : old_files_) {
+        uint32_t file_id = old_file->id();
+        uint64_t done_before = stats.input_bytes;
+        stats.input_files++;
+        stats.input_bytes += old_file->size();
+        Result<void> write_result = Result<void>::Ok();
         
-        // Copy live entries
-        for (const auto& key : keys) {
-            auto value_result = get(key);
-            if (!value_result.ok()) continue;
+        auto scan_result = old_file->scan([&](const LogFile::RecordView& record) {
+            stats.records_scanned++;
+            merge_bytes_done_.store(done_before + record.offset + record.raw.size(),
+                                    std::memory_order_relaxed);
+            if (record.flags & kRecordTombstone) {
+                return true;  // Every older record goes away with it
+            }
             
-            auto entry = index_.get(key);
-            if (!entry.has_value()) continue;
+            // Matching the location makes lookup() exact even for a Hashed keydir
+            std::string key(record.key);
+            auto entry = index_.lookup(key);
+            if (!entry.has_value() || entry->file_id != file_id ||
+                entry->value_pos != record.value_pos) {
+                return true;  // Superseded or deleted
+            }
             
-            uint32_t timestamp = entry->timestamp;
-            auto append_result = merged_file->append(key, value_result.value, timestamp);
+            if (copier && !copier->empty() &&
+                copier->size() + record.raw.size() > config_.max_file_size) {
+                write_result = finish_output();
+                if (!write_result.ok()) {
+                    return false;
+                }
+            }
+            if (!copier) {
+                merged_file = std::make_unique<LogFile>(next_file_id_++, merge_dir, false);
+                copier = std::make_unique<RecordCopier>(*merged_file, config_.block_crc);
+            }
             
-            if (append_result.ok()) {
-                // Update hint
-                IndexEntry hint_entry;
-                hint_entry.file_id = new_file_id;
-                hint_entry.value_pos = append_result.value;
-                hint_entry.value_size = value_result.value.size();
-                hint_entry.timestamp = timestamp;
-                
-                // Construct HintEntry properly
-                HashIndex::HintEntry hint;
-                hint.key = key;
-                hint.entry = hint_entry;
-                hints.push_back(hint);
+            auto copy_result = copier->add(record);
+            if (!copy_result.ok()) {
+                write_result = Result<void>::Err(copy_result.err());
+                return false;
             }
-        }
-        
-        merged_file->close();
-        
-        // Write hint file
-        write_hint_file(new_file_id, hints);
+            
+            hints.push_back({std::move(key), copy_result.value});
+            merged_from.push_back(*entry);
+            stats.records_copied++;
+            return true;
+        });
         
-        merged_file_ids.push_back(new_file_id);
+        if (!scan_result.ok()) {
+            return abandon("Failed to read log file: " + scan_result.err());
+        }
+        if (!write_result.ok()) {
+            return abandon("Failed to write merged file: " + write_result.err());
+        }
     }
     
-    // Move merged files to main directory and delete old files
-    for (size_t i = 0; i < old_files_.size(); ++i) {
-        uint32_t old_id = old_files_[i]->id();
-        std::string old_path = config_.directory + "/cask." + std::to_string(old_id);
-        remove(old_path.c_str());
+    if (copier) {
+        auto finish_result = finish_output();
+        if (!finish_result.ok()) {
+            return abandon("Failed to write merged file: " + finish_result.err());
+        }
+    }
+    
+    // Move merged files to the main directory, and make that durable before
+    // any original is deleted: recovery ignores .merge
+    for (size_t i = 0; i < merged_file_ids.size(); ++i) {
+        std::string src = merge_dir + "/cask." + std::to_string(merged_file_ids[i]);
+        std::string dst = config_.directory + "/cask." + std::to_string(merged_file_ids[i]);
+        if (std::rename(src.c_str(), dst.c_str()) != 0) {
+            return abandon("Failed to move merged file into place");
+        }
+    }
+    if (!merged_file_ids.empty()) {
+        sync_directory();
     }
     
-    for (uint32_t merged_id : merged_file_ids) {
-        std::string src = merge_dir + "/cask." + std::to_string(merged_id);
-        std::string dst = config_.directory + "/cask." + std::to_string(merged_id);
-        std::rename(src.c_str(), dst.c_str());
+    {
+        // Swap the file set and repoint the index atomically for readers
+        std::unique_lock<std::shared_mutex> files_lock(files_mutex_);
+        
+        // Delete old files. Readers holding an old file's handle can still
+        // finish reading it.
+        for (size_t i = 0; i < old_files_.size(); ++i) {
+            std::string old_path = config_.directory + "/cask." + std::to_string(old_files_[i]->id());
+            remove(old_path.c_str());
+            remove((old_path + ".hint").c_str());
+            files_.erase(old_files_[i]->id());
+        }
+        
+        // Reload old files
+        old_files_.clear();
+        for (uint32_t file_id : merged_file_ids) {
+            install_immutable_file(open_immutable_file(file_id));
+        }
         
-        std::string src_hint = merge_dir + "/cask." + std::to_string(merged_id) + ".hint";
-        std::string dst_hint = config_.directory + "/cask." + std::to_string(merged_id) + ".hint";
-        std::rename(src_hint.c_str(), dst_hint.c_str());
+        // Writers are blocked, so every key still points where it was
+        // copied from
+        for (size_t i = 0; i < merged_hints.size(); ++i) {
+            const auto& hint = merged_hints[i];
+            index_.compare_and_set(hint.key, merged_from[i], hint.entry);
+            if (auto file = files_.find(hint.entry.file_id)) {
+                file->add_records(1);
+                file->add_live(hint.entry.record_size(hint.key.size()), 1);
+            }
+        }
     }
     
-    // Reload old files
-    old_files_.clear();
-    for (uint32_t file_id : merged_file_ids) {
-        old_files_.push_back(
-            std::make_unique<LogFile>(file_id, config_.directory, true)
-        );
+    sync_directory();
+    
+    // Merged files got ids above the active file. Rotate so new writes land
+    // in a file newer than them, or recovery would replay merged (older)
+    // values over later writes.
+    if (!merged_file_ids.empty()) {
+        auto rotate_result = rotate_active_file();
+        if (!rotate_result.ok()) {
+            return Result<MergeStats>::Err(rotate_result.err());
+        }
     }
     
-    return Result<void>::Ok();
+    stats.seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    return Result<MergeStats>::Ok(stats);
 }
 
-Result<void> Bitcask::write_hint_file(uint32_t file_id, 
-                                       const std::vector<HashIndex::HintEntry>& hints) {
-    std::string hint_path = config_.directory + "/cask." + std::to_string(file_id) + ".hint";
-    std::ofstream hint_file(hint_path, std::ios::binary);
+std::vector<std::shared_ptr<LogFile>> Bitcask::pick_compaction_inputs() const {
+    struct Candidate {
+        std::shared_ptr<LogFile> file;
+        double dead_ratio;
+    };
+    std::vector<Candidate> candidates;
+    {
+        std::shared_lock<std::shared_mutex> files_lock(files_mutex_);
+        for (const auto& file : old_files_) {
+            uint64_t size = file->size();
+            if (file->empty()) {
+                continue;
+            }
+            double dead_ratio = static_cast<double>(size - std::min(size, file->live_bytes())) / size;
+            if (dead_ratio >= config_.compaction_min_dead_ratio) {
+                candidates.push_back({file, dead_ratio});
+            }
+        }
+    }
+    
+    // Most fragmented first, bounded by file count and by live bytes so the
+    // output stays within one file's worth
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return a.dead_ratio > b.dead_ratio;
+    });
     
-    if (!hint_file.is_open()) {
-        return Result<void>::Err("Failed to open hint file for writing");
+    std::vector<std::shared_ptr<LogFile>> inputs;
+    uint64_t live = 0;
+    uint64_t reclaimable = 0;
+    for (const auto& candidate : candidates) {
+        if (inputs.size() >= config_.compaction_max_files) {
+            break;
+        }
+        uint64_t file_live = candidate.file->live_bytes();
+        if (!inputs.empty() && live + file_live > config_.max_file_size) {
+            continue;
+        }
+        inputs.push_back(candidate.file);
+        live += file_live;
+        reclaimable += candidate.file->size() - std::min(candidate.file->size(), file_live);
     }
     
-    for (const auto& hint : hints) {
-        // Write: timestamp, key_size, value_size, value_pos, key
-        hint_file.write(reinterpret_cast<const char*>(&hint.entry.timestamp), 
-                       sizeof(hint.entry.timestamp));
-        
-        uint32_t key_size = hint.key.size();
-        hint_file.write(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
-        hint_file.write(reinterpret_cast<const char*>(&hint.entry.value_size), 
-                       sizeof(hint.entry.value_size));
-        hint_file.write(reinterpret_cast<const char*>(&hint.entry.value_pos), 
-                       sizeof(hint.entry.value_pos));
-        hint_file.write(hint.key.data(), hint.key.size());
+    if (reclaimable < config_.compaction_min_reclaim_bytes) {
+        return {};
     }
     
-    hint_file.close();
-    return Result<void>::Ok();
+    std::sort(inputs.begin(), inputs.end(), [](const auto& a, const auto& b) {
+        return a->id() < b->id();
+    });
+    return inputs;
+}
+
+Result<bool> Bitcask::compact() {
+    auto start = op_start(Metrics::Op::Compaction);
+    auto result = compact_files();
+    if (!result.ok() || result.value) {
+        op_done(Metrics::Op::Compaction, start, result.ok());
+    }
+    return result;
 }
 
-Result<bool> Bitcask::read_hint_file(uint32_t file_id) {
-    std::string hint_path = config_.directory + "/cask." + std::to_string(file_id) + ".hint";
-    std::ifstream hint_file(hint_path, std::ios::binary);
+Result<bool> Bitcask::compact_files() {
+    std::lock_guard<std::mutex> compaction_lock(compaction_mutex_);
     
-    if (!hint_file.is_open()) {
-        return Result<bool>::Ok(false);  // Hint file doesn't exist
+    auto inputs = pick_compaction_inputs();
+    if (inputs.empty()) {
+        return Result<bool>::Ok(false);
     }
     
-    while (hint_file.peek() != EOF) {
-        IndexEntry entry;
-        entry.file_id = file_id;
+    // A tombstone can only be dropped if every file older than its own is
+    // compacted in this round too, or an older value would come back at
+    // recovery. old_files_ and inputs are both sorted by id.
+    std::vector<bool> drop_tombstones(inputs.size());
+    {
+        std::shared_lock<std::shared_mutex> files_lock(files_mutex_);
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            uint32_t id = inputs[i]->id();
+            size_t older = std::count_if(old_files_.begin(), old_files_.end(),
+                                         [&](const auto& file) { return file->id() < id; });
+            drop_tombstones[i] = older == i;
+        }
+    }
+    
+    // The output must sort after every input but before anything written
+    // from now on: take the next id and move writes to a newer file
+    uint32_t output_id;
+    {
+        std::lock_guard<std::mutex> write_lock(write_mutex_);
+        output_id = next_file_id_++;
+        auto rotate_result = rotate_active_file();
+        if (!rotate_result.ok()) {
+            return Result<bool>::Err(rotate_result.err());
+        }
+    }
+    
+    std::string merge_dir = config_.directory + "/.merge";
+    if (mkdir(merge_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        return Result<bool>::Err("Failed to create merge directory");
+    }
+    
+    // Copy records the index still points at. Writes keep landing in the
+    // active file meanwhile; the swap below only repoints keys they haven't
+    // touched.
+    struct Relocation {
+        std::string key;
+        IndexEntry from;
+        IndexEntry to;
+    };
+    std::vector<Relocation> relocations;
+    std::vector<HashIndex::HintEntry> hints;
+    uint64_t kept_tombstone_bytes = 0;
+    uint64_t kept_tombstones = 0;
+    auto output = std::make_unique<LogFile>(output_id, merge_dir, false);
+    std::string output_tmp = merge_dir + "/cask." + std::to_string(output_id);
+    std::string output_path = config_.directory + "/cask." + std::to_string(output_id);
+    std::string hint_path = HintFile::path_for(config_.directory, output_id);
+    
+    // Until the output is renamed into place nothing else has changed, so a
+    // failed round only has its own files to drop
+    auto abandon = [&](const std::string& error) {
+        output.reset();
+        remove(output_tmp.c_str());
+        remove(hint_path.c_str());
+        return Result<bool>::Err(error);
+    };
+    
+    RecordCopier copier(*output, config_.block_crc);
+    
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        uint32_t file_id = inputs[i]->id();
+        bool drop = drop_tombstones[i];
+        Result<void> write_result = Result<void>::Ok();
         
-        hint_file.read(reinterpret_cast<char*>(&entry.timestamp), sizeof(entry.timestamp));
+        auto scan_result = inputs[i]->scan([&](const LogFile::RecordView& record) {
+            std::string key(record.key);
+            auto current = index_.lookup(key);
+            
+            if (record.flags & kRecordTombstone) {
+                // Still needed while the key stays deleted and older files
+                // remain. A Hashed keydir keeps no tombstones, so asks
+                // whether the key has come back instead.
+                bool superseded = config_.index_type == IndexType::Hashed
+                                ? contains(key)
+                                : !current || !current->is_tombstone();
+                if (drop || superseded) {
+                    return true;
+                }
+            } else if (!current || current->is_tombstone() || current->file_id != file_id ||
+                       current->value_pos != record.value_pos) {
+                return true;  // Superseded or deleted
+            }
+            
+            auto copy_result = copier.add(record);
+            if (!copy_result.ok()) {
+                write_result = Result<void>::Err(copy_result.err());
+                return false;
+            }
+            
+            const IndexEntry& to = copy_result.value;
+            if (record.flags & kRecordTombstone) {
+                kept_tombstone_bytes += to.record_size(record.key.size());
+                ++kept_tombstones;
+            } else {
+                hints.push_back({key, to});
+                relocations.push_back({std::move(key), *current, to});
+            }
+            return true;
+        });
         
-        uint32_t key_size;
-        hint_file.read(reinterpret_cast<char*>(&key_size), sizeof(key_size));
-        hint_file.read(reinterpret_cast<char*>(&entry.value_size), sizeof(entry.value_size));
-        hint_file.read(reinterpret_cast<char*>(&entry.value_pos), sizeof(entry.value_pos));
+        if (!scan_result.ok()) {
+            return abandon("Failed to read log file: " + scan_result.err());
+        }
+        if (write_result.ok()) {
+            write_result = copier.flush();
+        }
+        if (!write_result.ok()) {
+            return abandon("Failed to write compacted file: " + write_result.err());
+        }
+    }
+    
+    // The copy must be durable before any input is deleted
+    bool has_output = !output->empty();
+    if (has_output) {
+        auto sync_result = output->sync(config_.sync_metadata);
+        if (!sync_result.ok()) {
+            return abandon(sync_result.err());
+        }
+    }
+    uint64_t output_size = output->size();
+    output.reset();
+    
+    std::shared_ptr<LogFile> compacted;
+    if (has_output) {
+        // Hints carry no tombstones, so a file keeping some is scanned instead
+        if (kept_tombstone_bytes == 0) {
+            auto hint_result = HintFile::write(hint_path, output_size, hints);
+            if (!hint_result.ok()) {
+                return abandon(hint_result.err());
+            }
+        }
+        if (std::rename(output_tmp.c_str(), output_path.c_str()) != 0) {
+            return abandon("Failed to move compacted file into place");
+        }
+        sync_directory();
         
-        std::vector<char> key_buffer(key_size);
-        hint_file.read(key_buffer.data(), key_size);
+        compacted = open_immutable_file(output_id);
+        compacted->add_records(relocations.size() + kept_tombstones);
+        compacted->add_live(kept_tombstone_bytes, 0);
         
-        if (!hint_file.good() && !hint_file.eof()) {
-            return Result<bool>::Err("Corrupted hint file");
+        std::unique_lock<std::shared_mutex> files_lock(files_mutex_);
+        install_immutable_file(compacted);
+    } else {
+        remove(output_tmp.c_str());
+    }
+    
+    // Repoint keys that still refer to the copied records. Readers resolve
+    // either location until the inputs are unregistered below.
+    for (const auto& relocation : relocations) {
+        int64_t bytes = relocation.to.record_size(relocation.key.size());
+        compacted->add_live(bytes, 1);
+        if (!index_.compare_and_set(relocation.key, relocation.from, relocation.to)) {
+            compacted->add_live(-bytes, -1);  // Overwritten while we copied
         }
-        
-        std::string key(key_buffer.begin(), key_buffer.end());
-        index_.put(key, entry);
+    }
+    
+    {
+        std::unique_lock<std::shared_mutex> files_lock(files_mutex_);
+        for (const auto& input : inputs) {
+            files_.erase(input->id());
+            old_files_.erase(std::find(old_files_.begin(), old_files_.end(), input));
+        }
+    }
+    
+    // Readers still holding an input's handle finish on the unlinked file
+    for (const auto& input : inputs) {
+        std::string path = config_.directory + "/cask." + std::to_string(input->id());
+        remove(path.c_str());
+        remove(HintFile::path_for(config_.directory, input->id()).c_str());
     }
     
     return Result<bool>::Ok(true);
 }
 
+void Bitcask::compactor_loop() {
+    auto interval = std::chrono::milliseconds(config_.compaction_interval_ms);
+    std::unique_lock<std::mutex> lock(compactor_mutex_);
+    
+    while (!stop_compactor_) {
+        compactor_cv_.wait_for(lock, interval, [&] { return stop_compactor_; });
+        if (stop_compactor_) {
+            break;
+        }
+        
+        // Compact without holding compactor_mutex_ so shutdown can signal us
+        lock.unlock();
+        compact();
+        lock.lock();
+    }
+}
+
 } // namespace bitcask
\ No newline at end of file
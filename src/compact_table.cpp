@@ -0,0 +1,455 @@
+#include "../include/compact_table.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace bitcask {
+
+namespace {
+
+// Decorrelate from the shard choice, which already consumed some hash bits
+uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t hash_key(std::string_view key) {
+    return mix(std::hash<std::string_view>{}(key));
+}
+
+// Bitmask of the bytes in a 16-byte control group equal to value
+uint32_t match_group(const uint8_t* group, uint8_t value) {
+#if defined(__SSE2__)
+    __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    __m128i target = _mm_set1_epi8(static_cast<char>(value));
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, target)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < 16; ++i) {
+        mask |= static_cast<uint32_t>(group[i] == value) << i;
+    }
+    return mask;
+#endif
+}
+
+__extension__ typedef unsigned __int128 uint128;
+
+size_t varint_size(uint64_t value) {
+    size_t n = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        ++n;
+    }
+    return n;
+}
+
+} // namespace
+
+PackedEntry PackedEntry::pack(const IndexEntry& entry) {
+    PackedEntry packed;
+    packed.timestamp = entry.timestamp;
+    
+    if (entry.is_tombstone()) {
+        packed.file_and_pos = static_cast<uint64_t>(kMaxFileId) << 40;
+        packed.value_size = 0;
+        return packed;
+    }
+    
+    packed.file_and_pos = (static_cast<uint64_t>(entry.file_id) << 40) |
+                          (static_cast<uint64_t>(entry.overhead) << 35) |
+                          (entry.value_pos & kMaxValuePos);
+    packed.value_size = entry.value_size | ((entry.flags & kRecordCompressed) ? kCompressedBit : 0);
+    return packed;
+}
+
+PackedEntry PackedEntry::overflow(uint32_t timestamp) {
+    PackedEntry packed;
+    packed.file_and_pos = static_cast<uint64_t>(kMaxFileId) << 40;
+    packed.value_size = 1;
+    packed.timestamp = timestamp;
+    return packed;
+}
+
+IndexEntry PackedEntry::unpack() const {
+    uint32_t file_id = static_cast<uint32_t>(file_and_pos >> 40);
+    if (file_id == kMaxFileId) {
+        return IndexEntry::create_tombstone(timestamp);
+    }
+    
+    IndexEntry entry;
+    entry.file_id = file_id;
+    entry.overhead = static_cast<uint8_t>((file_and_pos >> 35) & kMaxOverhead);
+    entry.value_pos = file_and_pos & kMaxValuePos;
+    entry.flags = (value_size & kCompressedBit) ? kRecordCompressed : 0;
+    entry.value_size = value_size & ~kCompressedBit;
+    entry.timestamp = timestamp;
+    return entry;
+}
+
+CompactKeyTable::CompactKeyTable()
+    : capacity_(0), size_(0), arena_used_(0), arena_bytes_(0) {
+    clear();
+}
+
+CompactKeyTable::~CompactKeyTable() = default;
+
+void CompactKeyTable::clear() {
+    capacity_ = kGroupSize;
+    size_ = 0;
+    overflow_.clear();
+    ctrl_.reset(new uint8_t[capacity_ + kGroupSize]);
+    std::memset(ctrl_.get(), kEmpty, capacity_ + kGroupSize);
+    slots_.reset(new Slot[capacity_]);
+    
+    arena_.clear();
+    arena_sizes_.clear();
+    arena_used_ = 0;
+    arena_bytes_ = 0;
+}
+
+size_t CompactKeyTable::memory_usage() const {
+    return capacity_ * sizeof(Slot) + capacity_ + kGroupSize + arena_bytes_ +
+           overflow_.size() * (sizeof(IndexEntry) + 3 * sizeof(void*));
+}
+
+IndexEntry CompactKeyTable::entry_at(const Slot& slot) const {
+    return slot.entry.is_overflow() ? overflow_.at(slot.key_ref) : slot.entry.unpack();
+}
+
+uint64_t CompactKeyTable::store_key(std::string_view key) {
+    size_t needed = varint_size(key.size()) + key.size();
+    
+    if (arena_.empty() || arena_used_ + needed > arena_sizes_.back()) {
+        // Chunks double from 4 KB up to kChunkSize so small shards stay small
+        size_t chunk_size = arena_sizes_.empty() ? 4096 : std::min(arena_sizes_.back() * 2, kChunkSize);
+        chunk_size = std::max(chunk_size, needed);
+        arena_.emplace_back(new char[chunk_size]);
+        arena_sizes_.push_back(chunk_size);
+        arena_bytes_ += chunk_size;
+        arena_used_ = 0;
+    }
+    
+    uint64_t ref = (static_cast<uint64_t>(arena_.size() - 1) << kChunkShift) | arena_used_;
+    
+    // Length-prefixed (varint) key bytes
+    auto* out = reinterpret_cast<uint8_t*>(arena_.back().get() + arena_used_);
+    uint64_t length = key.size();
+    while (length >= 0x80) {
+        *out++ = static_cast<uint8_t>(length | 0x80);
+        length >>= 7;
+    }
+    *out++ = static_cast<uint8_t>(length);
+    std::memcpy(out, key.data(), key.size());
+    
+    arena_used_ += needed;
+    return ref;
+}
+
+std::string_view CompactKeyTable::key_at(uint64_t key_ref) const {
+    const auto* p = reinterpret_cast<const uint8_t*>(
+        arena_[key_ref >> kChunkShift].get() + (key_ref & ((uint64_t(1) << kChunkShift) - 1)));
+    
+    uint64_t length = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+        length |= static_cast<uint64_t>(*p++ & 0x7F) << shift;
+        shift += 7;
+    }
+    length |= static_cast<uint64_t>(*p++) << shift;
+    
+    return std::string_view(reinterpret_cast<const char*>(p), length);
+}
+
+size_t CompactKeyTable::probe(std::string_view key, uint64_t hash, bool& found) const {
+    size_t mask = capacity_ - 1;
+    size_t pos = (hash >> 7) & mask;
+    uint8_t h2 = hash & 0x7F;
+    
+    // Triangular probing over groups visits every group of a power-of-two table
+    for (size_t step = kGroupSize;; step += kGroupSize) {
+        const uint8_t* group = ctrl_.get() + pos;
+        
+        for (uint32_t matches = match_group(group, h2); matches != 0; matches &= matches - 1) {
+            size_t index = (pos + __builtin_ctz(matches)) & mask;
+            if (key_at(slots_[index].key_ref) == key) {
+                found = true;
+                return index;
+            }
+        }
+        
+        uint32_t empties = match_group(group, kEmpty);
+        if (empties != 0) {
+            found = false;
+            return (pos + __builtin_ctz(empties)) & mask;
+        }
+        
+        pos = (pos + step) & mask;
+    }
+}
+
+void CompactKeyTable::set_ctrl(size_t index, uint8_t value) {
+    ctrl_[index] = value;
+    // Mirror the first group past the end so unaligned group loads wrap
+    if (index < kGroupSize) {
+        ctrl_[capacity_ + index] = value;
+    }
+}
+
+bool CompactKeyTable::find(std::string_view key, IndexEntry& entry) const {
+    bool found;
+    size_t index = probe(key, hash_key(key), found);
+    if (!found) {
+        return false;
+    }
+    
+    entry = entry_at(slots_[index]);
+    return true;
+}
+
+void CompactKeyTable::assign(std::string_view key, const IndexEntry& entry) {
+    uint64_t hash = hash_key(key);
+    bool found;
+    size_t index = probe(key, hash, found);
+    bool fits = PackedEntry::fits(entry);
+    
+    if (found) {
+        Slot& slot = slots_[index];
+        if (fits) {
+            if (slot.entry.is_overflow()) {
+                overflow_.erase(slot.key_ref);
+            }
+            slot.entry = PackedEntry::pack(entry);
+        } else {
+            slot.entry = PackedEntry::overflow(entry.timestamp);
+            overflow_[slot.key_ref] = entry;
+        }
+        return;
+    }
+    
+    // Keep the load factor at or below 7/8
+    if ((size_ + 1) * 8 > capacity_ * 7) {
+        grow();
+        index = probe(key, hash, found);
+    }
+    
+    slots_[index].key_ref = store_key(key);
+    if (fits) {
+        slots_[index].entry = PackedEntry::pack(entry);
+    } else {
+        slots_[index].entry = PackedEntry::overflow(entry.timestamp);
+        overflow_[slots_[index].key_ref] = entry;
+    }
+    set_ctrl(index, hash & 0x7F);
+    ++size_;
+}
+
+void CompactKeyTable::grow() {
+    size_t old_capacity = capacity_;
+    std::unique_ptr<uint8_t[]> old_ctrl = std::move(ctrl_);
+    std::unique_ptr<Slot[]> old_slots = std::move(slots_);
+    
+    capacity_ = old_capacity * 2;
+    ctrl_.reset(new uint8_t[capacity_ + kGroupSize]);
+    std::memset(ctrl_.get(), kEmpty, capacity_ + kGroupSize);
+    slots_.reset(new Slot[capacity_]);
+    
+    // Keys stay where they are in the arena; only slots move
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (!is_full(old_ctrl[i])) {
+            continue;
+        }
+        
+        // Keys are distinct, so just take the first empty slot on the probe path
+        uint64_t hash = hash_key(key_at(old_slots[i].key_ref));
+        size_t mask = capacity_ - 1;
+        size_t pos = (hash >> 7) & mask;
+        uint32_t empties;
+        for (size_t step = kGroupSize; (empties = match_group(ctrl_.get() + pos, kEmpty)) == 0;
+             step += kGroupSize) {
+            pos = (pos + step) & mask;
+        }
+        
+        size_t index = (pos + __builtin_ctz(empties)) & mask;
+        slots_[index] = old_slots[i];
+        set_ctrl(index, hash & 0x7F);
+    }
+}
+
+FingerprintTable::FingerprintTable() : capacity_(0), size_(0), deleted_(0) {
+    clear();
+}
+
+FingerprintTable::~FingerprintTable() = default;
+
+void FingerprintTable::clear() {
+    capacity_ = kGroupSize;
+    size_ = 0;
+    deleted_ = 0;
+    overflow_.clear();
+    ctrl_.reset(new uint8_t[capacity_]);
+    std::memset(ctrl_.get(), kEmpty, capacity_);
+    slots_.reset(new Slot[capacity_]);
+}
+
+size_t FingerprintTable::memory_usage() const {
+    return capacity_ * (sizeof(Slot) + 1) +
+           overflow_.size() * (sizeof(IndexEntry) + 3 * sizeof(void*));
+}
+
+IndexEntry FingerprintTable::entry_at(const Slot& slot) const {
+    PackedEntry packed;
+    packed.file_and_pos = slot.file_and_pos;
+    packed.value_size = slot.value_size;
+    packed.timestamp = 0;
+    return packed.is_overflow() ? overflow_.at(slot.fingerprint) : packed.unpack();
+}
+
+void FingerprintTable::store(Slot& slot, const IndexEntry& entry) {
+    PackedEntry packed;
+    if (PackedEntry::fits(entry)) {
+        packed = PackedEntry::pack(entry);
+        overflow_.erase(slot.fingerprint);
+    } else {
+        packed = PackedEntry::overflow(0);
+        IndexEntry& stored = overflow_[slot.fingerprint];
+        stored = entry;
+        stored.timestamp = 0;   // Like packed entries
+    }
+    slot.file_and_pos = packed.file_and_pos;
+    slot.value_size = packed.value_size;
+}
+
+size_t FingerprintTable::home_group(uint64_t hash) const {
+    // Multiply-shift onto any number of groups
+    return static_cast<size_t>((static_cast<uint128>(hash) * (capacity_ / kGroupSize)) >> 64);
+}
+
+size_t FingerprintTable::probe(uint64_t fingerprint, uint64_t hash, bool& found) const {
+    size_t groups = capacity_ / kGroupSize;
+    size_t group = home_group(hash);
+    uint8_t h2 = hash & 0x7F;
+    size_t free_slot = capacity_;
+    
+    for (;;) {
+        size_t base = group * kGroupSize;
+        const uint8_t* ctrl = ctrl_.get() + base;
+        
+        for (uint32_t matches = match_group(ctrl, h2); matches != 0; matches &= matches - 1) {
+            size_t index = base + __builtin_ctz(matches);
+            if (slots_[index].fingerprint == fingerprint) {
+                found = true;
+                return index;
+            }
+        }
+        
+        if (free_slot == capacity_) {
+            uint32_t deleted = match_group(ctrl, kDeleted);
+            if (deleted != 0) {
+                free_slot = base + __builtin_ctz(deleted);
+            }
+        }
+        
+        // An empty slot ends the probe sequence
+        uint32_t empties = match_group(ctrl, kEmpty);
+        if (empties != 0) {
+            found = false;
+            return free_slot != capacity_ ? free_slot : base + __builtin_ctz(empties);
+        }
+        
+        group = group + 1 == groups ? 0 : group + 1;
+    }
+}
+
+bool FingerprintTable::find(uint64_t fingerprint, IndexEntry& entry) const {
+    bool found;
+    size_t index = probe(fingerprint, mix(fingerprint), found);
+    if (!found) {
+        return false;
+    }
+    
+    entry = entry_at(slots_[index]);
+    return true;
+}
+
+void FingerprintTable::assign(uint64_t fingerprint, const IndexEntry& entry) {
+    uint64_t hash = mix(fingerprint);
+    bool found;
+    size_t index = probe(fingerprint, hash, found);
+    
+    if (found) {
+        store(slots_[index], entry);
+        return;
+    }
+    
+    // Deleted slots count against the 7/8 load factor; purge them in place
+    // when they, rather than live entries, are what fills the table
+    if (ctrl_[index] == kEmpty && (size_ + deleted_ + 1) * 8 > capacity_ * 7) {
+        size_t groups = capacity_ / kGroupSize;
+        rehash((size_ + 1) * 16 > capacity_ * 7 ? (groups + (groups + 1) / 2) * kGroupSize
+                                                 : capacity_);
+        index = probe(fingerprint, hash, found);
+    }
+    
+    if (ctrl_[index] == kDeleted) {
+        --deleted_;
+    }
+    slots_[index].fingerprint = fingerprint;
+    store(slots_[index], entry);
+    ctrl_[index] = hash & 0x7F;
+    ++size_;
+}
+
+bool FingerprintTable::erase(uint64_t fingerprint) {
+    bool found;
+    size_t index = probe(fingerprint, mix(fingerprint), found);
+    if (!found) {
+        return false;
+    }
+    
+    overflow_.erase(fingerprint);
+    ctrl_[index] = kDeleted;
+    --size_;
+    ++deleted_;
+    return true;
+}
+
+void FingerprintTable::rehash(size_t capacity) {
+    size_t old_capacity = capacity_;
+    std::unique_ptr<uint8_t[]> old_ctrl = std::move(ctrl_);
+    std::unique_ptr<Slot[]> old_slots = std::move(slots_);
+    
+    capacity_ = capacity;
+    deleted_ = 0;
+    ctrl_.reset(new uint8_t[capacity_]);
+    std::memset(ctrl_.get(), kEmpty, capacity_);
+    slots_.reset(new Slot[capacity_]);
+    
+    // Fingerprints are distinct, so just take the first empty slot on the probe path
+    size_t groups = capacity_ / kGroupSize;
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (!is_full(old_ctrl[i])) {
+            continue;
+        }
+        
+        uint64_t hash = mix(old_slots[i].fingerprint);
+        size_t group = home_group(hash);
+        uint32_t empties;
+        while ((empties = match_group(ctrl_.get() + group * kGroupSize, kEmpty)) == 0) {
+            group = group + 1 == groups ? 0 : group + 1;
+        }
+        
+        size_t index = group * kGroupSize + __builtin_ctz(empties);
+        slots_[index] = old_slots[i];
+        ctrl_[index] = hash & 0x7F;
+    }
+}
+
+} // namespace bitcask
@@ -0,0 +1,276 @@
+#include "../include/crc32.h"
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+namespace bitcask {
+
+namespace {
+
+constexpr uint32_t kPolynomial = 0xEDB88320;
+
+// tables[0] is the classic byte table; tables[k][b] is the CRC of byte b
+// followed by k zero bytes, which lets slicing-by-8 fold 8 bytes at once
+constexpr std::array<std::array<uint32_t, 256>, 8> make_tables() {
+    std::array<std::array<uint32_t, 256>, 8> tables{};
+    
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; ++j) {
+            crc = (crc & 1) ? (crc >> 1) ^ kPolynomial : crc >> 1;
+        }
+        tables[0][i] = crc;
+    }
+    
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (size_t k = 1; k < 8; ++k) {
+            uint32_t prev = tables[k - 1][i];
+            tables[k][i] = (prev >> 8) ^ tables[0][prev & 0xFF];
+        }
+    }
+    
+    return tables;
+}
+
+constexpr auto kTables = make_tables();
+
+// The helpers below work on the raw (pre-/post-inverted) register value
+
+uint32_t reference_raw(uint32_t crc, const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        crc ^= data[i];
+        for (int j = 0; j < 8; ++j) {
+            if (crc & 1) {
+                crc = (crc >> 1) ^ kPolynomial;
+            } else {
+                crc >>= 1;
+            }
+        }
+    }
+    return crc;
+}
+
+uint32_t slicing8_raw(uint32_t crc, const uint8_t* data, size_t length) {
+    while (length >= 8) {
+        uint32_t lo;
+        uint32_t hi;
+        std::memcpy(&lo, data, 4);
+        std::memcpy(&hi, data + 4, 4);
+        lo ^= crc;  // Little-endian layout assumed, as for the on-disk format
+        
+        crc = kTables[7][lo & 0xFF] ^
+              kTables[6][(lo >> 8) & 0xFF] ^
+              kTables[5][(lo >> 16) & 0xFF] ^
+              kTables[4][lo >> 24] ^
+              kTables[3][hi & 0xFF] ^
+              kTables[2][(hi >> 8) & 0xFF] ^
+              kTables[1][(hi >> 16) & 0xFF] ^
+              kTables[0][hi >> 24];
+        
+        data += 8;
+        length -= 8;
+    }
+    
+    while (length-- > 0) {
+        crc = (crc >> 8) ^ kTables[0][(crc ^ *data++) & 0xFF];
+    }
+    
+    return crc;
+}
+
+#if defined(__x86_64__)
+
+// Carry-less multiplication folding (Intel, "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ"). Folds 64 bytes per iteration and finishes
+// with a Barrett reduction. Requires length >= 64 and a multiple of 16.
+__attribute__((target("pclmul,sse4.1")))
+uint32_t pclmul_raw(uint32_t crc, const uint8_t* buf, size_t length) {
+    alignas(16) static const uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+    alignas(16) static const uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+    alignas(16) static const uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+    alignas(16) static const uint64_t poly[] = {0x01db710641, 0x01f7011641};
+    
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+    
+    x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x00));
+    x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x10));
+    x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x20));
+    x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+    buf += 64;
+    length -= 64;
+    
+    // Fold four 128-bit lanes in parallel
+    while (length >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        y5 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x00));
+        y6 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x10));
+        y7 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x20));
+        y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x30));
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+        buf += 64;
+        length -= 64;
+    }
+    
+    // Fold the four lanes into one
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+    
+    // Single fold of any remaining 16-byte blocks
+    while (length >= 16) {
+        x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf));
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        buf += 16;
+        length -= 16;
+    }
+    
+    // Fold 128 bits down to 64
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    
+    // Barrett reduction to 32 bits
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    
+    return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+uint32_t hardware_raw(uint32_t crc, const uint8_t* data, size_t length) {
+    if (length >= 64) {
+        size_t chunk = length & ~static_cast<size_t>(15);
+        crc = pclmul_raw(crc, data, chunk);
+        data += chunk;
+        length -= chunk;
+    }
+    return slicing8_raw(crc, data, length);
+}
+
+bool detect_hardware() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+
+#elif defined(__aarch64__)
+
+// The ARMv8 CRC32 instructions implement exactly this polynomial
+__attribute__((target("+crc")))
+uint32_t hardware_raw(uint32_t crc, const uint8_t* data, size_t length) {
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        crc = __crc32d(crc, word);
+        data += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        crc = __crc32b(crc, *data++);
+    }
+    return crc;
+}
+
+bool detect_hardware() {
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+#else
+
+uint32_t hardware_raw(uint32_t crc, const uint8_t* data, size_t length) {
+    return slicing8_raw(crc, data, length);
+}
+
+bool detect_hardware() {
+    return false;
+}
+
+#endif
+
+using RawFn = uint32_t (*)(uint32_t, const uint8_t*, size_t);
+
+const bool kHardwareAvailable = detect_hardware();
+const Crc32Impl kActiveImpl = kHardwareAvailable ? Crc32Impl::Hardware : Crc32Impl::Slicing8;
+const RawFn kActiveFn = kHardwareAvailable ? hardware_raw : slicing8_raw;
+
+} // namespace
+
+uint32_t crc32(const uint8_t* data, size_t length, uint32_t crc) {
+    return ~kActiveFn(~crc, data, length);
+}
+
+uint32_t crc32_with(Crc32Impl impl, const uint8_t* data, size_t length, uint32_t crc) {
+    switch (impl) {
+        case Crc32Impl::Reference:
+            return ~reference_raw(~crc, data, length);
+        case Crc32Impl::Slicing8:
+            return ~slicing8_raw(~crc, data, length);
+        case Crc32Impl::Hardware:
+            return ~(kHardwareAvailable ? hardware_raw : slicing8_raw)(~crc, data, length);
+    }
+    return 0;
+}
+
+bool crc32_hardware_available() {
+    return kHardwareAvailable;
+}
+
+Crc32Impl crc32_active_impl() {
+    return kActiveImpl;
+}
+
+const char* crc32_impl_name(Crc32Impl impl) {
+    switch (impl) {
+        case Crc32Impl::Reference:
+            return "reference";
+        case Crc32Impl::Slicing8:
+            return "slicing-by-8";
+        case Crc32Impl::Hardware:
+#if defined(__x86_64__)
+            return "pclmulqdq";
+#elif defined(__aarch64__)
+            return "armv8-crc32";
+#else
+            return "hardware";
+#endif
+    }
+    return "unknown";
+}
+
+} // namespace bitcask
@@ -0,0 +1,98 @@
+#include "../include/file_registry.h"
+
+namespace bitcask {
+
+void FdCache::opened(const LogFile* file) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    if (positions_.count(file) == 0) {
+        // Newcomers go just behind the hand, the last place it looks
+        positions_[file] = ring_.insert(hand_, file);
+    }
+    
+    if (max_open_ == 0) {
+        return;
+    }
+    
+    // Sweep: referenced files get a second chance, the rest are evicted.
+    // Two full turns clear every referenced bit, so this terminates.
+    size_t budget = 2 * ring_.size();
+    while (ring_.size() > max_open_ && budget-- > 0) {
+        if (hand_ == ring_.end()) {
+            hand_ = ring_.begin();
+        }
+        
+        const LogFile* candidate = *hand_;
+        if (candidate == file || candidate->take_referenced()) {
+            ++hand_;
+            continue;
+        }
+        
+        candidate->release_read_handle();
+        erase(hand_++);
+    }
+}
+
+void FdCache::forget(const LogFile* file) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    auto it = positions_.find(file);
+    if (it != positions_.end()) {
+        Ring::iterator position = it->second;
+        if (hand_ == position) {
+            ++hand_;
+        }
+        erase(position);
+    }
+}
+
+size_t FdCache::open_count() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ring_.size();
+}
+
+void FdCache::erase(Ring::iterator it) {
+    positions_.erase(*it);
+    ring_.erase(it);
+}
+
+void FileRegistry::insert(std::shared_ptr<LogFile> file) {
+    uint32_t file_id = file->id();
+    
+    if (files_.empty()) {
+        base_ = file_id;
+    } else if (file_id < base_) {
+        files_.insert(files_.begin(), base_ - file_id, nullptr);
+        base_ = file_id;
+    }
+    
+    if (file_id - base_ >= files_.size()) {
+        files_.resize(file_id - base_ + 1);
+    }
+    files_[file_id - base_] = std::move(file);
+}
+
+void FileRegistry::erase(uint32_t file_id) {
+    if (file_id < base_ || file_id - base_ >= files_.size()) {
+        return;
+    }
+    files_[file_id - base_].reset();
+    
+    // Merge retires the oldest ids; don't keep a growing run of empty slots
+    size_t leading = 0;
+    while (leading < files_.size() && !files_[leading]) {
+        ++leading;
+    }
+    files_.erase(files_.begin(), files_.begin() + leading);
+    base_ += leading;
+    while (!files_.empty() && !files_.back()) {
+        files_.pop_back();
+    }
+}
+
+void FileRegistry::clear() {
+    files_.clear();
+    base_ = 0;
+}
+
+} // namespace bitcask
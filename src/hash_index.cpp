@@ -1,27 +1,259 @@
 #include "../include/hash_index.h"
+#include <functional>
+#include <mutex>
+#include <unordered_set>
 
 namespace bitcask {
 
-void HashIndex::put(const std::string& key, const IndexEntry& entry) {
-    index_[key] = entry;
+namespace {
+
+// Identity of a key in a Hashed shard; the table mixes it before probing
+uint64_t fingerprint(std::string_view key) {
+    return std::hash<std::string_view>{}(key);
+}
+
+bool same_location(const IndexEntry& a, const IndexEntry& b) {
+    return a.file_id == b.file_id && a.value_pos == b.value_pos;
+}
+
+} // namespace
+
+HashIndex::HashIndex(size_t num_shards, IndexType type, KeyCheck key_check)
+    : key_check_(std::move(key_check)) {
+    if (num_shards == 0) {
+        num_shards = 1;
+    }
+    
+    shards_.reserve(num_shards);
+    for (size_t i = 0; i < num_shards; ++i) {
+        shards_.push_back(std::make_unique<Shard>());
+        if (type == IndexType::Compact) {
+            shards_.back()->compact = std::make_unique<CompactKeyTable>();
+        } else if (type == IndexType::Hashed) {
+            shards_.back()->hashed = std::make_unique<FingerprintTable>();
+        }
+    }
+}
+
+bool HashIndex::Shard::find(const std::string& key, IndexEntry& entry) const {
+    if (compact) {
+        return compact->find(key, entry);
+    }
+    
+    auto it = map.find(key);
+    if (it == map.end()) {
+        return false;
+    }
+    entry = it->second;
+    return true;
+}
+
+void HashIndex::Shard::assign(const std::string& key, const IndexEntry& entry) {
+    if (compact) {
+        compact->assign(key, entry);
+    } else {
+        map[key] = entry;
+    }
+}
+
+std::optional<IndexEntry> HashIndex::Shard::replace(const std::string& key,
+                                                   const IndexEntry& entry) {
+    std::optional<IndexEntry> previous;
+    if (compact) {
+        IndexEntry old;
+        if (compact->find(key, old)) {
+            previous = old;
+        }
+        compact->assign(key, entry);
+        return previous;
+    }
+    
+    auto [it, inserted] = map.try_emplace(key, entry);
+    if (!inserted) {
+        previous = it->second;
+        it->second = entry;
+    }
+    return previous;
+}
+
+size_t HashIndex::Shard::memory_usage() const {
+    if (compact) {
+        return compact->memory_usage();
+    }
+    
+    // Bucket array plus one node per key (next pointer, cached hash, the
+    // pair itself) plus heap storage for keys too long for SSO
+    size_t bytes = hashed ? hashed->memory_usage() : 0;
+    bytes += map.bucket_count() * sizeof(void*);
+    for (const auto& [key, entry] : map) {
+        bytes += sizeof(void*) + sizeof(size_t) + sizeof(ShardMap::value_type);
+        if (key.capacity() > 15) {
+            bytes += key.capacity() + 1;
+        }
+    }
+    return bytes;
+}
+
+size_t HashIndex::shard_of(const std::string& key) const {
+    size_t hash = std::hash<std::string>{}(key);
+    // Mix the high bits in so shard choice is independent of bucket choice
+    return (hash ^ (hash >> 32)) % shards_.size();
+}
+
+bool HashIndex::find_hashed(const Shard& shard, const std::string& key, IndexEntry& entry,
+                            bool check_key) const {
+    if (!shard.map.empty() && shard.find(key, entry)) {
+        return true;
+    }
+    if (!shard.hashed->find(fingerprint(key), entry)) {
+        return false;
+    }
+    if (!check_key) {
+        return true;
+    }
+    auto owned = owns(key, entry);
+    return owned.ok() && owned.value;
+}
+
+Result<std::optional<IndexEntry>> HashIndex::put(const std::string& key, const IndexEntry& entry,
+                                                 const KeyCheck& key_check) {
+    using PutResult = Result<std::optional<IndexEntry>>;
+    Shard& shard = shard_for(key);
+    std::unique_lock lock(shard.mutex);
+    if (!shard.hashed) {
+        return PutResult::Ok(shard.replace(key, entry));
+    }
+    
+    if (!shard.map.empty()) {
+        auto it = shard.map.find(key);
+        if (it != shard.map.end()) {
+            IndexEntry previous = it->second;
+            it->second = entry;
+            return PutResult::Ok(previous);
+        }
+    }
+    
+    uint64_t hash = fingerprint(key);
+    IndexEntry current;
+    if (!shard.hashed->find(hash, current)) {
+        shard.hashed->assign(hash, entry);
+        return PutResult::Ok(std::nullopt);
+    }
+    auto owned = owns(key, current, key_check);
+    if (!owned.ok()) {
+        return PutResult::Err("Failed to check key: " + owned.err());
+    }
+    if (owned.value) {
+        shard.hashed->assign(hash, entry);
+        return PutResult::Ok(current);
+    }
+    
+    // Another key has this fingerprint; it keeps the slot
+    shard.map.emplace(key, entry);
+    return PutResult::Ok(std::nullopt);
 }
 
 std::optional<IndexEntry> HashIndex::get(const std::string& key) const {
-    auto it = index_.find(key);
-    if (it == index_.end()) {
+    Shard& shard = shard_for(key);
+    std::shared_lock lock(shard.mutex);
+    
+    IndexEntry entry;
+    if (shard.hashed ? !find_hashed(shard, key, entry, true) : !shard.find(key, entry)) {
         return std::nullopt;
     }
     
     // Don't return tombstones
-    if (it->second.is_tombstone()) {
+    if (entry.is_tombstone()) {
+        return std::nullopt;
+    }
+    
+    return entry;
+}
+
+std::optional<IndexEntry> HashIndex::lookup(const std::string& key) const {
+    Shard& shard = shard_for(key);
+    std::shared_lock lock(shard.mutex);
+    
+    IndexEntry entry;
+    if (shard.hashed ? !find_hashed(shard, key, entry, false) : !shard.find(key, entry)) {
         return std::nullopt;
     }
+    return entry;
+}
+
+Result<std::optional<IndexEntry>> HashIndex::remove(const std::string& key, uint32_t timestamp,
+                                                    const KeyCheck& key_check) {
+    using RemoveResult = Result<std::optional<IndexEntry>>;
+    Shard& shard = shard_for(key);
+    std::unique_lock lock(shard.mutex);
+    if (!shard.hashed) {
+        return RemoveResult::Ok(shard.replace(key, IndexEntry::create_tombstone(timestamp)));
+    }
+    
+    if (!shard.map.empty()) {
+        auto it = shard.map.find(key);
+        if (it != shard.map.end()) {
+            IndexEntry previous = it->second;
+            shard.map.erase(it);
+            return RemoveResult::Ok(previous);
+        }
+    }
+    
+    uint64_t hash = fingerprint(key);
+    IndexEntry current;
+    if (!shard.hashed->find(hash, current)) {
+        return RemoveResult::Ok(std::nullopt);
+    }
+    auto owned = owns(key, current, key_check);
+    if (!owned.ok()) {
+        return RemoveResult::Err("Failed to check key: " + owned.err());
+    }
+    if (owned.value) {
+        shard.hashed->erase(hash);
+        return RemoveResult::Ok(current);
+    }
+    return RemoveResult::Ok(std::nullopt);
+}
+
+Result<bool> HashIndex::check(const std::string& key) const {
+    Shard& shard = shard_for(key);
+    std::shared_lock lock(shard.mutex);
+    if (!shard.hashed || (!shard.map.empty() && shard.map.find(key) != shard.map.end())) {
+        return Result<bool>::Ok(true);
+    }
     
-    return it->second;
+    IndexEntry current;
+    if (!shard.hashed->find(fingerprint(key), current)) {
+        return Result<bool>::Ok(true);
+    }
+    auto owned = owns(key, current);
+    if (!owned.ok()) {
+        return Result<bool>::Err("Failed to check key: " + owned.err());
+    }
+    return owned;
 }
 
-void HashIndex::remove(const std::string& key, uint32_t timestamp) {
-    index_[key] = IndexEntry::create_tombstone(timestamp);
+bool HashIndex::compare_and_set(const std::string& key, const IndexEntry& expected,
+                                const IndexEntry& desired) {
+    Shard& shard = shard_for(key);
+    std::unique_lock lock(shard.mutex);
+    
+    // A record's location identifies its key, so Hashed shards need no key
+    // check here
+    IndexEntry current;
+    if (shard.hashed ? !find_hashed(shard, key, current, false) : !shard.find(key, current)) {
+        return false;
+    }
+    if (current.is_tombstone() || !same_location(current, expected)) {
+        return false;
+    }
+    
+    if (shard.hashed && shard.map.find(key) == shard.map.end()) {
+        shard.hashed->assign(fingerprint(key), desired);
+    } else {
+        shard.assign(key, desired);
+    }
+    return true;
 }
 
 bool HashIndex::contains(const std::string& key) const {
@@ -31,12 +263,14 @@ bool HashIndex::contains(const std::string& key) const {
 
 std::vector<std::string> HashIndex::keys() const {
     std::vector<std::string> result;
-    result.reserve(index_.size());
     
-    for (const auto& [key, entry] : index_) {
-        if (!entry.is_tombstone()) {
-            result.push_back(key);
-        }
+    for (const auto& shard : shards_) {
+        std::shared_lock lock(shard->mutex);
+        shard->for_each([&](std::string_view key, const IndexEntry& entry) {
+            if (!entry.is_tombstone()) {
+                result.emplace_back(key);
+            }
+        });
     }
     
     return result;
@@ -44,29 +278,126 @@ std::vector<std::string> HashIndex::keys() const {
 
 size_t HashIndex::size() const {
     size_t count = 0;
-    for (const auto& [key, entry] : index_) {
-        if (!entry.is_tombstone()) {
-            count++;
+    for (const auto& shard : shards_) {
+        std::shared_lock lock(shard->mutex);
+        shard->for_each([&](std::string_view, const IndexEntry& entry) {
+            if (!entry.is_tombstone()) {
+                count++;
+            }
+        });
+        if (shard->hashed) {
+            count += shard->hashed->size();
         }
     }
     return count;
 }
 
+void HashIndex::for_each(
+    const std::function<void(std::string_view key, const IndexEntry& entry)>& fn) const {
+    for (const auto& shard : shards_) {
+        std::shared_lock lock(shard->mutex);
+        shard->for_each(fn);
+    }
+}
+
 void HashIndex::clear() {
-    index_.clear();
+    for (const auto& shard : shards_) {
+        std::unique_lock lock(shard->mutex);
+        shard->map.clear();
+        if (shard->compact) {
+            shard->compact->clear();
+        }
+        if (shard->hashed) {
+            shard->hashed->clear();
+        }
+    }
 }
 
 std::vector<HashIndex::HintEntry> HashIndex::export_hints() const {
     std::vector<HintEntry> hints;
-    hints.reserve(index_.size());
     
-    for (const auto& [key, entry] : index_) {
-        if (!entry.is_tombstone()) {
-            hints.push_back({key, entry});
-        }
+    for (const auto& shard : shards_) {
+        std::shared_lock lock(shard->mutex);
+        shard->for_each([&](std::string_view key, const IndexEntry& entry) {
+            if (!entry.is_tombstone()) {
+                hints.push_back({std::string(key), entry});
+            }
+        });
     }
     
     return hints;
 }
 
-} // namespace bitcask
\ No newline at end of file
+size_t HashIndex::memory_usage() const {
+    size_t bytes = 0;
+    for (const auto& shard : shards_) {
+        std::shared_lock lock(shard->mutex);
+        bytes += shard->memory_usage();
+    }
+    return bytes;
+}
+
+void HashIndex::load_shard(size_t shard, ShardMap&& entries) {
+    Shard& target = *shards_[shard];
+    std::unique_lock lock(target.mutex);
+    
+    if (target.compact) {
+        for (const auto& [key, entry] : entries) {
+            target.compact->assign(key, entry);
+        }
+        entries.clear();
+        return;
+    }
+    
+    if (target.map.empty()) {
+        target.map = std::move(entries);
+        return;
+    }
+    
+    while (!entries.empty()) {
+        auto node = entries.extract(entries.begin());
+        auto result = target.map.insert(std::move(node));
+        if (!result.inserted) {
+            result.position->second = result.node.mapped();
+        }
+    }
+}
+
+void HashIndex::seal() {
+    for (const auto& shard : shards_) {
+        std::unique_lock lock(shard->mutex);
+        if (!shard->hashed) {
+            return;
+        }
+        
+        // Fingerprints of two or more live keys stay keyed in the map
+        std::unordered_set<uint64_t> shared;
+        for (const auto& [key, entry] : shard->map) {
+            if (entry.is_tombstone()) {
+                continue;
+            }
+            uint64_t hash = fingerprint(key);
+            IndexEntry existing;
+            if (shard->hashed->find(hash, existing)) {
+                shared.insert(hash);
+            } else {
+                shard->hashed->assign(hash, entry);
+            }
+        }
+        
+        ShardMap collided;
+        if (!shared.empty()) {
+            for (auto& [key, entry] : shard->map) {
+                if (!entry.is_tombstone() && shared.count(fingerprint(key))) {
+                    collided.emplace(key, entry);
+                }
+            }
+            for (uint64_t hash : shared) {
+                shard->hashed->erase(hash);
+            }
+        }
+        shard->map = std::move(collided);
+    }
+}
+
+} // namespace bitcask
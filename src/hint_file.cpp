@@ -0,0 +1,222 @@
+#include "../include/hint_file.h"
+#include "../include/log_file.h"
+#include "../include/crc32.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+namespace bitcask {
+
+namespace {
+
+// Walk entries of the given version in [data, data + length), counting
+// them. Returns false if the last entry is cut short. The visitor may be
+// null to only validate. Entries before version 4 get overhead, the same
+// for every record of their log.
+bool parse_entries(const char* data, size_t length, uint32_t version, uint32_t file_id,
+                   uint8_t overhead, const HintFile::Visitor* visitor, uint64_t& count) {
+    // Versions before 3 have no flags byte, before 4 no overhead
+    const size_t header_size = version >= 4 ? sizeof(HintEntryHeader)
+                             : version == 3 ? offsetof(HintEntryHeader, overhead)
+                                            : offsetof(HintEntryHeader, flags);
+    HintEntryHeader header;
+    header.flags = 0;
+    header.overhead = overhead;
+    
+    size_t pos = 0;
+    count = 0;
+    while (pos < length) {
+        if (length - pos < header_size) {
+            return false;
+        }
+        
+        std::memcpy(&header, data + pos, header_size);
+        pos += header_size;
+        
+        if (length - pos < header.key_size) {
+            return false;
+        }
+        
+        if (visitor) {
+            IndexEntry entry;
+            entry.file_id = file_id;
+            entry.flags = header.flags;
+            entry.overhead = header.overhead;
+            entry.value_pos = header.value_pos;
+            entry.value_size = header.value_size;
+            entry.timestamp = header.timestamp;
+            (*visitor)(std::string_view(data + pos, header.key_size), entry);
+        }
+        pos += header.key_size;
+        ++count;
+    }
+    return true;
+}
+
+} // namespace
+
+std::string HintFile::path_for(const std::string& directory, uint32_t file_id) {
+    return directory + "/cask." + std::to_string(file_id) + ".hint";
+}
+
+Result<void> HintFile::write(const std::string& path, uint64_t log_size,
+                             const std::vector<HashIndex::HintEntry>& hints) {
+    size_t total = sizeof(HintFileHeader);
+    for (const auto& hint : hints) {
+        total += sizeof(HintEntryHeader) + hint.key.size();
+    }
+    
+    std::string buffer(total, '\0');
+    char* out = buffer.data() + sizeof(HintFileHeader);
+    
+    for (const auto& hint : hints) {
+        HintEntryHeader entry;
+        entry.timestamp = hint.entry.timestamp;
+        entry.key_size = hint.key.size();
+        entry.value_size = hint.entry.value_size;
+        entry.value_pos = hint.entry.value_pos;
+        entry.flags = hint.entry.flags;
+        entry.overhead = hint.entry.overhead;
+        
+        std::memcpy(out, &entry, sizeof(entry));
+        std::memcpy(out + sizeof(entry), hint.key.data(), hint.key.size());
+        out += sizeof(entry) + hint.key.size();
+    }
+    
+    HintFileHeader header;
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.entry_count = hints.size();
+    header.log_size = log_size;
+    header.body_crc = crc32(reinterpret_cast<const uint8_t*>(buffer.data()) + sizeof(header),
+                            total - sizeof(header));
+    header.header_crc = crc32(reinterpret_cast<const uint8_t*>(&header),
+                              offsetof(HintFileHeader, header_crc));
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    
+    // Never leave a half-written hint under the real name
+    std::string tmp_path = path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return Result<void>::Err("Failed to open hint file for writing");
+    }
+    
+    size_t done = 0;
+    while (done < total) {
+        ssize_t n = ::write(fd, buffer.data() + done, total - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ::close(fd);
+            ::unlink(tmp_path.c_str());
+            return Result<void>::Err("Failed to write hint file");
+        }
+        done += static_cast<size_t>(n);
+    }
+    
+    // Renamed into place only once durable, or a crash could leave an
+    // empty file under the real name
+    bool synced = ::fdatasync(fd) == 0;
+    if (::close(fd) != 0 || !synced) {
+        ::unlink(tmp_path.c_str());
+        return Result<void>::Err("Failed to sync hint file");
+    }
+    
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        ::unlink(tmp_path.c_str());
+        return Result<void>::Err("Failed to install hint file");
+    }
+    
+    return Result<void>::Ok();
+}
+
+Result<bool> HintFile::load(const std::string& path, uint32_t file_id, uint64_t log_size,
+                            uint32_t format, const Visitor& visitor, uint64_t& covered_size) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return Result<bool>::Ok(false);  // Hint file doesn't exist
+    }
+    
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return Result<bool>::Ok(false);
+    }
+    
+    uint64_t length = static_cast<uint64_t>(st.st_size);
+    if (length == 0) {
+        // An empty version 1 hint is only trusted for a log with no records:
+        // a hint a crash truncated to nothing looks the same
+        ::close(fd);
+        uint64_t data_start = format >= 2 ? sizeof(LogFileHeader) : 0;
+        if (log_size > data_start) {
+            return Result<bool>::Ok(false);
+        }
+        covered_size = log_size;
+        return Result<bool>::Ok(true);
+    }
+    
+    auto region = MappedRegion::map(fd, length);
+    ::close(fd);
+    if (!region) {
+        return Result<bool>::Ok(false);
+    }
+    region->advise(MADV_SEQUENTIAL);
+    
+    const char* data = region->data();
+    
+    // Records of older formats all have a header of the same size; a
+    // version 3 log's vary, so only hints that store them will do
+    uint8_t overhead = static_cast<uint8_t>(LogFile::header_size(format));
+    
+    if (length >= sizeof(HintFileHeader) && std::memcmp(data, kMagic, sizeof(kMagic)) == 0) {
+        HintFileHeader header;
+        std::memcpy(&header, data, sizeof(header));
+        
+        const uint8_t* body = reinterpret_cast<const uint8_t*>(data) + sizeof(header);
+        size_t body_size = length - sizeof(header);
+        
+        if (header.version < 2 || header.version > kVersion ||
+            header.header_crc != crc32(reinterpret_cast<const uint8_t*>(&header),
+                                       offsetof(HintFileHeader, header_crc)) ||
+            header.body_crc != crc32(body, body_size) ||
+            header.log_size > log_size) {
+            return Result<bool>::Ok(false);  // Corrupt, truncated or stale
+        }
+        if (header.version < 4 && format >= 3) {
+            return Result<bool>::Ok(false);
+        }
+        
+        // A body that checks out but holds a different number of entries
+        // than the header says was not written by us
+        uint64_t count;
+        if (!parse_entries(data + sizeof(header), body_size, header.version, file_id, overhead,
+                           nullptr, count) ||
+            count != header.entry_count) {
+            return Result<bool>::Ok(false);
+        }
+        
+        parse_entries(data + sizeof(header), body_size, header.version, file_id, overhead,
+                      &visitor, count);
+        covered_size = header.log_size;
+        return Result<bool>::Ok(true);
+    }
+    
+    // Version 1: no checksum, so validate the framing before visiting anything
+    uint64_t count;
+    if (format >= 3 || !parse_entries(data, length, 1, file_id, overhead, nullptr, count)) {
+        return Result<bool>::Ok(false);
+    }
+    
+    parse_entries(data, length, 1, file_id, overhead, &visitor, count);
+    covered_size = log_size;
+    return Result<bool>::Ok(true);
+}
+
+} // namespace bitcask
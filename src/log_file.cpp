@@ -1,39 +1,294 @@
 #include "../include/log_file.h"
+#include "../include/crc32.h"
+#include "../include/file_registry.h"
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstddef>
 #include <ctime>
+#include <algorithm>
 #include <cstring>
+#include <limits>
 #include <sstream>
 #include <iomanip>
 
 namespace bitcask {
 
-LogFile::LogFile(uint32_t file_id, const std::string& directory, bool read_only)
-    : file_id_(file_id), read_only_(read_only), current_size_(0) {
+namespace {
+
+enum class Parse { Ok, Short, Bad };
+
+// Varints are LEB128: seven bits a byte, low bits first
+void put_varint(std::string& buffer, uint64_t value) {
+    while (value >= 0x80) {
+        buffer += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    buffer += static_cast<char>(value);
+}
+
+// Decode a varint at p, advancing p past it. Short if it runs past end;
+// Bad if it is overlong or exceeds limit.
+Parse get_varint(const char*& p, const char* end, uint64_t limit, uint64_t& value) {
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (p == end) {
+            return Parse::Short;
+        }
+        uint8_t byte = static_cast<uint8_t>(*p++);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return value <= limit ? Parse::Ok : Parse::Bad;
+        }
+    }
+    return Parse::Bad;
+}
+
+// Block members store their timestamp as a signed delta from the block's
+constexpr uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+constexpr uint64_t kMaxSize = std::numeric_limits<uint32_t>::max();
+constexpr uint64_t kMaxDelta = zigzag(static_cast<int64_t>(kMaxSize));
+
+// Parse the version 3 key and value sizes at p
+Parse get_sizes(const char*& p, const char* end, uint64_t& key_size, uint64_t& value_size) {
+    Parse parse = get_varint(p, end, kMaxSize, key_size);
+    if (parse != Parse::Ok) {
+        return parse;
+    }
+    return get_varint(p, end, kMaxSize, value_size);
+}
+
+// Length of the record (or version 3 block) at the front of data, from
+// however much of it is available
+Parse measure_unit(const char* data, size_t available, uint32_t format, uint64_t& size) {
+    if (format < 3) {
+        if (available < LogFile::header_size(format)) {
+            return Parse::Short;
+        }
+        // Version 2 only appends flags to the version 1 layout
+        LogEntryHeader header;
+        std::memcpy(&header, data, sizeof(header));
+        size = LogFile::header_size(format) + static_cast<uint64_t>(header.key_size) +
+               header.value_size;
+        return Parse::Ok;
+    }
     
-    filepath_ = get_filepath(file_id, directory);
+    if (available < offsetof(LogEntryHeaderV3, timestamp)) {
+        return Parse::Short;
+    }
+    if (data[offsetof(LogEntryHeaderV3, flags)] & kRecordBlock) {
+        if (available < sizeof(BlockHeader)) {
+            return Parse::Short;
+        }
+        BlockHeader header;
+        std::memcpy(&header, data, sizeof(header));
+        if (header.body_size == 0 || header.body_size > RecordEncoder::kMaxBlockSize) {
+            return Parse::Bad;
+        }
+        size = sizeof(header) + header.body_size;
+        return Parse::Ok;
+    }
+    
+    if (available < sizeof(LogEntryHeaderV3)) {
+        return Parse::Short;
+    }
+    const char* p = data + sizeof(LogEntryHeaderV3);
+    uint64_t key_size;
+    uint64_t value_size;
+    Parse parse = get_sizes(p, data + available, key_size, value_size);
+    if (parse == Parse::Ok) {
+        size = static_cast<uint64_t>(p - data) + key_size + value_size;
+    }
+    return parse;
+}
+
+// Split a whole, CRC-checked unit at file offset into its records; false
+// if a block's contents don't parse
+bool decode_unit(const char* data, size_t size, uint64_t offset, uint32_t format,
+                 std::vector<LogFile::RecordView>& records) {
+    LogFile::RecordView view;
+    view.format = format;
+    view.in_block = false;
+    
+    if (format < 3) {
+        LogEntryHeaderV2 header;
+        std::memcpy(&header, data, LogFile::header_size(format));
+        size_t header_size = LogFile::header_size(format);
+        view.offset = offset;
+        view.timestamp = header.timestamp;
+        view.flags = format >= 2 ? header.flags : 0;
+        view.key = std::string_view(data + header_size, header.key_size);
+        view.value = std::string_view(data + header_size + header.key_size, header.value_size);
+        view.value_pos = offset + header_size + header.key_size;
+        view.raw = std::string_view(data, size);
+        view.size = size;
+        
+        // Tombstones are records with an empty value
+        if (view.value.empty()) {
+            view.flags |= kRecordTombstone;
+        }
+        records.push_back(view);
+        return true;
+    }
+    
+    const char* end = data + size;
+    uint64_t key_size;
+    uint64_t value_size;
+    
+    if (!(data[offsetof(LogEntryHeaderV3, flags)] & kRecordBlock)) {
+        LogEntryHeaderV3 header;
+        std::memcpy(&header, data, sizeof(header));
+        const char* p = data + sizeof(header);
+        get_sizes(p, end, key_size, value_size);  // Already measured
+        view.offset = offset;
+        view.timestamp = header.timestamp;
+        view.flags = header.flags;
+        view.key = std::string_view(p, key_size);
+        view.value = std::string_view(p + key_size, value_size);
+        view.value_pos = offset + (p - data) + key_size;
+        view.raw = std::string_view(data, size);
+        view.size = size;
+        records.push_back(view);
+        return true;
+    }
+    
+    BlockHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    view.in_block = true;
+    
+    const char* p = data + sizeof(header);
+    while (p < end) {
+        const char* member = p;
+        uint8_t flags = static_cast<uint8_t>(*p++);
+        uint64_t delta;
+        if ((flags & kRecordBlock) || get_varint(p, end, kMaxDelta, delta) != Parse::Ok ||
+            get_sizes(p, end, key_size, value_size) != Parse::Ok ||
+            static_cast<uint64_t>(end - p) < key_size + value_size) {
+            return false;
+        }
+        int64_t timestamp = static_cast<int64_t>(header.timestamp) + unzigzag(delta);
+        if (timestamp < 0 || static_cast<uint64_t>(timestamp) > kMaxSize) {
+            return false;
+        }
+        
+        view.offset = offset + (member - data);
+        view.timestamp = static_cast<uint32_t>(timestamp);
+        view.flags = flags;
+        view.key = std::string_view(p, key_size);
+        view.value = std::string_view(p + key_size, value_size);
+        view.value_pos = offset + (p - data) + key_size;
+        p += key_size + value_size;
+        view.raw = std::string_view(member, p - member);
+        view.size = p - (member == data + sizeof(header) ? data : member);
+        records.push_back(view);
+    }
+    return true;
+}
+
+} // namespace
+
+std::shared_ptr<MappedRegion> MappedRegion::map(int fd, uint64_t length) {
+    if (fd < 0 || length == 0) {
+        return nullptr;
+    }
     
-    std::ios_base::openmode mode = std::ios::binary;
-    if (read_only) {
-        mode |= std::ios::in;
-    } else {
-        mode |= std::ios::in | std::ios::out | std::ios::app;
+    void* addr = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        return nullptr;
     }
     
-    file_.open(filepath_, mode);
+    return std::shared_ptr<MappedRegion>(
+        new MappedRegion(static_cast<const char*>(addr), length));
+}
+
+MappedRegion::~MappedRegion() {
+    ::munmap(const_cast<char*>(data_), size_);
+}
+
+void MappedRegion::advise(int advice) const {
+    ::madvise(const_cast<char*>(data_), size_, advice);
+}
+
+FileHandle::~FileHandle() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+LogFile::LogFile(uint32_t file_id, const std::string& directory, bool read_only,
+                 FdCache* fd_cache)
+    : file_id_(file_id), write_fd_(-1), fd_cache_(fd_cache), read_only_(read_only),
+      current_size_(0) {
     
-    // If file doesn't exist and we're writing, create it
-    if (!file_.is_open() && !read_only) {
-        file_.open(filepath_, std::ios::binary | std::ios::out);
-        file_.close();
-        file_.open(filepath_, mode);
+    filepath_ = get_filepath(file_id, directory);
+    
+    // Writable files are created on demand and only ever appended to
+    if (!read_only) {
+        write_fd_ = ::open(filepath_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
     }
     
     // Get current file size
-    if (file_.is_open()) {
-        file_.seekg(0, std::ios::end);
-        current_size_ = file_.tellg();
-        file_.seekg(0, std::ios::beg);
+    auto handle = read_handle();
+    struct stat st;
+    if (handle && ::fstat(handle->fd(), &st) == 0) {
+        current_size_ = static_cast<uint64_t>(st.st_size);
+    }
+    
+    init_format();
+}
+
+void LogFile::init_format() {
+    format_ = 1;
+    data_start_ = 0;
+    
+    LogFileHeader header;
+    uint64_t file_size = size();
+    
+    if (file_size == 0 && write_fd_ >= 0) {
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.version = kFormatVersion;
+        header.header_crc = calculate_crc32(reinterpret_cast<const uint8_t*>(&header),
+                                            offsetof(LogFileHeader, header_crc));
+        
+        // A file without its header must not take records
+        auto append_result = append_raw(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (!append_result.ok()) {
+            ::close(write_fd_);
+            write_fd_ = -1;
+            return;
+        }
+        format_ = kFormatVersion;
+        data_start_ = sizeof(header);
+        return;
+    }
+    
+    if (file_size < sizeof(header)) {
+        return;
     }
+    
+    // A version 1 file starts with a record, whose CRC and timestamp can't
+    // plausibly spell the magic and also match the header CRC
+    auto handle = read_handle();
+    if (!handle || ::pread(handle->fd(), &header, sizeof(header), 0) !=
+                       static_cast<ssize_t>(sizeof(header))) {
+        return;
+    }
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+        header.header_crc != calculate_crc32(reinterpret_cast<const uint8_t*>(&header),
+                                             offsetof(LogFileHeader, header_crc))) {
+        return;
+    }
+    format_ = header.version;
+    data_start_ = sizeof(header);
 }
 
 LogFile::~LogFile() {
@@ -41,9 +296,51 @@ LogFile::~LogFile() {
 }
 
 void LogFile::close() {
-    if (file_.is_open()) {
-        file_.close();
+    // Unregister first so the cache never touches a dying file
+    if (fd_cache_) {
+        fd_cache_->forget(this);
+    }
+    
+    // Outstanding views keep the mapping alive until they are released
+    mapping_.reset();
+    
+    if (write_fd_ >= 0) {
+        ::close(write_fd_);
+        write_fd_ = -1;
     }
+    
+    // Readers mid-pread hold their own reference to the descriptor
+    release_read_handle();
+}
+
+std::shared_ptr<const FileHandle> LogFile::read_handle() const {
+    referenced_.store(true, std::memory_order_relaxed);
+    
+    std::shared_ptr<const FileHandle> handle;
+    {
+        std::lock_guard<std::mutex> lock(handle_mutex_);
+        if (read_handle_) {
+            return read_handle_;
+        }
+        
+        int fd = ::open(filepath_.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return nullptr;
+        }
+        read_handle_ = std::make_shared<const FileHandle>(fd);
+        handle = read_handle_;
+    }
+    
+    // Outside handle_mutex_: the cache locks other files' handles to evict them
+    if (fd_cache_) {
+        fd_cache_->opened(this);
+    }
+    return handle;
+}
+
+void LogFile::release_read_handle() const {
+    std::lock_guard<std::mutex> lock(handle_mutex_);
+    read_handle_.reset();
 }
 
 std::string LogFile::get_filepath(uint32_t file_id, const std::string& directory) {
@@ -52,157 +349,443 @@ std::string LogFile::get_filepath(uint32_t file_id, const std::string& directory
     return oss.str();
 }
 
-Result<uint64_t> LogFile::append(const std::string& key, const std::string& value, 
+Result<uint64_t> LogFile::append(std::string_view key, std::string_view value,
                                   uint32_t timestamp) {
+    std::string record;
+    size_t value_offset = encode_entry(record, timestamp, key, value);
+    
+    auto append_result = append_raw(record.data(), record.size());
+    if (!append_result.ok()) {
+        return append_result;
+    }
+    
+    // Position where value starts (for index)
+    return Result<uint64_t>::Ok(append_result.value + value_offset);
+}
+
+Result<uint64_t> LogFile::append_raw(const char* data, size_t length) {
     if (read_only_) {
         return Result<uint64_t>::Err("Cannot append to read-only file");
     }
     
-    if (!file_.is_open()) {
+    if (write_fd_ < 0) {
         return Result<uint64_t>::Err("File not open");
     }
+    if (torn_) {
+        return Result<uint64_t>::Err("Log file has a torn append");
+    }
     
-    // Pack the entry for CRC calculation
-    auto packed = pack_entry(timestamp, key, value);
-    
-    // Calculate CRC (excluding the CRC field itself)
-    uint32_t crc = calculate_crc32(packed.data() + 4, packed.size() - 4);
+    uint64_t offset = current_size_.load(std::memory_order_relaxed);
     
-    // Write CRC at the beginning
-    std::memcpy(packed.data(), &crc, sizeof(crc));
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::write(write_fd_, data + done, length - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Take back what did land, or the next append would follow it
+            // while size() still says offset
+            if (done > 0 && ::ftruncate(write_fd_, static_cast<off_t>(offset)) != 0) {
+                torn_ = true;
+            }
+            return Result<uint64_t>::Err("Failed to write to log file");
+        }
+        done += static_cast<size_t>(n);
+    }
     
-    // Get position where value starts (for index)
-    uint64_t value_pos = current_size_ + sizeof(LogEntryHeader) + key.size();
+    // Publish the new size only after the data is visible to readers
+    current_size_.store(offset + length, std::memory_order_release);
     
-    // Write to file
-    file_.seekp(0, std::ios::end);
-    file_.write(reinterpret_cast<const char*>(packed.data()), packed.size());
-    file_.flush();
+    return Result<uint64_t>::Ok(offset);
+}
+
+Result<void> LogFile::sync(bool metadata) const {
+    std::shared_ptr<const FileHandle> handle;
+    int fd = write_fd_;
+    if (fd < 0) {
+        handle = read_handle();
+        fd = handle ? handle->fd() : -1;
+    }
+    if (fd < 0) {
+        return Result<void>::Err("File not open");
+    }
     
-    current_size_ += packed.size();
+    int rc = metadata ? ::fsync(fd) : ::fdatasync(fd);
+    if (rc != 0) {
+        return Result<void>::Err("Failed to sync log file");
+    }
     
-    return Result<uint64_t>::Ok(value_pos);
+    return Result<void>::Ok();
 }
 
-std::vector<uint8_t> LogFile::pack_entry(uint32_t timestamp, const std::string& key,
-                                          const std::string& value) {
-    LogEntryHeader header;
+size_t LogFile::encode_entry(std::string& buffer, uint32_t timestamp,
+                             std::string_view key, std::string_view value, uint8_t flags) {
+    LogEntryHeaderV3 header;
     header.crc = 0;  // Will be calculated
+    header.flags = flags;
     header.timestamp = timestamp;
-    header.key_size = key.size();
-    header.value_size = value.size();
     
-    size_t total_size = sizeof(LogEntryHeader) + key.size() + value.size();
-    std::vector<uint8_t> packed(total_size);
+    size_t start = buffer.size();
+    buffer.reserve(start + record_size(key.size(), value.size()));
+    buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    put_varint(buffer, key.size());
+    put_varint(buffer, value.size());
+    buffer.append(key);
+    size_t value_offset = buffer.size();
+    buffer.append(value);
     
-    // Copy header
-    std::memcpy(packed.data(), &header, sizeof(LogEntryHeader));
+    // Calculate CRC (excluding the CRC field itself) and write it at the beginning
+    uint32_t crc = calculate_crc32(reinterpret_cast<const uint8_t*>(&buffer[start]) + 4,
+                                   buffer.size() - start - 4);
+    std::memcpy(&buffer[start], &crc, sizeof(crc));
     
-    // Copy key
-    std::memcpy(packed.data() + sizeof(LogEntryHeader), key.data(), key.size());
+    return value_offset;
+}
+
+RecordEncoder::Encoded RecordEncoder::add(uint32_t timestamp, std::string_view key,
+                                          std::string_view value, uint8_t flags) {
+    size_t start = buffer_.size();
+    if (!blocks(key.size(), value.size())) {
+        finish();
+        size_t value_offset = LogFile::encode_entry(buffer_, timestamp, key, value, flags);
+        return {value_offset, buffer_.size() - start};
+    }
     
-    // Copy value
-    std::memcpy(packed.data() + sizeof(LogEntryHeader) + key.size(), 
-                value.data(), value.size());
+    reserve(1, key.size() + value.size());
+    if (block_start_ == kNoBlock) {
+        block_start_ = buffer_.size();
+        block_timestamp_ = timestamp;
+        buffer_.resize(block_start_ + sizeof(BlockHeader));  // Filled in by finish()
+    }
     
-    return packed;
+    buffer_ += static_cast<char>(flags);
+    put_varint(buffer_, zigzag(static_cast<int64_t>(timestamp) - block_timestamp_));
+    put_varint(buffer_, key.size());
+    put_varint(buffer_, value.size());
+    buffer_.append(key);
+    size_t value_offset = buffer_.size();
+    buffer_.append(value);
+    return {value_offset, buffer_.size() - start};  // Any new block's header reserved above
 }
 
-Result<std::string> LogFile::read_value(uint64_t pos, uint32_t value_size) {
-    if (!file_.is_open()) {
-        return Result<std::string>::Err("File not open");
+void RecordEncoder::reserve(size_t count, size_t bytes) {
+    if (block_start_ != kNoBlock &&
+        buffer_.size() - block_start_ - sizeof(BlockHeader) + bytes +
+            count * kMaxMemberOverhead > kMaxBlockSize) {
+        finish();
+    }
+}
+
+void RecordEncoder::finish() {
+    if (block_start_ == kNoBlock) {
+        return;
     }
     
-    std::vector<char> buffer(value_size);
+    BlockHeader header;
+    header.flags = kRecordBlock;
+    header.body_size = buffer_.size() - block_start_ - sizeof(header);
+    header.timestamp = block_timestamp_;
+    std::memcpy(&buffer_[block_start_], &header, sizeof(header));
     
-    file_.seekg(pos, std::ios::beg);
-    file_.read(buffer.data(), value_size);
+    header.crc = LogFile::calculate_crc32(
+        reinterpret_cast<const uint8_t*>(&buffer_[block_start_]) + 4,
+        buffer_.size() - block_start_ - 4);
+    std::memcpy(&buffer_[block_start_], &header.crc, sizeof(header.crc));
+    block_start_ = kNoBlock;
+}
+
+Result<std::string> LogFile::read_value(uint64_t pos, uint32_t value_size) const {
+    std::string value(value_size, '\0');
     
-    if (!file_.good() && !file_.eof()) {
-        return Result<std::string>::Err("Failed to read value from file");
+    auto read_result = read_value_into(pos, value_size, value.data());
+    if (!read_result.ok()) {
+        return Result<std::string>::Err(read_result.err());
     }
     
-    return Result<std::string>::Ok(std::string(buffer.begin(), buffer.end()));
+    return Result<std::string>::Ok(std::move(value));
 }
 
-// CRC-32 implementation (polynomial 0xEDB88320)
-uint32_t LogFile::calculate_crc32(const uint8_t* data, size_t length) {
-    uint32_t crc = 0xFFFFFFFF;
-    
-    for (size_t i = 0; i < length; ++i) {
-        crc ^= data[i];
-        for (int j = 0; j < 8; ++j) {
-            if (crc & 1) {
-                crc = (crc >> 1) ^ 0xEDB88320;
-            } else {
-                crc >>= 1;
+Result<void> LogFile::read_value_into(uint64_t pos, uint32_t value_size, char* buffer) const {
+    if (mapping_) {
+        if (pos + value_size > mapping_->size()) {
+            return Result<void>::Err("Value out of range of mapped file");
+        }
+        std::memcpy(buffer, mapping_->data() + pos, value_size);
+        return Result<void>::Ok();
+    }
+    
+    auto handle = read_handle();
+    if (!handle) {
+        return Result<void>::Err("File not open");
+    }
+    
+    size_t done = 0;
+    while (done < value_size) {
+        ssize_t n = ::pread(handle->fd(), buffer + done, value_size - done,
+                            static_cast<off_t>(pos + done));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            return Result<void>::Err("Failed to read value from file");
+        }
+        if (n == 0) {
+            return Result<void>::Err("Unexpected end of file reading value");
         }
+        done += static_cast<size_t>(n);
     }
     
-    return ~crc;
+    return Result<void>::Ok();
 }
 
-Result<std::vector<LogFile::EntryMetadata>> LogFile::read_all_entries() {
-    if (!file_.is_open()) {
-        return Result<std::vector<EntryMetadata>>::Err("File not open");
+Result<bool> LogFile::has_key(uint64_t pos, std::string_view key, uint32_t value_size) const {
+    if (format_ >= 3) {
+        // Standalone records and block members both end their header with
+        // the varint sizes, followed by the key
+        std::string expected;
+        put_varint(expected, key.size());
+        put_varint(expected, value_size);
+        expected += key;
+        if (pos < data_start_ + expected.size()) {
+            return Result<bool>::Ok(false);
+        }
+        
+        std::string stored(expected.size(), '\0');
+        auto read_result = read_value_into(pos - stored.size(), stored.size(), stored.data());
+        if (!read_result.ok()) {
+            return Result<bool>::Err(read_result.err());
+        }
+        return Result<bool>::Ok(stored == expected);
     }
     
-    std::vector<EntryMetadata> entries;
-    file_.seekg(0, std::ios::beg);
+    size_t header_length = header_size(format_);
+    if (pos < data_start_ + header_length + key.size()) {
+        return Result<bool>::Ok(false);
+    }
     
-    while (file_.tellg() < static_cast<std::streampos>(current_size_)) {
-        uint64_t entry_start = file_.tellg();
-        
-        // Read header
-        LogEntryHeader header;
-        file_.read(reinterpret_cast<char*>(&header), sizeof(LogEntryHeader));
-        
-        if (!file_.good()) {
-            break;  // Incomplete entry, likely from crash
+    // Both header versions start with the version 1 fields
+    std::string record(header_length + key.size(), '\0');
+    auto read_result = read_value_into(pos - record.size(), record.size(), record.data());
+    if (!read_result.ok()) {
+        return Result<bool>::Err(read_result.err());
+    }
+    
+    LogEntryHeader header;
+    std::memcpy(&header, record.data(), sizeof(header));
+    return Result<bool>::Ok(header.key_size == key.size() && header.value_size == value_size &&
+                            std::string_view(record).substr(header_length) == key);
+}
+
+Result<ValueView> LogFile::read_view(uint64_t pos, uint32_t value_size) const {
+    if (mapping_) {
+        if (pos + value_size > mapping_->size()) {
+            return Result<ValueView>::Err("Value out of range of mapped file");
         }
+        return Result<ValueView>::Ok(ValueView(mapping_, mapping_->data() + pos, value_size));
+    }
+    
+    auto read_result = read_value(pos, value_size);
+    if (!read_result.ok()) {
+        return Result<ValueView>::Err(read_result.err());
+    }
+    return Result<ValueView>::Ok(ValueView(std::move(read_result.value)));
+}
+
+Result<void> LogFile::map() {
+    if (!read_only_) {
+        return Result<void>::Err("Cannot map a writable file");
+    }
+    
+    if (mapping_ || size() == 0) {
+        return Result<void>::Ok();
+    }
+    
+    auto handle = read_handle();
+    auto region = MappedRegion::map(handle ? handle->fd() : -1, size());
+    if (!region) {
+        return Result<void>::Err("Failed to map log file");
+    }
+    
+    // Point lookups dominate; don't let the kernel read ahead around them
+    region->advise(MADV_RANDOM);
+    mapping_ = std::move(region);
+    
+    // Reads are served from the mapping now; give the descriptor back
+    if (fd_cache_) {
+        fd_cache_->forget(this);
+    }
+    release_read_handle();
+    return Result<void>::Ok();
+}
+
+// CRC-32 (polynomial 0xEDB88320), fastest implementation for this CPU
+uint32_t LogFile::calculate_crc32(const uint8_t* data, size_t length) {
+    return crc32(data, length);
+}
+
+Result<uint64_t> LogFile::scan(const RecordVisitor& visitor, uint64_t start_offset,
+                               size_t chunk_size) const {
+    if (format_ > kFormatVersion) {
+        return Result<uint64_t>::Err("Unsupported log file format");
+    }
+    
+    // Held for the whole scan, so eviction can't close it mid-file
+    auto handle = read_handle();
+    if (!handle) {
+        return Result<uint64_t>::Err("File not open");
+    }
+    
+    const uint64_t file_size = size();
+    start_offset = std::max(start_offset, data_start_);
+    
+    // buffer[begin, end) holds unparsed bytes starting at file offset record_offset.
+    // Reads always fetch whole chunks (chunk-aligned relative to start_offset)
+    // and land after any partial record carried over from the previous chunk.
+    std::vector<char> buffer(chunk_size);
+    std::vector<RecordView> records;
+    size_t begin = 0;
+    size_t end = 0;
+    uint64_t record_offset = start_offset;
+    uint64_t read_offset = start_offset;
+    
+    while (true) {
+        size_t available = end - begin;
+        const char* unit = buffer.data() + begin;
         
-        // Read key
-        std::vector<char> key_buffer(header.key_size);
-        file_.read(key_buffer.data(), header.key_size);
-        
-        // Read value (just to validate CRC, we don't store it)
-        std::vector<char> value_buffer(header.value_size);
-        file_.read(value_buffer.data(), header.value_size);
-        
-        if (!file_.good() && !file_.eof()) {
-            break;  // Incomplete entry
+        // A unit is one record or, in version 3, possibly a block of them
+        uint64_t unit_size = 0;
+        Parse parse = measure_unit(unit, available, format_, unit_size);
+        if (parse == Parse::Bad) {
+            break;  // Garbage sizes, likely from a crash
         }
+        size_t needed = available + 1;
         
-        // Validate CRC
-        std::vector<uint8_t> data_for_crc(sizeof(LogEntryHeader) - 4 + 
-                                          header.key_size + header.value_size);
-        std::memcpy(data_for_crc.data(), 
-                    reinterpret_cast<uint8_t*>(&header) + 4, 
-                    sizeof(LogEntryHeader) - 4);
-        std::memcpy(data_for_crc.data() + sizeof(LogEntryHeader) - 4,
-                    key_buffer.data(), header.key_size);
-        std::memcpy(data_for_crc.data() + sizeof(LogEntryHeader) - 4 + header.key_size,
-                    value_buffer.data(), header.value_size);
-        
-        uint32_t calculated_crc = calculate_crc32(data_for_crc.data(), data_for_crc.size());
+        if (parse == Parse::Ok) {
+            if (record_offset + unit_size > file_size) {
+                break;  // Incomplete entry (or garbage sizes), likely from crash
+            }
+            needed = unit_size;
+            
+            if (available >= unit_size) {
+                // Validate CRC (excluding the CRC field itself) in place
+                uint32_t stored_crc;
+                std::memcpy(&stored_crc, unit, sizeof(stored_crc));
+                uint32_t calculated_crc = calculate_crc32(
+                    reinterpret_cast<const uint8_t*>(unit) + 4, unit_size - 4);
+                if (calculated_crc != stored_crc) {
+                    break;  // Corrupted entry, stop reading
+                }
+                
+                // A block is only visited once all of it parses
+                records.clear();
+                if (!decode_unit(unit, unit_size, record_offset, format_, records)) {
+                    break;
+                }
+                
+                begin += unit_size;
+                record_offset += unit_size;
+                
+                bool stopped = false;
+                for (const RecordView& view : records) {
+                    if (!visitor(view)) {
+                        stopped = true;
+                        break;
+                    }
+                }
+                if (stopped) {
+                    break;
+                }
+                continue;
+            }
+        }
         
-        if (calculated_crc != header.crc) {
-            // Corrupted entry, stop reading
-            break;
+        // Need more data
+        if (read_offset >= file_size) {
+            break;  // Torn record at the end of the file
         }
         
-        // Valid entry
-        EntryMetadata meta;
-        meta.key = std::string(key_buffer.begin(), key_buffer.end());
-        meta.value_pos = entry_start + sizeof(LogEntryHeader) + header.key_size;
-        meta.value_size = header.value_size;
-        meta.timestamp = header.timestamp;
+        // Carry the partial record to the front of the buffer
+        if (begin > 0) {
+            std::memmove(buffer.data(), buffer.data() + begin, available);
+            begin = 0;
+            end = available;
+        }
         
-        entries.push_back(meta);
+        // Read whole chunks until the record is complete
+        do {
+            size_t to_read = std::min<uint64_t>(chunk_size, file_size - read_offset);
+            if (to_read == 0) {
+                break;
+            }
+            if (buffer.size() - end < to_read) {
+                buffer.resize(end + to_read);
+            }
+            
+            ssize_t n = ::pread(handle->fd(), buffer.data() + end, to_read,
+                                static_cast<off_t>(read_offset));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return Result<uint64_t>::Err("Failed to read log file");
+            }
+            end += static_cast<size_t>(n);
+            read_offset += static_cast<uint64_t>(n);
+        } while (end < needed);
+    }
+    
+    return Result<uint64_t>::Ok(record_offset);
+}
+
+Result<bool> LogFile::torn_at(uint64_t offset) const {
+    auto handle = read_handle();
+    if (!handle) {
+        return Result<bool>::Err("File not open");
+    }
+    
+    const uint64_t file_size = size();
+    std::vector<char> buffer(64 * 1024);
+    auto read = [&](uint64_t at, size_t length) -> ssize_t {
+        ssize_t n;
+        do {
+            n = ::pread(handle->fd(), buffer.data(), length, static_cast<off_t>(at));
+        } while (n < 0 && errno == EINTR);
+        return n;
+    };
+    
+    // A unit cut short by the end of the file, or running right up to it
+    size_t length = std::min<uint64_t>(32, file_size - std::min(offset, file_size));
+    ssize_t n = read(offset, length);
+    if (n < 0 || static_cast<size_t>(n) != length) {
+        return Result<bool>::Err("Failed to read log file");
+    }
+    uint64_t unit_size = 0;
+    Parse parse = measure_unit(buffer.data(), length, format_, unit_size);
+    if (parse == Parse::Short || (parse == Parse::Ok && offset + unit_size >= file_size)) {
+        return Result<bool>::Ok(true);
+    }
+    
+    // Or zeros the file was extended by before the data reached the disk
+    for (uint64_t at = offset; at < file_size; at += static_cast<uint64_t>(n)) {
+        n = read(at, std::min<uint64_t>(buffer.size(), file_size - at));
+        if (n <= 0) {
+            return Result<bool>::Err("Failed to read log file");
+        }
+        if (std::any_of(buffer.data(), buffer.data() + n, [](char c) { return c != 0; })) {
+            return Result<bool>::Ok(false);
+        }
+    }
+    return Result<bool>::Ok(true);
+}
+
+Result<void> LogFile::truncate(uint64_t length) {
+    if (::truncate(filepath_.c_str(), static_cast<off_t>(length)) != 0) {
+        return Result<void>::Err("Failed to truncate log file");
     }
     
-    return Result<std::vector<EntryMetadata>>::Ok(entries);
+    current_size_.store(length, std::memory_order_release);
+    return Result<void>::Ok();
 }
 
 } // namespace bitcask
\ No newline at end of file
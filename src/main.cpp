@@ -1,6 +1,17 @@
 #include "../include/bitcask.h"
+#include "../include/protocol.h"
+#include "../include/server.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
 #include <iostream>
+#include <poll.h>
+#include <csignal>
 #include <string>
+#include <strings.h>
+#include <unistd.h>
 #include <vector>
 
 using namespace bitcask;
@@ -10,16 +21,256 @@ void print_usage(const char* program_name) {
     std::cerr << "Commands:\n";
     std::cerr << "  set <key> <value>   Set a key-value pair\n";
     std::cerr << "  get <key>           Get value for a key\n";
+    std::cerr << "  mget <key>...       Get values for several keys, one per line\n";
     std::cerr << "  del <key>           Delete a key\n";
     std::cerr << "  list                List all keys\n";
-    std::cerr << "  merge               Compact log files\n\n";
+    std::cerr << "  merge               Compact log files\n";
+    std::cerr << "  stats [json]        Show per-file size and liveness, then engine metrics\n";
+    std::cerr << "  batch [file]        Run commands from a file or stdin (-) in one session\n";
+    std::cerr << "  serve [address]     Serve RESP on [127.0.0.1:]port or a Unix socket path\n";
+    std::cerr << "                      (default 127.0.0.1:6380) until SIGINT/SIGTERM\n\n";
     std::cerr << "Examples:\n";
     std::cerr << "  " << program_name << " -db ./mydb set user:1 alice\n";
     std::cerr << "  " << program_name << " -db ./mydb get user:1\n";
     std::cerr << "  " << program_name << " -db ./mydb del user:1\n";
     std::cerr << "  " << program_name << " -db ./mydb merge\n";
+    std::cerr << "  " << program_name << " -db ./mydb batch < commands.txt\n";
+    std::cerr << "  " << program_name << " -db ./mydb serve /tmp/bitcask.sock\n";
 }
 
+Server* g_server = nullptr;
+
+void stop_server(int) {
+    if (g_server) {
+        g_server->stop();
+    }
+}
+
+// Runs commands read from one descriptor against an open database, so a
+// script pays for recovery once instead of once per command. Commands are
+// inline lines or RESP arrays (see resp::parse) and are answered in order
+// on stdout. Consecutive sets are committed as one WriteBatch, and replies
+// are buffered until the input runs dry, so a piped bulk load costs about
+// what write() does.
+class BatchSession {
+public:
+    explicit BatchSession(Bitcask& db) : db_(db), start_(Clock::now()), last_report_(start_) {}
+    
+    // Read and run commands until end of input; false on an I/O or framing error
+    bool run(int fd) {
+        std::string input;
+        size_t offset = 0;
+        bool at_eof = false;
+        
+        while (true) {
+            resp::Command command;
+            size_t consumed = 0;
+            std::string error;
+            auto status = resp::parse(std::string_view(input).substr(offset), at_eof, command,
+                                      consumed, error);
+            
+            if (status == resp::ParseStatus::Ok) {
+                offset += consumed;
+                bytes_in_ += consumed;
+                if (!command.args.empty()) {
+                    execute(command);
+                }
+                continue;
+            }
+            if (status == resp::ParseStatus::Error) {
+                finish();
+                std::cerr << "Error: malformed command: " << error << "\n";
+                return false;
+            }
+            if (at_eof) {
+                break;
+            }
+            
+            // Need more input: drop what was parsed, and answer everything
+            // so far unless more is already waiting
+            input.erase(0, offset);
+            offset = 0;
+            if (!input_ready(fd)) {
+                finish();
+            }
+            report_progress(false);
+            
+            size_t old_size = input.size();
+            input.resize(old_size + kReadSize);
+            ssize_t n = ::read(fd, input.data() + old_size, kReadSize);
+            input.resize(old_size + (n > 0 ? n : 0));
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                finish();
+                std::cerr << "Error reading commands: " << std::strerror(errno) << "\n";
+                return false;
+            }
+            at_eof = n == 0;
+        }
+        
+        finish();
+        if (offset < input.size()) {
+            std::cerr << "Error: truncated command at end of input\n";
+            return false;
+        }
+        report_progress(true);
+        return true;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    
+    static constexpr size_t kReadSize = 1024 * 1024;
+    static constexpr size_t kMaxBatchOps = 4096;
+    static constexpr size_t kMaxBatchBytes = 4 * 1024 * 1024;
+    static constexpr size_t kMaxOutput = 1024 * 1024;
+    
+    Bitcask& db_;
+    WriteBatch batch_;                  // Sets not yet committed
+    std::vector<bool> batch_framed_;    // Framing of each queued set's reply
+    std::string out_;                   // Replies not yet written
+    
+    Clock::time_point start_;
+    Clock::time_point last_report_;
+    uint64_t commands_ = 0;
+    uint64_t sets_ = 0;
+    uint64_t gets_ = 0;
+    uint64_t dels_ = 0;
+    uint64_t errors_ = 0;
+    uint64_t bytes_in_ = 0;
+    
+    static bool input_ready(int fd) {
+        pollfd pfd{fd, POLLIN, 0};
+        return ::poll(&pfd, 1, 0) > 0;
+    }
+    
+    static bool is(const std::string& word, const char* name) {
+        return strcasecmp(word.c_str(), name) == 0;
+    }
+    
+    void execute(const resp::Command& command) {
+        const auto& args = command.args;
+        const std::string& name = args[0];
+        ++commands_;
+        
+        // A set the store would refuse is answered on its own below rather
+        // than queued, where it would fail the whole batch it joined
+        bool is_set = is(name, "set") && args.size() == 3;
+        auto checked = is_set ? Bitcask::check_op(args[1], args[2]) : Result<void>::Ok();
+        if (is_set && checked.ok()) {
+            ++sets_;
+            batch_.put(args[1], args[2]);
+            batch_framed_.push_back(command.framed);
+            if (batch_.count() >= kMaxBatchOps || batch_.byte_size() >= kMaxBatchBytes) {
+                commit_sets();
+            }
+            return;
+        }
+        
+        // Everything else sees the sets before it
+        commit_sets();
+        
+        if (is_set) {
+            ++sets_;
+            ++errors_;
+            resp::append_error(out_, checked.err(), command.framed);
+        } else if (is(name, "get") && args.size() == 2) {
+            ++gets_;
+            auto result = db_.get(args[1]);
+            if (result.ok()) {
+                resp::append_value(out_, result.value, command.framed);
+            } else {
+                resp::append_nil(out_, command.framed);
+            }
+        } else if (is(name, "mget") && args.size() >= 2) {
+            std::vector<std::string> keys(args.begin() + 1, args.end());
+            gets_ += keys.size();
+            resp::append_array(out_, keys.size(), command.framed);
+            for (const auto& result : db_.multi_get(keys)) {
+                if (result.ok()) {
+                    resp::append_value(out_, result.value, command.framed);
+                } else {
+                    resp::append_nil(out_, command.framed);
+                }
+            }
+        } else if (is(name, "del") && args.size() == 2) {
+            ++dels_;
+            auto result = db_.del(args[1]);
+            if (result.ok()) {
+                resp::append_ok(out_, command.framed);
+            } else {
+                ++errors_;
+                resp::append_error(out_, result.err(), command.framed);
+            }
+        } else {
+            ++errors_;
+            resp::append_error(out_, "unknown command or wrong number of arguments for '" +
+                                     name + "'", command.framed);
+        }
+        
+        if (out_.size() >= kMaxOutput) {
+            flush_output();
+        }
+    }
+    
+    void commit_sets() {
+        if (batch_.empty()) {
+            return;
+        }
+        
+        auto result = db_.write(batch_);
+        for (bool framed : batch_framed_) {
+            if (result.ok()) {
+                resp::append_ok(out_, framed);
+            } else {
+                ++errors_;
+                resp::append_error(out_, result.err(), framed);
+            }
+        }
+        batch_.clear();
+        batch_framed_.clear();
+        if (out_.size() >= kMaxOutput) {
+            flush_output();
+        }
+    }
+    
+    void flush_output() {
+        std::cout.write(out_.data(), static_cast<std::streamsize>(out_.size()));
+        std::cout.flush();
+        out_.clear();
+    }
+    
+    // Answer everything run so far
+    void finish() {
+        commit_sets();
+        flush_output();
+    }
+    
+    // Progress on stderr about once a second, and a summary at the end
+    void report_progress(bool final) {
+        auto now = Clock::now();
+        if (!final && now - last_report_ < std::chrono::seconds(1)) {
+            return;
+        }
+        last_report_ = now;
+        
+        double seconds = std::chrono::duration<double>(now - start_).count();
+        double rate = seconds > 0 ? commands_ / seconds : 0;
+        if (!final) {
+            std::cerr << "batch: " << commands_ << " commands, " << std::fixed
+                      << std::setprecision(0) << rate << "/s\n";
+            return;
+        }
+        std::cerr << "batch: " << commands_ << " commands (" << sets_ << " set, " << gets_
+                  << " get, " << dels_ << " del, " << errors_ << " error) in " << std::fixed
+                  << std::setprecision(2) << seconds << " s, " << std::setprecision(0) << rate
+                  << " commands/s, " << std::setprecision(1)
+                  << (seconds > 0 ? bytes_in_ / 1e6 / seconds : 0) << " MB/s in\n";
+    }
+};
+
 int main(int argc, char* argv[]) {
     // Parse command line arguments
     if (argc < 4) {
@@ -41,6 +292,8 @@ int main(int argc, char* argv[]) {
     Config config(db_dir);
     // For testing, use smaller file size (1MB instead of 2GB)
     config.max_file_size = 1024 * 1024;  // 1MB
+    // SCAN walks keys in order
+    config.ordered_index = command == "serve";
     
     auto db_result = Bitcask::open(config);
     if (!db_result.ok()) {
@@ -68,7 +321,7 @@ int main(int argc, char* argv[]) {
         }
         
         std::cout << "OK\n";
-        
+    
     } else if (command == "get") {
         if (argc < 5) {
             std::cerr << "Error: 'get' requires key argument\n";
@@ -85,7 +338,19 @@ int main(int argc, char* argv[]) {
         }
         
         std::cout << result.value << "\n";
+    
+    } else if (command == "mget") {
+        if (argc < 5) {
+            std::cerr << "Error: 'mget' requires at least one key argument\n";
+            print_usage(argv[0]);
+            return 1;
+        }
         
+        std::vector<std::string> keys(argv + 4, argv + argc);
+        for (const auto& result : db->multi_get(keys)) {
+            std::cout << (result.ok() ? result.value : "(nil)") << "\n";
+        }
+    
     } else if (command == "del") {
         if (argc < 5) {
             std::cerr << "Error: 'del' requires key argument\n";
@@ -102,7 +367,7 @@ int main(int argc, char* argv[]) {
         }
         
         std::cout << "OK\n";
-        
+    
     } else if (command == "list") {
         auto keys = db->list_keys();
         
@@ -113,7 +378,7 @@ int main(int argc, char* argv[]) {
                 std::cout << key << "\n";
             }
         }
-        
+    
     } else if (command == "merge") {
         std::cout << "Starting merge process...\n";
         
@@ -123,8 +388,92 @@ int main(int argc, char* argv[]) {
             return 1;
         }
         
+        const MergeStats& stats = result.value;
         std::cout << "Merge completed successfully\n";
+        std::cout << std::fixed << std::setprecision(1)
+                  << "  " << stats.input_files << " file(s), " << stats.input_bytes << " bytes, "
+                  << stats.records_scanned << " records scanned\n"
+                  << "  " << stats.output_files << " file(s), " << stats.output_bytes << " bytes, "
+                  << stats.records_copied << " live records copied\n"
+                  << "  " << stats.mb_per_sec() << " MB/s, " << std::setprecision(0)
+                  << stats.records_per_sec() << " records/s\n";
+    
+    } else if (command == "batch") {
+        std::string path = argc > 4 ? argv[4] : "-";
+        int fd = 0;
+        if (path != "-") {
+            fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                std::cerr << "Error: cannot open " << path << ": " << std::strerror(errno) << "\n";
+                return 1;
+            }
+        }
+        
+        BatchSession session(*db);
+        bool ok = session.run(fd);
+        if (fd != 0) {
+            ::close(fd);
+        }
+        return ok ? 0 : 1;
+    
+    } else if (command == "serve") {
+        std::string address = argc > 4 ? argv[4] : "127.0.0.1:6380";
+        Server server(*db);
+        auto result = server.listen(address);
+        if (!result.ok()) {
+            std::cerr << "Error: " << result.err() << "\n";
+            return 1;
+        }
+        
+        g_server = &server;
+        std::signal(SIGINT, stop_server);
+        std::signal(SIGTERM, stop_server);
+        std::signal(SIGPIPE, SIG_IGN);
+        std::cerr << "Serving " << db_dir << " on "
+                  << (server.port() ? "port " + std::to_string(server.port()) : address) << "\n";
+        
+        result = server.run();
+        g_server = nullptr;
+        if (!result.ok()) {
+            std::cerr << "Error: " << result.err() << "\n";
+            return 1;
+        }
+    
+    } else if (command == "stats") {
+        if (argc > 4 && std::string(argv[4]) == "json") {
+            std::cout << format_stats(db->stats(), true) << "\n";
+            return 0;
+        }
         
+        auto stats = db->file_stats();
+        
+        std::cout << std::left << std::setw(10) << "file" << std::right
+                  << std::setw(14) << "bytes" << std::setw(14) << "live bytes"
+                  << std::setw(8) << "dead%" << std::setw(12) << "records"
+                  << std::setw(12) << "live keys" << "\n";
+        
+        FileStats total;
+        for (const auto& file : stats) {
+            std::string name = "cask." + std::to_string(file.file_id) + (file.active ? "*" : "");
+            std::cout << std::left << std::setw(10) << name << std::right
+                      << std::setw(14) << file.total_bytes << std::setw(14) << file.live_bytes
+                      << std::setw(7) << std::fixed << std::setprecision(1)
+                      << file.dead_ratio() * 100 << "%" << std::setw(12) << file.total_records
+                      << std::setw(12) << file.live_keys << "\n";
+            total.total_bytes += file.total_bytes;
+            total.live_bytes += file.live_bytes;
+            total.total_records += file.total_records;
+            total.live_keys += file.live_keys;
+        }
+        
+        std::cout << std::left << std::setw(10) << "total" << std::right
+                  << std::setw(14) << total.total_bytes << std::setw(14) << total.live_bytes
+                  << std::setw(7) << total.dead_ratio() * 100 << "%"
+                  << std::setw(12) << total.total_records << std::setw(12) << total.live_keys << "\n";
+        std::cout << stats.size() << " file(s), " << total.reclaimable_bytes()
+                  << " bytes reclaimable by merge (* = active)\n\n";
+        std::cout << format_stats(db->stats(), false);
+    
     } else {
         std::cerr << "Error: Unknown command '" << command << "'\n\n";
         print_usage(argv[0]);
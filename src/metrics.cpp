@@ -0,0 +1,148 @@
+#include "../include/metrics.h"
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+namespace bitcask {
+
+void Metrics::snapshot(Stats& stats) const {
+    OpStats* targets[kOps] = {&stats.put, &stats.get, &stats.del, &stats.write,
+                              &stats.multi_get, &stats.merge, &stats.compaction,
+                              &stats.recovery};
+    for (size_t op = 0; op < kOps; ++op) {
+        OpStats& out = *targets[op];
+        out = OpStats{};
+        for (const Slot& slot : slots_) {
+            const Counters& counters = slot.ops[op];
+            out.count += counters.count.load(std::memory_order_relaxed);
+            out.failed += counters.failed.load(std::memory_order_relaxed);
+            out.total_ns += counters.total_ns.load(std::memory_order_relaxed);
+            out.max_ns = std::max(out.max_ns, counters.max_ns.load(std::memory_order_relaxed));
+            for (size_t i = 0; i < OpStats::kBuckets; ++i) {
+                uint64_t n = counters.buckets[i].load(std::memory_order_relaxed);
+                out.buckets[i] += n;
+                out.timed += n;
+            }
+        }
+    }
+    
+    stats.bytes_written = 0;
+    stats.bytes_read = 0;
+    for (const Slot& slot : slots_) {
+        stats.bytes_written += slot.bytes_written.load(std::memory_order_relaxed);
+        stats.bytes_read += slot.bytes_read.load(std::memory_order_relaxed);
+    }
+    stats.uptime_seconds = std::chrono::duration<double>(Clock::now() - opened_).count();
+}
+
+namespace {
+
+std::string fixed(double value, int precision) {
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "%.*f", precision, value);
+    return buffer;
+}
+
+std::string op_json(const OpStats& op) {
+    std::ostringstream out;
+    out << "{\"count\":" << op.count << ",\"failed\":" << op.failed
+        << ",\"timed\":" << op.timed << ",\"mean_ns\":" << fixed(op.mean_ns(), 1) << ",\"p50_ns\":" << op.percentile_ns(50)
+        << ",\"p99_ns\":" << op.percentile_ns(99) << ",\"p999_ns\":" << op.percentile_ns(99.9)
+        << ",\"max_ns\":" << op.max_ns << "}";
+    return out.str();
+}
+
+std::string to_json(const Stats& stats) {
+    std::ostringstream out;
+    out << "{\"uptime_seconds\":" << fixed(stats.uptime_seconds, 3) << ",\"ops\":{"
+        << "\"put\":" << op_json(stats.put) << ",\"get\":" << op_json(stats.get)
+        << ",\"del\":" << op_json(stats.del) << ",\"write\":" << op_json(stats.write)
+        << ",\"multi_get\":" << op_json(stats.multi_get) << ",\"merge\":" << op_json(stats.merge)
+        << ",\"compaction\":" << op_json(stats.compaction)
+        << ",\"recovery\":" << op_json(stats.recovery) << "}"
+        << ",\"bytes_written\":" << stats.bytes_written << ",\"bytes_read\":" << stats.bytes_read
+        << ",\"keys\":" << stats.keys << ",\"keydir_bytes\":" << stats.keydir_bytes
+        << ",\"open_files\":" << stats.open_files
+        << ",\"merge\":{\"running\":" << (stats.merge_running ? "true" : "false")
+        << ",\"bytes_done\":" << stats.merge_bytes_done
+        << ",\"bytes_total\":" << stats.merge_bytes_total << "}"
+        << ",\"recovery_seconds\":" << fixed(stats.recovery_seconds, 3)
+        << ",\"cache\":{\"hits\":" << stats.cache.hits << ",\"misses\":" << stats.cache.misses
+        << ",\"evictions\":" << stats.cache.evictions << ",\"bytes\":" << stats.cache.bytes << "}"
+        << ",\"compression\":{\"values_compressed\":" << stats.compression.values_compressed
+        << ",\"raw_bytes\":" << stats.compression.raw_bytes
+        << ",\"stored_bytes\":" << stats.compression.stored_bytes << "}"
+        << ",\"files\":[";
+    for (size_t i = 0; i < stats.files.size(); ++i) {
+        const FileStats& file = stats.files[i];
+        out << (i ? "," : "") << "{\"id\":" << file.file_id
+            << ",\"active\":" << (file.active ? "true" : "false")
+            << ",\"bytes\":" << file.total_bytes << ",\"live_bytes\":" << file.live_bytes
+            << ",\"records\":" << file.total_records << ",\"live_keys\":" << file.live_keys
+            << ",\"bytes_read\":" << file.bytes_read << "}";
+    }
+    out << "]}";
+    return out.str();
+}
+
+std::string to_text(const Stats& stats) {
+    char line[160];
+    std::ostringstream out;
+    out << "uptime " << fixed(stats.uptime_seconds, 1) << " s\n";
+    
+    std::snprintf(line, sizeof(line), "%-12s %12s %10s %10s %10s %10s %10s %10s\n", "op", "count",
+                  "failed", "mean us", "p50 us", "p99 us", "p999 us", "max us");
+    out << line;
+    std::pair<const char*, const OpStats*> ops[] = {
+        {"put", &stats.put},           {"get", &stats.get},
+        {"del", &stats.del},           {"write", &stats.write},
+        {"multi_get", &stats.multi_get}, {"merge", &stats.merge},
+        {"compaction", &stats.compaction}, {"recovery", &stats.recovery},
+    };
+    for (const auto& [name, op] : ops) {
+        std::snprintf(line, sizeof(line), "%-12s %12llu %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                      name, static_cast<unsigned long long>(op->count),
+                      static_cast<unsigned long long>(op->failed), op->mean_ns() / 1e3,
+                      op->percentile_ns(50) / 1e3, op->percentile_ns(99) / 1e3,
+                      op->percentile_ns(99.9) / 1e3, op->max_ns / 1e3);
+        out << line;
+    }
+    
+    uint64_t disk_bytes = 0;
+    uint64_t live_bytes = 0;
+    for (const auto& file : stats.files) {
+        disk_bytes += file.total_bytes;
+        live_bytes += file.live_bytes;
+    }
+    out << "bytes written " << stats.bytes_written << ", read " << stats.bytes_read << "\n"
+        << "keys " << stats.keys << ", keydir " << fixed(stats.keydir_bytes / 1048576.0, 1)
+        << " MB\n"
+        << "files " << stats.files.size() << " (" << stats.open_files << " immutable open), "
+        << fixed(disk_bytes / 1048576.0, 1) << " MB on disk, "
+        << fixed(live_bytes / 1048576.0, 1) << " MB live\n";
+    if (stats.merge_running) {
+        double done = stats.merge_bytes_total ? 100.0 * stats.merge_bytes_done /
+                                                stats.merge_bytes_total : 0.0;
+        out << "merge running, " << fixed(done, 1) << "% of "
+            << fixed(stats.merge_bytes_total / 1048576.0, 1) << " MB\n";
+    } else {
+        out << "merge idle\n";
+    }
+    out << "recovery " << fixed(stats.recovery_seconds, 3) << " s\n";
+    if (stats.cache.hits + stats.cache.misses > 0) {
+        out << "cache hit rate " << fixed(stats.cache.hit_rate(), 3) << ", "
+            << fixed(stats.cache.bytes / 1048576.0, 1) << " MB\n";
+    }
+    if (stats.compression.stored_bytes > 0) {
+        out << "compression ratio " << fixed(stats.compression.ratio(), 2) << "\n";
+    }
+    return out.str();
+}
+
+} // namespace
+
+std::string format_stats(const Stats& stats, bool json) {
+    return json ? to_json(stats) : to_text(stats);
+}
+
+} // namespace bitcask
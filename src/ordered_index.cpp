@@ -0,0 +1,178 @@
+#include "../include/ordered_index.h"
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+
+namespace bitcask {
+
+size_t OrderedIndex::leaf_for(const std::string& key) const {
+    // Last leaf whose first key is <= key (or the first leaf)
+    auto it = std::upper_bound(leaves_.begin(), leaves_.end(), key,
+                               [](const std::string& k, const Leaf& leaf) {
+                                   return k < leaf.front();
+                               });
+    return it == leaves_.begin() ? 0 : static_cast<size_t>(it - leaves_.begin()) - 1;
+}
+
+void OrderedIndex::insert(const std::string& key) {
+    std::unique_lock lock(mutex_);
+    
+    if (leaves_.empty()) {
+        leaves_.emplace_back();
+        leaves_.back().reserve(kLeafCapacity);
+        leaves_.back().push_back(key);
+        size_ = 1;
+        return;
+    }
+    
+    size_t index = leaf_for(key);
+    Leaf& leaf = leaves_[index];
+    auto pos = std::lower_bound(leaf.begin(), leaf.end(), key);
+    if (pos != leaf.end() && *pos == key) {
+        return;
+    }
+    leaf.insert(pos, key);
+    ++size_;
+    
+    // Split a full leaf in half
+    if (leaf.size() > kLeafCapacity) {
+        Leaf upper;
+        upper.reserve(kLeafCapacity);
+        auto mid = leaf.begin() + leaf.size() / 2;
+        upper.assign(std::make_move_iterator(mid), std::make_move_iterator(leaf.end()));
+        leaf.erase(mid, leaf.end());
+        leaves_.insert(leaves_.begin() + index + 1, std::move(upper));
+    }
+}
+
+void OrderedIndex::remove(const std::string& key) {
+    std::unique_lock lock(mutex_);
+    
+    if (leaves_.empty()) {
+        return;
+    }
+    
+    size_t index = leaf_for(key);
+    Leaf& leaf = leaves_[index];
+    auto pos = std::lower_bound(leaf.begin(), leaf.end(), key);
+    if (pos == leaf.end() || *pos != key) {
+        return;
+    }
+    leaf.erase(pos);
+    --size_;
+    
+    // Fold an underfull leaf into its successor when both fit in one
+    if (leaf.empty()) {
+        leaves_.erase(leaves_.begin() + index);
+    } else if (index + 1 < leaves_.size() &&
+               leaf.size() + leaves_[index + 1].size() <= kLeafCapacity / 2) {
+        Leaf& next = leaves_[index + 1];
+        leaf.insert(leaf.end(), std::make_move_iterator(next.begin()),
+                    std::make_move_iterator(next.end()));
+        leaves_.erase(leaves_.begin() + index + 1);
+    }
+}
+
+void OrderedIndex::build(std::vector<std::string> keys) {
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    
+    // Pack leaves three-quarters full to leave room for inserts
+    std::vector<Leaf> leaves;
+    const size_t fill = kLeafCapacity * 3 / 4;
+    for (size_t i = 0; i < keys.size(); i += fill) {
+        size_t end = std::min(keys.size(), i + fill);
+        leaves.emplace_back();
+        leaves.back().reserve(kLeafCapacity);
+        leaves.back().assign(std::make_move_iterator(keys.begin() + i),
+                             std::make_move_iterator(keys.begin() + end));
+    }
+    
+    std::unique_lock lock(mutex_);
+    leaves_ = std::move(leaves);
+    size_ = keys.size();
+}
+
+void OrderedIndex::clear() {
+    std::unique_lock lock(mutex_);
+    leaves_.clear();
+    size_ = 0;
+}
+
+size_t OrderedIndex::size() const {
+    std::shared_lock lock(mutex_);
+    return size_;
+}
+
+void OrderedIndex::collect(const std::string& begin, bool inclusive, const std::string& end,
+                           size_t limit, std::vector<std::string>& out) const {
+    std::shared_lock lock(mutex_);
+    
+    if (leaves_.empty()) {
+        return;
+    }
+    
+    size_t index = leaf_for(begin);
+    auto pos = inclusive ? std::lower_bound(leaves_[index].begin(), leaves_[index].end(), begin)
+                         : std::upper_bound(leaves_[index].begin(), leaves_[index].end(), begin);
+    
+    while (index < leaves_.size()) {
+        const Leaf& leaf = leaves_[index];
+        for (; pos != leaf.end(); ++pos) {
+            if (out.size() >= limit || (!end.empty() && *pos >= end)) {
+                return;
+            }
+            out.push_back(*pos);
+        }
+        if (++index < leaves_.size()) {
+            pos = leaves_[index].begin();
+        }
+    }
+}
+
+OrderedIndex::Iterator OrderedIndex::range(const std::string& begin, const std::string& end,
+                                           size_t limit) const {
+    return Iterator(this, begin, end, limit);
+}
+
+OrderedIndex::Iterator OrderedIndex::scan(const std::string& prefix, size_t limit) const {
+    return Iterator(this, prefix, prefix_end(prefix), limit);
+}
+
+std::string OrderedIndex::prefix_end(const std::string& prefix) {
+    std::string end = prefix;
+    while (!end.empty() && static_cast<unsigned char>(end.back()) == 0xFF) {
+        end.pop_back();
+    }
+    if (!end.empty()) {
+        end.back() = static_cast<char>(static_cast<unsigned char>(end.back()) + 1);
+    }
+    return end;
+}
+
+OrderedIndex::Iterator::Iterator(const OrderedIndex* index, std::string begin,
+                                 std::string end, size_t limit)
+    : index_(index), last_(std::move(begin)), end_(std::move(end)),
+      remaining_(limit == 0 ? SIZE_MAX : limit) {
+    fill(true);
+}
+
+void OrderedIndex::Iterator::next() {
+    if (++pos_ == page_.size() && pos_ > 0) {
+        last_ = std::move(page_.back());
+        fill(false);
+    }
+}
+
+void OrderedIndex::Iterator::fill(bool inclusive) {
+    page_.clear();
+    pos_ = 0;
+    if (remaining_ == 0) {
+        return;
+    }
+    
+    index_->collect(last_, inclusive, end_, std::min(kPageSize, remaining_), page_);
+    remaining_ -= page_.size();
+}
+
+} // namespace bitcask
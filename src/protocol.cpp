@@ -0,0 +1,214 @@
+#include "../include/protocol.h"
+#include <cctype>
+#include <charconv>
+
+namespace bitcask {
+namespace resp {
+
+namespace {
+
+// Longest "*<count>" or "$<length>" header line we wait for
+constexpr size_t kMaxHeaderLength = 32;
+
+// Read a "<type><number>\r\n" header at pos, advancing pos past it
+ParseStatus read_header(std::string_view input, size_t& pos, char type, size_t limit,
+                        size_t& value, std::string& error) {
+    if (pos >= input.size()) {
+        return ParseStatus::Incomplete;
+    }
+    if (input[pos] != type) {
+        error = std::string("expected '") + type + "' at offset " + std::to_string(pos);
+        return ParseStatus::Error;
+    }
+    
+    size_t end = input.find("\r\n", pos + 1);
+    if (end == std::string_view::npos) {
+        if (input.size() - pos > kMaxHeaderLength) {
+            error = "header too long";
+            return ParseStatus::Error;
+        }
+        return ParseStatus::Incomplete;
+    }
+    
+    const char* first = input.data() + pos + 1;
+    const char* last = input.data() + end;
+    auto [ptr, ec] = std::from_chars(first, last, value);
+    if (ec != std::errc() || ptr != last || first == last || value > limit) {
+        error = "bad length in '" + std::string(input.substr(pos, end - pos)) + "'";
+        return ParseStatus::Error;
+    }
+    
+    pos = end + 2;
+    return ParseStatus::Ok;
+}
+
+ParseStatus parse_framed(std::string_view input, Command& command, size_t& consumed,
+                         std::string& error) {
+    size_t pos = 0;
+    size_t count = 0;
+    ParseStatus status = read_header(input, pos, '*', kMaxArgs, count, error);
+    if (status != ParseStatus::Ok) {
+        return status;
+    }
+    
+    command.args.reserve(count < 64 ? count : 64);
+    for (size_t i = 0; i < count; ++i) {
+        size_t length = 0;
+        status = read_header(input, pos, '$', kMaxBulkLength, length, error);
+        if (status != ParseStatus::Ok) {
+            return status;
+        }
+        if (input.size() - pos < length + 2) {
+            return ParseStatus::Incomplete;
+        }
+        if (input.compare(pos + length, 2, "\r\n") != 0) {
+            error = "bulk string not terminated by CRLF";
+            return ParseStatus::Error;
+        }
+        command.args.emplace_back(input.substr(pos, length));
+        pos += length + 2;
+    }
+    
+    command.framed = true;
+    consumed = pos;
+    return ParseStatus::Ok;
+}
+
+// Next space-separated word of line from pos, advancing pos past it
+std::string_view next_word(std::string_view line, size_t& pos) {
+    while (pos < line.size() && line[pos] == ' ') {
+        ++pos;
+    }
+    size_t start = pos;
+    while (pos < line.size() && line[pos] != ' ') {
+        ++pos;
+    }
+    return line.substr(start, pos - start);
+}
+
+bool is_set(std::string_view word) {
+    return word.size() == 3 && std::tolower(static_cast<unsigned char>(word[0])) == 's' &&
+           std::tolower(static_cast<unsigned char>(word[1])) == 'e' &&
+           std::tolower(static_cast<unsigned char>(word[2])) == 't';
+}
+
+ParseStatus parse_inline(std::string_view input, bool at_eof, Command& command,
+                         size_t& consumed, std::string& error) {
+    size_t end = input.find('\n');
+    if (end == std::string_view::npos) {
+        if (!at_eof) {
+            if (input.size() > kMaxBulkLength) {
+                error = "inline command too long";
+                return ParseStatus::Error;
+            }
+            return ParseStatus::Incomplete;
+        }
+        end = input.size();
+        consumed = end;
+    } else {
+        consumed = end + 1;
+    }
+    
+    std::string_view line = input.substr(0, end);
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    if (!line.empty() && line.front() == '#') {
+        return ParseStatus::Ok;
+    }
+    
+    size_t pos = 0;
+    std::string_view word = next_word(line, pos);
+    if (word.empty()) {
+        return ParseStatus::Ok;
+    }
+    command.args.emplace_back(word);
+    
+    if (is_set(word)) {
+        // set <key> <value...>: the value keeps its spaces
+        std::string_view key = next_word(line, pos);
+        if (!key.empty()) {
+            command.args.emplace_back(key);
+            if (pos < line.size()) {
+                command.args.emplace_back(line.substr(pos + 1));
+            }
+        }
+        return ParseStatus::Ok;
+    }
+    
+    while (!(word = next_word(line, pos)).empty()) {
+        command.args.emplace_back(word);
+    }
+    return ParseStatus::Ok;
+}
+
+} // namespace
+
+ParseStatus parse(std::string_view input, bool at_eof, Command& command, size_t& consumed,
+                  std::string& error) {
+    command.args.clear();
+    command.framed = false;
+    if (input.empty()) {
+        return ParseStatus::Incomplete;
+    }
+    if (input.front() == '*') {
+        return parse_framed(input, command, consumed, error);
+    }
+    return parse_inline(input, at_eof, command, consumed, error);
+}
+
+void append_ok(std::string& out, bool framed) {
+    append_status(out, "OK", framed);
+}
+
+void append_status(std::string& out, std::string_view status, bool framed) {
+    if (framed) {
+        out += '+';
+    }
+    out += status;
+    out += framed ? "\r\n" : "\n";
+}
+
+void append_integer(std::string& out, long long value, bool framed) {
+    if (framed) {
+        out += ':';
+    }
+    out += std::to_string(value);
+    out += framed ? "\r\n" : "\n";
+}
+
+void append_value(std::string& out, std::string_view value, bool framed) {
+    if (framed) {
+        out += '$';
+        out += std::to_string(value.size());
+        out += "\r\n";
+        out += value;
+        out += "\r\n";
+    } else {
+        out += value;
+        out += '\n';
+    }
+}
+
+void append_nil(std::string& out, bool framed) {
+    out += framed ? "$-1\r\n" : "(nil)\n";
+}
+
+void append_error(std::string& out, std::string_view message, bool framed) {
+    out += framed ? "-ERR " : "(error) ";
+    for (char c : message) {
+        out += (c == '\r' || c == '\n') ? ' ' : c;
+    }
+    out += framed ? "\r\n" : "\n";
+}
+
+void append_array(std::string& out, size_t count, bool framed) {
+    if (framed) {
+        out += '*';
+        out += std::to_string(count);
+        out += "\r\n";
+    }
+}
+
+} // namespace resp
+} // namespace bitcask
@@ -0,0 +1,660 @@
+#include "../include/server.h"
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <unordered_set>
+
+namespace bitcask {
+
+namespace {
+
+constexpr size_t kReadChunk = 64 * 1024;
+constexpr size_t kMaxReadPerPass = 1024 * 1024;    // Per connection, for fairness
+
+Result<void> errno_error(const std::string& what) {
+    return Result<void>::Err(what + ": " + std::strerror(errno));
+}
+
+std::string to_hex(const std::string& bytes) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(bytes.size() * 2);
+    for (unsigned char c : bytes) {
+        hex += digits[c >> 4];
+        hex += digits[c & 15];
+    }
+    return hex;
+}
+
+bool from_hex(const std::string& hex, std::string& bytes) {
+    if (hex.size() % 2 != 0) {
+        return false;
+    }
+    auto nibble = [](char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    };
+    bytes.clear();
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        int high = nibble(hex[i]);
+        int low = nibble(hex[i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        bytes += static_cast<char>(high << 4 | low);
+    }
+    return true;
+}
+
+} // namespace
+
+Server::Server(Bitcask& db) : db_(db) {
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd_ >= 0 && wake_fd_ >= 0) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = wake_fd_;
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+    }
+}
+
+Server::~Server() {
+    while (!connections_.empty()) {
+        close_connection(*connections_.begin()->second);
+    }
+    for (int fd : {listen_fd_, epoll_fd_, wake_fd_}) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    if (!unix_path_.empty()) {
+        ::unlink(unix_path_.c_str());
+    }
+}
+
+Result<void> Server::listen(const std::string& address) {
+    if (listen_fd_ >= 0) {
+        return Result<void>::Err("Server is already listening");
+    }
+    if (epoll_fd_ < 0 || wake_fd_ < 0) {
+        return errno_error("Cannot create event loop");
+    }
+    
+    if (address.rfind("unix:", 0) == 0 || address.find('/') != std::string::npos) {
+        std::string path = address.rfind("unix:", 0) == 0 ? address.substr(5) : address;
+        sockaddr_un addr{};
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+            return Result<void>::Err("Bad Unix socket path: " + path);
+        }
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        
+        // Replace a socket left behind by a previous run, but nothing else
+        struct stat st;
+        if (::stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+            ::unlink(path.c_str());
+        }
+        
+        listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd_ < 0) {
+            return errno_error("Cannot create socket");
+        }
+        if (::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            return errno_error("Cannot bind " + path);
+        }
+        unix_path_ = path;
+    } else {
+        std::string host = "127.0.0.1";
+        std::string port_text = address;
+        size_t colon = address.rfind(':');
+        if (colon != std::string::npos) {
+            host = address.substr(0, colon);
+            port_text = address.substr(colon + 1);
+            if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+                host = host.substr(1, host.size() - 2);
+            }
+        }
+        
+        unsigned port = 0;
+        const char* end = port_text.data() + port_text.size();
+        auto [ptr, ec] = std::from_chars(port_text.data(), end, port);
+        if (ec != std::errc() || ptr != end || port > 65535) {
+            return Result<void>::Err("Bad port: " + port_text);
+        }
+        
+        sockaddr_storage storage{};
+        socklen_t length = 0;
+        if (host == "127.0.0.1" || host == "localhost") {
+            auto* addr = reinterpret_cast<sockaddr_in*>(&storage);
+            addr->sin_family = AF_INET;
+            addr->sin_port = htons(static_cast<uint16_t>(port));
+            addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            length = sizeof(sockaddr_in);
+        } else if (host == "::1") {
+            auto* addr = reinterpret_cast<sockaddr_in6*>(&storage);
+            addr->sin6_family = AF_INET6;
+            addr->sin6_port = htons(static_cast<uint16_t>(port));
+            addr->sin6_addr = in6addr_loopback;
+            length = sizeof(sockaddr_in6);
+        } else {
+            return Result<void>::Err("Only loopback addresses are served, not " + host);
+        }
+        
+        listen_fd_ = ::socket(storage.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd_ < 0) {
+            return errno_error("Cannot create socket");
+        }
+        int one = 1;
+        ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (::bind(listen_fd_, reinterpret_cast<sockaddr*>(&storage), length) != 0) {
+            return errno_error("Cannot bind " + address);
+        }
+        
+        length = sizeof(storage);
+        ::getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&storage), &length);
+        port_ = ntohs(storage.ss_family == AF_INET
+                          ? reinterpret_cast<sockaddr_in*>(&storage)->sin_port
+                          : reinterpret_cast<sockaddr_in6*>(&storage)->sin6_port);
+    }
+    
+    if (::listen(listen_fd_, SOMAXCONN) != 0) {
+        return errno_error("Cannot listen on " + address);
+    }
+    
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = listen_fd_;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event) != 0) {
+        return errno_error("Cannot watch listening socket");
+    }
+    return Result<void>::Ok();
+}
+
+void Server::stop() {
+    uint64_t one = 1;
+    ssize_t written = ::write(wake_fd_, &one, sizeof(one));
+    (void)written;
+}
+
+Result<void> Server::run() {
+    if (listen_fd_ < 0) {
+        return Result<void>::Err("Server is not listening");
+    }
+    
+    started_ = std::chrono::steady_clock::now();
+    std::vector<epoll_event> events(256);
+    std::vector<Connection*> ready;
+    std::vector<Connection*> backlog;   // Parsing held back by full output
+    
+    while (true) {
+        int n = ::epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()),
+                             backlog.empty() ? -1 : 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno_error("epoll_wait failed");
+        }
+        
+        ready.swap(backlog);
+        backlog.clear();
+        bool stopping = false;
+        
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd_) {
+                uint64_t count;
+                ssize_t drained = ::read(wake_fd_, &count, sizeof(count));
+                (void)drained;
+                stopping = true;
+                continue;
+            }
+            if (fd == listen_fd_) {
+                accept_connections();
+                continue;
+            }
+            
+            auto it = connections_.find(fd);
+            if (it == connections_.end()) {
+                continue;
+            }
+            Connection& conn = *it->second;
+            if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !conn.eof &&
+                !read_input(conn)) {
+                conn.eof = true;
+            }
+            if (!conn.queued) {
+                conn.queued = true;
+                ready.push_back(&conn);
+            }
+        }
+        
+        // Run every ready connection's commands, then append their writes
+        // with one commit before any reply goes out
+        for (Connection* conn : ready) {
+            process(*conn);
+        }
+        commit_writes();
+        
+        for (Connection* conn : ready) {
+            conn->queued = false;
+            bool held_back = conn->blocked;
+            if (flush(*conn) && held_back &&
+                conn->out.size() - conn->out_sent < kMaxOutput) {
+                conn->queued = true;
+                backlog.push_back(conn);
+            }
+        }
+        
+        if (stopping) {
+            return Result<void>::Ok();
+        }
+    }
+}
+
+void Server::accept_connections() {
+    while (true) {
+        int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            // EAGAIN, or out of descriptors: try again on the next event
+            return;
+        }
+        
+        if (unix_path_.empty()) {
+            int one = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        
+        auto conn = std::make_unique<Connection>();
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+            ::close(fd);
+            continue;
+        }
+        connections_[fd] = std::move(conn);
+        ++connections_received_;
+    }
+}
+
+bool Server::read_input(Connection& conn) {
+    char buffer[kReadChunk];
+    size_t total = 0;
+    while (total < kMaxReadPerPass) {
+        ssize_t n = ::read(conn.fd, buffer, sizeof(buffer));
+        if (n > 0) {
+            conn.in.append(buffer, static_cast<size_t>(n));
+            total += static_cast<size_t>(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        // Level-triggered: anything left over is reported again
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    return true;
+}
+
+void Server::process(Connection& conn) {
+    size_t offset = 0;
+    conn.blocked = false;
+    
+    while (!conn.closing) {
+        if (conn.out.size() - conn.out_sent >= kMaxOutput) {
+            conn.blocked = true;
+            break;
+        }
+        
+        resp::Command command;
+        size_t consumed = 0;
+        std::string error;
+        auto status = resp::parse(std::string_view(conn.in).substr(offset), conn.eof, command,
+                                  consumed, error);
+        if (status == resp::ParseStatus::Incomplete) {
+            break;
+        }
+        if (status == resp::ParseStatus::Error) {
+            if (conn.pending_writes > 0) {
+                commit_writes();
+            }
+            resp::append_error(conn.out, "Protocol error: " + error, true);
+            conn.closing = true;
+            break;
+        }
+        
+        offset += consumed;
+        if (!command.args.empty()) {
+            execute(conn, command);
+        }
+    }
+    
+    conn.in.erase(0, offset);
+}
+
+void Server::execute(Connection& conn, const resp::Command& command) {
+    const auto& args = command.args;
+    const std::string& name = args[0];
+    const bool framed = true;   // Like Redis, inline commands get RESP replies too
+    ++commands_processed_;
+    
+    auto is = [&](const char* candidate) { return strcasecmp(name.c_str(), candidate) == 0; };
+    auto wrong_arity = [&] {
+        std::string lower = name;
+        for (char& c : lower) {
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        resp::append_error(conn.out, "wrong number of arguments for '" + lower + "' command",
+                           framed);
+    };
+    
+    // Writes join the batch; their replies wait for its commit
+    if (is("SET") || is("DEL")) {
+        if (is("SET") ? args.size() != 3 : args.size() < 2) {
+            if (conn.pending_writes > 0) {
+                commit_writes();
+            }
+            if (is("SET") && args.size() > 3) {
+                resp::append_error(conn.out, "syntax error", framed);
+            } else {
+                wrong_arity();
+            }
+            return;
+        }
+        
+        // A SET the store would refuse fails alone here instead of failing
+        // the shared batch, and with it other clients' writes. DEL needs no
+        // check: only live keys join the batch, and those were all accepted.
+        if (is("SET")) {
+            auto checked = Bitcask::check_op(args[1], args[2]);
+            if (!checked.ok()) {
+                if (conn.pending_writes > 0) {
+                    commit_writes();
+                }
+                resp::append_error(conn.out, checked.err(), framed);
+                return;
+            }
+        }
+        
+        long long deleted = -1;
+        if (is("SET")) {
+            batch_.put(args[1], args[2]);
+            pending_live_[args[1]] = true;
+        } else {
+            // A key is live if the batch last set it, or it is in the
+            // keydir and the batch hasn't deleted it
+            deleted = 0;
+            std::unordered_set<std::string_view> seen;
+            for (size_t i = 1; i < args.size(); ++i) {
+                if (!seen.insert(args[i]).second) {
+                    continue;
+                }
+                auto it = pending_live_.find(args[i]);
+                bool live = it != pending_live_.end() ? it->second : db_.contains(args[i]);
+                if (live) {
+                    batch_.del(args[i]);
+                    pending_live_[args[i]] = false;
+                    ++deleted;
+                }
+            }
+        }
+        pending_.push_back({&conn, deleted});
+        ++conn.pending_writes;
+        
+        if (batch_.count() >= kMaxBatchOps || batch_.byte_size() >= kMaxBatchBytes) {
+            commit_writes();
+        }
+        return;
+    }
+    
+    // Everything else answers now, so this connection's writes go first
+    if (conn.pending_writes > 0) {
+        commit_writes();
+    }
+    
+    if (is("GET")) {
+        if (args.size() != 2) {
+            wrong_arity();
+        } else if (db_.get(args[1], value_).ok()) {
+            resp::append_value(conn.out, value_, framed);
+        } else {
+            resp::append_nil(conn.out, framed);
+        }
+    } else if (is("MGET")) {
+        if (args.size() < 2) {
+            wrong_arity();
+            return;
+        }
+        std::vector<std::string> keys(args.begin() + 1, args.end());
+        resp::append_array(conn.out, keys.size(), framed);
+        for (const auto& result : db_.multi_get(keys)) {
+            if (result.ok()) {
+                resp::append_value(conn.out, result.value, framed);
+            } else {
+                resp::append_nil(conn.out, framed);
+            }
+        }
+    } else if (is("SCAN")) {
+        scan(conn, command);
+    } else if (is("INFO")) {
+        resp::append_value(conn.out, info(), framed);
+    } else if (is("PING")) {
+        if (args.size() > 2) {
+            wrong_arity();
+        } else if (args.size() == 2) {
+            resp::append_value(conn.out, args[1], framed);
+        } else {
+            resp::append_status(conn.out, "PONG", framed);
+        }
+    } else if (is("QUIT")) {
+        resp::append_ok(conn.out, framed);
+        conn.closing = true;
+    } else {
+        resp::append_error(conn.out, "unknown command '" + name + "'", framed);
+    }
+}
+
+void Server::scan(Connection& conn, const resp::Command& command) {
+    const auto& args = command.args;
+    const bool framed = true;
+    if (args.size() < 2) {
+        resp::append_error(conn.out, "wrong number of arguments for 'scan' command", framed);
+        return;
+    }
+    
+    // The cursor is the hex of the last key returned, or 0 to start
+    std::string begin;
+    if (args[1] != "0") {
+        std::string last;
+        if (!from_hex(args[1], last)) {
+            resp::append_error(conn.out, "invalid cursor", framed);
+            return;
+        }
+        begin = last + '\0';
+    }
+    
+    std::string pattern;
+    size_t count = 10;
+    for (size_t i = 2; i < args.size(); i += 2) {
+        if (i + 1 < args.size() && strcasecmp(args[i].c_str(), "MATCH") == 0) {
+            pattern = args[i + 1];
+        } else if (i + 1 < args.size() && strcasecmp(args[i].c_str(), "COUNT") == 0) {
+            const std::string& text = args[i + 1];
+            auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), count);
+            if (ec != std::errc() || ptr != text.data() + text.size() || count == 0) {
+                resp::append_error(conn.out, "value is not an integer or out of range", framed);
+                return;
+            }
+        } else {
+            resp::append_error(conn.out, "syntax error", framed);
+            return;
+        }
+    }
+    
+    // Only keys starting with the pattern's literal prefix can match
+    std::string prefix = pattern.substr(0, pattern.find_first_of("*?[\\"));
+    if (begin < prefix) {
+        begin = prefix;
+    }
+    auto range = db_.range(begin, OrderedIndex::prefix_end(prefix), count);
+    if (!range.ok()) {
+        resp::append_error(conn.out, range.err(), framed);
+        return;
+    }
+    
+    std::vector<std::string> keys;
+    std::string last;
+    size_t examined = 0;
+    for (auto& it = range.value; it.valid(); it.next()) {
+        ++examined;
+        last = it.key();
+        if (pattern.empty() || ::fnmatch(pattern.c_str(), last.c_str(), 0) == 0) {
+            keys.push_back(last);
+        }
+    }
+    
+    resp::append_array(conn.out, 2, framed);
+    resp::append_value(conn.out, examined == count ? to_hex(last) : "0", framed);
+    resp::append_array(conn.out, keys.size(), framed);
+    for (const auto& key : keys) {
+        resp::append_value(conn.out, key, framed);
+    }
+}
+
+std::string Server::info() {
+    Stats stats = db_.stats();
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now() - started_).count();
+    
+    std::string text;
+    auto line = [&](const std::string& key, const std::string& value) {
+        text += key + ":" + value + "\r\n";
+    };
+    
+    text += "# Server\r\n";
+    line("uptime_in_seconds", std::to_string(seconds));
+    line("tcp_port", std::to_string(port_));
+    text += "\r\n# Clients\r\n";
+    line("connected_clients", std::to_string(connections_.size()));
+    text += "\r\n# Stats\r\n";
+    line("total_connections_received", std::to_string(connections_received_));
+    line("total_commands_processed", std::to_string(commands_processed_));
+    text += "\r\n# Bitcask\r\n";
+    line("keys", std::to_string(stats.keys));
+    line("keydir_bytes", std::to_string(stats.keydir_bytes));
+    line("log_files", std::to_string(stats.files.size()));
+    line("bytes_written", std::to_string(stats.bytes_written));
+    line("bytes_read", std::to_string(stats.bytes_read));
+    line("merge_running", stats.merge_running ? "1" : "0");
+    std::pair<const char*, const OpStats*> ops[] = {
+        {"put", &stats.put}, {"get", &stats.get}, {"del", &stats.del},
+        {"write", &stats.write}, {"multi_get", &stats.multi_get},
+    };
+    for (const auto& [name, op] : ops) {
+        std::string prefix = name;
+        line(prefix + "_calls", std::to_string(op->count));
+        line(prefix + "_p50_usec", std::to_string(op->percentile_ns(50) / 1000));
+        line(prefix + "_p99_usec", std::to_string(op->percentile_ns(99) / 1000));
+    }
+    text += "\r\n# Keyspace\r\n";
+    line("db0", "keys=" + std::to_string(stats.keys) + ",expires=0,avg_ttl=0");
+    return text;
+}
+
+void Server::commit_writes() {
+    if (pending_.empty()) {
+        return;
+    }
+    
+    auto result = batch_.empty() ? Result<void>::Ok() : db_.write(batch_);
+    for (const PendingReply& reply : pending_) {
+        std::string& out = reply.conn->out;
+        --reply.conn->pending_writes;
+        if (!result.ok()) {
+            resp::append_error(out, result.err(), true);
+        } else if (reply.deleted < 0) {
+            resp::append_ok(out, true);
+        } else {
+            resp::append_integer(out, reply.deleted, true);
+        }
+    }
+    
+    batch_.clear();
+    pending_.clear();
+    pending_live_.clear();
+}
+
+bool Server::flush(Connection& conn) {
+    while (conn.out_sent < conn.out.size()) {
+        ssize_t n = ::send(conn.fd, conn.out.data() + conn.out_sent,
+                           conn.out.size() - conn.out_sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            conn.out_sent += static_cast<size_t>(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        close_connection(conn);
+        return false;
+    }
+    
+    if (conn.out_sent == conn.out.size()) {
+        conn.out.clear();
+        conn.out_sent = 0;
+    } else if (conn.out_sent >= kMaxOutput / 2) {
+        conn.out.erase(0, conn.out_sent);
+        conn.out_sent = 0;
+    }
+    
+    size_t unsent = conn.out.size() - conn.out_sent;
+    if ((conn.closing || conn.eof) && unsent == 0 && !conn.blocked) {
+        close_connection(conn);
+        return false;
+    }
+    
+    uint32_t events = 0;
+    if (!conn.eof && !conn.closing && unsent < kMaxOutput) {
+        events |= EPOLLIN;
+    }
+    if (unsent > 0) {
+        events |= EPOLLOUT;
+    }
+    if (events != conn.events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = conn.fd;
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn.fd, &event);
+        conn.events = events;
+    }
+    return true;
+}
+
+void Server::close_connection(Connection& conn) {
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn.fd, nullptr);
+    ::close(conn.fd);
+    connections_.erase(conn.fd);
+}
+
+} // namespace bitcask
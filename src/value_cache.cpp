@@ -0,0 +1,163 @@
+#include "../include/value_cache.h"
+#include <mutex>
+
+namespace bitcask {
+
+ValueCache::ValueCache(size_t capacity_bytes, size_t num_shards) {
+    if (num_shards == 0) {
+        num_shards = 1;
+    }
+    
+    shard_capacity_ = capacity_bytes / num_shards;
+    shards_.reserve(num_shards);
+    for (size_t i = 0; i < num_shards; ++i) {
+        shards_.push_back(std::make_unique<Shard>());
+    }
+}
+
+bool ValueCache::get(uint32_t file_id, uint64_t value_pos, std::string& value) {
+    Key key{file_id, value_pos};
+    Shard& shard = shard_for(key);
+    std::shared_lock lock(shard.mutex);
+    
+    auto it = shard.entries.find(key);
+    if (it == shard.entries.end()) {
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    
+    // Racing readers may lose an increment; the count is only a hint
+    const Entry& entry = it->second;
+    uint8_t freq = entry.freq.load(std::memory_order_relaxed);
+    if (freq < 3) {
+        entry.freq.store(freq + 1, std::memory_order_relaxed);
+    }
+    
+    value.assign(entry.value);
+    shard.hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void ValueCache::insert(uint32_t file_id, uint64_t value_pos, const std::string& value) {
+    // A single value this large would evict much of the shard for one entry
+    size_t charge = value.size() + kEntryOverhead;
+    if (charge > shard_capacity_ / 8) {
+        return;
+    }
+    
+    Key key{file_id, value_pos};
+    Shard& shard = shard_for(key);
+    std::unique_lock lock(shard.mutex);
+    
+    auto [it, inserted] = shard.entries.try_emplace(key);
+    if (!inserted) {
+        return;  // Another reader missed on it too and got here first
+    }
+    
+    Entry& entry = it->second;
+    entry.value = value;
+    entry.seq = shard.next_seq++;
+    
+    // Evicted from the small queue recently: it was wanted again, so
+    // straight into main
+    if (shard.ghost_set.erase(KeyHash{}(key)) > 0) {
+        shard.main.push_back({key, entry.seq});
+        shard.main_bytes += charge;
+    } else {
+        shard.small.push_back({key, entry.seq});
+        shard.small_bytes += charge;
+    }
+    shard.inserts.fetch_add(1, std::memory_order_relaxed);
+    
+    evict(shard);
+}
+
+void ValueCache::evict(Shard& shard) {
+    while (shard.small_bytes + shard.main_bytes > shard_capacity_) {
+        if (shard.small.empty() && shard.main.empty()) {
+            break;
+        }
+        
+        // Keep the small queue to about a tenth of the shard
+        if (!shard.small.empty() && (shard.small_bytes > shard_capacity_ / 10 || shard.main.empty())) {
+            evict_small(shard);
+        } else {
+            evict_main(shard);
+        }
+    }
+}
+
+void ValueCache::evict_small(Shard& shard) {
+    Slot slot = shard.small.front();
+    shard.small.pop_front();
+    
+    auto it = shard.entries.find(slot.key);
+    if (it == shard.entries.end() || it->second.seq != slot.seq) {
+        return;  // Stale slot
+    }
+    
+    Entry& entry = it->second;
+    size_t charge = entry.value.size() + kEntryOverhead;
+    shard.small_bytes -= charge;
+    
+    // Read again while in the small queue: promote
+    if (entry.freq.load(std::memory_order_relaxed) > 0) {
+        entry.freq.store(0, std::memory_order_relaxed);
+        entry.seq = shard.next_seq++;
+        shard.main.push_back({slot.key, entry.seq});
+        shard.main_bytes += charge;
+        return;
+    }
+    
+    // Remember the key for a while, so a quick return skips the small queue
+    uint64_t fingerprint = KeyHash{}(slot.key);
+    shard.ghost.push_back(fingerprint);
+    shard.ghost_set.insert(fingerprint);
+    while (shard.ghost.size() > shard.entries.size()) {
+        shard.ghost_set.erase(shard.ghost.front());
+        shard.ghost.pop_front();
+    }
+    
+    shard.entries.erase(it);
+    shard.evictions.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ValueCache::evict_main(Shard& shard) {
+    Slot slot = shard.main.front();
+    shard.main.pop_front();
+    
+    auto it = shard.entries.find(slot.key);
+    if (it == shard.entries.end() || it->second.seq != slot.seq) {
+        return;  // Stale slot
+    }
+    
+    // Still being read: another lap
+    Entry& entry = it->second;
+    uint8_t freq = entry.freq.load(std::memory_order_relaxed);
+    if (freq > 0) {
+        entry.freq.store(freq - 1, std::memory_order_relaxed);
+        entry.seq = shard.next_seq++;
+        shard.main.push_back({slot.key, entry.seq});
+        return;
+    }
+    
+    shard.main_bytes -= entry.value.size() + kEntryOverhead;
+    shard.entries.erase(it);
+    shard.evictions.fetch_add(1, std::memory_order_relaxed);
+}
+
+CacheStats ValueCache::stats() const {
+    CacheStats stats;
+    for (const auto& shard : shards_) {
+        std::shared_lock lock(shard->mutex);
+        stats.hits += shard->hits.load(std::memory_order_relaxed);
+        stats.misses += shard->misses.load(std::memory_order_relaxed);
+        stats.inserts += shard->inserts.load(std::memory_order_relaxed);
+        stats.evictions += shard->evictions.load(std::memory_order_relaxed);
+        stats.bytes += shard->small_bytes + shard->main_bytes;
+        stats.entries += shard->entries.size();
+    }
+    return stats;
+}
+
+} // namespace bitcask
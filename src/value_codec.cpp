@@ -0,0 +1,213 @@
+#include "../include/value_codec.h"
+#include <algorithm>
+#include <cstring>
+
+namespace bitcask {
+
+namespace lz4 {
+
+namespace {
+
+constexpr size_t kMinMatch = 4;
+constexpr size_t kLastLiterals = 5;     // A block always ends in 5+ literals
+constexpr size_t kMatchFindLimit = 12;  // No match may start in the last 12 bytes
+constexpr size_t kMaxOffset = 65535;
+constexpr int kHashBits = 12;
+
+uint32_t load32(const uint8_t* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint32_t hash32(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - kHashBits);
+}
+
+// Lengths of 15 or more spill into extra bytes of 255 until a smaller one
+uint8_t* write_length(uint8_t* out, size_t length) {
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = static_cast<uint8_t>(length);
+    return out;
+}
+
+bool read_length(const uint8_t*& in, const uint8_t* end, size_t& length) {
+    uint8_t byte;
+    do {
+        if (in >= end) {
+            return false;
+        }
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+uint8_t* write_sequence(uint8_t* out, const uint8_t* literals, size_t literal_length,
+                        size_t offset, size_t match_length) {
+    uint8_t* token = out++;
+    *token = static_cast<uint8_t>(std::min<size_t>(literal_length, 15) << 4);
+    if (literal_length >= 15) {
+        out = write_length(out, literal_length - 15);
+    }
+    std::memcpy(out, literals, literal_length);
+    out += literal_length;
+    
+    if (match_length == 0) {
+        return out;  // Final, literal-only sequence
+    }
+    
+    *out++ = static_cast<uint8_t>(offset);
+    *out++ = static_cast<uint8_t>(offset >> 8);
+    size_t extra = match_length - kMinMatch;
+    *token |= static_cast<uint8_t>(std::min<size_t>(extra, 15));
+    if (extra >= 15) {
+        out = write_length(out, extra - 15);
+    }
+    return out;
+}
+
+} // namespace
+
+size_t compress(const char* src, size_t n, char* dst) {
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+    uint8_t* out = reinterpret_cast<uint8_t*>(dst);
+    size_t anchor = 0;
+    
+    if (n > kMatchFindLimit) {
+        // Last position seen for each hashed 4-byte sequence
+        uint32_t table[1 << kHashBits] = {};
+        const size_t match_limit = n - kMatchFindLimit;
+        const size_t extend_limit = n - kLastLiterals;
+        size_t pos = 1;
+        table[hash32(load32(in))] = 0;
+        
+        while (pos < match_limit) {
+            uint32_t sequence = load32(in + pos);
+            uint32_t& slot = table[hash32(sequence)];
+            size_t candidate = slot;
+            slot = static_cast<uint32_t>(pos);
+            
+            if (pos - candidate > kMaxOffset || load32(in + candidate) != sequence) {
+                // Step faster through data that isn't matching
+                pos += 1 + ((pos - anchor) >> 6);
+                continue;
+            }
+            
+            // Grow the match backwards over pending literals, then forwards
+            while (pos > anchor && candidate > 0 && in[pos - 1] == in[candidate - 1]) {
+                --pos;
+                --candidate;
+            }
+            size_t length = kMinMatch;
+            while (pos + length < extend_limit && in[candidate + length] == in[pos + length]) {
+                ++length;
+            }
+            
+            out = write_sequence(out, in + anchor, pos - anchor, pos - candidate, length);
+            pos += length;
+            anchor = pos;
+            if (pos < match_limit) {
+                table[hash32(load32(in + pos - 2))] = static_cast<uint32_t>(pos - 2);
+            }
+        }
+    }
+    
+    out = write_sequence(out, in + anchor, n - anchor, 0, 0);
+    return static_cast<size_t>(out - reinterpret_cast<uint8_t*>(dst));
+}
+
+bool decompress(const char* src, size_t n, char* dst, size_t raw_size) {
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+    const uint8_t* in_end = in + n;
+    uint8_t* out = reinterpret_cast<uint8_t*>(dst);
+    uint8_t* const out_begin = out;
+    uint8_t* const out_end = out + raw_size;
+    
+    while (in < in_end) {
+        uint8_t token = *in++;
+        
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !read_length(in, in_end, literal_length)) {
+            return false;
+        }
+        if (literal_length > static_cast<size_t>(in_end - in) ||
+            literal_length > static_cast<size_t>(out_end - out)) {
+            return false;
+        }
+        std::memcpy(out, in, literal_length);
+        in += literal_length;
+        out += literal_length;
+        
+        if (in == in_end) {
+            break;  // The last sequence has no match
+        }
+        
+        if (in_end - in < 2) {
+            return false;
+        }
+        size_t offset = in[0] | (static_cast<size_t>(in[1]) << 8);
+        in += 2;
+        if (offset == 0 || offset > static_cast<size_t>(out - out_begin)) {
+            return false;
+        }
+        
+        size_t match_length = token & 15;
+        if (match_length == 15 && !read_length(in, in_end, match_length)) {
+            return false;
+        }
+        match_length += kMinMatch;
+        if (match_length > static_cast<size_t>(out_end - out)) {
+            return false;
+        }
+        
+        // Overlapping matches (offset < length) repeat the last bytes, so
+        // they have to be copied forwards a byte at a time
+        const uint8_t* match = out - offset;
+        if (offset >= match_length) {
+            std::memcpy(out, match, match_length);
+        } else {
+            for (size_t i = 0; i < match_length; ++i) {
+                out[i] = match[i];
+            }
+        }
+        out += match_length;
+    }
+    
+    return out == out_end;
+}
+
+} // namespace lz4
+
+bool ValueCodec::compress(std::string_view value, std::string& frame) {
+    frame.resize(kFrameHeaderSize + lz4::max_compressed_size(value.size()));
+    
+    uint32_t raw_size = static_cast<uint32_t>(value.size());
+    for (size_t i = 0; i < kFrameHeaderSize; ++i) {
+        frame[i] = static_cast<char>(raw_size >> (8 * i));
+    }
+    
+    size_t length = lz4::compress(value.data(), value.size(), frame.data() + kFrameHeaderSize);
+    frame.resize(kFrameHeaderSize + length);
+    return frame.size() <= value.size() - value.size() / 8;
+}
+
+bool ValueCodec::decompress(std::string_view frame, std::string& value) {
+    if (frame.size() < kFrameHeaderSize) {
+        return false;
+    }
+    
+    uint32_t raw_size = 0;
+    for (size_t i = 0; i < kFrameHeaderSize; ++i) {
+        raw_size |= static_cast<uint32_t>(static_cast<uint8_t>(frame[i])) << (8 * i);
+    }
+    
+    value.resize(raw_size);
+    return lz4::decompress(frame.data() + kFrameHeaderSize, frame.size() - kFrameHeaderSize,
+                           value.data(), raw_size);
+}
+
+} // namespace bitcask
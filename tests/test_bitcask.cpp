@@ -0,0 +1,2141 @@
+#include "../include/bitcask.h"
+#include "../include/crc32.h"
+#include "../include/protocol.h"
+#include "../include/server.h"
+#include "../include/value_codec.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <dirent.h>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace bitcask;
+
+namespace {
+
+int g_failures = 0;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            std::cerr << "  CHECK failed: " #cond " (" << __FILE__ << ":"   \
+                      << __LINE__ << ")\n";                                 \
+            ++g_failures;                                                   \
+        }                                                                   \
+    } while (0)
+
+std::string fresh_dir(const std::string& name) {
+    std::string dir = "test_tmp_" + name;
+    std::system(("rm -rf " + dir).c_str());
+    return dir;
+}
+
+std::unique_ptr<Bitcask> open_db(const Config& config) {
+    auto result = Bitcask::open(config);
+    if (!result.ok()) {
+        std::cerr << "  open failed: " << result.err() << "\n";
+        std::exit(1);
+    }
+    return std::move(result.value);
+}
+
+// Value written for (key, version) so readers can verify what they see
+std::string value_for(int key, int version) {
+    return "v" + std::to_string(version) + ":" + std::string(32 + key % 64, 'a' + key % 26);
+}
+
+bool parse_value(const std::string& value, int key) {
+    size_t colon = value.find(':');
+    if (value.empty() || value[0] != 'v' || colon == std::string::npos) {
+        return false;
+    }
+    return value.substr(colon + 1) == std::string(32 + key % 64, 'a' + key % 26);
+}
+
+void test_concurrent_stress() {
+    Config config(fresh_dir("stress"));
+    config.max_file_size = 64 * 1024;  // Force frequent rotation under load
+    config.index_shards = 8;
+    auto db = open_db(config);
+    
+    const int num_keys = 2000;
+    const int num_writers = 4;
+    const int num_readers = 4;
+    const int writes_per_thread = 5000;
+    
+    for (int k = 0; k < num_keys; ++k) {
+        CHECK(db->put("key" + std::to_string(k), value_for(k, 0)).ok());
+    }
+    
+    std::atomic<bool> stop{false};
+    std::atomic<int> bad_reads{0};
+    std::atomic<int> failed_ops{0};
+    std::vector<std::thread> threads;
+    
+    for (int w = 0; w < num_writers; ++w) {
+        threads.emplace_back([&, w] {
+            for (int i = 0; i < writes_per_thread; ++i) {
+                int k = (i * 7919 + w * 104729) % num_keys;
+                if (!db->put("key" + std::to_string(k), value_for(k, i)).ok()) {
+                    ++failed_ops;
+                }
+            }
+        });
+    }
+    
+    for (int r = 0; r < num_readers; ++r) {
+        threads.emplace_back([&, r] {
+            int i = r;
+            while (!stop.load()) {
+                int k = (i++ * 31) % num_keys;
+                auto result = db->get("key" + std::to_string(k));
+                if (!result.ok()) {
+                    ++failed_ops;
+                } else if (!parse_value(result.value, k)) {
+                    ++bad_reads;
+                }
+            }
+        });
+    }
+    
+    // Merge concurrently with readers and writers
+    threads.emplace_back([&] {
+        for (int i = 0; i < 3; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            if (!db->merge().ok()) {
+                ++failed_ops;
+            }
+        }
+    });
+    
+    for (int w = 0; w < num_writers; ++w) {
+        threads[w].join();
+    }
+    threads.back().join();
+    stop = true;
+    for (size_t t = num_writers; t + 1 < threads.size(); ++t) {
+        threads[t].join();
+    }
+    
+    CHECK(failed_ops.load() == 0);
+    CHECK(bad_reads.load() == 0);
+    CHECK(db->list_keys().size() == static_cast<size_t>(num_keys));
+    
+    // Every key must survive a reopen with a well-formed value
+    db.reset();
+    db = open_db(config);
+    for (int k = 0; k < num_keys; ++k) {
+        auto result = db->get("key" + std::to_string(k));
+        CHECK(result.ok() && parse_value(result.value, k));
+    }
+}
+
+void test_mmap_views_survive_merge() {
+    Config config(fresh_dir("mmap"));
+    config.max_file_size = 4 * 1024;
+    config.mmap_immutable_files = true;
+    auto db = open_db(config);
+    
+    const std::string big(3000, 'm');
+    for (int k = 0; k < 20; ++k) {
+        CHECK(db->put("key" + std::to_string(k), big + std::to_string(k)).ok());
+    }
+    
+    // key0 lives in an immutable file by now, so the view must be zero-copy
+    auto view = db->get_view("key0");
+    CHECK(view.ok());
+    CHECK(view.value.is_mapped());
+    CHECK(view.value.view() == big + "0");
+    
+    // Retire every old file; the pinned view must stay readable
+    CHECK(db->merge().ok());
+    CHECK(view.value.view() == big + "0");
+    
+    auto after = db->get_view("key0");
+    CHECK(after.ok() && after.value.view() == big + "0");
+    
+    // The active file is not mapped, so views of it own a copy
+    CHECK(db->put("tail", "t").ok());
+    auto active = db->get_view("tail");
+    CHECK(active.ok() && !active.value.is_mapped());
+    CHECK(active.value.view() == "t");
+}
+
+void test_write_batch() {
+    Config config(fresh_dir("batch"));
+    auto db = open_db(config);
+    
+    CHECK(db->put("gone", "soon").ok());
+    
+    WriteBatch batch;
+    for (int k = 0; k < 100; ++k) {
+        batch.put("key" + std::to_string(k), value_for(k, 1));
+    }
+    batch.del("gone");
+    batch.put("key0", value_for(0, 2));  // Later ops in a batch win
+    CHECK(db->write(batch).ok());
+    
+    WriteBatch bad;
+    bad.put("", "empty key");
+    CHECK(!db->write(bad).ok());
+    
+    // Group commit: many writers at once, every batch must land exactly once
+    std::vector<std::thread> writers;
+    for (int w = 0; w < 8; ++w) {
+        writers.emplace_back([&, w] {
+            for (int i = 0; i < 50; ++i) {
+                WriteBatch b;
+                b.put("w" + std::to_string(w) + ":" + std::to_string(i), "x");
+                b.put("w" + std::to_string(w) + ":last", std::to_string(i));
+                CHECK(db->write(b).ok());
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    
+    for (int pass = 0; pass < 2; ++pass) {
+        CHECK(!db->get("gone").ok());
+        auto first = db->get("key0");
+        CHECK(first.ok() && first.value == value_for(0, 2));
+        CHECK(db->list_keys().size() == 100 + 8 * 51);
+        for (int w = 0; w < 8; ++w) {
+            auto last = db->get("w" + std::to_string(w) + ":last");
+            CHECK(last.ok() && last.value == "49");
+        }
+        
+        // Same answers after recovery
+        db.reset();
+        db = open_db(config);
+    }
+    
+    // Racing deletes of one key: exactly one succeeds, and only it is logged
+    for (int k = 0; k < 20; ++k) {
+        CHECK(db->put("racy" + std::to_string(k), "x").ok());
+    }
+    auto records = [&] {
+        uint64_t count = 0;
+        for (const auto& file : db->file_stats()) {
+            count += file.total_records;
+        }
+        return count;
+    };
+    uint64_t records_before = records();
+    std::atomic<int> deleted{0};
+    std::vector<std::thread> deleters;
+    for (int t = 0; t < 8; ++t) {
+        deleters.emplace_back([&] {
+            for (int k = 0; k < 20; ++k) {
+                auto result = db->del("racy" + std::to_string(k));
+                CHECK(result.ok() || result.err() == "Key not found");
+                deleted += result.ok();
+            }
+        });
+    }
+    for (auto& deleter : deleters) {
+        deleter.join();
+    }
+    CHECK(deleted == 20);
+    CHECK(records() == records_before + 20);
+    CHECK(!db->del("racy0").ok());
+    
+    // A batch deleting and re-creating a key lets a later del() of it succeed
+    WriteBatch revive;
+    revive.del("key1");
+    revive.put("key1", "back");
+    CHECK(db->write(revive).ok() && db->del("key1").ok() && !db->get("key1").ok());
+    
+    // A write cut short (here by the file size limit) is taken back off the
+    // log, so later writes land where the index expects them
+    std::string log_path = config.directory + "/cask." +
+                           std::to_string(db->file_stats().back().file_id);
+    uint64_t size = db->file_stats().back().total_bytes;
+    WriteBatch big;
+    for (int k = 0; k < 20; ++k) {
+        big.put("short" + std::to_string(k), std::string(1000, 's'));
+    }
+    struct rlimit old_limit;
+    getrlimit(RLIMIT_FSIZE, &old_limit);
+    struct rlimit limit = old_limit;
+    limit.rlim_cur = size + 4096;
+    auto old_handler = std::signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &limit);
+    bool failed = !db->write(big).ok();
+    setrlimit(RLIMIT_FSIZE, &old_limit);
+    std::signal(SIGXFSZ, old_handler);
+    CHECK(failed);
+    CHECK(db->file_stats().back().total_bytes == size);
+    CHECK(std::ifstream(log_path, std::ios::binary | std::ios::ate).tellg() ==
+          static_cast<std::streamoff>(size));
+    CHECK(db->put("after_short", "write").ok());
+    CHECK(db->get("after_short").value == "write");
+    db.reset();
+    db = open_db(config);
+    CHECK(db->get("after_short").value == "write" && !db->get("short0").ok());
+    
+    // A batch spanning several blocks and records comes back whole after a
+    // crash, or not at all if the append was torn
+    auto spanning = [](int round) {
+        WriteBatch span;
+        for (int k = 0; k < 200; ++k) {
+            span.put("span" + std::to_string(k), std::string(900, 'a' + round));
+            if (k == 100) {
+                span.put("span_large", std::string(5000, 'a' + round));
+            }
+        }
+        span.del("after_short");
+        return span;
+    };
+    CHECK(db->write(spanning(0)).ok());
+    db.reset();
+    db = open_db(config);
+    CHECK(db->get("span199").value == std::string(900, 'a') && !db->get("after_short").ok());
+    
+    for (int cut = 0; cut < 3; ++cut) {
+        uint64_t before = db->file_stats().back().total_bytes;
+        CHECK(db->write(spanning(1)).ok());
+        uint64_t after = db->file_stats().back().total_bytes;
+        log_path = config.directory + "/cask." + std::to_string(db->file_stats().back().file_id);
+        db.reset();
+        uint64_t length = cut == 0 ? after - 1 : before + (after - before) * cut / 3;
+        CHECK(::truncate(log_path.c_str(), static_cast<off_t>(length)) == 0);
+        db = open_db(config);
+        CHECK(db->file_stats().back().total_bytes == before);
+        CHECK(db->get("span0").value == std::string(900, 'a'));
+        CHECK(db->get("span199").value == std::string(900, 'a'));
+        CHECK(db->get("span_large").value == std::string(5000, 'a'));
+    }
+}
+
+void test_sync_policies() {
+    for (SyncPolicy policy : {SyncPolicy::None, SyncPolicy::Always, SyncPolicy::Interval}) {
+        Config config(fresh_dir("sync"));
+        config.max_file_size = 2048;
+        config.sync_policy = policy;
+        config.sync_interval_ms = 5;
+        config.sync_bytes = 1024;
+        auto db = open_db(config);
+        
+        for (int k = 0; k < 50; ++k) {
+            CHECK(db->put("key" + std::to_string(k), value_for(k, 0)).ok());
+        }
+        CHECK(db->sync().ok());
+        
+        db.reset();
+        db = open_db(config);
+        for (int k = 0; k < 50; ++k) {
+            auto result = db->get("key" + std::to_string(k));
+            CHECK(result.ok() && result.value == value_for(k, 0));
+        }
+    }
+}
+
+void test_crc32_matches_reference() {
+    // Standard check value for "123456789"
+    const char* check = "123456789";
+    for (Crc32Impl impl : {Crc32Impl::Reference, Crc32Impl::Slicing8, Crc32Impl::Hardware}) {
+        CHECK(crc32_with(impl, reinterpret_cast<const uint8_t*>(check), 9) == 0xCBF43926);
+    }
+    
+    std::mt19937 rng(7);
+    std::vector<uint8_t> data(9000);
+    for (auto& byte : data) {
+        byte = static_cast<uint8_t>(rng());
+    }
+    
+    // Every length around the SIMD block boundaries, at unaligned offsets
+    for (size_t length = 0; length < 300; ++length) {
+        for (size_t offset : {0, 1, 3, 7}) {
+            const uint8_t* p = data.data() + offset;
+            uint32_t expected = crc32_with(Crc32Impl::Reference, p, length);
+            CHECK(crc32_with(Crc32Impl::Slicing8, p, length) == expected);
+            CHECK(crc32_with(Crc32Impl::Hardware, p, length) == expected);
+            CHECK(crc32(p, length) == expected);
+        }
+    }
+    
+    // Large buffers and incremental chaining
+    uint32_t expected = crc32_with(Crc32Impl::Reference, data.data(), data.size());
+    CHECK(crc32(data.data(), data.size()) == expected);
+    CHECK(crc32(data.data() + 4097, data.size() - 4097, crc32(data.data(), 4097)) == expected);
+    CHECK(LogFile::calculate_crc32(data.data(), data.size()) == expected);
+}
+
+void test_parallel_recovery() {
+    Config config(fresh_dir("recovery"));
+    config.max_file_size = 1024;  // Spread history over many files
+    auto db = open_db(config);
+    
+    // Rewrite and delete keys across file boundaries so order matters
+    for (int version = 0; version < 4; ++version) {
+        for (int k = 0; k < 60; ++k) {
+            CHECK(db->put("key" + std::to_string(k), value_for(k, version)).ok());
+        }
+        for (int k = version; k < 60; k += 7) {
+            CHECK(db->del("key" + std::to_string(k)).ok());
+        }
+    }
+    CHECK(db->put("key3", value_for(3, 9)).ok());
+    
+    auto expected = db->list_keys();
+    db.reset();
+    
+    for (size_t threads : {1, 4}) {
+        config.recovery_threads = threads;
+        db = open_db(config);
+        
+        const auto& stats = db->recovery_stats();
+        CHECK(stats.threads == threads);
+        CHECK(stats.files.size() > 10);
+        for (size_t i = 1; i < stats.files.size(); ++i) {
+            CHECK(stats.files[i - 1].file_id < stats.files[i].file_id);
+        }
+        
+        CHECK(db->list_keys().size() == expected.size());
+        for (int k = 0; k < 60; ++k) {
+            auto result = db->get("key" + std::to_string(k));
+            bool deleted = k != 3 && k % 7 == 3;  // Last deleted in version 3
+            CHECK(result.ok() != deleted);
+            if (result.ok()) {
+                CHECK(result.value == value_for(k, k == 3 ? 9 : 3));
+            }
+        }
+        db.reset();
+    }
+}
+
+void test_scan_and_torn_tail() {
+    Config config(fresh_dir("scan"));
+    auto db = open_db(config);
+    
+    std::vector<std::string> values;
+    for (int k = 0; k < 40; ++k) {
+        values.push_back(std::string(k * k * 7 + 1, 'a' + k % 26));  // Up to ~11 KB
+        CHECK(db->put("key" + std::to_string(k), values.back()).ok());
+    }
+    db.reset();
+    
+    // Small chunks force records to straddle and exceed chunk boundaries
+    for (size_t chunk : {size_t(64), size_t(4096), LogFile::kScanChunkSize}) {
+        LogFile file(0, config.directory, true);
+        int seen = 0;
+        auto result = file.scan([&](const LogFile::RecordView& record) {
+            CHECK(record.key == "key" + std::to_string(seen));
+            CHECK(record.value == values[seen]);
+            ++seen;
+            return true;
+        }, 0, chunk);
+        CHECK(result.ok() && result.value == file.size());
+        CHECK(seen == 40);
+    }
+    
+    // Simulate a crash mid-append: a header promising more bytes than exist
+    {
+        std::ofstream out(config.directory + "/cask.0", std::ios::binary | std::ios::app);
+        LogEntryHeaderV3 header{0, 0, 0};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write("\x05\x64torn", 6);  // Key and value sizes 5 and 100
+    }
+    
+    db = open_db(config);
+    CHECK(db->list_keys().size() == 40);
+    CHECK(db->put("after", "crash").ok());
+    db.reset();
+    
+    // The torn tail was cut off, so the new record is reachable on recovery
+    db = open_db(config);
+    auto after = db->get("after");
+    CHECK(after.ok() && after.value == "crash");
+    auto last = db->get("key39");
+    CHECK(last.ok() && last.value == values[39]);
+    db.reset();
+    
+    // Zeros a crash left past the end of the data are a torn tail too
+    std::string log_path = config.directory + "/cask.0";
+    uint64_t size = std::ifstream(log_path, std::ios::binary | std::ios::ate).tellg();
+    CHECK(::truncate(log_path.c_str(), static_cast<off_t>(size + 5000)) == 0);
+    db = open_db(config);
+    CHECK(db->get("after").value == "crash" && db->file_stats().back().total_bytes == size);
+    db.reset();
+    
+    // But a bad record with intact ones after it is corruption: the open
+    // fails rather than drop them
+    {
+        std::fstream io(log_path, std::ios::binary | std::ios::in | std::ios::out);
+        io.seekp(size / 2);
+        char byte = static_cast<char>(io.get());
+        io.seekp(size / 2);
+        io.put(static_cast<char>(byte ^ 0x01));
+    }
+    auto corrupt = Bitcask::open(config);
+    CHECK(!corrupt.ok() && corrupt.err().find("Corrupt record in cask.0") == 0);
+    CHECK(std::ifstream(log_path, std::ios::binary | std::ios::ate).tellg() ==
+          static_cast<std::streamoff>(size));
+}
+
+void test_merge_then_reopen() {
+    Config config(fresh_dir("merge"));
+    config.max_file_size = 512;
+    auto db = open_db(config);
+    
+    for (int version = 0; version < 3; ++version) {
+        for (int k = 0; k < 30; ++k) {
+            CHECK(db->put("key" + std::to_string(k), value_for(k, version)).ok());
+        }
+    }
+    CHECK(db->del("key7").ok());
+    CHECK(db->merge().ok());
+    
+    // Writes after a merge must win over the merged copies on recovery
+    CHECK(db->put("key1", value_for(1, 5)).ok());
+    CHECK(db->del("key2").ok());
+    
+    for (int pass = 0; pass < 2; ++pass) {
+        CHECK(db->list_keys().size() == 28);
+        CHECK(!db->get("key7").ok());
+        CHECK(!db->get("key2").ok());
+        auto updated = db->get("key1");
+        CHECK(updated.ok() && updated.value == value_for(1, 5));
+        auto merged = db->get("key20");
+        CHECK(merged.ok() && merged.value == value_for(20, 2));
+        
+        db.reset();
+        db = open_db(config);
+    }
+}
+
+void test_hint_files() {
+    Config config(fresh_dir("hint"));
+    config.max_file_size = 512;
+    auto db = open_db(config);
+    for (int k = 0; k < 40; ++k) {
+        CHECK(db->put("key" + std::to_string(k), value_for(k, 0)).ok());
+    }
+    CHECK(db->merge().ok());
+    db.reset();
+    
+    // Find a merged file's hint
+    uint32_t hinted_id = 0;
+    while (!std::ifstream(HintFile::path_for(config.directory, hinted_id))) {
+        ++hinted_id;
+    }
+    
+    auto verify = [&](bool expect_hint) {
+        auto reopened = open_db(config);
+        for (const auto& file : reopened->recovery_stats().files) {
+            if (file.file_id == hinted_id) {
+                CHECK(file.from_hint == expect_hint);
+            }
+        }
+        CHECK(reopened->list_keys().size() == 40);
+        for (int k = 0; k < 40; ++k) {
+            auto result = reopened->get("key" + std::to_string(k));
+            CHECK(result.ok() && result.value == value_for(k, 0));
+        }
+    };
+    verify(true);
+    
+    // Check the hint header
+    std::string hint_path = HintFile::path_for(config.directory, hinted_id);
+    std::string bytes;
+    {
+        std::ifstream in(hint_path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    CHECK(bytes.compare(0, 8, "BCSKHINT") == 0);
+    
+    // A flipped bit fails the checksum and falls back to scanning the log
+    std::string corrupt = bytes;
+    corrupt[corrupt.size() - 1] ^= 0x01;
+    std::ofstream(hint_path, std::ios::binary | std::ios::trunc) << corrupt;
+    verify(false);
+    
+    // So does a truncated hint
+    std::ofstream(hint_path, std::ios::binary | std::ios::trunc)
+        << bytes.substr(0, bytes.size() - 3);
+    verify(false);
+    
+    // Even to nothing: an empty hint only stands for a log without records
+    std::ofstream(hint_path, std::ios::binary | std::ios::trunc);
+    verify(false);
+    
+    // And one whose header miscounts its entries, checksums notwithstanding
+    HintFileHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    header.entry_count += 1;
+    header.header_crc = crc32(reinterpret_cast<const uint8_t*>(&header),
+                              offsetof(HintFileHeader, header_crc));
+    std::string miscounted = bytes;
+    std::memcpy(miscounted.data(), &header, sizeof(header));
+    std::ofstream(hint_path, std::ios::binary | std::ios::trunc) << miscounted;
+    verify(false);
+    
+    // Hints from before version 4 don't have the record sizes a version 3
+    // log needs, so the log is scanned instead
+    std::string v1;
+    for (size_t pos = sizeof(HintFileHeader); pos < bytes.size();) {
+        HintEntryHeader entry;
+        std::memcpy(&entry, bytes.data() + pos, sizeof(entry));
+        v1.append(bytes, pos, offsetof(HintEntryHeader, flags));
+        v1.append(bytes, pos + sizeof(entry), entry.key_size);
+        pos += sizeof(entry) + entry.key_size;
+    }
+    std::ofstream(hint_path, std::ios::binary | std::ios::trunc) << v1;
+    verify(false);
+    std::ofstream(hint_path, std::ios::binary | std::ios::trunc) << bytes;
+    
+    // A merge that can't write its output leaves neither outputs nor hints
+    db = open_db(config);
+    for (int k = 0; k < 40; ++k) {
+        CHECK(db->put("key" + std::to_string(k), value_for(k, 0)).ok());
+    }
+    std::system(("rm -rf " + config.directory + "/.merge").c_str());
+    std::ofstream(config.directory + "/.merge") << "not a directory";
+    auto count_hints = [&] {
+        size_t count = 0;
+        for (uint32_t id = 0; id < 1000; ++id) {
+            count += static_cast<bool>(std::ifstream(HintFile::path_for(config.directory, id)));
+        }
+        return count;
+    };
+    size_t hints_before = count_hints();
+    CHECK(!db->merge().ok());
+    CHECK(count_hints() == hints_before);
+    db.reset();
+    std::remove((config.directory + "/.merge").c_str());
+    verify(true);
+}
+
+void test_compact_index() {
+    // Table level: growth, overwrite, tombstones and long keys
+    CompactKeyTable table;
+    for (uint32_t i = 0; i < 5000; ++i) {
+        table.assign("k" + std::to_string(i), {i % 7, 0, 0, i * 100ull, i, i});
+    }
+    table.assign("k42", IndexEntry::create_tombstone(9));
+    table.assign(std::string(300, 'x'), {1, 0, 0, 2, 3, 4});
+    CHECK(table.size() == 5001);
+    
+    IndexEntry entry;
+    CHECK(table.find("k4999", entry) && entry.value_pos == 499900 && entry.file_id == 4999 % 7);
+    CHECK(table.find("k42", entry) && entry.is_tombstone());
+    CHECK(table.find(std::string(300, 'x'), entry) && entry.value_size == 3);
+    CHECK(!table.find("k5000", entry));
+    
+    size_t visited = 0;
+    table.for_each([&](std::string_view, const IndexEntry&) { ++visited; });
+    CHECK(visited == 5001);
+    
+    // Locations at and past the packed limits round-trip exactly
+    const uint32_t max_file = PackedEntry::kMaxFileId;
+    const uint64_t max_pos = PackedEntry::kMaxValuePos;
+    const uint32_t max_size = PackedEntry::kCompressedBit - 1;
+    const uint8_t max_overhead = PackedEntry::kMaxOverhead;
+    std::vector<IndexEntry> edges = {
+        {max_file - 1, 0, max_overhead, max_pos, max_size, 1},  // Largest that packs
+        {max_file, 0, 9, 5, 6, 2},                              // The tombstone file id
+        {max_file + 1, kRecordCompressed, 9, 5, 6, 3},
+        {std::numeric_limits<uint32_t>::max() - 1, 0, 9, 5, 6, 4},
+        {7, 0, 9, max_pos + 1, 6, 5},
+        {7, 0, 9, 5, max_size + 1, 6},                          // The compressed bit
+        {7, kRecordCompressed, 9, 5, std::numeric_limits<uint32_t>::max() - 1, 7},
+        {7, 0, max_overhead + 1, 5, 6, 8},
+    };
+    auto same = [](const IndexEntry& a, const IndexEntry& b) {
+        return a.file_id == b.file_id && a.flags == b.flags && a.overhead == b.overhead &&
+               a.value_pos == b.value_pos && a.value_size == b.value_size;
+    };
+    FingerprintTable fingerprints;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t i = 0; i < edges.size(); ++i) {
+            table.assign("edge" + std::to_string(i), edges[i]);
+            fingerprints.assign(i, edges[i]);
+        }
+        for (size_t i = 0; i < edges.size(); ++i) {
+            CHECK(table.find("edge" + std::to_string(i), entry) && !entry.is_tombstone());
+            CHECK(same(entry, edges[i]) && entry.timestamp == edges[i].timestamp);
+            CHECK(fingerprints.find(i, entry) && same(entry, edges[i]));
+        }
+        size_t edge_visits = 0;
+        table.for_each([&](std::string_view key, const IndexEntry& visited_entry) {
+            if (key.substr(0, 4) == "edge") {
+                edge_visits += same(visited_entry, edges[std::stoul(std::string(key.substr(4)))]);
+            }
+        });
+        fingerprints.for_each([&](uint64_t fp, const IndexEntry& visited_entry) {
+            edge_visits += same(visited_entry, edges[fp]);
+        });
+        CHECK(edge_visits == 2 * edges.size());
+        
+        // Overwriting moves entries between slot and overflow both ways
+        std::rotate(edges.begin(), edges.begin() + 1, edges.end());
+    }
+    table.assign("edge1", IndexEntry::create_tombstone(8));
+    CHECK(table.find("edge1", entry) && entry.is_tombstone());
+    CHECK(fingerprints.erase(2) && !fingerprints.find(2, entry) && fingerprints.size() == 7);
+    
+    // Through the store, including recovery into the compact table
+    Config config(fresh_dir("compact"));
+    config.index_type = IndexType::Compact;
+    config.max_file_size = 4096;
+    auto db = open_db(config);
+    for (int k = 0; k < 500; ++k) {
+        CHECK(db->put("key" + std::to_string(k), value_for(k, 0)).ok());
+    }
+    for (int k = 0; k < 500; k += 5) {
+        CHECK(db->del("key" + std::to_string(k)).ok());
+    }
+    CHECK(db->merge().ok());
+    
+    for (int round = 0; round < 2; ++round) {
+        CHECK(db->list_keys().size() == 400);
+        for (int k = 0; k < 500; ++k) {
+            auto result = db->get("key" + std::to_string(k));
+            CHECK(result.ok() == (k % 5 != 0));
+            CHECK(k % 5 == 0 || result.value == value_for(k, 0));
+        }
+        db.reset();
+        db = open_db(config);
+    }
+}
+
+std::vector<std::string> drain(OrderedIndex::Iterator it) {
+    std::vector<std::string> keys;
+    for (; it.valid(); it.next()) {
+        keys.push_back(it.key());
+    }
+    return keys;
+}
+
+void test_ordered_index() {
+    Config config(fresh_dir("ordered"));
+    config.ordered_index = true;
+    config.max_file_size = 16 * 1024;
+    auto db = open_db(config);
+    
+    // Enough keys to split leaves and page the iterator several times
+    for (int user = 0; user < 40; ++user) {
+        for (int item = 0; item < 50; ++item) {
+            char key[32];
+            std::snprintf(key, sizeof(key), "user:%03d:%03d", user, item);
+            CHECK(db->put(key, "x").ok());
+        }
+    }
+    for (int item = 0; item < 50; item += 2) {
+        char key[32];
+        std::snprintf(key, sizeof(key), "user:007:%03d", item);
+        CHECK(db->del(key).ok());
+    }
+    CHECK(db->put("user:", "x").ok());
+    
+    CHECK(!Bitcask::open(Config(fresh_dir("unordered"))).value->scan("user:").ok());
+    
+    for (int round = 0; round < 2; ++round) {
+        auto all = drain(db->scan("user:").value);
+        CHECK(all.size() == 40 * 50 - 25 + 1);
+        CHECK(std::is_sorted(all.begin(), all.end()));
+        
+        auto user7 = drain(db->scan("user:007:").value);
+        CHECK(user7.size() == 25);
+        CHECK(!user7.empty() && user7.front() == "user:007:001" && user7.back() == "user:007:049");
+        
+        auto limited = drain(db->range("user:010:", "user:020:", 300).value);
+        CHECK(limited.size() == 300);
+        CHECK(!limited.empty() && limited.front() == "user:010:000" && limited.back() == "user:015:049");
+        
+        auto bounded = drain(db->range("user:038:", "user:039:000").value);
+        CHECK(bounded.size() == 50);
+        CHECK(drain(db->scan("nobody").value).empty());
+        
+        // Rebuilt from the keydir on reopen
+        db.reset();
+        db = open_db(config);
+    }
+    
+    CHECK(OrderedIndex::prefix_end("ab") == "ac");
+    CHECK(OrderedIndex::prefix_end(std::string("a\xff", 2)) == "b");
+}
+
+size_t open_fd_count() {
+    size_t count = 0;
+    if (DIR* dir = opendir("/proc/self/fd")) {
+        while (readdir(dir)) {
+            ++count;
+        }
+        closedir(dir);
+    }
+    return count;
+}
+
+void test_file_registry() {
+    Config config(fresh_dir("registry"));
+    config.max_file_size = 2048;
+    config.max_open_files = 4;
+    size_t baseline = open_fd_count();
+    
+    auto db = open_db(config);
+    for (int k = 0; k < 400; ++k) {
+        CHECK(db->put("key" + std::to_string(k), value_for(k, 0)).ok());
+    }
+    
+    // Reads touch every file, but only max_open_files keep a descriptor
+    // (plus the active file's two)
+    for (int k = 0; k < 400; ++k) {
+        auto result = db->get("key" + std::to_string(k));
+        CHECK(result.ok() && result.value == value_for(k, 0));
+    }
+    CHECK(open_fd_count() <= baseline + config.max_open_files + 2);
+    
+    // Readers racing merges (which swap and delete files under them) and
+    // the evictions their reads cause
+    std::atomic<bool> stop{false};
+    std::atomic<int> bad_reads{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&, t] {
+            for (int i = t; !stop; i = (i + 7) % 400) {
+                auto result = db->get("key" + std::to_string(i));
+                if (!result.ok() || !parse_value(result.value, i)) {
+                    ++bad_reads;
+                }
+            }
+        });
+    }
+    for (int round = 1; round <= 5; ++round) {
+        for (int k = 0; k < 400; k += 3) {
+            CHECK(db->put("key" + std::to_string(k), value_for(k, round)).ok());
+        }
+        CHECK(db->merge().ok());
+    }
+    stop = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    CHECK(bad_reads == 0);
+    CHECK(open_fd_count() <= baseline + config.max_open_files + 2);
+    
+    db.reset();
+    CHECK(open_fd_count() == baseline);
+}
+
+size_t count_log_files(const std::string& dir) {
+    size_t count = 0;
+    if (DIR* d = opendir(dir.c_str())) {
+        while (dirent* entry = readdir(d)) {
+            std::string name = entry->d_name;
+            if (name.rfind("cask.", 0) == 0 && name.find(".hint") == std::string::npos) {
+                ++count;
+            }
+        }
+        closedir(d);
+    }
+    return count;
+}
+
+void test_incremental_compaction() {
+    Config config(fresh_dir("compaction"));
+    config.max_file_size = 4096;
+    config.compaction_min_reclaim_bytes = 0;
+    config.compaction_max_files = 4;
+    auto db = open_db(config);
+    
+    // Rewrite the first 100 keys repeatedly and delete some of the rest, so
+    // older files become mostly dead
+    for (int k = 0; k < 200; ++k) {
+        CHECK(db->put("key" + std::to_string(k), value_for(k, 0)).ok());
+    }
+    for (int round = 1; round <= 4; ++round) {
+        for (int k = 0; k < 100; ++k) {
+            CHECK(db->put("key" + std::to_string(k), value_for(k, round)).ok());
+        }
+    }
+    for (int k = 100; k < 200; k += 4) {
+        CHECK(db->del("key" + std::to_string(k)).ok());
+    }
+    
+    auto verify = [&](Bitcask& store) {
+        CHECK(store.list_keys().size() == 175);
+        for (int k = 0; k < 200; ++k) {
+            auto result = store.get("key" + std::to_string(k));
+            if (k >= 100 && k % 4 == 0) {
+                CHECK(!result.ok());
+            } else {
+                CHECK(result.ok() && result.value == value_for(k, k < 100 ? 4 : 0));
+            }
+        }
+    };
+    
+    // A round that can't write its output fails before touching the inputs
+    // (rounds whose inputs are all dead write nothing and still go ahead)
+    std::ofstream(config.directory + "/.merge") << "not a directory";
+    Result<bool> failed = db->compact();
+    while (failed.ok() && failed.value) {
+        failed = db->compact();
+    }
+    CHECK(!failed.ok());
+    verify(*db);
+    std::remove((config.directory + "/.merge").c_str());
+    
+    size_t before = count_log_files(config.directory);
+    int rounds = 0;
+    for (;;) {
+        auto result = db->compact();
+        CHECK(result.ok());
+        if (!result.ok() || !result.value) {
+            break;
+        }
+        ++rounds;
+        verify(*db);
+    }
+    CHECK(rounds > 0);
+    CHECK(count_log_files(config.directory) < before);
+    
+    // Deleted keys stay deleted and moved values survive recovery
+    db.reset();
+    db = open_db(config);
+    verify(*db);
+    
+    // In the background, against live readers and writers
+    db.reset();
+    config.background_compaction = true;
+    config.compaction_interval_ms = 5;
+    db = open_db(config);
+    std::atomic<bool> stop{false};
+    std::atomic<int> bad_reads{0};
+    std::thread reader([&] {
+        for (int i = 0; !stop; i = (i + 1) % 100) {
+            auto result = db->get("key" + std::to_string(i));
+            if (!result.ok() || !parse_value(result.value, i)) {
+                ++bad_reads;
+            }
+        }
+    });
+    for (int round = 5; round < 40; ++round) {
+        for (int k = 0; k < 100; ++k) {
+            CHECK(db->put("key" + std::to_string(k), value_for(k, round)).ok());
+        }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    stop = true;
+    reader.join();
+    CHECK(bad_reads == 0);
+    
+    // Whatever the scheduler didn't get to yet
+    while (db->compact().value) {
+    }
+    
+    db.reset();
+    db = open_db(config);
+    for (int k = 0; k < 100; ++k) {
+        auto result = db->get("key" + std::to_string(k));
+        CHECK(result.ok() && result.value == value_for(k, 39));
+    }
+    CHECK(count_log_files(config.directory) < 12);
+}
+
+void test_file_stats() {
+    Config config(fresh_dir("file_stats"));
+    config.max_file_size = 4096;
+    auto db = open_db(config);
+    
+    auto totals = [&](Bitcask& store) {
+        FileStats total;
+        for (const auto& file : store.file_stats()) {
+            CHECK(file.live_bytes <= file.total_bytes);
+            total.total_bytes += file.total_bytes;
+            total.live_bytes += file.live_bytes;
+            total.total_records += file.total_records;
+            total.live_keys += file.live_keys;
+        }
+        return total;
+    };
+    
+    // Every record is live until something supersedes it
+    uint64_t live_bytes = 0;
+    for (int k = 0; k < 100; ++k) {
+        std::string key = "key" + std::to_string(k);
+        CHECK(db->put(key, value_for(k, 0)).ok());
+        live_bytes += LogFile::record_size(key.size(), value_for(k, 0).size());
+    }
+    live_bytes += db->file_stats().size() * sizeof(LogFileHeader);  // Never reclaimable
+    FileStats total = totals(*db);
+    CHECK(total.total_bytes == live_bytes && total.live_bytes == live_bytes);
+    CHECK(total.total_records == 100 && total.live_keys == 100);
+    CHECK(db->file_stats().back().active);
+    
+    // Overwrites and deletes move bytes from live to reclaimable
+    for (int k = 0; k < 50; ++k) {
+        CHECK(db->put("key" + std::to_string(k), value_for(k, 1)).ok());
+    }
+    for (int k = 50; k < 60; ++k) {
+        CHECK(db->del("key" + std::to_string(k)).ok());
+    }
+    total = totals(*db);
+    CHECK(total.total_records == 160 && total.live_keys == 90);
+    
+    uint64_t expected_live = db->file_stats().size() * sizeof(LogFileHeader);
+    for (const auto& key : db->list_keys()) {
+        expected_live += LogFile::record_size(key.size(), db->get(key).value.size());
+    }
+    CHECK(total.live_bytes == expected_live);
+    CHECK(total.reclaimable_bytes() == total.total_bytes - expected_live);
+    
+    // Rebuilt identically at recovery, from hints or scans
+    auto check_reopen = [&] {
+        auto before = db->file_stats();
+        db.reset();
+        db = open_db(config);
+        auto after = db->file_stats();
+        CHECK(before.size() == after.size());
+        for (size_t i = 0; i < before.size() && i < after.size(); ++i) {
+            CHECK(before[i].file_id == after[i].file_id);
+            CHECK(before[i].live_bytes == after[i].live_bytes);
+            CHECK(before[i].live_keys == after[i].live_keys);
+            CHECK(before[i].total_records == after[i].total_records);
+        }
+    };
+    check_reopen();
+    
+    // A merge leaves nothing reclaimable in the merged files, whose small
+    // records share blocks
+    uint32_t unmerged_id = db->file_stats().back().file_id;
+    CHECK(db->merge().ok());
+    for (const auto& file : db->file_stats()) {
+        if (!file.active && file.file_id != unmerged_id) {
+            CHECK(file.live_bytes == file.total_bytes && file.reclaimable_bytes() == 0);
+        }
+    }
+    CHECK(totals(*db).live_keys == 90);
+    check_reopen();
+    
+    // Block members count what they take, block headers included: a batch
+    // is all live, then all reclaimable once its keys are deleted
+    db.reset();
+    config = Config(fresh_dir("file_stats_batched"));
+    db = open_db(config);
+    WriteBatch batch;
+    uint64_t standalone_bytes = 0;
+    for (int k = 0; k < 20; ++k) {
+        std::string key = "batched" + std::to_string(k);
+        batch.put(key, value_for(k, 0));
+        standalone_bytes += LogFile::record_size(key.size(), value_for(k, 0).size());
+    }
+    CHECK(db->write(batch).ok());
+    FileStats file = db->file_stats().back();
+    CHECK(file.total_bytes - sizeof(LogFileHeader) < standalone_bytes);
+    CHECK(file.live_bytes == file.total_bytes && file.live_keys == 20);
+    check_reopen();
+    
+    WriteBatch deletes;
+    for (int k = 0; k < 20; ++k) {
+        deletes.del("batched" + std::to_string(k));
+    }
+    CHECK(db->write(deletes).ok());
+    file = db->file_stats().back();
+    CHECK(file.live_bytes == sizeof(LogFileHeader) && file.live_keys == 0);
+    CHECK(file.reclaimable_bytes() == file.total_bytes - sizeof(LogFileHeader));
+    check_reopen();
+}
+
+void test_streaming_merge() {
+    Config config(fresh_dir("streaming_merge"));
+    config.max_file_size = 8192;
+    auto db = open_db(config);
+    
+    for (int round = 0; round < 3; ++round) {
+        for (int k = 0; k < 300; ++k) {
+            CHECK(db->put("key" + std::to_string(k), value_for(k, round)).ok());
+        }
+    }
+    for (int k = 0; k < 300; k += 10) {
+        CHECK(db->del("key" + std::to_string(k)).ok());
+    }
+    CHECK(db->put("tail", "x").ok());  // Keep the deletes out of the active file
+    
+    uint64_t old_records = 0;
+    uint64_t old_bytes = 0;
+    for (const auto& file : db->file_stats()) {
+        if (!file.active) {
+            old_records += file.total_records;
+            old_bytes += file.total_bytes;
+        }
+    }
+    
+    auto result = db->merge();
+    CHECK(result.ok());
+    const MergeStats& stats = result.value;
+    CHECK(stats.records_scanned == old_records);
+    CHECK(stats.input_bytes == old_bytes);
+    CHECK(stats.records_copied <= 270);
+    CHECK(stats.output_files >= 2);  // Output rolls over at max_file_size
+    
+    // Copied records keep their CRCs and every output has a hint
+    uint64_t output_bytes = 0;
+    for (const auto& file : db->file_stats()) {
+        if (!file.active && file.reclaimable_bytes() == 0 && file.total_records > 0) {
+            CHECK(file.total_bytes <= config.max_file_size);
+            output_bytes += file.total_bytes;
+        }
+    }
+    CHECK(output_bytes == stats.output_bytes);
+    
+    db.reset();
+    db = open_db(config);
+    size_t from_hint = 0;
+    for (const auto& file : db->recovery_stats().files) {
+        from_hint += file.from_hint;
+    }
+    CHECK(from_hint == stats.output_files);
+    for (int k = 0; k < 300; ++k) {
+        auto value = db->get("key" + std::to_string(k));
+        CHECK(value.ok() == (k % 10 != 0));
+        CHECK(k % 10 == 0 || value.value == value_for(k, 2));
+    }
+}
+
+void test_value_cache() {
+    // One shard, so the budget below is exact
+    ValueCache cache(64 * 1024, 1);
+    std::string value(200, 'h');
+    std::string out;
+    
+    CHECK(!cache.get(1, 0, out));
+    for (uint64_t pos = 0; pos < 50; ++pos) {
+        cache.insert(1, pos * 1000, value);
+        CHECK(cache.get(1, pos * 1000, out) && out == value);
+    }
+    
+    // A one-off scan several times the budget must not flush the hot set
+    for (uint64_t pos = 0; pos < 2000; ++pos) {
+        cache.insert(2, pos * 1000, std::string(200, 's'));
+    }
+    for (uint64_t pos = 0; pos < 50; ++pos) {
+        CHECK(cache.get(1, pos * 1000, out) && out == value);
+    }
+    
+    CacheStats stats = cache.stats();
+    CHECK(stats.bytes <= 64 * 1024);
+    CHECK(stats.evictions > 0);
+    CHECK(stats.inserts == 2050);
+    CHECK(stats.entries == stats.inserts - stats.evictions);
+    
+    // Through the store: overwrites, deletes and merges move keys, so a
+    // cached value is never served for a stale location
+    Config config(fresh_dir("value_cache"));
+    config.max_file_size = 4096;
+    config.cache_bytes = 1 << 20;
+    auto db = open_db(config);
+    for (int k = 0; k < 100; ++k) {
+        CHECK(db->put("key" + std::to_string(k), value_for(k, 0)).ok());
+    }
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int k = 0; k < 100; ++k) {
+            CHECK(db->get("key" + std::to_string(k)).value == value_for(k, 0));
+        }
+    }
+    stats = db->cache_stats();
+    CHECK(stats.misses == 100 && stats.hits == 100);
+    
+    for (int k = 0; k < 100; k += 2) {
+        CHECK(db->put("key" + std::to_string(k), value_for(k, 1)).ok());
+    }
+    CHECK(db->del("key1").ok());
+    CHECK(db->merge().ok());
+    for (int k = 0; k < 100; ++k) {
+        auto value = db->get("key" + std::to_string(k));
+        auto view = db->get_view("key" + std::to_string(k));
+        CHECK(value.ok() == (k != 1) && view.ok() == (k != 1));
+        if (k != 1) {
+            CHECK(value.value == value_for(k, k % 2 == 0 ? 1 : 0));
+            CHECK(view.value.str() == value.value);
+        }
+    }
+}
+
+// Encode a record the way version 1 (headerless) files stored it
+std::string legacy_record(const std::string& key, const std::string& value, uint32_t timestamp) {
+    LogEntryHeader header;
+    header.timestamp = timestamp;
+    header.key_size = key.size();
+    header.value_size = value.size();
+    std::string record(reinterpret_cast<const char*>(&header), sizeof(header));
+    record += key;
+    record += value;
+    header.crc = crc32(reinterpret_cast<const uint8_t*>(record.data()) + 4, record.size() - 4);
+    std::memcpy(&record[0], &header.crc, sizeof(header.crc));
+    return record;
+}
+
+void test_compression() {
+    // Codec: round trips, overlapping matches, offsets near the 64 KB limit
+    std::mt19937 rng(17);
+    std::string random(100000, '\0');
+    for (auto& c : random) {
+        c = static_cast<char>(rng());
+    }
+    std::string far_repeat = random.substr(0, 60000) + random.substr(0, 40000);
+    std::vector<std::string> inputs = {
+        "", "a", "abcabcabcabcabcabc", std::string(5000, 'z'), random, far_repeat,
+        R"({"id":1,"name":"alpha","tags":["x","y"]},{"id":2,"name":"beta","tags":["x","y"]})",
+    };
+    for (const auto& input : inputs) {
+        std::string block(lz4::max_compressed_size(input.size()), '\0');
+        block.resize(lz4::compress(input.data(), input.size(), block.data()));
+        std::string output(input.size(), '\0');
+        CHECK(lz4::decompress(block.data(), block.size(), output.data(), output.size()));
+        CHECK(output == input);
+        if (block.size() > 1) {
+            CHECK(!lz4::decompress(block.data(), block.size() - 1, output.data(), output.size()));
+        }
+    }
+    std::string frame;
+    CHECK(!ValueCodec::compress(random, frame));
+    CHECK(ValueCodec::compress(std::string(5000, 'z'), frame) && frame.size() < 100);
+    
+    // Store: JSON-like values compress, small and random ones are stored raw
+    auto json = [](int k, int version) {
+        std::string value = "[";
+        for (int i = 0; i < 20; ++i) {
+            value += R"({"user":)" + std::to_string(k) + R"(,"version":)" + std::to_string(version) +
+                     R"(,"item":)" + std::to_string(i) + R"(,"status":"active"},)";
+        }
+        return value + "]";
+    };
+    Config config(fresh_dir("compression"));
+    config.max_file_size = 16 * 1024;
+    config.compression = Compression::LZ4;
+    auto db = open_db(config);
+    for (int k = 0; k < 200; ++k) {
+        CHECK(db->put("json" + std::to_string(k), json(k, 0)).ok());
+        CHECK(db->put("small" + std::to_string(k), "tiny").ok());
+        CHECK(db->put("random" + std::to_string(k), random.substr(k * 100, 300)).ok());
+    }
+    CompressionStats stats = db->compression_stats();
+    CHECK(stats.values_compressed == 200 && stats.values_raw == 200);
+    CHECK(stats.ratio() > 4.0);
+    
+    uint64_t disk_bytes = 0;
+    for (const auto& file : db->file_stats()) {
+        disk_bytes += file.total_bytes;
+    }
+    CHECK(disk_bytes < 200 * (json(0, 0).size() + 300) / 2);
+    
+    auto verify = [&](Bitcask& store, int version) {
+        for (int k = 0; k < 200; ++k) {
+            CHECK(store.get("json" + std::to_string(k)).value == json(k, version));
+            CHECK(store.get_view("json" + std::to_string(k)).value.str() == json(k, version));
+            CHECK(store.get("small" + std::to_string(k)).value == "tiny");
+            CHECK(store.get("random" + std::to_string(k)).value == random.substr(k * 100, 300));
+        }
+    };
+    verify(*db, 0);
+    CHECK(db->compression_stats().values_decompressed == 400);
+    
+    // Flags survive merge, hint files and recovery, in either keydir
+    for (int k = 0; k < 200; k += 2) {
+        CHECK(db->put("json" + std::to_string(k), json(k, 0)).ok());
+    }
+    CHECK(db->merge().ok());
+    for (IndexType type : {IndexType::Map, IndexType::Compact, IndexType::Hashed}) {
+        db.reset();
+        config.index_type = type;
+        config.mmap_immutable_files = type == IndexType::Compact;
+        db = open_db(config);
+        verify(*db, 0);
+    }
+    
+    // Version 1 files, which have no header, stay readable. Appends go to
+    // a new file rather than extending the old one, and merge rewrites the
+    // old records in the current format.
+    Config legacy(fresh_dir("legacy"));
+    legacy.compression = Compression::LZ4;
+    std::system(("mkdir -p " + legacy.directory).c_str());
+    {
+        std::ofstream out(legacy.directory + "/cask.0", std::ios::binary);
+        for (int k = 0; k < 50; ++k) {
+            out << legacy_record("key" + std::to_string(k), value_for(k, 0), 1);
+        }
+        out << legacy_record("key7", "", 2);  // Tombstone
+    }
+    
+    // Their headerless hints (entries without flags) are still read too
+    {
+        std::ofstream out(HintFile::path_for(legacy.directory, 0), std::ios::binary);
+        uint64_t pos = 0;
+        for (int k = 0; k < 50; ++k) {
+            std::string key = "key" + std::to_string(k);
+            std::string value = value_for(k, 0);
+            HintEntryHeader entry{1, static_cast<uint32_t>(key.size()),
+                                  static_cast<uint32_t>(value.size()),
+                                  pos + sizeof(LogEntryHeader) + key.size(), 0, 0};
+            pos += sizeof(LogEntryHeader) + key.size() + value.size();
+            if (k != 7) {
+                out.write(reinterpret_cast<const char*>(&entry), offsetof(HintEntryHeader, flags));
+                out << key;
+            }
+        }
+    }
+    db = open_db(legacy);
+    CHECK(db->recovery_stats().files[0].from_hint);
+    for (int k = 0; k < 50; ++k) {
+        auto value = db->get("key" + std::to_string(k));
+        CHECK(value.ok() == (k != 7));
+        CHECK(k == 7 || value.value == value_for(k, 0));
+    }
+    CHECK(db->put("key1", json(1, 1)).ok());
+    CHECK(db->file_stats().size() == 2 && db->file_stats()[0].live_keys == 48);
+    CHECK(db->merge().ok());
+    db.reset();
+    db = open_db(legacy);
+    CHECK(db->list_keys().size() == 49);
+    CHECK(db->get("key1").value == json(1, 1) && db->get("key2").value == value_for(2, 0));
+    CHECK(!std::ifstream(legacy.directory + "/cask.0"));
+    for (const auto& file : db->file_stats()) {
+        std::ifstream in(legacy.directory + "/cask." + std::to_string(file.file_id),
+                         std::ios::binary);
+        char magic[sizeof(LogFile::kMagic)] = {};
+        in.read(magic, sizeof(magic));
+        CHECK(std::memcmp(magic, LogFile::kMagic, sizeof(magic)) == 0);
+    }
+}
+
+struct TestCase {
+    const char* name;
+    std::function<void()> fn;
+};
+
+} // namespace
+
+void test_async_io() {
+    auto big = [](int k) {
+        std::string value;
+        while (value.size() < 4096) {
+            value += "record " + std::to_string(k) + " of the async test; ";
+        }
+        return value;
+    };
+    auto expected = [&](int k) { return k % 2 ? big(k) : value_for(k, 0); };
+    
+    // io_uring where the kernel allows it, then the thread pool
+    for (uint32_t depth : {8u, 0u}) {
+        Config config(fresh_dir("async_io"));
+        config.max_file_size = 64 * 1024;
+        config.compression = Compression::LZ4;
+        config.async_threads = 2;
+        config.async_queue_depth = depth;   // 8 forces the backlog path
+        auto db = open_db(config);
+        if (depth == 0) {
+            CHECK(!db->async_uses_io_uring());
+        }
+        
+        std::mutex mutex;
+        std::condition_variable cv;
+        int pending = 0;
+        auto finish = [&] {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0) {
+                cv.notify_one();
+            }
+        };
+        auto wait = [&] {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return pending == 0; });
+        };
+        
+        const int n = 300;
+        std::vector<char> put_ok(n, 0);
+        pending = n;
+        for (int k = 0; k < n; ++k) {
+            db->put_async("key" + std::to_string(k), expected(k), [&, k](Result<void> result) {
+                put_ok[k] = result.ok();
+                finish();
+            });
+        }
+        wait();
+        CHECK(std::count(put_ok.begin(), put_ok.end(), 1) == n);
+        CHECK(db->compression_stats().values_compressed == n / 2);
+        
+        // Reads span several files, half of them compressed
+        std::vector<std::string> values(n);
+        std::vector<char> get_ok(n, 0);
+        bool missing_failed = false;
+        pending = n + 1;
+        for (int k = 0; k < n; ++k) {
+            db->get_async("key" + std::to_string(k), [&, k](Result<std::string> result) {
+                get_ok[k] = result.ok();
+                values[k] = std::move(result.value);
+                finish();
+            });
+        }
+        db->get_async("missing", [&](Result<std::string> result) {
+            missing_failed = !result.ok();
+            finish();
+        });
+        wait();
+        CHECK(missing_failed);
+        for (int k = 0; k < n; ++k) {
+            CHECK(get_ok[k] && values[k] == expected(k));
+        }
+        
+        bool del_ok = false;
+        pending = 1;
+        db->del_async("key0", [&](Result<void> result) {
+            del_ok = result.ok();
+            finish();
+        });
+        wait();
+        CHECK(del_ok && !db->get("key0").ok());
+        
+        // Destruction waits for calls still in flight
+        for (int k = 1; k < n; ++k) {
+            db->get_async("key" + std::to_string(k), [](Result<std::string>) {});
+        }
+        db.reset();
+    }
+}
+
+void test_multi_get() {
+    // Coalesced reads (default gap), one read per value, then mapped files
+    for (int variant = 0; variant < 3; ++variant) {
+        Config config(fresh_dir("multi_get"));
+        config.max_file_size = 32 * 1024;
+        config.compression = Compression::LZ4;
+        config.multi_get_gap = variant == 1 ? 0 : config.multi_get_gap;
+        config.mmap_immutable_files = variant == 2;
+        auto db = open_db(config);
+        
+        const int n = 1000;
+        for (int k = 0; k < n; ++k) {
+            // Every third value is large and compressible
+            std::string value = k % 3 ? value_for(k, 0) : std::string(500 + k, 'a' + k % 26);
+            CHECK(db->put("key" + std::to_string(k), value).ok());
+        }
+        for (int k = 0; k < n; k += 2) {
+            CHECK(db->put("key" + std::to_string(k), value_for(k, 1)).ok());
+        }
+        CHECK(db->del("key5").ok());
+        
+        // Shuffled, with duplicates and missing keys
+        std::vector<std::string> keys;
+        for (int k = 0; k < n; k += 3) {
+            keys.push_back("key" + std::to_string(k));
+        }
+        keys.push_back("key5");
+        keys.push_back("missing");
+        keys.push_back("key3");
+        std::shuffle(keys.begin(), keys.end(), std::mt19937(3));
+        
+        auto results = db->multi_get(keys);
+        CHECK(results.size() == keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            auto expected = db->get(keys[i]);
+            CHECK(results[i].ok() == expected.ok());
+            CHECK(results[i].value == expected.value);
+        }
+        CHECK(db->multi_get({}).empty());
+        CHECK(db->multi_get({"key1"})[0].value == value_for(1, 0));
+    }
+}
+
+void test_metrics() {
+    Config config(fresh_dir("metrics"));
+    config.max_file_size = 16 * 1024;
+    {
+        auto db = open_db(config);
+        for (int k = 0; k < 500; ++k) {
+            CHECK(db->put("key" + std::to_string(k), value_for(k, 0)).ok());
+        }
+        CHECK(db->del("key1").ok());
+        
+        Stats before = db->stats();
+        for (int k = 0; k < 100; ++k) {
+            CHECK(db->get("key" + std::to_string(k + 2)).ok());
+        }
+        CHECK(!db->get("key1").ok());
+        db->multi_get({"key2", "key3"});
+        
+        Stats stats = db->stats();
+        CHECK(stats.put.count == 500);
+        CHECK(stats.del.count == 1);
+        CHECK(stats.get.count == 101);
+        CHECK(stats.get.failed == 1);
+        CHECK(stats.multi_get.count == 1);
+        CHECK(stats.put.timed > 0 && stats.put.timed < stats.put.count);
+        CHECK(stats.put.percentile_ns(50) > 0);
+        CHECK(stats.put.percentile_ns(50) <= stats.put.percentile_ns(99));
+        CHECK(stats.put.percentile_ns(99) <= stats.put.max_ns);
+        CHECK(stats.bytes_written > 500 * 32);
+        CHECK(stats.bytes_read > before.bytes_read);
+        CHECK(stats.keys == 499);
+        CHECK(stats.keydir_bytes > 0);
+        CHECK(stats.files.size() > 1);
+        
+        uint64_t file_bytes_read = 0;
+        for (const auto& file : stats.files) {
+            file_bytes_read += file.bytes_read;
+        }
+        CHECK(file_bytes_read == stats.bytes_read);
+        
+        CHECK(db->merge().ok());
+        stats = db->stats();
+        CHECK(stats.merge.count == 1);
+        CHECK(!stats.merge_running);
+        CHECK(stats.merge_bytes_done == stats.merge_bytes_total);
+        
+        std::string json = format_stats(stats, true);
+        CHECK(json.front() == '{' && json.back() == '}');
+        CHECK(json.find("\"put\":{\"count\":500,") != std::string::npos);
+        CHECK(format_stats(stats, false).find("keys 499") != std::string::npos);
+    }
+    
+    // Recovery is timed per file; a periodic dump appends JSON lines
+    config.stats_dump_interval_ms = 10;
+    config.stats_dump_path = config.directory + "/stats.jsonl";
+    config.stats_dump_json = true;
+    {
+        auto db = open_db(config);
+        CHECK(db->stats().recovery.count == db->stats().files.size());
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    std::ifstream dump(config.stats_dump_path);
+    std::string line;
+    CHECK(std::getline(dump, line) && line.find("\"recovery\":{\"count\":") != std::string::npos);
+    
+    // Disabled: nothing counted, the rest still reported
+    config.metrics = false;
+    config.stats_dump_interval_ms = 0;
+    auto db = open_db(config);
+    CHECK(db->get("key2").ok());
+    Stats stats = db->stats();
+    CHECK(stats.get.count == 0);
+    CHECK(stats.recovery.count == 0);
+    CHECK(stats.keys == 499);
+}
+
+void test_protocol() {
+    using resp::ParseStatus;
+    resp::Command command;
+    size_t consumed = 0;
+    std::string error;
+    
+    // Inline: set keeps the rest of the line as its value
+    std::string input = "set k  a b\r\nGET k\n# note\n\nmget  x y";
+    CHECK(resp::parse(input, false, command, consumed, error) == ParseStatus::Ok);
+    CHECK(!command.framed && command.args == std::vector<std::string>({"set", "k", " a b"}));
+    input.erase(0, consumed);
+    CHECK(resp::parse(input, false, command, consumed, error) == ParseStatus::Ok);
+    CHECK(command.args == std::vector<std::string>({"GET", "k"}));
+    input.erase(0, consumed);
+    for (int blank = 0; blank < 2; ++blank) {
+        CHECK(resp::parse(input, false, command, consumed, error) == ParseStatus::Ok);
+        CHECK(command.args.empty());
+        input.erase(0, consumed);
+    }
+    CHECK(resp::parse(input, false, command, consumed, error) == ParseStatus::Incomplete);
+    CHECK(resp::parse(input, true, command, consumed, error) == ParseStatus::Ok);
+    CHECK(command.args == std::vector<std::string>({"mget", "x", "y"}) && consumed == input.size());
+    
+    // Framed: binary-safe, and incomplete until the last byte arrives
+    std::string value("a\r\n\0b", 5);
+    std::string framed = "*3\r\n$3\r\nset\r\n$1\r\nk\r\n$5\r\n" + value + "\r\n";
+    for (size_t n = 0; n < framed.size(); ++n) {
+        CHECK(resp::parse(framed.substr(0, n), false, command, consumed, error) ==
+              ParseStatus::Incomplete);
+    }
+    CHECK(resp::parse(framed + "*1", false, command, consumed, error) == ParseStatus::Ok);
+    CHECK(command.framed && consumed == framed.size());
+    CHECK(command.args.size() == 3 && command.args[2] == value);
+    
+    CHECK(resp::parse("*1\r\n$3\r\nabcd\r\n", false, command, consumed, error) ==
+          ParseStatus::Error);
+    CHECK(resp::parse("*x\r\n", false, command, consumed, error) == ParseStatus::Error);
+    CHECK(resp::parse("*1\r\n:1\r\n", false, command, consumed, error) == ParseStatus::Error);
+    
+    std::string out;
+    resp::append_array(out, 2, true);
+    resp::append_value(out, value, true);
+    resp::append_nil(out, true);
+    resp::append_error(out, "bad\nthing", true);
+    resp::append_ok(out, true);
+    CHECK(out == "*2\r\n$5\r\n" + value + "\r\n$-1\r\n-ERR bad thing\r\n+OK\r\n");
+    out.clear();
+    resp::append_array(out, 2, false);
+    resp::append_value(out, "v", false);
+    resp::append_nil(out, false);
+    CHECK(out == "v\n(nil)\n");
+}
+
+// RESP array of bulk strings
+std::string resp_command(const std::vector<std::string>& args) {
+    std::string out = "*" + std::to_string(args.size()) + "\r\n";
+    for (const auto& arg : args) {
+        out += "$" + std::to_string(arg.size()) + "\r\n" + arg + "\r\n";
+    }
+    return out;
+}
+
+// Read one RESP reply, appending its bulk strings (and the text of
+// other scalars) in order
+void read_reply(int fd, std::vector<std::string>& items) {
+    std::string line;
+    char c;
+    while (::read(fd, &c, 1) == 1 && c != '\n') {
+        line += c;
+    }
+    if (line.size() < 2) {
+        return;
+    }
+    line.pop_back();
+    
+    if (line[0] == '*') {
+        for (int i = std::stoi(line.substr(1)); i > 0; --i) {
+            read_reply(fd, items);
+        }
+    } else if (line[0] == '$' && line != "$-1") {
+        std::string value(std::stoul(line.substr(1)) + 2, '\0');
+        size_t got = 0;
+        while (got < value.size()) {
+            ssize_t n = ::read(fd, &value[got], value.size() - got);
+            if (n <= 0) {
+                break;
+            }
+            got += static_cast<size_t>(n);
+        }
+        value.resize(value.size() - 2);
+        items.push_back(value);
+    } else {
+        items.push_back(line.substr(1));
+    }
+}
+
+void test_server() {
+    Config config(fresh_dir("server"));
+    config.ordered_index = true;
+    auto db = open_db(config);
+    
+    Server server(*db);
+    std::string path = config.directory + "/server.sock";
+    CHECK(server.listen(path).ok());
+    CHECK(!server.listen(path).ok());
+    CHECK(!Server(*db).listen("10.0.0.1:6380").ok());
+    std::thread reactor([&] { CHECK(server.run().ok()); });
+    
+    auto connect_client = [&] {
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strcpy(addr.sun_path, path.c_str());
+        CHECK(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+        return fd;
+    };
+    // Send requests, then read until the expected reply length has arrived
+    auto round_trip = [](int fd, const std::string& request, size_t reply_size) {
+        CHECK(::write(fd, request.data(), request.size()) == static_cast<ssize_t>(request.size()));
+        std::string reply;
+        char buffer[4096];
+        while (reply.size() < reply_size) {
+            ssize_t n = ::read(fd, buffer, sizeof(buffer));
+            if (n <= 0) {
+                break;
+            }
+            reply.append(buffer, static_cast<size_t>(n));
+        }
+        return reply;
+    };
+    
+    // Two clients pipelining; one's writes are visible to its own reads
+    int a = connect_client();
+    int b = connect_client();
+    std::string binary("x\r\n\0y", 5);
+    std::string request = resp_command({"SET", "k1", binary}) + resp_command({"SET", "k2", "two"}) +
+                          resp_command({"GET", "k1"}) + resp_command({"DEL", "k2", "k2", "nope"}) +
+                          resp_command({"MGET", "k1", "k2"}) + "PING\r\n" +
+                          resp_command({"SET", "k3"}) + resp_command({"FLUSHALL"});
+    std::string expected = "+OK\r\n+OK\r\n$5\r\n" + binary + "\r\n:1\r\n*2\r\n$5\r\n" + binary +
+                           "\r\n$-1\r\n+PONG\r\n" +
+                           "-ERR wrong number of arguments for 'set' command\r\n" +
+                           "-ERR unknown command 'FLUSHALL'\r\n";
+    CHECK(round_trip(a, request, expected.size()) == expected);
+    
+    // A refused SET is answered alone and doesn't fail the writes around it
+    request = resp_command({"SET", "k4", "four"}) + resp_command({"SET", "", "x"}) +
+              resp_command({"SET", "k5", "five"});
+    expected = "+OK\r\n-ERR Key cannot be empty\r\n+OK\r\n";
+    CHECK(round_trip(a, request, expected.size()) == expected);
+    
+    request.clear();
+    for (int k = 0; k < 25; ++k) {
+        request += resp_command({"SET", "s" + std::to_string(k + 10), "v"});
+    }
+    CHECK(round_trip(b, request, 25 * 5).size() == 25 * 5);
+    
+    // SCAN pages through keys matching the pattern
+    std::vector<std::string> scanned;
+    std::string cursor = "0";
+    do {
+        std::string scan = resp_command({"SCAN", cursor, "MATCH", "s1*", "COUNT", "4"});
+        CHECK(::write(a, scan.data(), scan.size()) == static_cast<ssize_t>(scan.size()));
+        std::vector<std::string> items;
+        read_reply(a, items);
+        CHECK(!items.empty());
+        cursor = items.empty() ? "0" : items[0];
+        scanned.insert(scanned.end(), items.begin() + (items.empty() ? 0 : 1), items.end());
+    } while (cursor != "0");
+    CHECK(scanned.size() == 10 && scanned.front() == "s10" && scanned.back() == "s19");
+    
+    std::string info_request = resp_command({"INFO"});
+    CHECK(::write(a, info_request.data(), info_request.size()) ==
+          static_cast<ssize_t>(info_request.size()));
+    std::vector<std::string> info;
+    read_reply(a, info);
+    CHECK(info.size() == 1 && info[0].find("connected_clients:2") != std::string::npos);
+    
+    CHECK(round_trip(b, resp_command({"QUIT"}), 100) == "+OK\r\n");
+    ::close(a);
+    ::close(b);
+    server.stop();
+    reactor.join();
+    
+    CHECK(db->get("k1").value == binary);
+    CHECK(db->get("k4").value == "four" && db->get("k5").value == "five");
+    CHECK(!db->get("k2").ok());
+    CHECK(db->get("s19").ok());
+}
+
+// Two 16-byte keys with the same std::hash, or empty strings if the library
+// doesn't hash strings with libstdc++'s MurmurHash64A (seed 0xc70f6907).
+// Each 8-byte block is mixed invertibly into the state, so the second
+// block of b can be solved for to cancel the difference its first left.
+std::pair<std::string, std::string> colliding_keys() {
+    const uint64_t mul = 0xc6a4a7935bd1e995ull;
+    uint64_t inverse = mul;
+    for (int i = 0; i < 5; ++i) {
+        inverse *= 2 - mul * inverse;
+    }
+    auto shift_mix = [](uint64_t v) { return v ^ (v >> 47); };
+    auto mix = [&](uint64_t block) { return shift_mix(block * mul) * mul; };
+    auto unmix = [&](uint64_t mixed) { return shift_mix(mixed * inverse) * inverse; };
+    auto block = [](const char* text) {
+        uint64_t value;
+        std::memcpy(&value, text, sizeof(value));
+        return value;
+    };
+    
+    uint64_t state = 0xc70f6907ull ^ (16 * mul);
+    uint64_t a1 = block("hashed:a");
+    uint64_t a2 = block("-suffix-");
+    uint64_t b1 = block("hashed:b");
+    uint64_t b2 = unmix(((state ^ mix(a1)) * mul) ^ ((state ^ mix(b1)) * mul) ^ mix(a2));
+    
+    std::string a(16, '\0');
+    std::string b(16, '\0');
+    std::memcpy(&a[0], &a1, 8);
+    std::memcpy(&a[8], &a2, 8);
+    std::memcpy(&b[0], &b1, 8);
+    std::memcpy(&b[8], &b2, 8);
+    if (std::hash<std::string>{}(a) != std::hash<std::string>{}(b)) {
+        return {};
+    }
+    return {a, b};
+}
+
+void test_hashed_index() {
+    // Table level: erased slots are stepped over, reused and purged
+    FingerprintTable table;
+    auto fingerprint = [](uint64_t i) { return i * 0x9E3779B97F4A7C15ull; };
+    for (uint32_t i = 0; i < 5000; ++i) {
+        table.assign(fingerprint(i), {i % 7, 0, 0, i * 100ull, i, i});
+    }
+    for (uint32_t i = 0; i < 5000; i += 2) {
+        CHECK(table.erase(fingerprint(i)));
+    }
+    CHECK(!table.erase(fingerprint(0)));
+    size_t capacity_bytes = table.memory_usage();
+    for (uint32_t i = 5000; i < 50000; ++i) {
+        table.assign(fingerprint(i), {0, 0, 0, 0, 0, 0});
+        CHECK(table.erase(fingerprint(i)));
+    }
+    CHECK(table.size() == 2500 && table.memory_usage() == capacity_bytes);
+    
+    IndexEntry entry;
+    CHECK(table.find(fingerprint(4999), entry) && entry.value_pos == 499900 &&
+          entry.file_id == 4999 % 7);
+    CHECK(!table.find(fingerprint(4998), entry));
+    size_t visited = 0;
+    table.for_each([&](uint64_t, const IndexEntry&) { ++visited; });
+    CHECK(visited == 2500);
+    
+    // Index level: the key check decides whose a fingerprint is, and keys
+    // sharing one are kept whole
+    auto [a, b] = colliding_keys();
+    std::vector<std::string> on_disk = {"", a, b, a, b};   // Key of the record at each value_pos
+    bool unreadable = false;
+    HashIndex index(1, IndexType::Hashed, [&](std::string_view key, const IndexEntry& entry) {
+        if (unreadable) {
+            return Result<bool>::Err("unreadable");
+        }
+        return Result<bool>::Ok(on_disk[entry.value_pos] == key);
+    });
+    if (a.empty()) {
+        std::cerr << "  (no colliding keys for this std::hash; skipping collision checks)\n";
+    } else {
+        CHECK(!index.put(a, {0, 0, 0, 1, 1, 1}).value);
+        CHECK(!index.put(b, {0, 0, 0, 2, 1, 1}).value);
+        CHECK(index.get(a)->value_pos == 1 && index.get(b)->value_pos == 2);
+        CHECK(index.put(b, {0, 0, 0, 4, 1, 1}).value->value_pos == 2);
+        CHECK(index.compare_and_set(a, {0, 0, 0, 1, 1, 1}, {0, 0, 0, 3, 1, 1}));
+        CHECK(!index.compare_and_set(b, {0, 0, 0, 2, 1, 1}, {0, 0, 0, 3, 1, 1}));
+        CHECK(index.size() == 2 && index.keys() == std::vector<std::string>{b});
+        CHECK(index.remove(a, 0).value->value_pos == 3);
+        CHECK(!index.contains(a) && index.get(b)->value_pos == 4);
+        CHECK(!index.remove(a, 0).value && index.remove(b, 0).value && index.size() == 0);
+    }
+    
+    // A key check that fails makes writes fail without touching the index,
+    // rather than be taken for a collision
+    CHECK(!index.put("owner", {0, 0, 0, 1, 1, 1}).value);
+    on_disk[1] = "owner";
+    unreadable = true;
+    CHECK(!index.put("owner", {0, 0, 0, 2, 1, 1}).ok());
+    CHECK(!index.remove("owner", 0).ok());
+    CHECK(index.size() == 1 && index.keys().empty());
+    unreadable = false;
+    CHECK(index.get("owner")->value_pos == 1 && index.remove("owner", 0).value);
+    CHECK(index.size() == 0);
+    
+    // Through the store: overwrites, deletes, merge, recovery and
+    // compaction that must keep tombstones
+    Config config(fresh_dir("hashed"));
+    config.index_type = IndexType::Hashed;
+    config.max_file_size = 4096;
+    config.compaction_min_reclaim_bytes = 0;
+    config.compaction_max_files = 1;
+    auto db = open_db(config);
+    for (int k = 0; k < 200; ++k) {
+        CHECK(db->put("key" + std::to_string(k), value_for(k, 0)).ok());
+    }
+    for (int round = 1; round <= 3; ++round) {
+        for (int k = 0; k < 100; ++k) {
+            CHECK(db->put("key" + std::to_string(k), value_for(k, round)).ok());
+        }
+    }
+    for (int k = 100; k < 200; k += 4) {
+        CHECK(db->del("key" + std::to_string(k)).ok());
+    }
+    CHECK(!db->del("key100").ok());
+    if (!a.empty()) {
+        CHECK(db->put(a, "first").ok() && db->put(b, "second").ok());
+        CHECK(db->del(a).ok() && !db->del(a).ok());
+        CHECK(db->put(a, "again").ok());
+    }
+    
+    size_t extra = a.empty() ? 0 : 2;
+    auto verify = [&](Bitcask& store) {
+        CHECK(store.list_keys().size() == 175 + extra);
+        CHECK(store.stats().keys == 175 + extra);
+        for (int k = 0; k < 200; ++k) {
+            auto result = store.get("key" + std::to_string(k));
+            if (k >= 100 && k % 4 == 0) {
+                CHECK(!result.ok() && !store.contains("key" + std::to_string(k)));
+            } else {
+                CHECK(result.ok() && result.value == value_for(k, k < 100 ? 3 : 0));
+            }
+        }
+        if (!a.empty()) {
+            CHECK(store.get(a).value == "again" && store.get(b).value == "second");
+        }
+    };
+    verify(*db);
+    
+    // One file per round, so rounds that can't drop tombstones run too
+    int rounds = 0;
+    for (auto result = db->compact(); result.ok() && result.value; result = db->compact()) {
+        ++rounds;
+        verify(*db);
+    }
+    CHECK(rounds > 1);
+    db.reset();
+    db = open_db(config);
+    verify(*db);
+    
+    CHECK(db->merge().ok());
+    verify(*db);
+    db.reset();
+    db = open_db(config);
+    verify(*db);
+    
+    // Half the memory of even the compact keydir
+    Config compact = config;
+    compact.index_type = IndexType::Compact;
+    uint64_t hashed_bytes = db->stats().keydir_bytes;
+    db.reset();
+    db = open_db(compact);
+    CHECK(hashed_bytes * 2 < db->stats().keydir_bytes);
+    
+    db.reset();
+    config.ordered_index = true;
+    CHECK(!Bitcask::open(config).ok());
+    
+    // A batch whose key check fails is refused before anything is written,
+    // so a restart can't bring it back, and later writes still commit
+    Config unreadable_config(fresh_dir("hashed_unreadable"));
+    unreadable_config.index_type = IndexType::Hashed;
+    unreadable_config.max_file_size = 64;
+    db = open_db(unreadable_config);
+    CHECK(db->put("held", std::string(100, 'h')).ok());
+    std::string held_path = unreadable_config.directory + "/cask." +
+                            std::to_string(db->file_stats().front().file_id);
+    std::string held_log;
+    {
+        std::ifstream in(held_path, std::ios::binary);
+        held_log.assign(std::istreambuf_iterator<char>(in), {});
+    }
+    CHECK(::truncate(held_path.c_str(), 8) == 0);
+    uint64_t active_bytes = db->file_stats().back().total_bytes;
+    WriteBatch refused;
+    refused.put("other", "o");
+    refused.put("held", "overwrite");
+    CHECK(!db->write(refused).ok());
+    CHECK(db->file_stats().back().total_bytes == active_bytes);
+    CHECK(!db->contains("other"));
+    CHECK(db->put("fine", "f").ok());
+    {
+        std::ofstream out(held_path, std::ios::binary | std::ios::trunc);
+        out << held_log;
+    }
+    db.reset();
+    db = open_db(unreadable_config);
+    CHECK(!db->contains("other") && db->get("fine").value == "f");
+    CHECK(db->get("held").value == std::string(100, 'h'));
+}
+
+// Encode a record the way version 2 files stored it
+std::string v2_record(const std::string& key, const std::string& value, uint32_t timestamp) {
+    LogEntryHeaderV2 header;
+    header.timestamp = timestamp;
+    header.key_size = key.size();
+    header.value_size = value.size();
+    header.flags = 0;
+    std::string record(reinterpret_cast<const char*>(&header), sizeof(header));
+    record += key;
+    record += value;
+    header.crc = crc32(reinterpret_cast<const uint8_t*>(record.data()) + 4, record.size() - 4);
+    std::memcpy(&record[0], &header.crc, sizeof(header.crc));
+    return record;
+}
+
+void test_record_format() {
+    Config config(fresh_dir("format"));
+    auto db = open_db(config);
+    
+    // Small records of a batch share blocks; large ones stand alone
+    std::string large(5000, 'L');
+    WriteBatch batch;
+    for (int k = 0; k < 200; ++k) {
+        batch.put("key" + std::to_string(k), value_for(k, 0));
+        if (k == 100) {
+            batch.put("large", large);
+        }
+    }
+    batch.del("key5");
+    CHECK(db->write(batch).ok());
+    CHECK(db->put("single", "standalone").ok());
+    CHECK(db->put("empty", "").ok());   // An empty value is a value, not a delete
+    db.reset();
+    
+    uint64_t v2_size = sizeof(LogFileHeader);
+    {
+        LogFile file(0, config.directory, true);
+        CHECK(file.format() == 3);
+        int members = 0;
+        int standalone = 0;
+        bool tombstone = false;
+        uint64_t record_bytes = 0;
+        auto result = file.scan([&](const LogFile::RecordView& record) {
+            v2_size += LogFile::record_size(record.key.size(), record.value.size(), 2);
+            record_bytes += record.size;
+            (record.in_block ? members : standalone)++;
+            CHECK(record.in_block == (record.key != "large" && record.key != "single" &&
+                                      record.key != "empty"));
+            if (record.flags & kRecordTombstone) {
+                tombstone = record.key == "key5" && record.value.empty();
+            }
+            return true;
+        }, 0, 64);
+        CHECK(result.ok() && result.value == file.size());
+        CHECK(members == 201 && standalone == 3 && tombstone);
+        CHECK(record_bytes == file.size() - file.data_start());
+        CHECK(file.size() < v2_size * 9 / 10);
+    }
+    
+    // Values resolve through blocks, also for a keydir that checks keys on disk
+    for (IndexType type : {IndexType::Map, IndexType::Hashed}) {
+        config.index_type = type;
+        db = open_db(config);
+        for (int k = 0; k < 200; ++k) {
+            auto value = db->get("key" + std::to_string(k));
+            CHECK(value.ok() == (k != 5));
+            CHECK(k == 5 || value.value == value_for(k, 0));
+        }
+        CHECK(db->get("large").value == large && db->get("single").value == "standalone");
+        auto empty = db->get("empty");
+        CHECK(empty.ok() && empty.value.empty());
+        db.reset();
+    }
+    config.index_type = IndexType::Map;
+    
+    // Records reserved together that don't fit the open block start a new one
+    {
+        std::string buffer;
+        RecordEncoder encoder(buffer, true);
+        std::string value(900, 'b');
+        for (int k = 0; k < 70 && buffer.size() < RecordEncoder::kMaxBlockSize - 2000; ++k) {
+            encoder.add(1, "fill" + std::to_string(k), value);
+        }
+        size_t open_size = buffer.size();
+        encoder.reserve(1, 100);
+        CHECK(buffer.size() == open_size);  // Still room
+        encoder.reserve(3, 3 * value.size());
+        CHECK(buffer.size() == open_size);  // Sealed in place
+        encoder.add(1, "next", value);
+        encoder.finish();
+        BlockHeader header;
+        std::memcpy(&header, buffer.data() + open_size, sizeof(header));
+        CHECK(header.flags == kRecordBlock && header.body_size == buffer.size() - open_size - sizeof(header));
+    }
+    
+    // A block whose CRC fails is dropped whole, like a torn record
+    db = open_db(config);
+    WriteBatch torn;
+    for (int k = 0; k < 50; ++k) {
+        torn.put("torn" + std::to_string(k), value_for(k, 1));
+    }
+    uint64_t before = db->file_stats().back().total_bytes;
+    CHECK(db->write(torn).ok());
+    db.reset();
+    {
+        std::fstream io(config.directory + "/cask.0", std::ios::binary | std::ios::in | std::ios::out);
+        io.seekp(before + 40);
+        io.put('\xff');
+    }
+    db = open_db(config);
+    CHECK(!db->get("torn0").ok() && !db->get("torn49").ok());
+    CHECK(db->get("key0").value == value_for(0, 0) && db->get("empty").ok());
+    CHECK(db->file_stats().back().total_bytes == before);
+    CHECK(db->put("after", "corruption").ok());
+    db.reset();
+    db = open_db(config);
+    CHECK(db->get("after").value == "corruption");
+    db.reset();
+    
+    // Without block CRCs every record carries its own
+    Config plain(fresh_dir("format_plain"));
+    plain.block_crc = false;
+    db = open_db(plain);
+    CHECK(db->write(batch).ok());
+    db.reset();
+    {
+        LogFile file(0, plain.directory, true);
+        bool any_block = false;
+        file.scan([&](const LogFile::RecordView& record) {
+            any_block |= record.in_block;
+            return true;
+        });
+        CHECK(!any_block);
+    }
+    
+    // Version 2 files stay readable, empty values there being tombstones,
+    // and merge rewrites them as version 3
+    Config old(fresh_dir("format_v2"));
+    std::system(("mkdir -p " + old.directory).c_str());
+    {
+        LogFileHeader header;
+        std::memcpy(header.magic, LogFile::kMagic, sizeof(header.magic));
+        header.version = 2;
+        header.header_crc = crc32(reinterpret_cast<const uint8_t*>(&header),
+                                  offsetof(LogFileHeader, header_crc));
+        std::ofstream out(old.directory + "/cask.0", std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (int k = 0; k < 20; ++k) {
+            out << v2_record("key" + std::to_string(k), value_for(k, 0), 1);
+        }
+        out << v2_record("key3", "", 2);    // Tombstone
+    }
+    db = open_db(old);
+    CHECK(db->list_keys().size() == 19 && !db->get("key3").ok());
+    CHECK(db->put("key4", "").ok());
+    CHECK(db->merge().ok());
+    db.reset();
+    db = open_db(old);
+    CHECK(db->list_keys().size() == 19 && !db->get("key3").ok());
+    CHECK(db->get("key4").ok() && db->get("key4").value.empty());
+    CHECK(db->get("key9").value == value_for(9, 0));
+    for (const auto& stats : db->file_stats()) {
+        LogFile file(stats.file_id, old.directory, true);
+        CHECK(file.format() == LogFile::kFormatVersion);
+    }
+}
+
+int main() {
+    std::vector<TestCase> tests = {
+        {"concurrent_stress", test_concurrent_stress},
+        {"mmap_views_survive_merge", test_mmap_views_survive_merge},
+        {"write_batch", test_write_batch},
+        {"sync_policies", test_sync_policies},
+        {"crc32_matches_reference", test_crc32_matches_reference},
+        {"parallel_recovery", test_parallel_recovery},
+        {"scan_and_torn_tail", test_scan_and_torn_tail},
+        {"merge_then_reopen", test_merge_then_reopen},
+        {"hint_files", test_hint_files},
+        {"compact_index", test_compact_index},
+        {"ordered_index", test_ordered_index},
+        {"file_registry", test_file_registry},
+        {"incremental_compaction", test_incremental_compaction},
+        {"file_stats", test_file_stats},
+        {"streaming_merge", test_streaming_merge},
+        {"value_cache", test_value_cache},
+        {"compression", test_compression},
+        {"async_io", test_async_io},
+        {"multi_get", test_multi_get},
+        {"metrics", test_metrics},
+        {"protocol", test_protocol},
+        {"server", test_server},
+        {"hashed_index", test_hashed_index},
+        {"record_format", test_record_format},
+    };
+    
+    for (const auto& test : tests) {
+        std::cout << "[ RUN  ] " << test.name << "\n";
+        int before = g_failures;
+        test.fn();
+        std::cout << (g_failures == before ? "[  OK  ] " : "[ FAIL ] ") << test.name << "\n";
+    }
+    
+    std::system("rm -rf test_tmp_*");
+    
+    if (g_failures > 0) {
+        std::cout << g_failures << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "All " << tests.size() << " test(s) passed\n";
+    return 0;
+}